@@ -0,0 +1,351 @@
+#include <algorithm>
+#include <iostream>
+#include "AggregateOperator.h"
+#include "JoinOperator.h"  // for JoinHashTable::hash
+#include "heap_storage.h"
+
+
+void Accumulator::add(const Aggregate &aggregate, const ValueDict &row) {
+    if (aggregate.column_name.empty()) {
+        this->count++;
+        return;
+    }
+    auto found = row.find(aggregate.column_name);
+    if (found == row.end())
+        throw DbRelationError("unknown column '" + aggregate.column_name + "'");
+    const Value &value = found->second;
+    switch (aggregate.function) {
+        case Aggregate::SUM:
+        case Aggregate::AVG:
+            if (value.data_type != ColumnAttribute::INT)
+                throw DbRelationError("can only add up INT columns like '" + aggregate.column_name + "'");
+            this->sum += value.n;
+            break;
+        case Aggregate::MIN:
+            if (this->count == 0 || value < this->extreme)
+                this->extreme = value;
+            break;
+        case Aggregate::MAX:
+            if (this->count == 0 || this->extreme < value)
+                this->extreme = value;
+            break;
+        case Aggregate::COUNT:
+        default:
+            break;
+    }
+    this->count++;
+}
+
+// AVG comes out as an INT too (rounded toward zero), since that's the only number type we have.
+Value Accumulator::result(const Aggregate &aggregate) const {
+    switch (aggregate.function) {
+        case Aggregate::COUNT:
+            return Value((int32_t) this->count);
+        case Aggregate::SUM:
+            return Value((int32_t) this->sum);
+        case Aggregate::AVG:
+            return Value((int32_t) (this->count == 0 ? 0 : this->sum / this->count));
+        case Aggregate::MIN:
+        case Aggregate::MAX:
+            return this->extreme;
+        default:
+            throw DbRelationError("unknown aggregate function");
+    }
+}
+
+
+const uint32_t GroupTable::NONE;
+
+GroupTable::GroupTable(const ColumnNames &group_columns, size_t aggregate_count)
+        : group_columns(group_columns), aggregate_count(aggregate_count), keys(), hashes(), accumulator_values(),
+          slots(), memory(0) {
+}
+
+void GroupTable::clear() {
+    this->keys.clear();
+    this->hashes.clear();
+    this->accumulator_values.clear();
+    this->slots.clear();
+    this->memory = 0;
+}
+
+uint32_t GroupTable::find(const ValueDict &row, uint64_t hash, bool add) {
+    uint32_t h = (uint32_t) hash;
+    if (add && (size() + 1) * 2 > this->slots.size())
+        grow();
+    if (this->slots.empty())
+        return NONE;
+    size_t mask = this->slots.size() - 1;
+    for (size_t slot = h & mask; ; slot = (slot + 1) & mask) {
+        uint32_t group = this->slots[slot];
+        if (group == NONE) {
+            if (!add)
+                return NONE;
+            group = (uint32_t) size();
+            for (auto const &column_name: this->group_columns) {
+                auto found = row.find(column_name);
+                if (found == row.end())
+                    throw DbRelationError("unknown column '" + column_name + "'");
+                this->keys.push_back(found->second);
+                this->memory += sizeof(Value) + found->second.s.size();
+            }
+            this->hashes.push_back(h);
+            this->accumulator_values.resize(this->accumulator_values.size() + this->aggregate_count);
+            this->memory += sizeof(uint32_t) + this->aggregate_count * sizeof(Accumulator);
+            this->slots[slot] = group;
+            return group;
+        }
+        if (this->hashes[group] == h && same_key(group, row))
+            return group;
+    }
+}
+
+bool GroupTable::same_key(uint32_t group, const ValueDict &row) const {
+    const Value *values = key(group);
+    for (size_t i = 0; i < this->group_columns.size(); i++)
+        if (values[i] != row.at(this->group_columns[i]))
+            return false;
+    return true;
+}
+
+// Double the slots and put each group back in.
+void GroupTable::grow() {
+    this->memory -= this->slots.size() * sizeof(uint32_t);
+    this->slots.assign(std::max((size_t) 16, this->slots.size() * 2), NONE);
+    this->memory += this->slots.size() * sizeof(uint32_t);
+    size_t mask = this->slots.size() - 1;
+    for (uint32_t group = 0; group < size(); group++) {
+        size_t slot = this->hashes[group] & mask;
+        while (this->slots[slot] != NONE)
+            slot = (slot + 1) & mask;
+        this->slots[slot] = group;
+    }
+}
+
+
+size_t HashAggregateOperator::memory_budget = 64 * 1024 * 1024;
+const uint HashAggregateOperator::PARTITIONS;
+const uint HashAggregateOperator::MAX_LEVEL;
+
+HashAggregateOperator::HashAggregateOperator(EvalOperator *input, const ColumnNames &group_columns,
+                                             const Aggregates &aggregates)
+        : input(input), group_columns(group_columns), aggregates(aggregates),
+          table(group_columns, aggregates.size()), position(0), pending(), spill_count(0) {
+}
+
+HashAggregateOperator::~HashAggregateOperator() {
+    close();
+    delete this->input;
+}
+
+// Aggregate the whole input into the table, leaving the groups that didn't fit in pending partitions.
+void HashAggregateOperator::open() {
+    close();
+    this->spill_count = 0;
+    this->input->open();
+    aggregate(*this->input, 0);
+    this->input->close();
+    if (this->group_columns.empty() && this->table.size() == 0)
+        this->table.find(ValueDict(), JoinHashTable::hash(ValueDict(), this->group_columns), true);
+}
+
+ValueDicts *HashAggregateOperator::next() {
+    ValueDicts *ret = new ValueDicts();
+    WorkCounters::allocated();
+    while (ret->size() < BATCH_SIZE) {
+        if (this->position < this->table.size()) {
+            ret->push_back(group_row(this->position++));
+            continue;
+        }
+        if (this->pending.empty())
+            break;
+
+        // the table's groups are all out, so on to the next partition
+        this->table.clear();
+        this->position = 0;
+        std::pair<HeapTable*, uint> partition = this->pending.back();
+        this->pending.pop_back();
+        TableScanOperator scan(*partition.first);
+        scan.open();
+        aggregate(scan, partition.second);
+        scan.close();
+        partition.first->drop();
+        delete partition.first;
+    }
+    if (ret->empty()) {
+        delete ret;
+        return nullptr;
+    }
+    return ret;
+}
+
+void HashAggregateOperator::close() {
+    this->table.clear();
+    this->position = 0;
+    for (auto const &partition: this->pending) {
+        partition.first->drop();
+        delete partition.first;
+    }
+    this->pending.clear();
+}
+
+// Add source's rows into their groups. Once the table is over budget, rows of groups that aren't in it yet are
+// written out to a partition picked by the next four bits of their hash, to be aggregated at level + 1.
+void HashAggregateOperator::aggregate(EvalOperator &source, uint level) {
+    std::vector<HeapTable*> files;  // by partition, made when its first row comes along
+    bool full = false;
+    for (ValueDicts *batch = source.next(); batch != nullptr; batch = source.next()) {
+        for (auto row: *batch) {
+            uint64_t h = JoinHashTable::hash(*row, this->group_columns);
+            uint32_t group = this->table.find(*row, h, !full);
+            if (group == GroupTable::NONE) {
+                uint p = (uint) (h >> (32 + 4 * level)) % PARTITIONS;
+                if (files.empty())
+                    files.assign(PARTITIONS, nullptr);
+                if (files[p] == nullptr) {
+                    files[p] = temp_table("hash_aggregate", *row);
+                    this->pending.push_back(std::make_pair(files[p], level + 1));
+                    this->spill_count++;
+                }
+                files[p]->insert(row);
+                continue;
+            }
+            Accumulator *accumulators = this->table.accumulators(group);
+            for (size_t i = 0; i < this->aggregates.size(); i++)
+                accumulators[i].add(this->aggregates[i], *row);
+            full = full || (level < MAX_LEVEL && !this->group_columns.empty() && this->table.bytes() > memory_budget);
+        }
+        free_batch(batch);
+    }
+}
+
+ValueDict *HashAggregateOperator::group_row(uint32_t group) {
+    ValueDict *row = new ValueDict();
+    WorkCounters::allocated();
+    const Value *key = this->table.key(group);
+    for (size_t i = 0; i < this->group_columns.size(); i++)
+        (*row)[this->group_columns[i]] = key[i];
+    Accumulator *accumulators = this->table.accumulators(group);
+    for (size_t i = 0; i < this->aggregates.size(); i++)
+        (*row)[this->aggregates[i].output_name] = accumulators[i].result(this->aggregates[i]);
+    return row;
+}
+
+
+CountOperator::CountOperator(DbRelation &table, const Aggregates &aggregates)
+        : table(table), aggregates(aggregates), done(false) {
+}
+
+void CountOperator::open() {
+    this->done = false;
+}
+
+ValueDicts *CountOperator::next() {
+    if (this->done)
+        return nullptr;
+    this->done = true;
+    Value n((int32_t) this->table.count());
+    ValueDict *row = new ValueDict();
+    WorkCounters::allocated();
+    for (auto const &aggregate: this->aggregates)
+        (*row)[aggregate.output_name] = n;
+    WorkCounters::allocated();
+    return new ValueDicts(1, row);
+}
+
+
+// Group table by g with each aggregate function and check every group's results (see test_aggregate_operators).
+static bool test_grouped(DbRelation &table, size_t budget, bool expect_spill) {
+    Aggregates aggregates;
+    aggregates.push_back(Aggregate(Aggregate::COUNT, "", "COUNT(*)"));
+    aggregates.push_back(Aggregate(Aggregate::SUM, "n", "SUM(n)"));
+    aggregates.push_back(Aggregate(Aggregate::MIN, "n", "MIN(n)"));
+    aggregates.push_back(Aggregate(Aggregate::MAX, "s", "MAX(s)"));
+    aggregates.push_back(Aggregate(Aggregate::AVG, "n", "AVG(n)"));
+    size_t saved = HashAggregateOperator::memory_budget;
+    HashAggregateOperator::memory_budget = budget;
+    HashAggregateOperator aggregate(new TableScanOperator(table), ColumnNames(1, "g"), aggregates);
+    std::vector<bool> seen(100, false);
+    bool ok = true;
+    aggregate.open();
+    for (ValueDicts *batch = aggregate.next(); batch != nullptr; batch = aggregate.next()) {
+        for (auto row: *batch) {
+            int g = row->at("g").n;
+            ok = ok && g >= 0 && g < 100 && !seen[g];
+            if (ok) {
+                seen[g] = true;
+                ok = row->at("COUNT(*)").n == 50 && row->at("SUM(n)").n == 50 * g + 122500
+                     && row->at("MIN(n)").n == g && row->at("MAX(s)").s == "s" + std::to_string(g % 7)
+                     && row->at("AVG(n)").n == g + 2450;
+            }
+        }
+        EvalOperator::free_batch(batch);
+    }
+    ok = ok && aggregate.spilled() == expect_spill;
+    aggregate.close();
+    HashAggregateOperator::memory_budget = saved;
+    for (auto s: seen)
+        ok = ok && s;
+    return ok;
+}
+
+bool test_aggregate_operators() {
+    ColumnNames column_names;
+    column_names.push_back("g");
+    column_names.push_back("s");
+    column_names.push_back("n");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    HeapTable table("__test_aggregate", column_names, column_attributes);
+    table.create();
+    const int n = 5000;
+    for (int i = 0; i < n; i++) {
+        ValueDict row;
+        row["g"] = Value(i % 100);  // 50 rows in each of 100 groups
+        row["s"] = Value("s" + std::to_string(i % 100 % 7));
+        row["n"] = Value(i);
+        table.insert(&row);
+    }
+    bool ok = true;
+
+    ok = ok && test_grouped(table, HashAggregateOperator::memory_budget, false);
+    if (!ok)
+        std::cout << "in-memory hash aggregate failed" << std::endl;
+    ok = ok && test_grouped(table, 2 * 1024, true);
+    if (!ok)
+        std::cout << "partitioned hash aggregate failed" << std::endl;
+
+    // no groups: one row, even with nothing to aggregate
+    Aggregates count_all(1, Aggregate(Aggregate::COUNT, "", "COUNT(*)"));
+    ValueDict none;
+    none["g"] = Value(-1);
+    HashAggregateOperator empty(new TableScanOperator(table, &none), ColumnNames(), count_all);
+    empty.open();
+    ValueDicts *batch = empty.next();
+    ok = ok && batch != nullptr && batch->size() == 1 && batch->at(0)->at("COUNT(*)").n == 0 && empty.next() == nullptr;
+    if (batch != nullptr)
+        EvalOperator::free_batch(batch);
+    empty.close();
+    if (!ok)
+        std::cout << "aggregate of no rows failed" << std::endl;
+
+    // counting from the pages, with some rows deleted
+    Handles *handles = table.select();
+    for (int i = 0; i < 10; i++)
+        table.del((*handles)[i * 7]);
+    delete handles;
+    CountOperator count(table, count_all);
+    count.open();
+    batch = count.next();
+    ok = ok && batch != nullptr && batch->at(0)->at("COUNT(*)").n == n - 10 && count.next() == nullptr;
+    if (batch != nullptr)
+        EvalOperator::free_batch(batch);
+    count.close();
+    if (!ok)
+        std::cout << "count from pages failed" << std::endl;
+
+    table.drop();
+    return ok;
+}
@@ -0,0 +1,139 @@
+/**
+ * Operators that sum up their input's rows, by group or all together.
+ * Aggregate
+ * GroupTable
+ * HashAggregateOperator
+ * CountOperator
+ */
+#pragma once
+
+#include <cstdint>
+#include "EvalOperator.h"
+
+
+// One aggregate function over a column (or, for COUNT(*), over the rows), and the column it comes out as.
+class Aggregate {
+public:
+    enum Function {
+        COUNT,
+        SUM,
+        MIN,
+        MAX,
+        AVG
+    };
+
+    Function function;
+    Identifier column_name;  // empty for COUNT(*)
+    Identifier output_name;
+
+    Aggregate(Function function, Identifier column_name, Identifier output_name)
+            : function(function), column_name(column_name), output_name(output_name) {}
+};
+typedef std::vector<Aggregate> Aggregates;
+
+
+// What an aggregate has seen of its group so far.
+class Accumulator {
+public:
+    int64_t count;
+    int64_t sum;
+    Value extreme;  // the least (MIN) or greatest (MAX) so far
+
+    Accumulator() : count(0), sum(0), extreme() {}
+
+    void add(const Aggregate &aggregate, const ValueDict &row);
+    Value result(const Aggregate &aggregate) const;
+};
+
+
+// A compact open-addressing table of groups. Each slot holds a group number (found by linear probing on the hash of
+// the group's key); the keys and every group's accumulators are kept in flat arrays by group number, so adding a row
+// to its group touches one slot and one run of accumulators.
+class GroupTable {
+public:
+    static const uint32_t NONE = UINT32_MAX;
+
+    GroupTable(const ColumnNames &group_columns, size_t aggregate_count);
+    virtual ~GroupTable() {}
+
+    // row's group (hash being JoinHashTable::hash of its group columns), added if it isn't there yet and add is true
+    uint32_t find(const ValueDict &row, uint64_t hash, bool add);
+    void clear();
+    size_t size() const { return hashes.size(); }
+    size_t bytes() const { return memory; }  // roughly what the groups take up
+
+    const Value *key(uint32_t group) const { return keys.data() + group * group_columns.size(); }
+    Accumulator *accumulators(uint32_t group) { return accumulator_values.data() + group * aggregate_count; }
+
+protected:
+    ColumnNames group_columns;
+    size_t aggregate_count;
+    std::vector<Value> keys;                      // per group, its group column values
+    std::vector<uint32_t> hashes;                 // per group
+    std::vector<Accumulator> accumulator_values;  // per group, one per aggregate
+    std::vector<uint32_t> slots;                  // power of two in size, never more than half full
+    size_t memory;
+
+    bool same_key(uint32_t group, const ValueDict &row) const;
+    void grow();
+
+private:
+    GroupTable(const GroupTable &other);
+    GroupTable &operator=(const GroupTable &other);
+};
+
+
+// Hash aggregation: each input row is added into its group's accumulators in a GroupTable, and a row per group
+// comes out at the end, with the group columns and an output column per aggregate. With no group columns there is
+// exactly one group, even for no rows. Once the groups outgrow memory_budget, no new ones are started: rows of the
+// groups already in the table still go into them, and the rest are split by key hash into PARTITIONS temporary heap
+// files, each aggregated the same way (and split further if need be) once the table's groups are handed back.
+class HashAggregateOperator : public EvalOperator {
+public:
+    static const uint PARTITIONS = 16;
+    static size_t memory_budget;  // bytes of groups to hold at once
+
+    // takes ownership of input
+    HashAggregateOperator(EvalOperator *input, const ColumnNames &group_columns, const Aggregates &aggregates);
+    virtual ~HashAggregateOperator();
+
+    virtual void open();
+    virtual ValueDicts *next();
+    virtual void close();
+
+    bool spilled() const { return spill_count > 0; }
+
+protected:
+    static const uint MAX_LEVEL = 7;  // partitioning uses hash bits 32 + 4 * level and up
+
+    EvalOperator *input;
+    ColumnNames group_columns;
+    Aggregates aggregates;
+    GroupTable table;
+    uint32_t position;  // next group of the table to hand back
+    std::vector<std::pair<HeapTable*, uint>> pending;  // spilled partitions yet to be aggregated, and their levels
+    size_t spill_count;
+
+    void aggregate(EvalOperator &source, uint level);
+    ValueDict *group_row(uint32_t group);
+};
+
+
+// SELECT COUNT(*) FROM table, straight from the table's own count of its rows (see DbRelation::count): one row with
+// that count as each of the aggregates (all of them COUNT(*)).
+class CountOperator : public EvalOperator {
+public:
+    CountOperator(DbRelation &table, const Aggregates &aggregates);
+    virtual ~CountOperator() {}
+
+    virtual void open();
+    virtual ValueDicts *next();
+    virtual void close() {}
+
+protected:
+    DbRelation &table;
+    Aggregates aggregates;
+    bool done;
+};
+
+bool test_aggregate_operators();
@@ -2,6 +2,7 @@
 // Created by Kevin Lundeen on 4/29/17.
 //
 
+#include <cmath>
 #include "BTreeNode.h"
 
 /************************
@@ -93,13 +94,92 @@ Dbt *BTreeNode::marshal_handle(Handle handle) {
     return dbt;
 }
 
+// Convert the given columns of row into bytes, leaving header_size bytes at the front for the caller.
+Dbt *BTreeNode::marshal_row(const ValueDict *row, const ColumnNames &column_names,
+                            const ColumnAttributes &column_attributes, uint header_size) {
+    typedef uint16_t u16;
+    char *bytes = new char[DB_BLOCK_SZ]; // more than we need (we insist that one row fits into DB_BLOCK_SZ)
+    uint offset = header_size;
+    uint col_num = 0;
+    for (auto const& column_name: column_names) {
+        ColumnAttribute ca = column_attributes[col_num++];
+        ValueDict::const_iterator column = row->find(column_name);
+        Value value = column->second;
+
+        if (ca.get_data_type() == ColumnAttribute::DataType::INT) {
+            if (offset + 4 > DB_BLOCK_SZ - 4)
+                throw DbRelationError("row too big to marshal");
+
+            *(int32_t*) (bytes + offset) = value.n;
+            offset += sizeof(int32_t);
+
+        } else if (ca.get_data_type() == ColumnAttribute::DataType::TEXT) {
+            u_long size = (u16) value.s.length();
+            if (size > UINT16_MAX)
+                throw DbRelationError("text field too long to marshal");
+            if (offset + 2 + size > DB_BLOCK_SZ)
+                throw DbRelationError("row too big to marshal");
+
+            *(u16*) (bytes + offset) = (u16) size;
+            offset += sizeof(u16);
+            memcpy(bytes+offset, value.s.c_str(), size); // assume ascii for now
+            offset += size;
+
+        } else if (ca.get_data_type() == ColumnAttribute::DataType::BOOLEAN) {
+            if (offset + 1 > DB_BLOCK_SZ - 1)
+                throw DbRelationError("row too big to marshal");
+
+            *(uint8_t*) (bytes + offset) = (uint8_t)value.n;
+            offset += sizeof(uint8_t);
+
+        } else {
+            throw DbRelationError("only know how to marshal INT, TEXT, or BOOLEAN");
+        }
+    }
+    char *right_size_bytes = new char[offset];
+    memcpy(right_size_bytes, bytes, offset);
+    delete[] bytes;
+    Dbt *data = new Dbt(right_size_bytes, offset);
+    return data;
+}
+
+// Convert bytes (as written by marshal_row) back into a row of the given columns.
+ValueDict *BTreeNode::unmarshal_row(const char *bytes, const ColumnNames &column_names,
+                                    const ColumnAttributes &column_attributes) {
+    ValueDict *row = new ValueDict();
+    WorkCounters::allocated();
+    Value value;
+    uint offset = 0;
+    uint col_num = 0;
+    for (auto const& cn: column_names) {
+        ColumnAttribute ca = column_attributes[col_num++];
+        value.data_type = ca.get_data_type();
+        if (value.data_type == ColumnAttribute::DataType::INT) {
+            value.n = *(int32_t*)(bytes + offset);
+            offset += sizeof(int32_t);
+        } else if (value.data_type == ColumnAttribute::DataType::TEXT) {
+            uint16_t size = *(uint16_t *)(bytes + offset);
+            offset += sizeof(uint16_t);
+            value.s = std::string(bytes + offset, size);  // assume ascii for now
+            offset += size;
+        } else if (value.data_type == ColumnAttribute::DataType::BOOLEAN) {
+            value.n = *(uint8_t*)(bytes + offset);
+            offset += sizeof(uint8_t);
+        } else {
+            throw DbRelationError("Only know how to unmarshal INT, TEXT, or BOOLEAN");
+        }
+        (*row)[cn] = value;
+    }
+    return row;
+}
+
 // Convert KeyValue into bytes.
 Dbt *BTreeNode::marshal_key(const KeyValue *key) {
     char *bytes = new char[DB_BLOCK_SZ]; // more than we need
     uint offset = 0;
     uint col_num = 0;
     for (auto const& data_type: this->key_profile) {
-        Value value = (*key)[col_num];
+        Value value = (*key)[col_num++];
 
         if (data_type == ColumnAttribute::DataType::INT) {
             if (offset + 4 > DB_BLOCK_SZ - 4)
@@ -167,43 +247,257 @@ std::ostream& operator<<(std::ostream& out, const BTreeNode *node) {
  ******************************/
 
 BTreeStat::BTreeStat(HeapFile &file, BlockID stat_id, BlockID new_root, const KeyProfile& key_profile)
-        : BTreeNode(file, stat_id, key_profile, false), root_id(new_root), height(1) {
+        : BTreeNode(file, stat_id, key_profile, false), root_id(new_root), height(1),
+          bloom_id(0), bloom_blocks(0), bloom_hashes(0),
+          counted(true), entries(0), leaves(1), interiors(0), min_key(), max_key() {
     save();
 }
 
 BTreeStat::BTreeStat(HeapFile &file, BlockID stat_id, const KeyProfile& key_profile)
-        : BTreeNode(file, stat_id, key_profile, false), root_id(get_block_id(ROOT)), height(get_block_id(HEIGHT)) {
+        : BTreeNode(file, stat_id, key_profile, false), root_id(get_stat(ROOT)), height(get_stat(HEIGHT)),
+          bloom_id(get_stat(BLOOM)), bloom_blocks(get_stat(BLOOM_BLOCKS)), bloom_hashes(get_stat(BLOOM_HASHES)),
+          counted(this->block->size() >= INTERIORS), entries(get_stat(ENTRIES)), leaves(get_stat(LEAVES)),
+          interiors(get_stat(INTERIORS)), min_key(), max_key() {
+    if (this->block->size() >= MAX_KEY) {
+        KeyValue *key = get_key(MIN_KEY);
+        this->min_key = *key;
+        delete key;
+        key = get_key(MAX_KEY);
+        this->max_key = *key;
+        delete key;
+    }
+}
+
+// Get one of the numbers in the stat block. Ones that an older stat block doesn't have yet are zero.
+uint BTreeStat::get_stat(RecordID record_id) const {
+    if (record_id > this->block->size())
+        return 0;
+    return get_block_id(record_id);  // not necessarily a block ID but it fits
 }
 
 void BTreeStat::save() {
-    Dbt *dbt = marshal_block_id(this->root_id);
-    bool is_new = (this->block->size() == 0);
-    if (is_new)
+    uint stats[] = {this->root_id, this->height, this->bloom_id, this->bloom_blocks, this->bloom_hashes,
+                    this->entries, this->leaves, this->interiors};
+    this->block->clear();
+    for (auto const& n: stats) {
+        Dbt *dbt = marshal_block_id(n);
         this->block->add(dbt);
-    else
-        this->block->put(ROOT, *dbt);
-    delete[] (char*)dbt->get_data();
-    delete dbt;
+        delete[] (char*)dbt->get_data();
+        delete dbt;
+    }
+    if (!this->min_key.empty()) {
+        const KeyValue *bounds[] = {&this->min_key, &this->max_key};
+        for (auto const& key: bounds) {
+            Dbt *dbt = marshal_key(key);
+            this->block->add(dbt);
+            delete[] (char*)dbt->get_data();
+            delete dbt;
+        }
+    }
+    this->counted = true;
+    BTreeNode::save();
+}
 
-    dbt = marshal_block_id(this->height);  // not really a block ID but it fits
-    if (is_new)
-        this->block->add(dbt);
-    else
-        this->block->put(HEIGHT, *dbt);
-    delete[] (char*)dbt->get_data();
-    delete dbt;
+// Count a new key, widening the key bounds if need be.
+void BTreeStat::add_entry(const KeyValue *key) {
+    this->entries++;
+    if (this->min_key.empty() || *key < this->min_key)
+        this->min_key = *key;
+    if (this->max_key.empty() || this->max_key < *key)
+        this->max_key = *key;
+}
 
-    BTreeNode::save();
+void BTreeStat::set_counts(uint entries, uint leaves, uint interiors, const KeyValue &min_key,
+                           const KeyValue &max_key) {
+    this->entries = entries;
+    this->leaves = leaves;
+    this->interiors = interiors;
+    this->min_key = min_key;
+    this->max_key = max_key;
 }
 
 std::ostream& operator<<(std::ostream& out, const BTreeStat *stat) {
     out << (const BTreeNode*)stat << std::endl;
     out << "root_id: " << stat->root_id << std::endl;
     out << "height: " << stat->height;
+    if (stat->bloom_id != 0)
+        out << std::endl << "bloom: " << stat->bloom_blocks << " blocks from " << stat->bloom_id;
+    out << std::endl << "entries: " << stat->entries << " in " << stat->leaves << " leaves, "
+        << stat->interiors << " interior blocks";
+    if (!stat->min_key.empty()) {
+        out << std::endl << "keys: ";
+        stat->dump_key(out, &stat->min_key) << " to ";
+        stat->dump_key(out, &stat->max_key);
+    }
     return out;
 }
 
 
+/****************************
+ * BTreeLatch block latches *
+ ****************************/
+
+void BTreeLatch::lock_shared() {
+    std::unique_lock<std::mutex> guard(this->mutex);
+    this->released.wait(guard, [this] { return !this->writer && this->writers_waiting == 0; });
+    this->readers++;
+}
+
+void BTreeLatch::unlock_shared() {
+    std::lock_guard<std::mutex> guard(this->mutex);
+    if (--this->readers == 0)
+        this->released.notify_all();
+}
+
+void BTreeLatch::lock() {
+    std::unique_lock<std::mutex> guard(this->mutex);
+    this->writers_waiting++;
+    this->released.wait(guard, [this] { return !this->writer && this->readers == 0; });
+    this->writers_waiting--;
+    this->writer = true;
+}
+
+void BTreeLatch::unlock() {
+    std::lock_guard<std::mutex> guard(this->mutex);
+    this->writer = false;
+    this->released.notify_all();
+}
+
+BTreeLatches::~BTreeLatches() {
+    for (auto const& latch: this->latches)
+        delete latch.second;
+}
+
+BTreeLatch &BTreeLatches::get(BlockID block_id) {
+    std::lock_guard<std::mutex> guard(this->mutex);
+    BTreeLatch *&latch = this->latches[block_id];
+    if (latch == nullptr)
+        latch = new BTreeLatch();
+    return *latch;
+}
+
+
+/**********************************
+ * BTreeBloom Bloom filter blocks *
+ **********************************/
+
+BTreeBloom::BTreeBloom(HeapFile &file, BlockID first, uint n_blocks, uint n_hashes, bool create)
+        : file(file), first(first), n_hashes(n_hashes), blocks(), bits(), dirty() {
+    for (uint i = 0; i < n_blocks; i++) {
+        SlottedPage *block;
+        if (create) {
+            block = file.get_new();
+            if (i == 0)
+                this->first = block->get_block_id();
+            char zeros[BYTES_PER_BLOCK];
+            memset(zeros, 0, sizeof(zeros));
+            Dbt dbt(zeros, sizeof(zeros));
+            block->add(&dbt);
+            file.put(block);
+        } else {
+            block = file.get(first + i);
+        }
+        Dbt *dbt = block->get(BITS);
+        this->blocks.push_back(block);
+        this->bits.push_back((char*)dbt->get_data());  // points into the block, so we can flip bits in place
+        this->dirty.push_back(false);
+        delete dbt;
+    }
+}
+
+BTreeBloom::~BTreeBloom() {
+    for (auto block: this->blocks)
+        delete block;
+}
+
+// How many blocks we need for n_keys keys at bits_per_key bits each
+uint BTreeBloom::blocks_for(u_long n_keys, uint bits_per_key) {
+    u_long bits_per_block = BYTES_PER_BLOCK * 8UL;
+    u_long n = (n_keys * bits_per_key + bits_per_block - 1) / bits_per_block;
+    return n > 0 ? (uint) n : 1;
+}
+
+// Best number of hash functions for the given bits per key: ln 2 * bits_per_key
+uint BTreeBloom::hashes_for(uint bits_per_key) {
+    uint k = (uint) (bits_per_key * 0.69 + 0.5);
+    return k > 0 ? k : 1;
+}
+
+// Two independent hashes of the key (FNV-1a over its values), from which we derive the n_hashes
+// bit positions as h1 + i*h2 (Kirsch-Mitzenmacher). These are stored on disk, so they must not change.
+void BTreeBloom::hash(const KeyValue *key, uint64_t &h1, uint64_t &h2) {
+    uint64_t h = 14695981039346656037ULL;
+    for (auto const& value: *key) {
+        const char *bytes;
+        size_t size;
+        if (value.data_type == ColumnAttribute::TEXT) {
+            bytes = value.s.c_str();
+            size = value.s.size() + 1;  // include the terminator so ("ab","c") and ("a","bc") differ
+        } else {
+            bytes = (const char *) &value.n;
+            size = sizeof(value.n);
+        }
+        for (size_t i = 0; i < size; i++) {
+            h ^= (unsigned char) bytes[i];
+            h *= 1099511628211ULL;
+        }
+    }
+    h1 = h;
+    h2 = (h >> 33 | h << 31) * 0xff51afd7ed558ccdULL | 1;  // odd, so it cycles through all the positions
+}
+
+void BTreeBloom::add(const KeyValue *key) {
+    uint64_t h1, h2;
+    hash(key, h1, h2);
+    u_long m = n_bits();
+    for (uint i = 0; i < this->n_hashes; i++) {
+        u_long bit = (u_long) ((h1 + i * h2) % m);
+        u_long block = bit / (BYTES_PER_BLOCK * 8), offset = bit % (BYTES_PER_BLOCK * 8);
+        this->bits[block][offset / 8] |= (char) (1 << (offset % 8));
+        this->dirty[block] = true;
+    }
+}
+
+bool BTreeBloom::may_contain(const KeyValue *key) const {
+    uint64_t h1, h2;
+    hash(key, h1, h2);
+    u_long m = n_bits();
+    for (uint i = 0; i < this->n_hashes; i++) {
+        u_long bit = (u_long) ((h1 + i * h2) % m);
+        u_long block = bit / (BYTES_PER_BLOCK * 8), offset = bit % (BYTES_PER_BLOCK * 8);
+        if ((this->bits[block][offset / 8] & (1 << (offset % 8))) == 0)
+            return false;
+    }
+    return true;
+}
+
+void BTreeBloom::clear() {
+    for (uint i = 0; i < this->blocks.size(); i++) {
+        memset(this->bits[i], 0, BYTES_PER_BLOCK);
+        this->dirty[i] = true;
+    }
+}
+
+// Write out the blocks that have changed since the last save
+void BTreeBloom::save() {
+    for (uint i = 0; i < this->blocks.size(); i++) {
+        if (this->dirty[i]) {
+            this->file.put(this->blocks[i]);
+            this->dirty[i] = false;
+        }
+    }
+}
+
+// (fraction of bits set) ^ (number of hashes)
+double BTreeBloom::expected_false_positive_rate() const {
+    u_long set = 0;
+    for (auto const& block_bits: this->bits)
+        for (uint i = 0; i < BYTES_PER_BLOCK; i++)
+            set += __builtin_popcount((unsigned char) block_bits[i]);
+    return pow((double) set / n_bits(), this->n_hashes);
+}
+
+
 /*****************
  * BTreeInterior *
  *****************/
@@ -239,9 +533,20 @@ BTreeInterior::~BTreeInterior() {
 
 // Get next block down in tree where key must be.
 BlockID BTreeInterior::find(const KeyValue* key) const {
-    if (key == nullptr)
+    const KeyValue *upper = nullptr;
+    return find(key, upper);
+}
+
+// Same, but also narrow upper to the boundary (if any) above the returned block. Keys at or past upper
+// are not in that block's subtree.
+BlockID BTreeInterior::find(const KeyValue* key, const KeyValue* &upper) const {
+    if (key == nullptr) {
+        if (!this->boundaries.empty())
+            upper = this->boundaries[0];
         return this->first;
-    BlockID down = this->pointers.back();  // last pointer is correct if we don't find an earlier boundary
+    }
+    // last pointer is correct if we don't find an earlier boundary (a bulk-loaded node may have only first)
+    BlockID down = this->pointers.empty() ? this->first : this->pointers.back();
     for (uint i = 0; i < this->boundaries.size(); i++) {
         KeyValue *boundary = this->boundaries[i];
         if (*boundary > *key) {
@@ -249,6 +554,7 @@ BlockID BTreeInterior::find(const KeyValue* key) const {
                 down = this->pointers[i - 1];
             else
                 down = this->first;
+            upper = boundary;
             break;
         }
     }
@@ -260,6 +566,7 @@ void BTreeInterior::save() {
     Dbt *dbt;
     this->block->clear();
     dbt = marshal_block_id(this->first);
+    this->block->add(dbt);
     delete[] (char *) dbt->get_data();
     delete dbt;
     for (uint i = 0; i < this->boundaries.size(); i++) {
@@ -285,7 +592,7 @@ Insertion BTreeInterior::insert(const KeyValue* boundary, BlockID block_id) {
     bool inserted = false;
     for (uint i = 0; i < this->boundaries.size(); i++) {
         KeyValue *check = this->boundaries[i];
-        if (*boundary == *check) {
+        if (*boundary < *check) {
             this->boundaries.insert(this->boundaries.begin() + i, new KeyValue(*boundary));
             this->pointers.insert(this->pointers.begin() + i, block_id);
             inserted = true;
@@ -340,10 +647,32 @@ Insertion BTreeInterior::insert(const KeyValue* boundary, BlockID block_id) {
         // save everything
         nnode->save();
         this->save();
+        delete nnode;
         return ret;
     }
 }
 
+// Add boundary, block_id after all the others, without saving. Throws DbBlockNoRoomError (leaving the node as it
+// was) if there's no room for them.
+void BTreeInterior::append(const KeyValue* boundary, BlockID block_id) {
+    Dbt *dbt = marshal_key(boundary);
+    try {
+        this->block->add(dbt);  // just a check for size, as in insert
+        delete[] (char *) dbt->get_data();
+        delete dbt;
+        dbt = marshal_block_id(block_id);
+        this->block->add(dbt);
+        delete[] (char *) dbt->get_data();
+        delete dbt;
+    } catch (DbBlockNoRoomError &e) {
+        delete[] (char *) dbt->get_data();
+        delete dbt;
+        throw;
+    }
+    this->boundaries.push_back(new KeyValue(*boundary));
+    this->pointers.push_back(block_id);
+}
+
 std::ostream& operator<<(std::ostream& out, const BTreeInterior *node) {
     out << (const BTreeNode*)node << " ";
     out << node->first;
@@ -401,6 +730,14 @@ void BTreeLeafBase::save() {
 
 // Insert key, handle pair into block.
 Insertion BTreeLeafBase::insert(const KeyValue* key, BTreeLeafValue value) {
+    add(key, value);
+    save();
+    return BTreeNode::insertion_none();
+}
+
+// Insert key, handle pair into the key map, without saving. Throws DbBlockNoRoomError (not taking value) if there's
+// no room for them, so the leaf has to split.
+void BTreeLeafBase::add(const KeyValue* key, BTreeLeafValue value) {
     // check unique
     if (this->key_map.find(*key) != this->key_map.end())
         throw DbRelationError("Duplicate keys are not allowed in unique index");
@@ -419,8 +756,6 @@ Insertion BTreeLeafBase::insert(const KeyValue* key, BTreeLeafValue value) {
 
         // that worked, so no need to split
         this->key_map[*key] = value;
-        save();
-        return BTreeNode::insertion_none();
 
     } catch (DbBlockNoRoomError &e) {
         delete[] (char *) dbt->get_data();
@@ -429,13 +764,56 @@ Insertion BTreeLeafBase::insert(const KeyValue* key, BTreeLeafValue value) {
     }
 }
 
+// Add key, value past all the others (the caller sees to the order and uniqueness), without saving. Throws
+// DbBlockNoRoomError (not taking value) if there's no room for them.
+void BTreeLeafBase::append(const KeyValue* key, BTreeLeafValue value) {
+    Dbt *dbt = marshal_value(value);
+    try {
+        this->block->add(dbt);  // just a check for size, as in insert
+        delete[] (char *) dbt->get_data();
+        delete dbt;
+        dbt = marshal_key(key);
+        this->block->add(dbt);
+        delete[] (char *) dbt->get_data();
+        delete dbt;
+    } catch (DbBlockNoRoomError &e) {
+        delete[] (char *) dbt->get_data();
+        delete dbt;
+        throw;
+    }
+    this->key_map.emplace_hint(this->key_map.end(), *key, value);
+}
+
 // Delete an entry from the key map and shrink as appropriate
 void BTreeLeafBase::del(const KeyValue* key) {
+    remove(key);
+    this->save();
+    // FIXME: tree never shrinks -- if all keys get deleted we still have an empty shell of tree
+}
+
+// Put value in place of key's value and save. Throws DbBlockNoRoomError (leaving the leaf as it was, and not taking
+// value) if the leaf has no room for a bigger value. The old value is the caller's.
+BTreeLeafValue BTreeLeafBase::replace(const KeyValue* key, BTreeLeafValue value) {
+    auto found = this->key_map.find(*key);
+    if (found == this->key_map.end())
+        throw DbRelationError("key to be updated not found in index");
+    BTreeLeafValue old = found->second;
+    found->second = value;
+    try {
+        this->save();
+    } catch (DbBlockNoRoomError &e) {
+        found->second = old;
+        this->save();
+        throw;
+    }
+    return old;
+}
+
+// Take key out of the key map, without saving.
+void BTreeLeafBase::remove(const KeyValue* key) {
     if (this->key_map.find(*key) == this->key_map.end())
         throw DbRelationError("key to be deleted not found in index");
     this->key_map.erase(*key);
-    this->save();
-    // FIXME: tree never shrinks -- if all keys get deleted we still have an empty shell of tree
 }
 
 // too big, so split
@@ -470,8 +848,12 @@ Insertion BTreeLeafBase::split(BTreeLeafBase *nleaf, const KeyValue *key, BTreeL
 }
 
 
-BTreeLeafIndex::BTreeLeafIndex(HeapFile &file, BlockID block_id, const KeyProfile& key_profile, bool create)
-        : BTreeLeafBase(file, block_id, key_profile, create) {
+BTreeLeafIndex::BTreeLeafIndex(HeapFile &file, BlockID block_id, const KeyProfile& key_profile,
+                               ColumnNames include_column_names, ColumnAttributes include_column_attributes,
+                               bool create)
+        : BTreeLeafBase(file, block_id, key_profile, create),
+          column_names(include_column_names),
+          column_attributes(include_column_attributes) {
     if (!create) {
         RecordIDs *record_id_list = this->block->ids();
         RecordID i = 1;
@@ -491,14 +873,31 @@ BTreeLeafIndex::BTreeLeafIndex(HeapFile &file, BlockID block_id, const KeyProfil
 }
 
 BTreeLeafIndex::~BTreeLeafIndex() {
+    for (auto &item: this->key_map)
+        delete item.second.vd;
 }
 
+// Handle, followed by the INCLUDE column values (if any)
 BTreeLeafValue BTreeLeafIndex::get_value(RecordID record_id) {
-    return get_handle(record_id);
+    BTreeLeafValue value(get_handle(record_id));
+    if (!this->column_names.empty()) {
+        Dbt *dbt = this->block->get(record_id);
+        value.vd = unmarshal_row((char*)dbt->get_data() + sizeof(BlockID) + sizeof(RecordID),
+                                 this->column_names, this->column_attributes);
+        delete dbt;
+    }
+    return value;
 }
 
 Dbt *BTreeLeafIndex::marshal_value(BTreeLeafValue value) {
-    return marshal_handle(value.h);
+    if (this->column_names.empty())
+        return marshal_handle(value.h);
+    Dbt *dbt = marshal_row(value.vd, this->column_names, this->column_attributes,
+                           sizeof(BlockID) + sizeof(RecordID));
+    char *bytes = (char*)dbt->get_data();
+    *(BlockID *)bytes = value.h.block_id;
+    *(RecordID *)(bytes + sizeof(BlockID)) = value.h.record_id;
+    return dbt;
 }
 
 std::ostream& operator<<(std::ostream& out, const BTreeLeafIndex *node) {
@@ -548,81 +947,11 @@ BTreeLeafFile::~BTreeLeafFile() {
 
 BTreeLeafValue BTreeLeafFile::get_value(RecordID record_id) {
     Dbt *dbt = this->block->get(record_id);
-    char *bytes = (char*)dbt->get_data();
-    ValueDict *row = new ValueDict();
-    Value value;
-    uint offset = 0;
-    uint col_num = 0;
-    for (auto const& cn: this->column_names) {
-        ColumnAttribute ca = this->column_attributes[col_num++];
-        value.data_type = ca.get_data_type();
-        if (value.data_type == ColumnAttribute::DataType::INT) {
-            value.n = *(int32_t*)(bytes + offset);
-            offset += sizeof(int32_t);
-        } else if (value.data_type == ColumnAttribute::DataType::TEXT) {
-            uint16_t size = *(uint16_t *)(bytes + offset);
-            offset += sizeof(uint16_t);
-            char buffer[DB_BLOCK_SZ];
-            memcpy(buffer, bytes+offset, size);
-            buffer[size] = '\0';
-            value.s = std::string(buffer);  // assume ascii for now
-            offset += size;
-        } else if (value.data_type == ColumnAttribute::DataType::BOOLEAN) {
-            value.n = *(uint8_t*)(bytes + offset);
-            offset += sizeof(uint8_t);
-        } else {
-            throw DbRelationError("Only know how to unmarshal INT, TEXT, or BOOLEAN");
-        }
-        (*row)[cn] = value;
-    }
+    ValueDict *row = unmarshal_row((char*)dbt->get_data(), this->column_names, this->column_attributes);
     delete dbt;
     return BTreeLeafValue(row);
 }
 
 Dbt *BTreeLeafFile::marshal_value(BTreeLeafValue btvalue) {
-    typedef uint16_t u16;
-    char *bytes = new char[DB_BLOCK_SZ]; // more than we need (we insist that one row fits into DB_BLOCK_SZ)
-    ValueDict *row = btvalue.vd;
-    uint offset = 0;
-    uint col_num = 0;
-    for (auto const& column_name: this->column_names) {
-        ColumnAttribute ca = this->column_attributes[col_num++];
-        ValueDict::const_iterator column = row->find(column_name);
-        Value value = column->second;
-
-        if (ca.get_data_type() == ColumnAttribute::DataType::INT) {
-            if (offset + 4 > DB_BLOCK_SZ - 4)
-                throw DbRelationError("row too big to marshal");
-
-            *(int32_t*) (bytes + offset) = value.n;
-            offset += sizeof(int32_t);
-
-        } else if (ca.get_data_type() == ColumnAttribute::DataType::TEXT) {
-            u_long size = (u16) value.s.length();
-            if (size > UINT16_MAX)
-                throw DbRelationError("text field too long to marshal");
-            if (offset + 2 + size > DB_BLOCK_SZ)
-                throw DbRelationError("row too big to marshal");
-
-            *(u16*) (bytes + offset) = (u16) size;
-            offset += sizeof(u16);
-            memcpy(bytes+offset, value.s.c_str(), size); // assume ascii for now
-            offset += size;
-
-        } else if (ca.get_data_type() == ColumnAttribute::DataType::BOOLEAN) {
-            if (offset + 1 > DB_BLOCK_SZ - 1)
-                throw DbRelationError("row too big to marshal");
-
-            *(uint8_t*) (bytes + offset) = (uint8_t)value.n;
-            offset += sizeof(uint8_t);
-
-        } else {
-            throw DbRelationError("only know how to marshal INT, TEXT, or BOOLEAN");
-        }
-    }
-    char *right_size_bytes = new char[offset];
-    memcpy(right_size_bytes, bytes, offset);
-    delete[] bytes;
-    Dbt *data = new Dbt(right_size_bytes, offset);
-    return data;
+    return marshal_row(btvalue.vd, this->column_names, this->column_attributes);
 }
@@ -3,6 +3,8 @@
 #include "storage_engine.h"
 #include "heap_storage.h"
 #include <memory.h>
+#include <condition_variable>
+#include <mutex>
 
 typedef std::vector<ColumnAttribute::DataType> KeyProfile;
 typedef std::vector<BlockID> BlockPointers;
@@ -31,6 +33,10 @@ protected:
 
     static Dbt *marshal_block_id(BlockID block_id);
     static Dbt *marshal_handle(Handle handle);
+    static Dbt *marshal_row(const ValueDict *row, const ColumnNames &column_names,
+                            const ColumnAttributes &column_attributes, uint header_size=0);
+    static ValueDict *unmarshal_row(const char *bytes, const ColumnNames &column_names,
+                                    const ColumnAttributes &column_attributes);
     virtual Dbt *marshal_key(const KeyValue *key);
 
     virtual BlockID get_block_id(RecordID record_id) const;
@@ -45,6 +51,14 @@ class BTreeStat : public BTreeNode {
 public:
     static const RecordID ROOT = 1;  // where we store the root id in the stat block
     static const RecordID HEIGHT = ROOT + 1;  // where we store the height in the stat block
+    static const RecordID BLOOM = HEIGHT + 1;  // where we store the first block of the Bloom filter (0 if none)
+    static const RecordID BLOOM_BLOCKS = BLOOM + 1;  // where we store how many blocks the Bloom filter has
+    static const RecordID BLOOM_HASHES = BLOOM_BLOCKS + 1;  // where we store how many hashes the Bloom filter uses
+    static const RecordID ENTRIES = BLOOM_HASHES + 1;  // where we store how many keys are in the tree
+    static const RecordID LEAVES = ENTRIES + 1;  // where we store how many leaf blocks the tree has
+    static const RecordID INTERIORS = LEAVES + 1;  // where we store how many interior blocks the tree has
+    static const RecordID MIN_KEY = INTERIORS + 1;  // where we store the smallest key (if there are any keys)
+    static const RecordID MAX_KEY = MIN_KEY + 1;  // where we store the largest key (if there are any keys)
 
     BTreeStat(HeapFile &file, BlockID stat_id, BlockID new_root, const KeyProfile& key_profile);
     BTreeStat(HeapFile &file, BlockID stat_id, const KeyProfile& key_profile);
@@ -56,13 +70,117 @@ public:
     void set_root_id(BlockID root_id) { this->root_id = root_id; }
     uint get_height() const { return this->height; }
     void set_height(uint height) { this->height = height; }
+    BlockID get_bloom_id() const { return this->bloom_id; }
+    uint get_bloom_blocks() const { return this->bloom_blocks; }
+    uint get_bloom_hashes() const { return this->bloom_hashes; }
+    void set_bloom(BlockID bloom_id, uint bloom_blocks, uint bloom_hashes) {
+        this->bloom_id = bloom_id;
+        this->bloom_blocks = bloom_blocks;
+        this->bloom_hashes = bloom_hashes;
+    }
+
+    // Counts kept up to date as the tree changes. The key bounds only ever widen, so after deletes they
+    // may be looser than the keys actually there until the counts are redone with set_counts.
+    bool has_counts() const { return this->counted; }  // false for a stat block from before we kept counts
+    uint get_entries() const { return this->entries; }
+    uint get_leaves() const { return this->leaves; }
+    uint get_interiors() const { return this->interiors; }
+    const KeyValue &get_min_key() const { return this->min_key; }  // empty if there have never been any keys
+    const KeyValue &get_max_key() const { return this->max_key; }
+    void add_entry(const KeyValue *key);
+    void remove_entry() { if (this->entries > 0) this->entries--; }
+    void add_leaf() { this->leaves++; }
+    void add_interior() { this->interiors++; }
+    void set_counts(uint entries, uint leaves, uint interiors, const KeyValue &min_key, const KeyValue &max_key);
 
     friend std::ostream &operator<<(std::ostream &stream, const BTreeStat *node);
 
 protected:
     BlockID root_id;
     uint height;
+    BlockID bloom_id;
+    uint bloom_blocks;
+    uint bloom_hashes;
+    bool counted;
+    uint entries;
+    uint leaves;
+    uint interiors;
+    KeyValue min_key;
+    KeyValue max_key;
+
+    virtual uint get_stat(RecordID record_id) const;
+};
+
+
+// Bloom filter over all the keys in a BTree, so we can tell that a key is not there without descending
+// the tree. The bits live in their own run of blocks of the BTree's file, one record per block, and are
+// updated in place. Deleted keys are never removed from the filter (rebuild it to get rid of them).
+class BTreeBloom {
+public:
+    static const uint BYTES_PER_BLOCK = DB_BLOCK_SZ - 16;  // leaves room for the slotted page headers
+    static const uint DEFAULT_BITS_PER_KEY = 10;  // about 1% false positives
+
+    BTreeBloom(HeapFile &file, BlockID first, uint n_blocks, uint n_hashes, bool create);
+    virtual ~BTreeBloom();
+
+    static uint blocks_for(u_long n_keys, uint bits_per_key);
+    static uint hashes_for(uint bits_per_key);
+
+    void add(const KeyValue *key);  // call save() afterwards to write out the changed blocks
+    bool may_contain(const KeyValue *key) const;
+    void clear();
+    void save();
+
+    BlockID get_first() const { return this->first; }
+    uint get_n_blocks() const { return (uint) this->blocks.size(); }
+    double expected_false_positive_rate() const;  // given how full the filter is now
+
+protected:
+    static const RecordID BITS = 1;
+
+    HeapFile &file;
+    BlockID first;
+    uint n_hashes;
+    std::vector<SlottedPage*> blocks;
+    std::vector<char*> bits;  // the BITS record in each of the blocks
+    std::vector<bool> dirty;
 
+    u_long n_bits() const { return (u_long) this->blocks.size() * BYTES_PER_BLOCK * 8; }
+    static void hash(const KeyValue *key, uint64_t &h1, uint64_t &h2);
+};
+
+
+// Reader/writer latch on one block of a BTree: any number of readers, or one writer. Once a writer is
+// waiting, new readers wait behind it so a steady stream of lookups can't starve an insert.
+class BTreeLatch {
+public:
+    BTreeLatch() : readers(0), writer(false), writers_waiting(0) {}
+
+    void lock_shared();
+    void unlock_shared();
+    void lock();
+    void unlock();
+
+protected:
+    std::mutex mutex;
+    std::condition_variable released;
+    uint readers;
+    bool writer;
+    uint writers_waiting;
+};
+
+
+// The latches for the blocks of one BTree, made the first time each block is latched.
+class BTreeLatches {
+public:
+    BTreeLatches() : mutex(), latches() {}
+    virtual ~BTreeLatches();
+
+    BTreeLatch &get(BlockID block_id);
+
+protected:
+    std::mutex mutex;
+    std::map<BlockID, BTreeLatch*> latches;
 };
 
 
@@ -72,7 +190,9 @@ public:
     virtual ~BTreeInterior();
 
     BlockID find(const KeyValue* key) const;
+    BlockID find(const KeyValue* key, const KeyValue* &upper) const;
     Insertion insert(const KeyValue* boundary, BlockID block_id);
+    void append(const KeyValue* boundary, BlockID block_id);  // for loading in bulk (see BTreeBase::bulk_load)
     virtual void save();
 
     void set_first(BlockID first) { this->first = first; }
@@ -109,13 +229,18 @@ public:
 
     BTreeLeafValue find_eq(const KeyValue* key) const;  // throws if not found
     Insertion insert(const KeyValue* key, BTreeLeafValue value);
+    void add(const KeyValue* key, BTreeLeafValue value);  // insert, but call save() afterwards (for a batch)
+    void append(const KeyValue* key, BTreeLeafValue value);  // for loading in bulk (see BTreeBase::bulk_load)
     virtual void save();
 
     virtual Insertion split(BTreeLeafBase *new_leaf, const KeyValue* key, BTreeLeafValue value);
     virtual void del(const KeyValue* key);
+    void remove(const KeyValue* key);  // del, but call save() afterwards (for a batch)
+    BTreeLeafValue replace(const KeyValue* key, BTreeLeafValue value);  // gives back the old value
 
     virtual LeafMap const& get_key_map() const { return this->key_map; }
     virtual BlockID get_next_leaf() const { return this->next_leaf; }
+    void set_next_leaf(BlockID next_leaf) { this->next_leaf = next_leaf; }
 
 protected:
     BlockID next_leaf;
@@ -126,14 +251,24 @@ protected:
 };
 
 
+// Leaf of a secondary index. Each entry is the handle into the relation, optionally followed by the
+// values of the index's INCLUDE columns (so that a covering index can answer a query without the relation).
 class BTreeLeafIndex : public BTreeLeafBase {
 public:
-    BTreeLeafIndex(HeapFile &file, BlockID block_id, const KeyProfile& key_profile, bool create);
+    BTreeLeafIndex(HeapFile &file,
+                   BlockID block_id,
+                   const KeyProfile& key_profile,
+                   ColumnNames include_column_names,
+                   ColumnAttributes include_column_attributes,
+                   bool create);
     virtual ~BTreeLeafIndex();
 
     friend std::ostream &operator<<(std::ostream &stream, const BTreeLeafIndex *node);
 
 protected:
+    ColumnNames column_names;
+    ColumnAttributes column_attributes;
+
     virtual BTreeLeafValue get_value(RecordID record_id);
     virtual Dbt *marshal_value(BTreeLeafValue value);
 };
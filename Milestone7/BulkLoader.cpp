@@ -0,0 +1,457 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <set>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include "BulkLoader.h"
+#include "btree.h"
+#include "heap_storage.h"
+
+
+uint BulkLoader::workers = std::max(1U, std::thread::hardware_concurrency());
+size_t BulkLoader::chunk_bytes = 1 << 20;
+
+void BulkLoader::Chunk::free_rows() {
+    for (auto row: this->rows)
+        delete row;
+    this->rows.clear();
+    this->row_lines.clear();
+}
+
+void BulkLoader::Chunk::free() {
+    free_rows();
+    for (auto block: this->blocks)
+        delete block;
+    this->blocks.clear();
+}
+
+BulkLoader::BulkLoader(DbRelation &relation) : relation(relation), columns(), data_types() {
+}
+
+Handles* BulkLoader::load(const std::string &path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw DbRelationError("can't open " + path + ": " + strerror(errno));
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw DbRelationError("can't read " + path + ": " + strerror(errno));
+    }
+    size_t size = (size_t) st.st_size;
+    void *data = nullptr;
+    if (size > 0) {
+        data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            ::close(fd);
+            throw DbRelationError("can't map " + path + ": " + strerror(errno));
+        }
+        madvise(data, size, MADV_SEQUENTIAL);
+    }
+    ::close(fd);  // the mapping holds on to the file
+
+    Handles *handles;
+    try {
+        handles = load((const char *) data, (const char *) data + size);
+    } catch (...) {
+        if (data != nullptr)
+            munmap(data, size);
+        throw;
+    }
+    if (data != nullptr)
+        munmap(data, size);
+    return handles;
+}
+
+Handles* BulkLoader::load(const char *begin, const char *end) {
+    this->relation.open();
+    const char *p = begin;
+    read_header(p, end);
+
+    // cut the rest of the file into chunks, each ending at a line break
+    std::vector<Chunk> chunks;
+    while (p < end) {
+        const char *chunk_end = end;
+        if ((size_t) (end - p) > chunk_bytes) {
+            const char *newline = (const char *) memchr(p + chunk_bytes, '\n', end - p - chunk_bytes);
+            if (newline != nullptr)
+                chunk_end = newline + 1;
+        }
+        chunks.push_back(Chunk(p, chunk_end));
+        p = chunk_end;
+    }
+
+    // parse them, each worker taking the next chunk nobody has yet, until they're done or one fails
+    std::atomic<size_t> next_chunk(0);
+    std::atomic<bool> failed(false);
+    auto work = [this, &chunks, &next_chunk, &failed]() {
+        size_t i;
+        while (!failed && (i = next_chunk++) < chunks.size()) {
+            parse(chunks[i]);
+            if (!chunks[i].error.empty())
+                failed = true;
+        }
+    };
+    uint n_workers = (uint) std::min((size_t) std::max(workers, 1U), chunks.size());
+    if (n_workers <= 1) {
+        work();
+    } else {
+        std::vector<std::thread> threads;
+        for (uint worker = 0; worker < n_workers; worker++)
+            threads.push_back(std::thread(work));
+        for (auto &thread: threads)
+            thread.join();
+    }
+    if (failed) {
+        std::string message;
+        for (auto &chunk: chunks) {
+            if (message.empty() && !chunk.error.empty()) {
+                u_long line = (u_long) std::count(begin, chunk.begin, '\n') + chunk.error_line;
+                message = "line " + std::to_string(line) + ": " + chunk.error;
+            }
+            chunk.free();
+        }
+        throw DbRelationError(message);
+    }
+
+    // write them out in file order
+    Handles *handles = new Handles();
+    try {
+        if (this->relation.loads_blocks()) {
+            for (auto &chunk: chunks) {
+                while (!chunk.blocks.empty()) {
+                    Handles *block_handles = this->relation.append_block(chunk.blocks.front());
+                    handles->insert(handles->end(), block_handles->begin(), block_handles->end());
+                    delete block_handles;
+                    delete chunk.blocks.front();
+                    chunk.blocks.erase(chunk.blocks.begin());
+                }
+            }
+        } else {
+            ValueDicts rows;
+            for (auto &chunk: chunks)
+                rows.insert(rows.end(), chunk.rows.begin(), chunk.rows.end());
+            Handles *inserted = this->relation.insert_many(&rows);
+            handles->swap(*inserted);
+            delete inserted;
+        }
+    } catch (...) {
+        // take back whatever made it in
+        this->relation.del_many(handles);
+        delete handles;
+        for (auto &chunk: chunks)
+            chunk.free();
+        throw;
+    }
+    for (auto &chunk: chunks)
+        chunk.free();
+    return handles;
+}
+
+// If the first line is a header naming every column of the relation, take the order of the fields from it and
+// move begin past it; otherwise the fields are in the relation's column order.
+void BulkLoader::read_header(const char *&begin, const char *end) {
+    const ColumnNames &column_names = this->relation.get_column_names();
+    ColumnAttributes column_attributes = this->relation.get_column_attributes();
+    this->columns = column_names;
+
+    const char *p = begin;
+    std::vector<std::string> fields;
+    try {
+        parse_line(p, end, fields);
+    } catch (DbRelationError &e) {
+        fields.clear();  // not a header, and parse will say what's wrong with it
+    }
+    std::set<std::string> names(fields.begin(), fields.end());
+    if (fields.size() == column_names.size() && names.size() == fields.size()
+            && std::all_of(column_names.begin(), column_names.end(),
+                           [&names](const Identifier &name) { return names.count(name) > 0; })) {
+        this->columns = fields;
+        begin = p;
+    }
+
+    this->data_types.clear();
+    for (auto const &column: this->columns) {
+        size_t i = (size_t) (std::find(column_names.begin(), column_names.end(), column) - column_names.begin());
+        this->data_types.push_back(column_attributes[i].get_data_type());
+    }
+}
+
+// Parse a chunk into rows, and pack them into blocks if the relation loads blocks. Runs in a worker, so it reports
+// a failure in chunk.error rather than throwing.
+void BulkLoader::parse(Chunk &chunk) const {
+    const char *p = chunk.begin;
+    u_long line = 0;
+    std::vector<std::string> fields;
+    try {
+        while (p < chunk.end) {
+            line++;
+            parse_line(p, chunk.end, fields);
+            if (fields.empty())
+                continue;  // a blank line
+            if (fields.size() != this->columns.size())
+                throw DbRelationError("expected " + std::to_string(this->columns.size()) + " fields, not "
+                                      + std::to_string(fields.size()));
+            ValueDict *row = new ValueDict();
+            chunk.rows.push_back(row);
+            chunk.row_lines.push_back(line);
+            for (size_t i = 0; i < fields.size(); i++)
+                (*row)[this->columns[i]] = convert(fields[i], this->data_types[i]);
+        }
+        if (this->relation.loads_blocks()) {
+            size_t next = 0;
+            try {
+                while (next < chunk.rows.size())
+                    chunk.blocks.push_back(this->relation.pack_block(chunk.rows, next));
+            } catch (std::exception &e) {
+                line = chunk.row_lines[next];  // pack_block stops at the row it couldn't take
+                throw;
+            }
+            chunk.free_rows();
+        }
+    } catch (std::exception &e) {
+        chunk.error = e.what();
+        chunk.error_line = line;
+        chunk.free();
+    }
+}
+
+// Split the line at p into fields (none for a blank line) and move p to the start of the next one.
+void BulkLoader::parse_line(const char *&p, const char *end, std::vector<std::string> &fields) {
+    fields.clear();
+    if (p < end && (*p == '\n' || (*p == '\r' && p + 1 < end && p[1] == '\n'))) {
+        p += *p == '\n' ? 1 : 2;
+        return;
+    }
+    std::string field;
+    while (true) {
+        field.clear();
+        if (p < end && *p == '"') {
+            for (p++; ; p++) {
+                if (p == end || *p == '\n')
+                    throw DbRelationError("unterminated quoted field");
+                if (*p == '"') {
+                    if (p + 1 < end && p[1] == '"') {
+                        field += '"';
+                        p++;
+                    } else {
+                        p++;
+                        break;
+                    }
+                } else {
+                    field += *p;
+                }
+            }
+            if (p < end && *p == '\r')
+                p++;
+            if (p < end && *p != ',' && *p != '\n')
+                throw DbRelationError("unexpected character after a quoted field");
+        } else {
+            const char *start = p;
+            while (p < end && *p != ',' && *p != '\n')
+                p++;
+            const char *field_end = p;
+            if (field_end > start && field_end[-1] == '\r' && (p == end || *p == '\n'))
+                field_end--;
+            field.assign(start, field_end);
+        }
+        fields.push_back(field);
+        if (p < end && *p == ',') {
+            p++;
+            continue;
+        }
+        if (p < end)
+            p++;  // past the line break
+        return;
+    }
+}
+
+Value BulkLoader::convert(const std::string &field, ColumnAttribute::DataType data_type) {
+    if (data_type == ColumnAttribute::INT) {
+        char *end = nullptr;
+        errno = 0;
+        long long n = field.empty() ? 0 : strtoll(field.c_str(), &end, 10);
+        if (field.empty() || *end != '\0' || isspace(field[0]) || errno == ERANGE || n < INT32_MIN || n > INT32_MAX)
+            throw DbRelationError("\"" + field + "\" is not an INT");
+        return Value((int32_t) n);
+    } else if (data_type == ColumnAttribute::BOOLEAN) {
+        std::string word(field);
+        for (auto &c: word)
+            c = (char) tolower(c);
+        if (word == "true" || word == "t" || word == "1")
+            return Value(true);
+        if (word == "false" || word == "f" || word == "0")
+            return Value(false);
+        throw DbRelationError("\"" + field + "\" is not a BOOLEAN");
+    }
+    return Value(field);
+}
+
+
+// test function -- returns true if all tests pass
+
+// a new temporary file holding text; "" if it can't be made
+static std::string write_file(const std::string &text) {
+    char path[] = "/tmp/test_bulk_loader_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0)
+        return "";
+    bool ok = write(fd, text.data(), text.size()) == (ssize_t) text.size();
+    close(fd);
+    if (!ok) {
+        unlink(path);
+        return "";
+    }
+    return path;
+}
+
+// load text into relation, giving the number of rows loaded, or -1 (with the error in message) if it fails
+static long load_text(DbRelation &relation, const std::string &text, std::string &message) {
+    std::string path = write_file(text);
+    if (path.empty()) {
+        message = "can't write a temporary file";
+        return -1;
+    }
+    long rows = -1;
+    try {
+        BulkLoader loader(relation);
+        Handles *handles = loader.load(path);
+        rows = (long) handles->size();
+        delete handles;
+    } catch (DbRelationError &e) {
+        message = e.what();
+    }
+    unlink(path.c_str());
+    return rows;
+}
+
+bool test_bulk_loader() {
+    uint saved_workers = BulkLoader::workers;
+    size_t saved_chunk_bytes = BulkLoader::chunk_bytes;
+    BulkLoader::workers = 4;
+    BulkLoader::chunk_bytes = 4096;  // lots of chunks, so the workers have something to share
+    bool ok = true;
+
+    ColumnNames column_names = {"a", "b", "c"};
+    ColumnAttributes column_attributes = {ColumnAttribute(ColumnAttribute::INT), ColumnAttribute(ColumnAttribute::TEXT),
+                                          ColumnAttribute(ColumnAttribute::BOOLEAN)};
+    HeapTable table("_test_bulk_loader", column_names, column_attributes);
+    table.create();
+
+    // a header putting the columns in another order, quoting, CRLF line breaks and a blank line
+    const int N = 5000;
+    std::string text = "c,a,b\r\n";
+    for (int i = 0; i < N; i++) {
+        if (i == N / 2)
+            text += "\r\n";
+        text += std::string(i % 2 ? "t" : "false") + "," + std::to_string(i - N / 2) + ","
+                + (i % 3 == 0 ? "\"row, \"\"" + std::to_string(i) + "\"\"\"" : "row " + std::to_string(i)) + "\r\n";
+    }
+    std::string message;
+    long rows = load_text(table, text, message);
+    if (rows != N) {
+        std::cout << "loaded " << rows << " rows, not " << N << ": " << message << std::endl;
+        ok = false;
+    }
+    Handles *handles = table.select();
+    if (handles->size() != (size_t) N) {
+        std::cout << "selected " << handles->size() << " rows, not " << N << std::endl;
+        ok = false;
+    }
+    for (size_t i = 0; ok && i < handles->size(); i++) {
+        ValueDict *row = table.project((*handles)[i]);
+        std::string b = i % 3 == 0 ? "row, \"" + std::to_string(i) + "\"" : "row " + std::to_string(i);
+        if ((*row)["a"] != Value((int32_t) i - N / 2) || (*row)["b"] != Value(b) || (*row)["c"] != Value(i % 2 == 1)) {
+            std::cout << "row " << i << " loaded wrong" << std::endl;
+            ok = false;
+        }
+        delete row;
+    }
+    delete handles;
+
+    // a bad line anywhere leaves the table as it was, and says where it was
+    const char *bad[] = {"x", "1,2,maybe", "1,\"unterminated,t", "1,two,t,4", "99999999999,big,t"};
+    for (auto const &line: bad) {
+        std::string bad_text;
+        for (int i = 0; i < 1000; i++)
+            bad_text += std::to_string(i) + ",ok,f\n";
+        bad_text += std::string(line) + "\n1000,ok,t\n";
+        rows = load_text(table, bad_text, message);
+        if (rows != -1 || message.find("line 1001") != 0 || table.count() != (u_long) N) {
+            std::cout << "loaded \"" << line << "\": " << rows << " " << message << std::endl;
+            ok = false;
+        }
+    }
+    table.drop();
+
+    // a table kept in a tree is loaded bottom up, and keys may come in any order
+    ColumnNames key = {"a"};
+    BTreeTable tree_table("_test_bulk_loader_btree", column_names, column_attributes, key);
+    tree_table.create();
+    text.clear();
+    for (int i = 0; i < N; i++)
+        text += std::to_string(i * 7919 % N) + ",row " + std::to_string(i) + ",1\n";
+    rows = load_text(tree_table, text, message);
+    if (rows != N || tree_table.count() != (u_long) N) {
+        std::cout << "loaded " << rows << " rows into a BTreeTable: " << message << std::endl;
+        ok = false;
+    }
+    ValueDict where;
+    where["a"] = Value(7919 % N);
+    handles = tree_table.select(&where);
+    if (handles->size() != 1) {
+        ok = false;
+    } else {
+        ValueDict *row = tree_table.project((*handles)[0]);
+        ok = ok && (*row)["b"] == Value("row 1");
+        delete row;
+    }
+    delete handles;
+    rows = load_text(tree_table, "1,again,t\n", message);  // a key it has already
+    ok = ok && rows == -1 && tree_table.count() == (u_long) N;
+    rows = load_text(tree_table, std::to_string(N) + ",new,t\n" + std::to_string(N + 1) + ",new,t\n1,again,t\n"
+                                 + std::to_string(N + 2) + ",new,t\n", message);  // and after some new ones
+    where["a"] = Value(N);
+    handles = tree_table.select(&where);
+    ok = ok && rows == -1 && tree_table.count() == (u_long) N && handles->empty();
+    delete handles;
+    tree_table.drop();
+
+    // how fast rows go in from a file, and one insert at a time
+    const int ROWS = 100000, INSERTS = 5000;
+    text.clear();
+    for (int i = 0; i < ROWS; i++)
+        text += std::to_string(i) + ",some text for row " + std::to_string(i) + ",t\n";
+    BulkLoader::chunk_bytes = saved_chunk_bytes;
+    HeapTable timed("_test_bulk_loader_timed", column_names, column_attributes);
+    timed.create();
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < INSERTS; i++) {
+        ValueDict row;
+        row["a"] = Value(i);
+        row["b"] = Value("some text for row " + std::to_string(i));
+        row["c"] = Value(true);
+        timed.insert(&row);
+    }
+    auto middle = std::chrono::steady_clock::now();
+    rows = load_text(timed, text, message);
+    auto end = std::chrono::steady_clock::now();
+    ok = ok && rows == ROWS && timed.count() == (u_long) (ROWS + INSERTS);
+    double inserted_us = (double) std::chrono::duration_cast<std::chrono::microseconds>(middle - start).count();
+    double loaded_us = (double) std::chrono::duration_cast<std::chrono::microseconds>(end - middle).count();
+    std::cout << "rows/sec into a table: one insert at a time " << (long) (INSERTS * 1e6 / std::max(inserted_us, 1.0))
+              << ", loaded from a file " << (long) (ROWS * 1e6 / std::max(loaded_us, 1.0)) << std::endl;
+    timed.drop();
+
+    BulkLoader::workers = saved_workers;
+    BulkLoader::chunk_bytes = saved_chunk_bytes;
+    return ok;
+}
@@ -0,0 +1,62 @@
+/**
+ * Loading a table in bulk from a CSV file (COPY ... FROM, or IMPORT FROM CSV FILE).
+ * BulkLoader
+ */
+#pragma once
+
+#include <string>
+#include "storage_engine.h"
+
+
+// Loads the rows of a CSV file into a relation. The file is mapped into memory and cut into chunks at line breaks,
+// which workers parse in parallel into rows and, for a relation that loads_blocks(), pack into full blocks; those
+// are then appended in file order, each written just once. Any other relation gets all the rows in one insert_many.
+// Every line is parsed and checked before anything is written, so a bad one leaves the relation as it was.
+//
+// Fields are separated by commas; a field may be quoted with ", doubling any " inside it, but can't span lines.
+// Blank lines are skipped. If the first line is the relation's column names (in any order), it's a header giving
+// the order of the fields; otherwise they're in the relation's column order. BOOLEAN fields are true/false, t/f
+// or 1/0.
+class BulkLoader {
+public:
+    static uint workers;  // threads parsing the file; by default one per core
+    static size_t chunk_bytes;  // how much of the file each worker takes at a time
+
+    explicit BulkLoader(DbRelation &relation);
+    virtual ~BulkLoader() {}
+
+    Handles* load(const std::string &path);  // the handles of the rows loaded, in file order (caller deletes)
+
+protected:
+    // a piece of the file, and what a worker made of it
+    class Chunk {
+    public:
+        const char *begin;
+        const char *end;
+        ValueDicts rows;
+        std::vector<u_long> row_lines;  // the line (counted in the chunk from 1) of each row
+        std::vector<DbBlock*> blocks;
+        std::string error;
+        u_long error_line;  // in the chunk, as for row_lines
+
+        Chunk(const char *begin, const char *end) : begin(begin), end(end), error_line(0) {}
+        void free_rows();
+        void free();
+    };
+
+    DbRelation &relation;
+    ColumnNames columns;  // the column each field goes in
+    std::vector<ColumnAttribute::DataType> data_types;
+
+    Handles* load(const char *begin, const char *end);
+    void read_header(const char *&begin, const char *end);
+    void parse(Chunk &chunk) const;
+    static void parse_line(const char *&p, const char *end, std::vector<std::string> &fields);
+    static Value convert(const std::string &field, ColumnAttribute::DataType data_type);
+
+private:
+    BulkLoader(const BulkLoader &other);
+    BulkLoader &operator=(const BulkLoader &other);
+};
+
+bool test_bulk_loader();
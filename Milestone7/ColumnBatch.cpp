@@ -0,0 +1,354 @@
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include "ColumnBatch.h"
+#include "EvalOperator.h"
+#include "heap_storage.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define COLUMN_BATCH_X86
+#include <immintrin.h>
+#endif
+
+
+ColumnBatch::ColumnBatch(const ColumnNames &column_names, const ColumnAttributes &column_attributes)
+        : column_names(column_names), columns(column_names.size()) {
+    for (uint i = 0; i < this->columns.size(); i++) {
+        this->columns[i].data_type = ColumnAttribute(column_attributes[i]).get_data_type();
+        this->columns[i].offsets.push_back(0);
+    }
+}
+
+void ColumnBatch::clear() {
+    for (auto &column: this->columns) {
+        column.ints.clear();
+        column.bytes.clear();
+        column.offsets.resize(1);
+        column.text.clear();
+    }
+    this->handles.clear();
+}
+
+void ColumnBatch::add_text(uint column, const char *s, uint size) {
+    Column &c = this->columns[column];
+    c.text.append(s, size);
+    c.offsets.push_back((uint32_t) c.text.size());
+}
+
+uint ColumnBatch::column_number(const Identifier &column_name) const {
+    for (uint i = 0; i < this->column_names.size(); i++)
+        if (this->column_names[i] == column_name)
+            return i;
+    throw DbRelationError("table does not have column named '" + column_name + "'");
+}
+
+Value ColumnBatch::value(uint column, uint32_t position) const {
+    const Column &c = this->columns[column];
+    switch (c.data_type) {
+        case ColumnAttribute::INT:
+            return Value(c.ints[position]);
+        case ColumnAttribute::BOOLEAN:
+            return Value(c.bytes[position] != 0);
+        case ColumnAttribute::TEXT:
+            return Value(c.text.substr(c.offsets[position], c.offsets[position + 1] - c.offsets[position]));
+        default:
+            throw DbRelationError("only know how to decode INT, TEXT, or BOOLEAN");
+    }
+}
+
+ValueDict *ColumnBatch::project(uint32_t position, const ColumnNames *column_names) const {
+    ValueDict *row = new ValueDict();
+    WorkCounters::allocated();
+    if (column_names == nullptr || column_names->empty()) {
+        for (uint i = 0; i < this->columns.size(); i++)
+            (*row)[this->column_names[i]] = value(i, position);
+    } else {
+        for (auto const &column_name: *column_names)
+            (*row)[column_name] = value(column_number(column_name), position);
+    }
+    return row;
+}
+
+// Text equality has no wide kernel; comparing lengths first throws out most rows cheaply.
+static uint32_t refine_eq_text(const std::vector<uint32_t> &offsets, const std::string &text,
+                               const uint32_t *selection, uint32_t n, const std::string &target, uint32_t *out) {
+    uint32_t k = 0;
+    for (uint32_t j = 0; j < n; j++) {
+        uint32_t i = selection[j];
+        uint32_t size = offsets[i + 1] - offsets[i];
+        if (size == target.size() && memcmp(text.data() + offsets[i], target.data(), size) == 0)
+            out[k++] = i;
+    }
+    return k;
+}
+
+// Each term narrows the selection left by the ones before; the first that has a wide kernel starts it off.
+void ColumnBatch::select(const ValueDict *where, Selection &selection) const {
+    uint32_t n = (uint32_t) size();
+    selection.resize(n);
+    if (where == nullptr || where->empty()) {
+        for (uint32_t i = 0; i < n; i++)
+            selection[i] = i;
+        return;
+    }
+    bool started = false;
+    for (auto const &term: *where) {
+        const Column &c = this->columns[column_number(term.first)];
+        const Value &target = term.second;
+        if (target.data_type != c.data_type) {
+            n = 0;  // never equal, as with Value::operator==
+        } else if (c.data_type == ColumnAttribute::INT) {
+            n = started ? refine_eq_int32(c.ints.data(), selection.data(), n, target.n, selection.data())
+                        : select_eq_int32(c.ints.data(), n, target.n, selection.data());
+        } else if (c.data_type == ColumnAttribute::BOOLEAN) {
+            uint8_t b = target.n != 0;
+            n = started ? refine_eq_uint8(c.bytes.data(), selection.data(), n, b, selection.data())
+                        : select_eq_uint8(c.bytes.data(), n, b, selection.data());
+        } else {
+            if (!started)
+                for (uint32_t i = 0; i < n; i++)
+                    selection[i] = i;
+            n = refine_eq_text(c.offsets, c.text, selection.data(), n, target.s, selection.data());
+        }
+        started = true;
+        if (n == 0)
+            break;
+    }
+    selection.resize(n);
+}
+
+
+// Scalar kernels: branch-free, so a mismatch costs the same as a match and nothing is mispredicted.
+
+static uint32_t select_eq_int32_scalar(const int32_t *values, uint32_t begin, uint32_t n, int32_t target,
+                                       uint32_t *out) {
+    uint32_t k = 0;
+    for (uint32_t i = begin; i < n; i++) {
+        out[k] = i;
+        k += values[i] == target;
+    }
+    return k;
+}
+
+static uint32_t select_eq_uint8_scalar(const uint8_t *values, uint32_t begin, uint32_t n, uint8_t target,
+                                       uint32_t *out) {
+    uint32_t k = 0;
+    for (uint32_t i = begin; i < n; i++) {
+        out[k] = i;
+        k += values[i] == target;
+    }
+    return k;
+}
+
+uint32_t refine_eq_int32(const int32_t *values, const uint32_t *selection, uint32_t n, int32_t target,
+                         uint32_t *out) {
+    uint32_t k = 0;
+    for (uint32_t j = 0; j < n; j++) {
+        uint32_t i = selection[j];
+        out[k] = i;
+        k += values[i] == target;
+    }
+    return k;
+}
+
+uint32_t refine_eq_uint8(const uint8_t *values, const uint32_t *selection, uint32_t n, uint8_t target,
+                         uint32_t *out) {
+    uint32_t k = 0;
+    for (uint32_t j = 0; j < n; j++) {
+        uint32_t i = selection[j];
+        out[k] = i;
+        k += values[i] == target;
+    }
+    return k;
+}
+
+
+#ifdef COLUMN_BATCH_X86
+
+// Turn a comparison mask into positions, lowest bit first.
+static inline uint32_t emit_positions(uint32_t mask, uint32_t base, uint32_t *out) {
+    uint32_t k = 0;
+    while (mask != 0) {
+        out[k++] = base + (uint32_t) __builtin_ctz(mask);
+        mask &= mask - 1;
+    }
+    return k;
+}
+
+__attribute__((target("avx2")))
+static uint32_t select_eq_int32_avx2(const int32_t *values, uint32_t n, int32_t target, uint32_t *out) {
+    uint32_t i = 0, k = 0;
+    __m256i wanted = _mm256_set1_epi32(target);
+    for (; i + 8 <= n; i += 8) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *) (values + i));
+        uint32_t mask = (uint32_t) _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(chunk, wanted)));
+        k += emit_positions(mask, i, out + k);
+    }
+    return k + select_eq_int32_scalar(values, i, n, target, out + k);
+}
+
+__attribute__((target("avx2")))
+static uint32_t select_eq_uint8_avx2(const uint8_t *values, uint32_t n, uint8_t target, uint32_t *out) {
+    uint32_t i = 0, k = 0;
+    __m256i wanted = _mm256_set1_epi8((char) target);
+    for (; i + 32 <= n; i += 32) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *) (values + i));
+        uint32_t mask = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, wanted));
+        k += emit_positions(mask, i, out + k);
+    }
+    return k + select_eq_uint8_scalar(values, i, n, target, out + k);
+}
+
+__attribute__((target("sse2")))
+static uint32_t select_eq_int32_sse2(const int32_t *values, uint32_t n, int32_t target, uint32_t *out) {
+    uint32_t i = 0, k = 0;
+    __m128i wanted = _mm_set1_epi32(target);
+    for (; i + 4 <= n; i += 4) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *) (values + i));
+        uint32_t mask = (uint32_t) _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(chunk, wanted)));
+        k += emit_positions(mask, i, out + k);
+    }
+    return k + select_eq_int32_scalar(values, i, n, target, out + k);
+}
+
+__attribute__((target("sse2")))
+static uint32_t select_eq_uint8_sse2(const uint8_t *values, uint32_t n, uint8_t target, uint32_t *out) {
+    uint32_t i = 0, k = 0;
+    __m128i wanted = _mm_set1_epi8((char) target);
+    for (; i + 16 <= n; i += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *) (values + i));
+        uint32_t mask = (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, wanted));
+        k += emit_positions(mask, i, out + k);
+    }
+    return k + select_eq_uint8_scalar(values, i, n, target, out + k);
+}
+
+static bool has_avx2() {
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    return avx2;
+}
+
+static bool has_sse2() {
+    static const bool sse2 = __builtin_cpu_supports("sse2");
+    return sse2;
+}
+
+#endif
+
+// Dense kernels pick the widest instructions the CPU has at run time, so no special build flags are needed.
+
+uint32_t select_eq_int32(const int32_t *values, uint32_t n, int32_t target, uint32_t *out) {
+#ifdef COLUMN_BATCH_X86
+    if (has_avx2())
+        return select_eq_int32_avx2(values, n, target, out);
+    if (has_sse2())
+        return select_eq_int32_sse2(values, n, target, out);
+#endif
+    return select_eq_int32_scalar(values, 0, n, target, out);
+}
+
+uint32_t select_eq_uint8(const uint8_t *values, uint32_t n, uint8_t target, uint32_t *out) {
+#ifdef COLUMN_BATCH_X86
+    if (has_avx2())
+        return select_eq_uint8_avx2(values, n, target, out);
+    if (has_sse2())
+        return select_eq_uint8_sse2(values, n, target, out);
+#endif
+    return select_eq_uint8_scalar(values, 0, n, target, out);
+}
+
+
+bool test_column_batch() {
+    // kernels agree with the obvious loop, including across the vector-width tails
+    bool ok = true;
+    const uint32_t len = 1000;
+    std::vector<int32_t> ints(len);
+    std::vector<uint8_t> bytes(len);
+    for (uint32_t i = 0; i < len; i++) {
+        ints[i] = (int32_t) ((i * 7919) % 13);
+        bytes[i] = (uint8_t) (i % 3 == 0);
+    }
+    for (uint32_t n = 0; ok && n < 70; n++) {
+        uint32_t out[len], expected[len], k = 0;
+        for (uint32_t i = 0; i < n; i++)
+            if (ints[i] == 5)
+                expected[k++] = i;
+        ok = select_eq_int32(ints.data(), n, 5, out) == k && memcmp(out, expected, k * sizeof(uint32_t)) == 0;
+        k = 0;
+        for (uint32_t i = 0; i < n; i++)
+            if (bytes[i] == 1 && ints[i] == 5)
+                expected[k++] = i;
+        uint32_t m = select_eq_uint8(bytes.data(), n, 1, out);
+        ok = ok && refine_eq_int32(ints.data(), out, m, 5, out) == k
+             && memcmp(out, expected, k * sizeof(uint32_t)) == 0;
+    }
+    if (!ok)
+        std::cout << "kernels disagree with scalar loop" << std::endl;
+
+    ColumnNames column_names;
+    column_names.push_back("a");
+    column_names.push_back("b");
+    column_names.push_back("c");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::BOOLEAN));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    HeapTable table("__test_column_batch", column_names, column_attributes);
+    table.create();
+    const int n = 20000;
+    for (int i = 0; i < n; i++) {
+        ValueDict row;
+        row["a"] = Value(i % 10);
+        row["b"] = Value(i % 4 == 0);
+        row["c"] = Value(i % 5 == 0 ? "five" : "other");
+        table.insert(&row);
+    }
+    ValueDict where;
+    where["a"] = Value(0);
+    where["b"] = Value(true);
+    where["c"] = Value("five");
+
+    // the row-at-a-time path against decoding blocks and filtering them column-wise
+    auto start = std::chrono::steady_clock::now();
+    Handles *handles = table.select(&where);
+    auto middle = std::chrono::steady_clock::now();
+    Handles columnar;
+    ColumnBatch batch(column_names, column_attributes);
+    Selection selection;
+    BlockID block_id = 0;
+    while (table.decode_block(block_id, batch)) {
+        batch.select(&where, selection);
+        for (auto position: selection)
+            columnar.push_back(batch.get_handle(position));
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    ok = ok && handles->size() == (size_t) n / 20 && columnar.size() == handles->size();
+    for (size_t i = 0; ok && i < columnar.size(); i++)
+        ok = columnar[i].block_id == (*handles)[i].block_id && columnar[i].record_id == (*handles)[i].record_id;
+    if (!ok)
+        std::cout << "columnar filter disagrees with select(where)" << std::endl;
+    delete handles;
+    double row_secs = std::chrono::duration<double>(middle - start).count();
+    double column_secs = std::chrono::duration<double>(end - middle).count();
+    std::cout << "rows/sec filtered: select(where) " << (long) (n / row_secs)
+              << ", column batches " << (long) (n / column_secs) << std::endl;
+
+    // and through a table scan operator, which takes the columnar path for a heap table
+    TableScanOperator scan(table, &where);
+    size_t count = 0;
+    scan.open();
+    for (ValueDicts *rows = scan.next(); rows != nullptr; rows = scan.next()) {
+        for (auto row: *rows)
+            ok = ok && *row == where;
+        count += rows->size();
+        EvalOperator::free_batch(rows);
+    }
+    scan.close();
+    ok = ok && count == (size_t) n / 20;
+    if (!ok)
+        std::cout << "columnar table scan failed" << std::endl;
+
+    table.drop();
+    return ok;
+}
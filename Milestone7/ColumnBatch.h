@@ -0,0 +1,69 @@
+/**
+ * Column-at-a-time form of a batch of rows, for filtering without building a ValueDict per row.
+ * ColumnBatch
+ */
+#pragma once
+
+#include <string>
+#include <vector>
+#include "storage_engine.h"
+
+typedef std::vector<uint32_t> Selection;  // positions within a ColumnBatch, ascending
+
+
+// The rows of one or more blocks decoded into one array per column: int32 for INT, a byte each for BOOLEAN and
+// offsets into one run of bytes for TEXT. Filled in by DbRelation::decode_block.
+class ColumnBatch {
+public:
+    ColumnBatch(const ColumnNames &column_names, const ColumnAttributes &column_attributes);
+    virtual ~ColumnBatch() {}
+
+    void clear();
+    size_t size() const { return handles.size(); }
+    const Handle &get_handle(uint32_t position) const { return handles[position]; }
+
+    // filling in a row: add_handle, then one add per column in column order
+    void add_handle(const Handle &handle) { handles.push_back(handle); }
+    void add_int(uint column, int32_t n) { columns[column].ints.push_back(n); }
+    void add_boolean(uint column, uint8_t b) { columns[column].bytes.push_back(b); }
+    void add_text(uint column, const char *s, uint size);
+
+    // positions of the rows that match an equality conjunction
+    void select(const ValueDict *where, Selection &selection) const;
+
+    // one row, with every column or just those asked for (caller deletes)
+    ValueDict *project(uint32_t position, const ColumnNames *column_names=nullptr) const;
+
+    // the raw arrays, for compiled filters and projections (see CompiledExpression.h)
+    uint column_number(const Identifier &column_name) const;
+    const int32_t *ints(uint column) const { return columns[column].ints.data(); }
+    const uint8_t *bytes(uint column) const { return columns[column].bytes.data(); }
+    const uint32_t *offsets(uint column) const { return columns[column].offsets.data(); }
+    const char *text(uint column) const { return columns[column].text.data(); }
+
+protected:
+    struct Column {
+        ColumnAttribute::DataType data_type;
+        std::vector<int32_t> ints;      // INT
+        std::vector<uint8_t> bytes;     // BOOLEAN
+        std::vector<uint32_t> offsets;  // TEXT: row i is text[offsets[i], offsets[i + 1])
+        std::string text;
+    };
+
+    ColumnNames column_names;
+    std::vector<Column> columns;
+    Handles handles;
+
+    Value value(uint column, uint32_t position) const;
+};
+
+// Selection-vector kernels: dense ones look at every position up to n, refine ones only at those in selection
+// (and may write back over it). Each returns how many positions it kept.
+uint32_t select_eq_int32(const int32_t *values, uint32_t n, int32_t target, uint32_t *out);
+uint32_t refine_eq_int32(const int32_t *values, const uint32_t *selection, uint32_t n, int32_t target,
+                         uint32_t *out);
+uint32_t select_eq_uint8(const uint8_t *values, uint32_t n, uint8_t target, uint32_t *out);
+uint32_t refine_eq_uint8(const uint8_t *values, const uint32_t *selection, uint32_t n, uint8_t target,
+                         uint32_t *out);
+
+bool test_column_batch();
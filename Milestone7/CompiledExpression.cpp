@@ -0,0 +1,474 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include "CompiledExpression.h"
+#include "EvalOperator.h"
+#include "heap_storage.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define COMPILED_EXPRESSION_X86
+#include <x86intrin.h>
+#endif
+
+
+// A TEXT value still in the batch's run of bytes, ordered as Value orders TEXT (as std::string does).
+struct TextRef {
+    const char *data;
+    uint32_t size;
+
+    TextRef(const char *data, uint32_t size) : data(data), size(size) {}
+
+    int compare(const TextRef &other) const {
+        int c = memcmp(data, other.data, std::min(size, other.size));
+        return c != 0 ? c : (size < other.size ? -1 : size > other.size);
+    }
+    bool operator==(const TextRef &other) const { return size == other.size && memcmp(data, other.data, size) == 0; }
+    bool operator!=(const TextRef &other) const { return !(*this == other); }
+    bool operator<(const TextRef &other) const { return compare(other) < 0; }
+    bool operator<=(const TextRef &other) const { return compare(other) <= 0; }
+    bool operator>(const TextRef &other) const { return compare(other) > 0; }
+    bool operator>=(const TextRef &other) const { return compare(other) >= 0; }
+};
+
+// How a ColumnBatch holds a column of each data type, and what a constant of that type compares as.
+template <ColumnAttribute::DataType type> struct ColumnValues;
+
+template <> struct ColumnValues<ColumnAttribute::INT> {
+    typedef int32_t value_type;
+    const int32_t *values;
+    ColumnValues(const ColumnBatch &batch, uint column) : values(batch.ints(column)) {}
+    int32_t operator[](uint32_t i) const { return values[i]; }
+    static int32_t constant(const Value &value) { return value.n; }
+};
+
+template <> struct ColumnValues<ColumnAttribute::BOOLEAN> {
+    typedef uint8_t value_type;
+    const uint8_t *values;
+    ColumnValues(const ColumnBatch &batch, uint column) : values(batch.bytes(column)) {}
+    uint8_t operator[](uint32_t i) const { return values[i]; }
+    static uint8_t constant(const Value &value) { return value.n != 0; }
+};
+
+template <> struct ColumnValues<ColumnAttribute::TEXT> {
+    typedef TextRef value_type;
+    const uint32_t *offsets;
+    const char *text;
+    ColumnValues(const ColumnBatch &batch, uint column) : offsets(batch.offsets(column)), text(batch.text(column)) {}
+    TextRef operator[](uint32_t i) const { return TextRef(text + offsets[i], offsets[i + 1] - offsets[i]); }
+    static TextRef constant(const Value &value) { return TextRef(value.s.data(), (uint32_t) value.s.size()); }
+};
+
+
+uint32_t ColumnTerm::select(const ColumnBatch &batch, uint32_t n, uint32_t *out) const {
+    for (uint32_t i = 0; i < n; i++)
+        out[i] = i;
+    return refine(batch, out, n);
+}
+
+// column <compare> target, for a column of the given type. The loop is branch-free for INT and BOOLEAN columns.
+template <ColumnAttribute::DataType type, template <typename> class Compare>
+class TypedTerm : public ColumnTerm {
+public:
+    TypedTerm(uint column, const Value &target) : ColumnTerm(column), target(target) {}
+
+    virtual uint32_t refine(const ColumnBatch &batch, uint32_t *selection, uint32_t n) const {
+        typedef typename ColumnValues<type>::value_type value_type;
+        ColumnValues<type> values(batch, this->column);
+        const value_type target = ColumnValues<type>::constant(this->target);
+        Compare<value_type> compare;
+        uint32_t k = 0;
+        for (uint32_t j = 0; j < n; j++) {
+            uint32_t i = selection[j];
+            selection[k] = i;
+            k += compare(values[i], target);
+        }
+        return k;
+    }
+
+    virtual uint32_t select(const ColumnBatch &batch, uint32_t n, uint32_t *out) const {
+        return ColumnTerm::select(batch, n, out);
+    }
+
+protected:
+    Value target;
+};
+
+// equalities on INT and BOOLEAN columns start off with the wide kernels
+template <>
+uint32_t TypedTerm<ColumnAttribute::INT, std::equal_to>::select(const ColumnBatch &batch, uint32_t n,
+                                                                 uint32_t *out) const {
+    return select_eq_int32(batch.ints(this->column), n, this->target.n, out);
+}
+
+template <>
+uint32_t TypedTerm<ColumnAttribute::BOOLEAN, std::equal_to>::select(const ColumnBatch &batch, uint32_t n,
+                                                                     uint32_t *out) const {
+    return select_eq_uint8(batch.bytes(this->column), n, this->target.n != 0, out);
+}
+
+// a comparison with a constant of another type, which no row passes
+class NoTerm : public ColumnTerm {
+public:
+    NoTerm() : ColumnTerm(0) {}
+    virtual uint32_t refine(const ColumnBatch &batch, uint32_t *selection, uint32_t n) const { return 0; }
+};
+
+enum TermComparison { EQ, NE, LT, LE, GT, GE };
+
+template <ColumnAttribute::DataType type>
+static ColumnTerm *typed_term(uint column, TermComparison comparison, const Value &target) {
+    switch (comparison) {
+        case EQ:
+            return new TypedTerm<type, std::equal_to>(column, target);
+        case NE:
+            return new TypedTerm<type, std::not_equal_to>(column, target);
+        case LT:
+            return new TypedTerm<type, std::less>(column, target);
+        case LE:
+            return new TypedTerm<type, std::less_equal>(column, target);
+        case GT:
+            return new TypedTerm<type, std::greater>(column, target);
+        default:
+            return new TypedTerm<type, std::greater_equal>(column, target);
+    }
+}
+
+// The term for column <comparison> target, or nullptr if every row passes. Values of different types are never
+// equal or ordered (see Predicate::matches).
+static ColumnTerm *make_term(const ColumnNames &column_names, const ColumnAttributes &column_attributes,
+                             const Identifier &column_name, TermComparison comparison, const Value &target) {
+    uint column = 0;
+    while (column < column_names.size() && column_names[column] != column_name)
+        column++;
+    if (column == column_names.size())
+        throw DbRelationError("table does not have column named '" + column_name + "'");
+    ColumnAttribute::DataType data_type = ColumnAttribute(column_attributes[column]).get_data_type();
+    if (target.data_type != data_type)
+        return comparison == NE ? nullptr : new NoTerm();
+    switch (data_type) {
+        case ColumnAttribute::INT:
+            return typed_term<ColumnAttribute::INT>(column, comparison, target);
+        case ColumnAttribute::BOOLEAN:
+            return typed_term<ColumnAttribute::BOOLEAN>(column, comparison, target);
+        case ColumnAttribute::TEXT:
+            return typed_term<ColumnAttribute::TEXT>(column, comparison, target);
+        default:
+            throw DbRelationError("only know how to compare INT, TEXT, or BOOLEAN");
+    }
+}
+
+
+CompiledFilter::CompiledFilter(const ColumnNames &column_names, const ColumnAttributes &column_attributes,
+                               const ValueDict *where, const Predicates &predicates) : alternatives() {
+    compile(column_names, column_attributes, where, predicates);
+}
+
+CompiledFilter::CompiledFilter(const ColumnNames &column_names, const ColumnAttributes &column_attributes,
+                               const Conditions &any_of) : alternatives() {
+    for (auto const &condition: any_of)
+        compile(column_names, column_attributes, &condition.where, condition.predicates);
+}
+
+CompiledFilter::~CompiledFilter() {
+    for (auto const &terms: this->alternatives)
+        for (auto term: terms)
+            delete term;
+}
+
+// Add an alternative: the equalities come first, since they usually throw out the most rows.
+void CompiledFilter::compile(const ColumnNames &column_names, const ColumnAttributes &column_attributes,
+                             const ValueDict *where, const Predicates &predicates) {
+    static const TermComparison comparisons[] = {LT, LE, GT, GE, NE};  // by Predicate::Comparison
+    this->alternatives.push_back(Conjunction());
+    Conjunction &terms = this->alternatives.back();
+    try {
+        if (where != nullptr)
+            for (auto const &term: *where)
+                terms.push_back(make_term(column_names, column_attributes, term.first, EQ, term.second));
+        for (auto const &predicate: predicates)
+            terms.push_back(make_term(column_names, column_attributes, predicate.column_name,
+                                      comparisons[predicate.comparison], predicate.value));
+    } catch (...) {
+        for (auto term: terms)
+            delete term;
+        this->alternatives.pop_back();
+        throw;
+    }
+    terms.erase(std::remove(terms.begin(), terms.end(), nullptr), terms.end());
+}
+
+// Each term narrows what the ones before it left.
+uint32_t CompiledFilter::select(const Conjunction &terms, const ColumnBatch &batch, uint32_t n, uint32_t *out) {
+    if (terms.empty()) {
+        for (uint32_t i = 0; i < n; i++)
+            out[i] = i;
+        return n;
+    }
+    n = terms[0]->select(batch, n, out);
+    for (size_t t = 1; t < terms.size() && n > 0; t++)
+        n = terms[t]->refine(batch, out, n);
+    return n;
+}
+
+void CompiledFilter::select(const ColumnBatch &batch, Selection &selection) const {
+    uint32_t n = (uint32_t) batch.size();
+    selection.resize(n);
+    if (this->alternatives.size() == 1) {
+        selection.resize(select(this->alternatives[0], batch, n, selection.data()));
+        return;
+    }
+    // any of several: the union of what each lets through
+    Selection passed(n), merged;
+    selection.clear();
+    for (auto const &terms: this->alternatives) {
+        passed.resize(select(terms, batch, n, passed.data()));
+        merged.clear();
+        std::set_union(selection.begin(), selection.end(), passed.begin(), passed.end(), std::back_inserter(merged));
+        selection.swap(merged);
+        passed.resize(n);
+    }
+}
+
+
+CompiledProjection::CompiledProjection(const ColumnNames &column_names, const ColumnAttributes &column_attributes,
+                                       const ColumnNames &projection)
+        : names(projection.empty() ? column_names : projection), columns(), data_types() {
+    for (auto const &column_name: this->names) {
+        auto found = std::find(column_names.begin(), column_names.end(), column_name);
+        if (found == column_names.end())
+            throw DbRelationError("table does not have column named '" + column_name + "'");
+        uint column = (uint) (found - column_names.begin());
+        this->columns.push_back(column);
+        this->data_types.push_back(ColumnAttribute(column_attributes[column]).get_data_type());
+    }
+}
+
+// One pass down each column, so the data type is looked at once per column rather than once per value.
+void CompiledProjection::project(const ColumnBatch &batch, const Selection &selection, size_t begin, size_t end,
+                                 ValueDicts &rows) const {
+    size_t first = rows.size();
+    for (size_t j = begin; j < end; j++)
+        rows.push_back(new ValueDict());
+    WorkCounters::allocated(end - begin);
+    for (size_t c = 0; c < this->columns.size(); c++) {
+        const Identifier &name = this->names[c];
+        uint column = this->columns[c];
+        switch (this->data_types[c]) {
+            case ColumnAttribute::INT: {
+                const int32_t *ints = batch.ints(column);
+                for (size_t j = begin; j < end; j++)
+                    rows[first + j - begin]->emplace(name, Value(ints[selection[j]]));
+                break;
+            }
+            case ColumnAttribute::BOOLEAN: {
+                const uint8_t *bytes = batch.bytes(column);
+                for (size_t j = begin; j < end; j++)
+                    rows[first + j - begin]->emplace(name, Value(bytes[selection[j]] != 0));
+                break;
+            }
+            default: {
+                const uint32_t *offsets = batch.offsets(column);
+                const char *text = batch.text(column);
+                for (size_t j = begin; j < end; j++) {
+                    uint32_t i = selection[j];
+                    rows[first + j - begin]->emplace(name, Value(std::string(text + offsets[i],
+                                                                             offsets[i + 1] - offsets[i])));
+                }
+            }
+        }
+    }
+}
+
+
+// Ticks of the CPU's cycle counter where there is one (nanoseconds otherwise).
+static uint64_t test_ticks() {
+#ifdef COMPILED_EXPRESSION_X86
+    return __rdtsc();
+#else
+    return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+bool test_compiled_expressions() {
+    ColumnNames column_names;
+    column_names.push_back("a");
+    column_names.push_back("b");
+    column_names.push_back("c");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::BOOLEAN));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    HeapTable table("__test_compiled_expressions", column_names, column_attributes);
+    table.create();
+    const int n = 30000;
+    const char *words[] = {"apple", "kiwi", "melon", "fig", "mango", "pear", "", "plum"};
+    for (int i = 0; i < n; i++) {
+        ValueDict row;
+        row["a"] = Value((int) (((long) i * 7919) % 10000) - 5000);
+        row["b"] = Value(i % 3 == 0);
+        row["c"] = Value(words[i % 8]);
+        table.insert(&row);
+    }
+    std::vector<ColumnBatch*> batches;
+    BlockID block_id = 0;
+    ColumnBatch *batch = new ColumnBatch(column_names, column_attributes);
+    while (table.decode_block(block_id, *batch)) {
+        batches.push_back(batch);
+        batch = new ColumnBatch(column_names, column_attributes);
+    }
+    delete batch;
+
+    // some typical filters, each as alternatives (just one unless it's an OR)
+    struct Filter {
+        std::string name;
+        Conditions alternatives;
+    };
+    std::vector<Filter> filters;
+    Filter filter;
+    filter.name = "a < 0";
+    filter.alternatives.assign(1, Condition());
+    filter.alternatives[0].predicates.push_back(Predicate("a", Predicate::LT, Value(0)));
+    filters.push_back(filter);
+    filter.name = "a BETWEEN -100 AND 2500 AND b = true";
+    filter.alternatives.assign(1, Condition());
+    filter.alternatives[0].where["b"] = Value(true);
+    filter.alternatives[0].predicates.push_back(Predicate("a", Predicate::GE, Value(-100)));
+    filter.alternatives[0].predicates.push_back(Predicate("a", Predicate::LE, Value(2500)));
+    filters.push_back(filter);
+    filter.name = "c > 'kiwi' AND c != 'pear'";
+    filter.alternatives.assign(1, Condition());
+    filter.alternatives[0].predicates.push_back(Predicate("c", Predicate::GT, Value("kiwi")));
+    filter.alternatives[0].predicates.push_back(Predicate("c", Predicate::NE, Value("pear")));
+    filters.push_back(filter);
+    filter.name = "a = 17 OR c = 'fig'";
+    filter.alternatives.assign(2, Condition());
+    filter.alternatives[0].where["a"] = Value(17);
+    filter.alternatives[1].where["c"] = Value("fig");
+    filters.push_back(filter);
+    filter.name = "a < 'x' OR a != 'x'";  // types that don't match: nothing for the first, everything for the second
+    filter.alternatives.assign(2, Condition());
+    filter.alternatives[0].predicates.push_back(Predicate("a", Predicate::LT, Value("x")));
+    filter.alternatives[1].predicates.push_back(Predicate("a", Predicate::NE, Value("x")));
+    filters.push_back(filter);
+
+    // each agrees with matching the rows one at a time (just the columns it needs, as a scan used to), and is timed
+    // against that
+    bool ok = true;
+    std::cout << "cycles/row interpreted vs compiled:";
+    for (auto const &f: filters) {
+        CompiledFilter compiled(column_names, column_attributes, f.alternatives);
+        ColumnNames needed;
+        for (auto const &condition: f.alternatives) {
+            for (auto const &term: condition.where)
+                needed.push_back(term.first);
+            for (auto const &predicate: condition.predicates)
+                needed.push_back(predicate.column_name);
+        }
+        size_t interpreted_count = 0, compiled_count = 0;
+        Selection selection;
+        uint64_t start = test_ticks();
+        for (auto b: batches)
+            for (uint32_t position = 0; position < b->size(); position++) {
+                ValueDict *row = b->project(position, &needed);
+                interpreted_count += SelectOperator::matches(*row, f.alternatives);
+                delete row;
+            }
+        uint64_t middle = test_ticks();
+        for (auto b: batches) {
+            compiled.select(*b, selection);
+            compiled_count += selection.size();
+        }
+        uint64_t end = test_ticks();
+        for (auto b: batches) {
+            compiled.select(*b, selection);
+            size_t k = 0;
+            for (uint32_t position = 0; ok && position < b->size(); position++) {
+                ValueDict *row = b->project(position);
+                if (SelectOperator::matches(*row, f.alternatives))
+                    ok = k < selection.size() && selection[k++] == position;
+                delete row;
+            }
+            ok = ok && k == selection.size();
+        }
+        ok = ok && compiled_count == interpreted_count;
+        if (!ok) {
+            std::cout << std::endl << "compiled filter " << f.name << " failed" << std::endl;
+            break;
+        }
+        std::cout << (&f == &filters[0] ? " " : "; ") << f.name << " " << (middle - start) / n << " vs "
+                  << (end - middle) / n;
+    }
+    std::cout << std::endl;
+
+    // projections, of some columns and of all of them
+    ColumnNames some;
+    some.push_back("c");
+    some.push_back("a");
+    CompiledProjection projection(column_names, column_attributes, some);
+    CompiledProjection everything(column_names, column_attributes, ColumnNames());
+    for (size_t i = 0; ok && i < batches.size(); i++) {
+        Selection all(batches[i]->size());
+        for (uint32_t position = 0; position < all.size(); position++)
+            all[position] = position;
+        ValueDicts rows, whole;
+        projection.project(*batches[i], all, 1, all.size(), rows);
+        everything.project(*batches[i], all, 0, all.size(), whole);
+        for (uint32_t position = 0; position < all.size(); position++) {
+            ValueDict *expected = batches[i]->project(position);
+            ok = ok && *whole[position] == *expected;
+            delete expected;
+            if (position > 0) {
+                expected = batches[i]->project(position, &some);
+                ok = ok && *rows[position - 1] == *expected;
+                delete expected;
+            }
+        }
+        for (auto row: rows)
+            delete row;
+        for (auto row: whole)
+            delete row;
+    }
+    if (!ok)
+        std::cout << "compiled projection failed" << std::endl;
+
+    // a scan with predicates filters with them too
+    ValueDict where;
+    where["b"] = Value(true);
+    TableScanOperator scan(table, &where, filters[1].alternatives[0].predicates);
+    size_t count = 0;
+    scan.open();
+    for (ValueDicts *rows = scan.next(); rows != nullptr; rows = scan.next()) {
+        for (auto row: *rows)
+            ok = ok && SelectOperator::matches(*row, filters[1].alternatives[0].predicates) && row->at("b").n == 1;
+        count += rows->size();
+        EvalOperator::free_batch(rows);
+    }
+    scan.close();
+    Handles *handles = table.select(&where);
+    size_t expected = 0;
+    ValueDicts *rows = table.project(handles);
+    for (auto row: *rows)
+        expected += SelectOperator::matches(*row, filters[1].alternatives[0].predicates);
+    EvalOperator::free_batch(rows);
+    delete handles;
+    ok = ok && count == expected && count > 0;
+    if (!ok)
+        std::cout << "table scan with predicates failed" << std::endl;
+
+    try {
+        CompiledFilter bad(column_names, column_attributes, &filters[0].alternatives[0].where,
+                           Predicates(1, Predicate("z", Predicate::LT, Value(1))));
+        ok = false;
+        std::cout << "compiled filter took an unknown column" << std::endl;
+    } catch (DbRelationError &e) {
+    }
+
+    for (auto b: batches)
+        delete b;
+    table.drop();
+    return ok;
+}
@@ -0,0 +1,80 @@
+/**
+ * WHERE clauses and projections compiled once, when an operator opens, into code for the column types of a table,
+ * so that filtering and projecting a ColumnBatch looks up no column names and switches on no data types per row.
+ * ColumnTerm
+ * CompiledFilter
+ * CompiledProjection
+ */
+#pragma once
+
+#include <vector>
+#include "ColumnBatch.h"
+
+
+// One comparison of a column with a constant, specialized for the column's data type and the comparison (see
+// CompiledExpression.cpp). It is called once per batch and loops over the rows itself.
+class ColumnTerm {
+public:
+    explicit ColumnTerm(uint column) : column(column) {}
+    virtual ~ColumnTerm() {}
+
+    // keep just the n positions of selection that pass (written back over it); returns how many there are
+    virtual uint32_t refine(const ColumnBatch &batch, uint32_t *selection, uint32_t n) const = 0;
+    // the same for every position below n, written to out
+    virtual uint32_t select(const ColumnBatch &batch, uint32_t n, uint32_t *out) const;
+
+protected:
+    uint column;
+
+private:
+    ColumnTerm(const ColumnTerm &other);
+    ColumnTerm &operator=(const ColumnTerm &other);
+};
+
+
+// An equality conjunction and predicates (or any of several such alternatives) over a table's columns, as
+// ColumnTerms. Thread safe once made: workers can share one.
+class CompiledFilter {
+public:
+    CompiledFilter(const ColumnNames &column_names, const ColumnAttributes &column_attributes,
+                   const ValueDict *where, const Predicates &predicates=Predicates());
+    CompiledFilter(const ColumnNames &column_names, const ColumnAttributes &column_attributes,
+                   const Conditions &any_of);
+    virtual ~CompiledFilter();
+
+    // positions of the rows that pass, ascending
+    void select(const ColumnBatch &batch, Selection &selection) const;
+
+protected:
+    typedef std::vector<ColumnTerm*> Conjunction;
+    std::vector<Conjunction> alternatives;  // a row passes if it passes every term of any one of them
+
+    void compile(const ColumnNames &column_names, const ColumnAttributes &column_attributes,
+                 const ValueDict *where, const Predicates &predicates);
+    static uint32_t select(const Conjunction &terms, const ColumnBatch &batch, uint32_t n, uint32_t *out);
+
+private:
+    CompiledFilter(const CompiledFilter &other);
+    CompiledFilter &operator=(const CompiledFilter &other);
+};
+
+
+// Some of a table's columns (or all of them), built into rows a column at a time.
+class CompiledProjection {
+public:
+    // projection empty for every column
+    CompiledProjection(const ColumnNames &column_names, const ColumnAttributes &column_attributes,
+                       const ColumnNames &projection);
+    virtual ~CompiledProjection() {}
+
+    // append a row to rows for each of the positions selection[begin] up to selection[end]
+    void project(const ColumnBatch &batch, const Selection &selection, size_t begin, size_t end,
+                 ValueDicts &rows) const;
+
+protected:
+    ColumnNames names;
+    std::vector<uint> columns;
+    std::vector<ColumnAttribute::DataType> data_types;
+};
+
+bool test_compiled_expressions();
@@ -0,0 +1,647 @@
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <iostream>
+#include "EvalOperator.h"
+#include "EvalPlan.h"
+#include "heap_storage.h"
+#include "btree.h"
+
+
+const size_t EvalOperator::BATCH_SIZE;
+
+void EvalOperator::free_batch(ValueDicts *batch) {
+    for (auto row: *batch)
+        delete row;
+    delete batch;
+}
+
+// the map itself, then a tree node per column with its name and text
+size_t EvalOperator::row_bytes(const ValueDict &row) {
+    size_t bytes = sizeof(ValueDict);
+    for (auto const &column: row)
+        bytes += 64 + column.first.size() + column.second.s.size();
+    return bytes;
+}
+
+HeapTable *EvalOperator::temp_table(const std::string &purpose, const ValueDict &row) {
+    static std::atomic<uint> serial(0);
+    ColumnNames column_names;
+    ColumnAttributes column_attributes;
+    for (auto const &column: row) {
+        column_names.push_back(column.first);
+        column_attributes.push_back(ColumnAttribute(column.second.data_type));
+    }
+    HeapTable *table = new HeapTable("_" + purpose + "_" + std::to_string(serial++), column_names, column_attributes);
+    table->create();
+    return table;
+}
+
+
+TableScanOperator::TableScanOperator(DbRelation &table, const ValueDict *where, const Predicates &predicates)
+        : table(table), where(nullptr), predicates(predicates), batch_size(BATCH_SIZE), block_id(0), pending(nullptr),
+          position(0), columns(nullptr), selection(), filter(nullptr), projection(nullptr) {
+    if (where != nullptr)
+        this->where = new ValueDict(*where);
+}
+
+TableScanOperator::~TableScanOperator() {
+    delete this->where;
+    close();
+}
+
+void TableScanOperator::open() {
+    close();
+    this->table.open();
+    this->block_id = 0;
+    this->position = 0;
+    if (this->table.decodes_blocks()) {
+        const ColumnNames &column_names = this->table.get_column_names();
+        const ColumnAttributes &column_attributes = this->table.get_column_attributes();
+        this->filter = new CompiledFilter(column_names, column_attributes, this->where, this->predicates);
+        this->projection = new CompiledProjection(column_names, column_attributes, ColumnNames());
+        this->columns = new ColumnBatch(column_names, column_attributes);
+    }
+}
+
+ValueDicts *TableScanOperator::next() {
+    return this->columns != nullptr ? next_by_column() : next_by_handle();
+}
+
+ValueDicts *TableScanOperator::next_by_handle() {
+    Handles batch;
+    while (batch.size() < this->batch_size) {
+        if (this->pending == nullptr || this->position >= this->pending->size()) {
+            delete this->pending;
+            this->position = 0;
+            this->pending = this->table.select_block(this->block_id, this->where);
+            if (this->pending == nullptr)
+                break;
+            continue;
+        }
+        batch.push_back((*this->pending)[this->position++]);
+    }
+    if (batch.empty())
+        return nullptr;
+    ValueDicts *rows = this->table.project(&batch);
+    if (!this->predicates.empty()) {
+        ValueDicts *matching = new ValueDicts();
+        WorkCounters::allocated();
+        for (auto row: *rows) {
+            if (SelectOperator::matches(*row, this->predicates))
+                matching->push_back(row);
+            else
+                delete row;
+        }
+        delete rows;
+        rows = matching;
+    }
+    return rows;
+}
+
+// Rows come straight out of the decoded columns, so each record is read just once.
+ValueDicts *TableScanOperator::next_by_column() {
+    ValueDicts *batch = new ValueDicts();
+    WorkCounters::allocated();
+    while (batch->size() < this->batch_size) {
+        if (this->position >= this->selection.size()) {
+            this->position = 0;
+            this->selection.clear();
+            if (!this->table.decode_block(this->block_id, *this->columns))
+                break;
+            this->filter->select(*this->columns, this->selection);
+            continue;
+        }
+        size_t end = std::min(this->selection.size(), this->position + this->batch_size - batch->size());
+        this->projection->project(*this->columns, this->selection, this->position, end, *batch);
+        this->position = end;
+    }
+    if (batch->empty()) {
+        delete batch;
+        return nullptr;
+    }
+    return batch;
+}
+
+void TableScanOperator::close() {
+    delete this->pending;
+    this->pending = nullptr;
+    delete this->columns;
+    this->columns = nullptr;
+    delete this->filter;
+    this->filter = nullptr;
+    delete this->projection;
+    this->projection = nullptr;
+    this->selection.clear();
+}
+
+
+IndexLookupOperator::IndexLookupOperator(DbIndex &index, const ValueDict *key)
+        : index(index), key(new ValueDict(*key)), handles(nullptr), position(0), batch_size(BATCH_SIZE) {
+}
+
+IndexLookupOperator::~IndexLookupOperator() {
+    delete this->key;
+    delete this->handles;
+}
+
+void IndexLookupOperator::open() {
+    delete this->handles;
+    this->handles = this->index.lookup(this->key);
+    this->position = 0;
+}
+
+ValueDicts *IndexLookupOperator::next() {
+    if (this->handles == nullptr || this->position >= this->handles->size())
+        return nullptr;
+    size_t end = std::min(this->position + this->batch_size, this->handles->size());
+    Handles batch(this->handles->begin() + this->position, this->handles->begin() + end);
+    this->position = end;
+    return this->index.get_relation().project(&batch);
+}
+
+void IndexLookupOperator::close() {
+    delete this->handles;
+    this->handles = nullptr;
+}
+
+
+IndexRangeOperator::IndexRangeOperator(DbIndex &index, const ValueDict *min_key, const ValueDict *max_key,
+                                       u_long limit)
+        : IndexLookupOperator(index, min_key), max_key(new ValueDict(*max_key)), limit(limit) {
+}
+
+IndexRangeOperator::~IndexRangeOperator() {
+    delete this->max_key;
+}
+
+void IndexRangeOperator::open() {
+    delete this->handles;
+    this->handles = this->index.range(this->key, this->max_key, this->limit);
+    this->position = 0;
+}
+
+
+Handles *IndexProbe::handles() const {
+    ValueDict key(this->min_key), max_key(this->max_key);
+    if (this->lookup)
+        return this->index->lookup(&key);
+    return this->index->range(&key, &max_key);
+}
+
+
+IndexSetOperator::IndexSetOperator(DbRelation &table, const IndexProbes &probes, bool intersect)
+        : table(table), probes(probes), intersect(intersect), rows(nullptr), position(0), batch_size(BATCH_SIZE) {
+}
+
+IndexSetOperator::~IndexSetOperator() {
+    delete this->rows;
+}
+
+// Handles sort into physical order as they are (see Handle::operator<).
+Handles *IndexSetOperator::handles(const IndexProbes &probes, bool intersect) {
+    Handles *ret = nullptr;
+    for (auto const &probe: probes) {
+        Handles *found = probe.handles();
+        std::sort(found->begin(), found->end());
+        found->erase(std::unique(found->begin(), found->end()), found->end());
+        if (ret == nullptr) {
+            ret = found;
+            continue;
+        }
+        Handles *combined = new Handles();
+        if (intersect)
+            std::set_intersection(ret->begin(), ret->end(), found->begin(), found->end(),
+                                  std::back_inserter(*combined));
+        else
+            std::set_union(ret->begin(), ret->end(), found->begin(), found->end(), std::back_inserter(*combined));
+        delete ret;
+        delete found;
+        ret = combined;
+        if (intersect && ret->empty())
+            break;
+    }
+    return ret != nullptr ? ret : new Handles();
+}
+
+void IndexSetOperator::open() {
+    delete this->rows;
+    this->rows = handles(this->probes, this->intersect);
+    this->position = 0;
+}
+
+ValueDicts *IndexSetOperator::next() {
+    if (this->rows == nullptr || this->position >= this->rows->size())
+        return nullptr;
+    size_t end = std::min(this->position + this->batch_size, this->rows->size());
+    Handles batch(this->rows->begin() + this->position, this->rows->begin() + end);
+    this->position = end;
+    return this->table.project(&batch);
+}
+
+void IndexSetOperator::close() {
+    delete this->rows;
+    this->rows = nullptr;
+}
+
+
+IndexOnlyLookupOperator::IndexOnlyLookupOperator(DbIndex &index, const ValueDict *key, const ColumnNames &projection)
+        : index(index), key(new ValueDict(*key)), projection(projection), rows(nullptr), position(0) {
+}
+
+IndexOnlyLookupOperator::~IndexOnlyLookupOperator() {
+    delete this->key;
+    close();
+}
+
+void IndexOnlyLookupOperator::open() {
+    close();
+    this->rows = this->index.lookup_values(this->key, &this->projection);
+    this->position = 0;
+}
+
+ValueDicts *IndexOnlyLookupOperator::next() {
+    if (this->rows == nullptr || this->position >= this->rows->size())
+        return nullptr;
+    size_t end = std::min(this->position + BATCH_SIZE, this->rows->size());
+    ValueDicts *batch = new ValueDicts(this->rows->begin() + this->position, this->rows->begin() + end);
+    WorkCounters::allocated();
+    this->position = end;
+    return batch;
+}
+
+void IndexOnlyLookupOperator::close() {
+    if (this->rows != nullptr) {
+        // rows before position have been handed back and belong to the caller now
+        for (size_t i = this->position; i < this->rows->size(); i++)
+            delete (*this->rows)[i];
+        delete this->rows;
+        this->rows = nullptr;
+    }
+}
+
+
+SelectOperator::SelectOperator(EvalOperator *input, const ValueDict &where, const Predicates &predicates)
+        : input(input), where(where), predicates(predicates), any_of() {
+}
+
+SelectOperator::SelectOperator(EvalOperator *input, const Conditions &any_of)
+        : input(input), where(), predicates(), any_of(any_of) {
+}
+
+SelectOperator::~SelectOperator() {
+    delete this->input;
+}
+
+void SelectOperator::open() {
+    this->input->open();
+}
+
+// Keep pulling until some input rows survive, so an empty batch never looks like the end.
+ValueDicts *SelectOperator::next() {
+    ValueDicts *batch;
+    while ((batch = this->input->next()) != nullptr) {
+        ValueDicts *ret = new ValueDicts();
+        WorkCounters::allocated();
+        for (auto row: *batch) {
+            if (matches(*row, this->where) && matches(*row, this->predicates)
+                && (this->any_of.empty() || matches(*row, this->any_of)))
+                ret->push_back(row);
+            else
+                delete row;
+        }
+        delete batch;
+        if (!ret->empty())
+            return ret;
+        delete ret;
+    }
+    return nullptr;
+}
+
+void SelectOperator::close() {
+    this->input->close();
+}
+
+bool SelectOperator::matches(const ValueDict &row, const ValueDict &where) {
+    for (auto const &column: where) {
+        auto found = row.find(column.first);
+        if (found == row.end())
+            throw DbRelationError("unknown column '" + column.first + "'");
+        if (found->second != column.second)
+            return false;
+    }
+    return true;
+}
+
+bool SelectOperator::matches(const ValueDict &row, const Predicates &predicates) {
+    for (auto const &predicate: predicates)
+        if (!predicate.matches(row))
+            return false;
+    return true;
+}
+
+bool SelectOperator::matches(const ValueDict &row, const Conditions &any_of) {
+    for (auto const &condition: any_of)
+        if (matches(row, condition.where) && matches(row, condition.predicates))
+            return true;
+    return false;
+}
+
+
+ProjectOperator::ProjectOperator(EvalOperator *input, const ColumnNames &projection)
+        : input(input), projection(projection) {
+}
+
+ProjectOperator::~ProjectOperator() {
+    delete this->input;
+}
+
+void ProjectOperator::open() {
+    this->input->open();
+}
+
+ValueDicts *ProjectOperator::next() {
+    ValueDicts *batch = this->input->next();
+    if (batch == nullptr)
+        return nullptr;
+    for (auto &row: *batch) {
+        ValueDict *narrowed = new ValueDict();
+        WorkCounters::allocated();
+        for (auto const &column_name: this->projection) {
+            auto found = row->find(column_name);
+            if (found == row->end())
+                throw DbRelationError("unknown column '" + column_name + "'");
+            (*narrowed)[column_name] = found->second;
+        }
+        delete row;
+        row = narrowed;
+    }
+    return batch;
+}
+
+void ProjectOperator::close() {
+    this->input->close();
+}
+
+
+const u_long LimitOperator::ALL;
+
+LimitOperator::LimitOperator(EvalOperator *input, u_long limit, u_long offset)
+        : input(input), limit(limit), offset(offset), skipped(0), returned(0) {
+}
+
+LimitOperator::~LimitOperator() {
+    delete this->input;
+}
+
+void LimitOperator::open() {
+    if (this->limit != ALL && this->offset < ALL - this->limit)
+        this->input->limit_batch_size(this->limit + this->offset);
+    this->input->open();
+    this->skipped = 0;
+    this->returned = 0;
+}
+
+ValueDicts *LimitOperator::next() {
+    ValueDicts *batch;
+    while (this->returned < this->limit && (batch = this->input->next()) != nullptr) {
+        ValueDicts *ret = new ValueDicts();
+        WorkCounters::allocated();
+        for (auto row: *batch) {
+            if (this->skipped < this->offset) {
+                this->skipped++;
+                delete row;
+            } else if (this->returned < this->limit) {
+                ret->push_back(row);
+                this->returned++;
+            } else {
+                delete row;
+            }
+        }
+        delete batch;
+        if (!ret->empty())
+            return ret;
+        delete ret;
+    }
+    return nullptr;
+}
+
+void LimitOperator::close() {
+    this->input->close();
+}
+
+
+ProfileOperator::ProfileOperator(EvalOperator *input, OperatorProfile &profile)
+        : input(input), profile(profile), blocks_read(0), blocks_written(0), allocations(0) {
+}
+
+ProfileOperator::~ProfileOperator() {
+    delete this->input;
+}
+
+void ProfileOperator::start() {
+    this->blocks_read = WorkCounters::blocks_read.load(std::memory_order_relaxed);
+    this->blocks_written = WorkCounters::blocks_written.load(std::memory_order_relaxed);
+    this->allocations = WorkCounters::allocations.load(std::memory_order_relaxed);
+    this->started = std::chrono::steady_clock::now();
+}
+
+void ProfileOperator::stop() {
+    auto stopped = std::chrono::steady_clock::now();
+    this->profile.ms += std::chrono::duration<double, std::milli>(stopped - this->started).count();
+    this->profile.blocks_read += WorkCounters::blocks_read.load(std::memory_order_relaxed) - this->blocks_read;
+    this->profile.blocks_written += WorkCounters::blocks_written.load(std::memory_order_relaxed)
+                                    - this->blocks_written;
+    this->profile.allocations += WorkCounters::allocations.load(std::memory_order_relaxed) - this->allocations;
+}
+
+void ProfileOperator::open() {
+    this->profile.opens++;
+    start();
+    this->input->open();
+    stop();
+}
+
+ValueDicts *ProfileOperator::next() {
+    start();
+    ValueDicts *batch = this->input->next();
+    stop();
+    if (batch != nullptr) {
+        this->profile.batches++;
+        this->profile.rows += batch->size();
+    }
+    return batch;
+}
+
+void ProfileOperator::close() {
+    start();
+    this->input->close();
+    stop();
+}
+
+
+// Drain an operator, checking that no batch is empty or too big.
+static ValueDicts *test_drain(EvalOperator &op, size_t &batches, bool &ok) {
+    ValueDicts *rows = new ValueDicts();
+    batches = 0;
+    op.open();
+    for (ValueDicts *batch = op.next(); batch != nullptr; batch = op.next()) {
+        batches++;
+        if (batch->empty() || batch->size() > EvalOperator::BATCH_SIZE)
+            ok = false;
+        rows->insert(rows->end(), batch->begin(), batch->end());
+        delete batch;
+    }
+    op.close();
+    return rows;
+}
+
+bool test_eval_operators() {
+    ColumnNames column_names;
+    column_names.push_back("a");
+    column_names.push_back("b");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    HeapTable table("__test_eval_operators", column_names, column_attributes);
+    table.create();
+    const int n = 3000;
+    for (int i = 0; i < n; i++) {
+        ValueDict row;
+        row["a"] = Value(i);
+        row["b"] = Value(i % 3 == 0 ? "fizz" : "buzz");
+        table.insert(&row);
+    }
+    bool ok = true;
+    size_t batches;
+
+    // full scan comes back in order, a bounded batch at a time
+    TableScanOperator scan(table);
+    ValueDicts *rows = test_drain(scan, batches, ok);
+    ok = ok && rows->size() == (size_t) n && batches == (n + EvalOperator::BATCH_SIZE - 1) / EvalOperator::BATCH_SIZE;
+    for (size_t i = 0; ok && i < rows->size(); i++)
+        ok = (*rows)[i]->at("a").n == (int) i;
+    EvalOperator::free_batch(rows);
+    if (!ok)
+        std::cout << "table scan failed" << std::endl;
+
+    // filter pushed into the scan, or applied afterwards, then projected
+    ValueDict where;
+    where["b"] = Value("fizz");
+    ColumnNames a_only;
+    a_only.push_back("a");
+    EvalOperator *pushed = new ProjectOperator(new TableScanOperator(table, &where), a_only);
+    EvalOperator *after = new ProjectOperator(new SelectOperator(new TableScanOperator(table), where), a_only);
+    ValueDicts *pushed_rows = test_drain(*pushed, batches, ok);
+    ValueDicts *after_rows = test_drain(*after, batches, ok);
+    ok = ok && pushed_rows->size() == (size_t) n / 3 && after_rows->size() == pushed_rows->size();
+    for (size_t i = 0; ok && i < pushed_rows->size(); i++)
+        ok = (*pushed_rows)[i]->size() == 1 && *(*pushed_rows)[i] == *(*after_rows)[i]
+             && (*pushed_rows)[i]->at("a").n % 3 == 0;
+    EvalOperator::free_batch(pushed_rows);
+    EvalOperator::free_batch(after_rows);
+    delete pushed;
+    delete after;
+    if (!ok)
+        std::cout << "select/project failed" << std::endl;
+
+    // index lookups, through the table or index-only
+    BTreeIndex index(table, "fooindex", a_only, true);
+    index.create();
+    ValueDict key;
+    key["a"] = Value(42);
+    IndexLookupOperator lookup(index, &key);
+    rows = test_drain(lookup, batches, ok);
+    ok = ok && rows->size() == 1 && rows->at(0)->at("b").s == "fizz";
+    EvalOperator::free_batch(rows);
+    IndexOnlyLookupOperator index_only(index, &key, a_only);
+    rows = test_drain(index_only, batches, ok);
+    ok = ok && rows->size() == 1 && rows->at(0)->size() == 1 && rows->at(0)->at("a").n == 42;
+    EvalOperator::free_batch(rows);
+    if (!ok)
+        std::cout << "index lookup failed" << std::endl;
+
+    // range predicates, by filtering a scan and by a range scan on the index (rechecking the strict bound)
+    Predicates predicates;
+    predicates.push_back(Predicate("a", Predicate::GT, Value(100)));
+    predicates.push_back(Predicate("a", Predicate::LE, Value(200)));
+    predicates.push_back(Predicate("b", Predicate::NE, Value("fizz")));
+    ValueDict no_equalities, low, high;
+    low["a"] = Value(100);
+    high["a"] = Value(200);
+    EvalOperator *filtered = new SelectOperator(new TableScanOperator(table), no_equalities, predicates);
+    EvalOperator *ranged = new SelectOperator(new IndexRangeOperator(index, &low, &high), no_equalities, predicates);
+    ValueDicts *filtered_rows = test_drain(*filtered, batches, ok);
+    ValueDicts *ranged_rows = test_drain(*ranged, batches, ok);
+    ok = ok && filtered_rows->size() == 67 && ranged_rows->size() == filtered_rows->size();
+    for (size_t i = 0; ok && i < ranged_rows->size(); i++)
+        ok = *(*filtered_rows)[i] == *(*ranged_rows)[i];
+    EvalOperator::free_batch(filtered_rows);
+    EvalOperator::free_batch(ranged_rows);
+    delete filtered;
+    delete ranged;
+    if (!ok)
+        std::cout << "range predicates failed" << std::endl;
+
+    // a range on just the leading column of a composite index
+    ColumnNames b_then_a;
+    b_then_a.push_back("b");
+    b_then_a.push_back("a");
+    BTreeIndex composite(table, "barindex", b_then_a, true);
+    composite.create();
+    ValueDict fizz;
+    fizz["b"] = Value("fizz");
+    Handles *handles = composite.range(&fizz, &fizz);
+    ok = ok && handles->size() == (size_t) n / 3;
+    delete handles;
+    handles = composite.range(nullptr, &fizz);
+    ok = ok && handles->size() == (size_t) n;  // "buzz" < "fizz"
+    delete handles;
+    if (!ok)
+        std::cout << "composite index range failed" << std::endl;
+
+    // a between 100 and 200 AND b = 'fizz', and OR, from the two indices' handles, fetched in physical order
+    IndexProbes probes;
+    probes.push_back(IndexProbe(&index, low, high));
+    probes.push_back(IndexProbe(&composite, fizz, fizz));
+    for (int intersect = 1; intersect >= 0; intersect--) {
+        IndexSetOperator combined(table, probes, intersect);
+        rows = test_drain(combined, batches, ok);
+        size_t expected = 0;
+        for (int i = 0; i < n; i++)
+            if (intersect ? i >= 100 && i <= 200 && i % 3 == 0 : (i >= 100 && i <= 200) || i % 3 == 0)
+                ok = ok && expected < rows->size() && rows->at(expected++)->at("a").n == i;
+        ok = ok && expected == rows->size();
+        EvalOperator::free_batch(rows);
+    }
+    composite.drop();
+    if (!ok)
+        std::cout << "index intersection and union failed" << std::endl;
+
+    // LIMIT and OFFSET, stopping early, and a range scan that reads just its first few entries
+    LimitOperator limited(new SelectOperator(new TableScanOperator(table), where), 5, 10);
+    rows = test_drain(limited, batches, ok);
+    ok = ok && rows->size() == 5 && batches == 1;
+    for (size_t i = 0; ok && i < rows->size(); i++)
+        ok = (*rows)[i]->at("a").n == (int) (30 + 3 * i);
+    EvalOperator::free_batch(rows);
+    IndexRangeOperator first(index, &low, &high, 5);
+    rows = test_drain(first, batches, ok);
+    ok = ok && rows->size() == 5 && rows->at(0)->at("a").n == 100 && rows->at(4)->at("a").n == 104;
+    EvalOperator::free_batch(rows);
+    if (!ok)
+        std::cout << "limit failed" << std::endl;
+
+    // a plan evaluates through its operators
+    EvalPlan *plan = new EvalPlan(new ColumnNames(a_only), new EvalPlan(new ValueDict(where), new EvalPlan(table)));
+    rows = plan->evaluate();
+    ok = ok && rows->size() == (size_t) n / 3;
+    EvalOperator::free_batch(rows);
+    delete plan;
+    if (!ok)
+        std::cout << "plan evaluation failed" << std::endl;
+
+    index.drop();
+    table.drop();
+    return ok;
+}
@@ -0,0 +1,287 @@
+/**
+ * Batch-at-a-time (Volcano-style) operators that carry out an evaluation plan.
+ * EvalOperator
+ * TableScanOperator
+ * IndexLookupOperator
+ * IndexOnlyLookupOperator
+ * IndexRangeOperator
+ * IndexProbe
+ * IndexSetOperator
+ * SelectOperator
+ * ProjectOperator
+ * LimitOperator
+ * OperatorProfile
+ * ProfileOperator
+ */
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include "storage_engine.h"
+#include "ColumnBatch.h"
+#include "CompiledExpression.h"
+
+class HeapTable;
+
+
+// An operator pulls batches of rows from its input(s) and hands back batches of its own: open() it, call next()
+// until it returns nullptr, then close() it. Only about a batch of rows is ever in memory per operator.
+class EvalOperator {
+public:
+    static const size_t BATCH_SIZE = 1024;
+
+    EvalOperator() {}
+    virtual ~EvalOperator() {}
+
+    virtual void open() = 0;
+    virtual ValueDicts *next() = 0;  // up to BATCH_SIZE rows, owned by the caller; nullptr once exhausted
+    virtual void close() = 0;
+
+    // A hint, before open(), that no more than rows rows will be wanted, so batches needn't be any bigger than that.
+    virtual void limit_batch_size(size_t rows) {}
+
+    static void free_batch(ValueDicts *batch);
+    static size_t row_bytes(const ValueDict &row);  // a guess at the heap a row takes up, for memory budgets
+
+    // a new (created) heap table with a unique name starting with purpose, with row's columns, for spilling rows
+    // that don't fit in memory; the caller drops and deletes it
+    static HeapTable *temp_table(const std::string &purpose, const ValueDict &row);
+
+private:
+    EvalOperator(const EvalOperator &other);
+    EvalOperator &operator=(const EvalOperator &other);
+};
+
+
+// Every row of a table (matching where, if given), a block at a time. Tables that can decode their blocks into
+// columns are filtered a column at a time (see ColumnBatch::select); the rest a handle at a time.
+class TableScanOperator : public EvalOperator {
+public:
+    TableScanOperator(DbRelation &table, const ValueDict *where=nullptr, const Predicates &predicates=Predicates());
+    virtual ~TableScanOperator();
+
+    virtual void open();
+    virtual ValueDicts *next();
+    virtual void close();
+    virtual void limit_batch_size(size_t rows) { batch_size = std::min(rows, BATCH_SIZE); }
+
+protected:
+    DbRelation &table;
+    ValueDict *where;
+    Predicates predicates;
+    size_t batch_size;
+    BlockID block_id;  // scan position, for DbRelation::select_block
+    Handles *pending;  // handles from the last block read that haven't been handed back yet
+    size_t position;   // next one of pending (or of selection) to hand back
+    ColumnBatch *columns;  // the last block decoded, for a table that decodes_blocks()
+    Selection selection;   // positions within columns that match where and predicates
+    CompiledFilter *filter;  // where and predicates, for columns
+    CompiledProjection *projection;
+
+    ValueDicts *next_by_handle();
+    ValueDicts *next_by_column();
+};
+
+
+// The table rows for a key's index entries.
+class IndexLookupOperator : public EvalOperator {
+public:
+    IndexLookupOperator(DbIndex &index, const ValueDict *key);
+    virtual ~IndexLookupOperator();
+
+    virtual void open();
+    virtual ValueDicts *next();
+    virtual void close();
+    virtual void limit_batch_size(size_t rows) { batch_size = std::min(rows, BATCH_SIZE); }
+
+protected:
+    DbIndex &index;
+    ValueDict *key;
+    Handles *handles;
+    size_t position;
+    size_t batch_size;  // rows to project at a time
+};
+
+
+// The table rows for the index entries with keys from min_key to max_key, inclusive (see DbIndex::range), or just
+// the first limit of them if limit isn't 0.
+class IndexRangeOperator : public IndexLookupOperator {
+public:
+    IndexRangeOperator(DbIndex &index, const ValueDict *min_key, const ValueDict *max_key, u_long limit=0);
+    virtual ~IndexRangeOperator();
+
+    virtual void open();
+
+protected:
+    ValueDict *max_key;  // key is the minimum
+    u_long limit;
+};
+
+
+// What IndexSetOperator gets from one index: the entries for a key (a lookup), or for keys from min_key to max_key.
+class IndexProbe {
+public:
+    DbIndex *index;
+    ValueDict min_key;
+    ValueDict max_key;
+    bool lookup;
+
+    IndexProbe(DbIndex *index, const ValueDict &key) : index(index), min_key(key), max_key(), lookup(true) {}
+    IndexProbe(DbIndex *index, const ValueDict &min_key, const ValueDict &max_key)
+            : index(index), min_key(min_key), max_key(max_key), lookup(false) {}
+
+    Handles *handles() const;  // caller deletes
+};
+typedef std::vector<IndexProbe> IndexProbes;
+
+
+// The table rows whose handles every one of the probes finds (intersect), or any of them finds (otherwise). Only
+// handles are combined, so no row is read until it is known to qualify; the survivors are then fetched in physical
+// order, (block, record), so a block's rows come together.
+class IndexSetOperator : public EvalOperator {
+public:
+    IndexSetOperator(DbRelation &table, const IndexProbes &probes, bool intersect);
+    virtual ~IndexSetOperator();
+
+    virtual void open();
+    virtual ValueDicts *next();
+    virtual void close();
+    virtual void limit_batch_size(size_t rows) { batch_size = std::max(rows, (size_t)1); }
+
+    // the combined handles in physical order, without duplicates (caller deletes)
+    static Handles *handles(const IndexProbes &probes, bool intersect);
+
+protected:
+    DbRelation &table;
+    IndexProbes probes;
+    bool intersect;
+    Handles *rows;
+    size_t position;
+    size_t batch_size;
+};
+
+
+// Rows made entirely from a key's index entries, without visiting the table (see DbIndex::covers).
+class IndexOnlyLookupOperator : public EvalOperator {
+public:
+    IndexOnlyLookupOperator(DbIndex &index, const ValueDict *key, const ColumnNames &projection);
+    virtual ~IndexOnlyLookupOperator();
+
+    virtual void open();
+    virtual ValueDicts *next();
+    virtual void close();
+
+protected:
+    DbIndex &index;
+    ValueDict *key;
+    ColumnNames projection;
+    ValueDicts *rows;
+    size_t position;
+};
+
+
+// The input rows that match an equality conjunction and any other predicates, or any one of several such conditions.
+class SelectOperator : public EvalOperator {
+public:
+    // takes ownership of input
+    SelectOperator(EvalOperator *input, const ValueDict &where, const Predicates &predicates=Predicates());
+    SelectOperator(EvalOperator *input, const Conditions &any_of);
+    virtual ~SelectOperator();
+
+    virtual void open();
+    virtual ValueDicts *next();
+    virtual void close();
+    virtual void limit_batch_size(size_t rows) { input->limit_batch_size(rows); }
+
+    static bool matches(const ValueDict &row, const ValueDict &where);
+    static bool matches(const ValueDict &row, const Predicates &predicates);
+    static bool matches(const ValueDict &row, const Conditions &any_of);
+
+protected:
+    EvalOperator *input;
+    ValueDict where;
+    Predicates predicates;
+    Conditions any_of;  // if not empty, a row must also match one of these
+};
+
+
+// The input rows cut down to the given columns.
+class ProjectOperator : public EvalOperator {
+public:
+    ProjectOperator(EvalOperator *input, const ColumnNames &projection);  // takes ownership of input
+    virtual ~ProjectOperator();
+
+    virtual void open();
+    virtual ValueDicts *next();
+    virtual void close();
+    virtual void limit_batch_size(size_t rows) { input->limit_batch_size(rows); }
+
+protected:
+    EvalOperator *input;
+    ColumnNames projection;
+};
+
+
+// At most limit of the input rows, after skipping offset of them (LIMIT ... OFFSET). Once it has handed back limit
+// rows it stops pulling from its input, and it asks the input for batches no bigger than it needs.
+class LimitOperator : public EvalOperator {
+public:
+    static const u_long ALL = ULONG_MAX;  // no limit, just an offset
+
+    LimitOperator(EvalOperator *input, u_long limit, u_long offset=0);  // takes ownership of input
+    virtual ~LimitOperator();
+
+    virtual void open();
+    virtual ValueDicts *next();
+    virtual void close();
+
+protected:
+    EvalOperator *input;
+    u_long limit;
+    u_long offset;
+    u_long skipped;   // of the offset, so far
+    u_long returned;  // rows handed back so far
+};
+
+// What an operator did while EXPLAIN ANALYZE ran it, counting what its inputs did for it.
+class OperatorProfile {
+public:
+    u_long opens;
+    u_long batches;
+    u_long rows;
+    double ms;  // wall time in open(), next() and close()
+    u_long blocks_read;
+    u_long blocks_written;
+    u_long allocations;
+
+    OperatorProfile() : opens(0), batches(0), rows(0), ms(0.0), blocks_read(0), blocks_written(0), allocations(0) {}
+};
+
+
+// Another operator, timed and counted into a profile. The plan only puts these in for EXPLAIN ANALYZE (see
+// EvalPlan::operators), so other queries don't pay for them. Work that parallel workers do while it waits for its
+// input is counted too.
+class ProfileOperator : public EvalOperator {
+public:
+    ProfileOperator(EvalOperator *input, OperatorProfile &profile);  // takes ownership of input
+    virtual ~ProfileOperator();
+
+    virtual void open();
+    virtual ValueDicts *next();
+    virtual void close();
+    virtual void limit_batch_size(size_t rows) { input->limit_batch_size(rows); }
+
+protected:
+    EvalOperator *input;
+    OperatorProfile &profile;
+    std::chrono::steady_clock::time_point started;
+    u_long blocks_read;
+    u_long blocks_written;
+    u_long allocations;
+
+    void start();
+    void stop();
+};
+
+bool test_eval_operators();
@@ -2,7 +2,12 @@
 // Created by Kevin Lundeen on 4/24/17.
 //
 
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
 #include "EvalPlan.h"
+#include "JoinOperator.h"
 #include "SQLExec.h" // for SQLExec::indices
 
 
@@ -28,60 +33,394 @@ public:
 EvalPlan::EvalPlan(PlanType type, EvalPlan *relation)
         : type(type),
           relation(relation),
+          right(nullptr),
+          left_columns(nullptr),
+          right_columns(nullptr),
+          sort_columns(nullptr),
+          aggregates(nullptr),
           projection(nullptr),
           select_conjunction(nullptr),
+          select_predicates(nullptr),
           table(Dummy::one()),
           key(nullptr),
-          index(nullptr) {
+          max_key(nullptr),
+          index(nullptr),
+          limit(0),
+          offset(0),
+          alternatives(nullptr),
+          probes(nullptr),
+          ordered(true) {
 }
 
 EvalPlan::EvalPlan(ColumnNames *projection, EvalPlan *relation)
         : type(Project),
           relation(relation),
+          right(nullptr),
+          left_columns(nullptr),
+          right_columns(nullptr),
+          sort_columns(nullptr),
+          aggregates(nullptr),
           projection(projection),
           select_conjunction(nullptr),
+          select_predicates(nullptr),
           table(Dummy::one()),
           key(nullptr),
-          index(nullptr) {
+          max_key(nullptr),
+          index(nullptr),
+          limit(0),
+          offset(0),
+          alternatives(nullptr),
+          probes(nullptr),
+          ordered(true) {
 }
 
 EvalPlan::EvalPlan(ValueDict* conjunction, EvalPlan *relation)
         : type(Select),
           relation(relation),
+          right(nullptr),
+          left_columns(nullptr),
+          right_columns(nullptr),
+          sort_columns(nullptr),
+          aggregates(nullptr),
           projection(nullptr),
           select_conjunction(conjunction),
+          select_predicates(nullptr),
           table(Dummy::one()),
           key(nullptr),
-          index(nullptr) {
+          max_key(nullptr),
+          index(nullptr),
+          limit(0),
+          offset(0),
+          alternatives(nullptr),
+          probes(nullptr),
+          ordered(true) {
+}
+
+EvalPlan::EvalPlan(ValueDict* conjunction, Predicates *predicates, EvalPlan *relation)
+        : type(Select),
+          relation(relation),
+          right(nullptr),
+          left_columns(nullptr),
+          right_columns(nullptr),
+          sort_columns(nullptr),
+          aggregates(nullptr),
+          projection(nullptr),
+          select_conjunction(conjunction),
+          select_predicates(predicates),
+          table(Dummy::one()),
+          key(nullptr),
+          max_key(nullptr),
+          index(nullptr),
+          limit(0),
+          offset(0),
+          alternatives(nullptr),
+          probes(nullptr),
+          ordered(true) {
+}
+
+EvalPlan::EvalPlan(SortColumns *sort_columns, EvalPlan *relation)
+        : type(Sort),
+          relation(relation),
+          right(nullptr),
+          left_columns(nullptr),
+          right_columns(nullptr),
+          sort_columns(sort_columns),
+          aggregates(nullptr),
+          projection(nullptr),
+          select_conjunction(nullptr),
+          select_predicates(nullptr),
+          table(Dummy::one()),
+          key(nullptr),
+          max_key(nullptr),
+          index(nullptr),
+          limit(0),
+          offset(0),
+          alternatives(nullptr),
+          probes(nullptr),
+          ordered(true) {
+}
+
+EvalPlan::EvalPlan(ColumnNames *group_by, Aggregates *aggregates, EvalPlan *relation)
+        : type(Aggregate),
+          relation(relation),
+          right(nullptr),
+          left_columns(nullptr),
+          right_columns(nullptr),
+          sort_columns(nullptr),
+          aggregates(aggregates),
+          projection(group_by),
+          select_conjunction(nullptr),
+          select_predicates(nullptr),
+          table(Dummy::one()),
+          key(nullptr),
+          max_key(nullptr),
+          index(nullptr),
+          limit(0),
+          offset(0),
+          alternatives(nullptr),
+          probes(nullptr),
+          ordered(true) {
+}
+
+EvalPlan::EvalPlan(u_long limit, u_long offset, EvalPlan *relation)
+        : type(Limit),
+          relation(relation),
+          right(nullptr),
+          left_columns(nullptr),
+          right_columns(nullptr),
+          sort_columns(nullptr),
+          aggregates(nullptr),
+          projection(nullptr),
+          select_conjunction(nullptr),
+          select_predicates(nullptr),
+          table(Dummy::one()),
+          key(nullptr),
+          max_key(nullptr),
+          index(nullptr),
+          limit(limit),
+          offset(offset),
+          alternatives(nullptr),
+          probes(nullptr),
+          ordered(true) {
+}
+
+EvalPlan::EvalPlan(Conditions *alternatives, EvalPlan *relation)
+        : type(Or),
+          relation(relation),
+          right(nullptr),
+          left_columns(nullptr),
+          right_columns(nullptr),
+          sort_columns(nullptr),
+          aggregates(nullptr),
+          projection(nullptr),
+          select_conjunction(nullptr),
+          select_predicates(nullptr),
+          table(Dummy::one()),
+          key(nullptr),
+          max_key(nullptr),
+          index(nullptr),
+          limit(0),
+          offset(0),
+          alternatives(alternatives),
+          probes(nullptr),
+          ordered(true) {
+}
+
+EvalPlan::EvalPlan(PlanType type, IndexProbes *probes, DbRelation &table)
+        : type(type),
+          relation(nullptr),
+          right(nullptr),
+          left_columns(nullptr),
+          right_columns(nullptr),
+          sort_columns(nullptr),
+          aggregates(nullptr),
+          projection(nullptr),
+          select_conjunction(nullptr),
+          select_predicates(nullptr),
+          table(table),
+          key(nullptr),
+          max_key(nullptr),
+          index(nullptr),
+          limit(0),
+          offset(0),
+          alternatives(nullptr),
+          probes(probes),
+          ordered(true) {
 }
 
 EvalPlan::EvalPlan(DbRelation &table)
         : type(TableScan),
           relation(nullptr),
+          right(nullptr),
+          left_columns(nullptr),
+          right_columns(nullptr),
+          sort_columns(nullptr),
+          aggregates(nullptr),
           projection(nullptr),
           select_conjunction(nullptr),
+          select_predicates(nullptr),
+          table(table),
+          key(nullptr),
+          max_key(nullptr),
+          index(nullptr),
+          limit(0),
+          offset(0),
+          alternatives(nullptr),
+          probes(nullptr),
+          ordered(true) {
+}
+
+EvalPlan::EvalPlan(DbRelation &table, ValueDict *conjunction, Predicates *predicates)
+        : type(ParallelScan),
+          relation(nullptr),
+          right(nullptr),
+          left_columns(nullptr),
+          right_columns(nullptr),
+          sort_columns(nullptr),
+          aggregates(nullptr),
+          projection(nullptr),
+          select_conjunction(conjunction),
+          select_predicates(predicates),
           table(table),
           key(nullptr),
-          index(nullptr) {
+          max_key(nullptr),
+          index(nullptr),
+          limit(0),
+          offset(0),
+          alternatives(nullptr),
+          probes(nullptr),
+          ordered(true) {
 }
 
 EvalPlan::EvalPlan(ValueDict *key, DbIndex *index)
         : type(IndexLookup),
           relation(nullptr),
+          right(nullptr),
+          left_columns(nullptr),
+          right_columns(nullptr),
+          sort_columns(nullptr),
+          aggregates(nullptr),
           projection(nullptr),
           select_conjunction(nullptr),
+          select_predicates(nullptr),
+          table(Dummy::one()),
+          key(key),
+          max_key(nullptr),
+          index(index),
+          limit(0),
+          offset(0),
+          alternatives(nullptr),
+          probes(nullptr),
+          ordered(true) {
+}
+
+EvalPlan::EvalPlan(ColumnNames *projection, ValueDict *key, DbIndex *index)
+        : type(IndexOnlyLookup),
+          relation(nullptr),
+          right(nullptr),
+          left_columns(nullptr),
+          right_columns(nullptr),
+          sort_columns(nullptr),
+          aggregates(nullptr),
+          projection(projection),
+          select_conjunction(nullptr),
+          select_predicates(nullptr),
           table(Dummy::one()),
           key(key),
-          index(index) {
+          max_key(nullptr),
+          index(index),
+          limit(0),
+          offset(0),
+          alternatives(nullptr),
+          probes(nullptr),
+          ordered(true) {
+}
+
+EvalPlan::EvalPlan(ValueDict *min_key, ValueDict *max_key, DbIndex *index)
+        : type(IndexRange),
+          relation(nullptr),
+          right(nullptr),
+          left_columns(nullptr),
+          right_columns(nullptr),
+          sort_columns(nullptr),
+          aggregates(nullptr),
+          projection(nullptr),
+          select_conjunction(nullptr),
+          select_predicates(nullptr),
+          table(Dummy::one()),
+          key(min_key),
+          max_key(max_key),
+          index(index),
+          limit(0),
+          offset(0),
+          alternatives(nullptr),
+          probes(nullptr),
+          ordered(true) {
+}
+
+EvalPlan::EvalPlan(PlanType type, EvalPlan *left, EvalPlan *right, ColumnNames *left_columns,
+                   ColumnNames *right_columns, const Identifier &left_name, const Identifier &right_name)
+        : type(type),
+          relation(left),
+          right(right),
+          left_columns(left_columns),
+          right_columns(right_columns),
+          left_name(left_name),
+          right_name(right_name),
+          sort_columns(nullptr),
+          aggregates(nullptr),
+          projection(nullptr),
+          select_conjunction(nullptr),
+          select_predicates(nullptr),
+          table(Dummy::one()),
+          key(nullptr),
+          max_key(nullptr),
+          index(nullptr),
+          limit(0),
+          offset(0),
+          alternatives(nullptr),
+          probes(nullptr),
+          ordered(true) {
+}
+
+EvalPlan::EvalPlan(EvalPlan *outer, EvalPlan *inner, DbIndex *index, ColumnNames *outer_columns,
+                   ColumnNames *inner_columns, const Identifier &outer_name, const Identifier &inner_name)
+        : type(IndexNestedLoopJoin),
+          relation(outer),
+          right(inner),
+          left_columns(outer_columns),
+          right_columns(inner_columns),
+          left_name(outer_name),
+          right_name(inner_name),
+          sort_columns(nullptr),
+          aggregates(nullptr),
+          projection(nullptr),
+          select_conjunction(nullptr),
+          select_predicates(nullptr),
+          table(Dummy::one()),
+          key(nullptr),
+          max_key(nullptr),
+          index(index),
+          limit(0),
+          offset(0),
+          alternatives(nullptr),
+          probes(nullptr),
+          ordered(true) {
 }
 
 EvalPlan::EvalPlan(const EvalPlan *other)
-        : type(other->type), table(other->table) {
+        : type(other->type), left_name(other->left_name), right_name(other->right_name), table(other->table),
+          limit(other->limit), offset(other->offset), ordered(other->ordered) {
     if (other->relation != nullptr)
         relation = new EvalPlan(other->relation);
     else
         relation = nullptr;
 
+    if (other->right != nullptr)
+        right = new EvalPlan(other->right);
+    else
+        right = nullptr;
+
+    if (other->left_columns != nullptr)
+        left_columns = new ColumnNames(*other->left_columns);
+    else
+        left_columns = nullptr;
+
+    if (other->right_columns != nullptr)
+        right_columns = new ColumnNames(*other->right_columns);
+    else
+        right_columns = nullptr;
+
+    if (other->sort_columns != nullptr)
+        sort_columns = new SortColumns(*other->sort_columns);
+    else
+        sort_columns = nullptr;
+
+    if (other->aggregates != nullptr)
+        aggregates = new Aggregates(*other->aggregates);
+    else
+        aggregates = nullptr;
+
     if (other->projection != nullptr)
         projection = new ColumnNames(*other->projection);
     else
@@ -92,72 +431,1289 @@ EvalPlan::EvalPlan(const EvalPlan *other)
     else
         select_conjunction = nullptr;
 
+    if (other->select_predicates != nullptr)
+        select_predicates = new Predicates(*other->select_predicates);
+    else
+        select_predicates = nullptr;
+
     if (other->key != nullptr)
         key = new ValueDict(*other->key);
     else
         key = nullptr;
 
+    if (other->max_key != nullptr)
+        max_key = new ValueDict(*other->max_key);
+    else
+        max_key = nullptr;
+
     if (other->index != nullptr)
         index = other->index;
     else
         index = nullptr;
+
+    if (other->alternatives != nullptr)
+        alternatives = new Conditions(*other->alternatives);
+    else
+        alternatives = nullptr;
+
+    if (other->probes != nullptr)
+        probes = new IndexProbes(*other->probes);
+    else
+        probes = nullptr;
 }
 
 EvalPlan::~EvalPlan() {
     delete relation;
+    delete right;
+    delete left_columns;
+    delete right_columns;
+    delete sort_columns;
+    delete aggregates;
     delete projection;
     delete select_conjunction;
+    delete select_predicates;
     delete key;
+    delete max_key;
+    delete alternatives;
+    delete probes;
+}
+
+void EvalPlan::bind(Value &value, const ParameterValues &values) {
+    if (value.parameter == 0)
+        return;
+    auto found = values.find(value.parameter);
+    if (found == values.end())
+        throw DbRelationError("no value for parameter " + std::to_string(value.parameter));
+    int parameter = value.parameter;
+    value = found->second;
+    value.parameter = parameter;
+}
+
+void EvalPlan::bind(ValueDict &row, const ParameterValues &values) {
+    for (auto &column: row)
+        bind(column.second, values);
+}
+
+void EvalPlan::bind(Predicates &predicates, const ParameterValues &values) {
+    for (auto &predicate: predicates)
+        bind(predicate.value, values);
+}
+
+void EvalPlan::bind(const ParameterValues &values) {
+    if (select_conjunction != nullptr)
+        bind(*select_conjunction, values);
+    if (select_predicates != nullptr)
+        bind(*select_predicates, values);
+    if (key != nullptr)
+        bind(*key, values);
+    if (max_key != nullptr)
+        bind(*max_key, values);
+    if (alternatives != nullptr) {
+        for (auto &alternative: *alternatives) {
+            bind(alternative.where, values);
+            bind(alternative.predicates, values);
+        }
+    }
+    if (probes != nullptr) {
+        for (auto &probe: *probes) {
+            bind(probe.min_key, values);
+            bind(probe.max_key, values);
+        }
+    }
+    if (relation != nullptr)
+        relation->bind(values);
+    if (right != nullptr)
+        right->bind(values);
 }
 
 
+// Tables with fewer blocks than this aren't worth starting workers for.
+static const double PARALLEL_BLOCKS = 4 * ParallelScanOperator::MORSEL_BLOCKS;
+
+// Whether to split a full scan of table (of blocks blocks) among worker threads: there's more than one worker, the
+// table can decode its blocks itself, and there are enough of them to go around.
+static bool parallel(DbRelation &table, double blocks) {
+    return ParallelScanOperator::workers > 1 && table.decodes_blocks() && blocks >= PARALLEL_BLOCKS;
+}
+
 EvalPlan *EvalPlan::optimize() {
     switch(this->type) {
-        case ProjectAll:
-            return new EvalPlan(EvalPlan::ProjectAll, this->relation->optimize());
+        case ProjectAll: {
+            // knowing the projection lets the access path consider index-only plans
+            EvalPlan *optimized;
+            if (this->relation->type == Select && this->relation->relation->type == TableScan)
+                optimized = this->relation->access_path(&this->relation->relation->table.get_column_names());
+            else
+                optimized = this->relation->optimize();
+            return new EvalPlan(EvalPlan::ProjectAll, optimized);
+        }
 
-        case Project:
-            return new EvalPlan(new ColumnNames(*this->projection), this->relation->optimize());
+        case Project: {
+            EvalPlan *optimized;
+            if (this->relation->type == Select && this->relation->relation->type == TableScan)
+                optimized = this->relation->access_path(this->projection);
+            else
+                optimized = this->relation->optimize();
+            return new EvalPlan(new ColumnNames(*this->projection), optimized);
+        }
 
         case Select:
-            // look for index lookup opportunity
-            if (this->relation->type == TableScan) {
-                for (auto const& index_name: SQLExec::indices->get_index_names(this->relation->table.get_table_name())) {
-                    DbIndex &index = SQLExec::indices->get_index(this->relation->table, index_name);
-                    // if this index starts with a value that's in our where clause, then figure it's best to use index
-                    if (this->select_conjunction->find(index.get_key_columns()[0]) != this->select_conjunction->end()) {
-                        ValueDict *key = new ValueDict();
-                        for (Identifier const& cn: index.get_key_columns()) {
-                            if (this->select_conjunction->find(cn) != this->select_conjunction->end())
-                                (*key)[cn] = (*this->select_conjunction)[cn];
-                            return new EvalPlan(key, &index);
-                            // FIXME: not quite done since we have to account for any non-key values in the select_conjunction
-                        }
-                    }
-                }
+            if (this->relation->type == TableScan)
+                return access_path(nullptr);
+            if (this->relation->type == Join)
+                return push_down();
+            return new EvalPlan(new ValueDict(*this->select_conjunction),
+                                this->select_predicates == nullptr ? nullptr : new Predicates(*this->select_predicates),
+                                this->relation->optimize());
+
+        case Join:
+            return join_path();
+
+        case Limit:
+            return limit_path();
+
+        case Or:
+            return or_path();
+
+        case Sort: {
+            // no need to sort what comes out in order already, like a range scan on a B-tree on the sort columns
+            EvalPlan *optimized = this->relation->optimize();
+            if (optimized->sorted_on(*this->sort_columns))
+                return optimized;
+            optimized->any_order();
+            return new EvalPlan(new SortColumns(*this->sort_columns), optimized);
+        }
+
+        case Aggregate: {
+            // a bare COUNT(*) of a table comes from the table's own count of its rows
+            bool counts_rows = this->projection->empty();
+            for (auto const& aggregate: *this->aggregates)
+                counts_rows = counts_rows && aggregate.column_name.empty();
+            if (counts_rows && this->relation->type == TableScan) {
+                EvalPlan *count = new EvalPlan(new ColumnNames(), new Aggregates(*this->aggregates),
+                                               new EvalPlan(this->relation->table));
+                count->type = Count;
+                return count;
             }
-            return new EvalPlan(new ValueDict(*this->select_conjunction), this->relation->optimize());
+
+            // the group and aggregated columns are all that's needed, which may allow an index-only plan
+            EvalPlan *optimized;
+            if (this->relation->type == Select && this->relation->relation->type == TableScan) {
+                ColumnNames needed(*this->projection);
+                for (auto const& aggregate: *this->aggregates)
+                    if (!aggregate.column_name.empty()
+                            && std::find(needed.begin(), needed.end(), aggregate.column_name) == needed.end())
+                        needed.push_back(aggregate.column_name);
+                optimized = this->relation->access_path(&needed);
+            } else {
+                optimized = this->relation->optimize();
+            }
+            optimized->any_order();
+            return new EvalPlan(new ColumnNames(*this->projection), new Aggregates(*this->aggregates), optimized);
+        }
 
         case TableScan:
+            if (parallel(this->table, this->table.get_block_count()))
+                return new EvalPlan(this->table, new ValueDict(), nullptr);
+            break;
+
         case IndexLookup:
+        case IndexOnlyLookup:
+        case IndexRange:
+        case HashJoin:
+        case IndexNestedLoopJoin:
+        case SortMergeJoin:
+        case Count:
+        case TopN:
+        case IndexIntersect:
+        case IndexUnion:
+        case ParallelScan:
         default:
             break;
     }
     return new EvalPlan(this);  // For now, we don't know how to do anything better
 }
 
+// Which side of a join a column of the joined rows comes from (-1 for left, 1 for right, 0 if there's no telling),
+// and what that side's rows call it. A side named by a table has the plain column names; a side that's a join
+// itself (no name) keeps them qualified, and gets whatever the named side doesn't claim.
+static int join_side(const Identifier &left_name, const Identifier &right_name, const Identifier &qualified,
+                     Identifier &column_name) {
+    size_t dot = qualified.find('.');
+    Identifier prefix = dot == std::string::npos ? "" : qualified.substr(0, dot);
+    column_name = qualified;
+    if (!left_name.empty() && prefix == left_name) {
+        column_name = qualified.substr(dot + 1);
+        return -1;
+    }
+    if (!right_name.empty() && prefix == right_name) {
+        column_name = qualified.substr(dot + 1);
+        return 1;
+    }
+    if (left_name.empty() && !right_name.empty())
+        return -1;
+    if (right_name.empty() && !left_name.empty())
+        return 1;
+    return 0;
+}
+
+// Split a Select over a Join into a Select under each side, for the terms about just that side's columns, and a
+// residual Select over the join for the rest, then optimize the lot. The pushed-down Selects get access paths of
+// their own.
+EvalPlan *EvalPlan::push_down() {
+    const EvalPlan *join = this->relation;
+    ValueDict *wheres[2] = {new ValueDict(), new ValueDict()};
+    Predicates *predicates[2] = {new Predicates(), new Predicates()};
+    ValueDict *residual = new ValueDict();
+    Predicates *residual_predicates = new Predicates();
+    Identifier column_name;
+    for (auto const& column: *this->select_conjunction) {
+        int side = join_side(join->left_name, join->right_name, column.first, column_name);
+        if (side == 0)
+            (*residual)[column.first] = column.second;
+        else
+            (*wheres[side > 0])[column_name] = column.second;
+    }
+    if (this->select_predicates != nullptr) {
+        for (auto const& predicate: *this->select_predicates) {
+            int side = join_side(join->left_name, join->right_name, predicate.column_name, column_name);
+            if (side == 0)
+                residual_predicates->push_back(predicate);
+            else
+                predicates[side > 0]->push_back(Predicate(column_name, predicate.comparison, predicate.value));
+        }
+    }
+
+    EvalPlan *sides[2] = {new EvalPlan(join->relation), new EvalPlan(join->right)};
+    for (int i = 0; i < 2; i++) {
+        if (wheres[i]->empty() && predicates[i]->empty()) {
+            delete wheres[i];
+            delete predicates[i];
+        } else {
+            sides[i] = new EvalPlan(wheres[i], predicates[i], sides[i]);
+        }
+    }
+    EvalPlan *pushed = new EvalPlan(Join, sides[0], sides[1], new ColumnNames(*join->left_columns),
+                                    new ColumnNames(*join->right_columns), join->left_name, join->right_name);
+    EvalPlan *optimized = pushed->optimize();
+    delete pushed;
+
+    if (residual->empty() && residual_predicates->empty()) {
+        delete residual;
+        delete residual_predicates;
+        return optimized;
+    }
+    return new EvalPlan(residual, residual_predicates, optimized);
+}
+
+
+// What the planner knows about a table and its indices, for costing access paths in blocks read. Where there
+// are no statistics to go on, we fall back on the textbook guesses (1/10 of the rows for an equality, 1/3 for
+// a range bound).
+static const double EQ_SELECTIVITY = 0.1;
+static const double BOUND_SELECTIVITY = 1.0 / 3;  // just one side bounded
+static const double BOUNDS_SELECTIVITY = 0.25;     // both sides
+static const double GUESSED_HEIGHT = 3;
+static const double GUESSED_BLOCKS = 1000;
+
+class PlanStats {
+public:
+    double rows;
+    double blocks;
+    std::vector<std::pair<DbIndex*, IndexStats*>> indices;
+
+    PlanStats(DbRelation &table) : rows(0), blocks(table.get_block_count()), indices() {
+        for (auto const& index_name: SQLExec::indices->get_index_names(table.get_table_name())) {
+            DbIndex *index = &SQLExec::indices->get_index(table, index_name);
+            IndexStats *stats = index->get_stats();
+            indices.push_back(std::make_pair(index, stats));
+            if (stats != nullptr && stats->entries > rows)
+                rows = stats->entries;
+        }
+        if (blocks == 0)
+            blocks = rows > 0 ? rows / rows_per_block(table) : GUESSED_BLOCKS;
+        if (rows == 0)
+            rows = blocks * rows_per_block(table);
+        if (blocks < 1)
+            blocks = 1;
+        if (rows < 1)
+            rows = 1;
+    }
+
+    ~PlanStats() {
+        for (auto const& index: indices)
+            delete index.second;
+    }
+
+    // rows that fit in a block, going by the column types (and a guess at how long text is)
+    static double rows_per_block(DbRelation &table) {
+        uint row_size = 4;  // its slotted page header entry
+        for (auto const& attribute: table.get_column_attributes()) {
+            ColumnAttribute ca = attribute;
+            if (ca.get_data_type() == ColumnAttribute::INT)
+                row_size += 4;
+            else if (ca.get_data_type() == ColumnAttribute::BOOLEAN)
+                row_size += 1;
+            else
+                row_size += 2 + 16;
+        }
+        return (double) DB_BLOCK_SZ / row_size;
+    }
+
+    // the statistics of an index on just this column (or starting with it, if !whole), or nullptr
+    IndexStats *stats_for(const Identifier &column_name, bool whole) const {
+        for (auto const& index: indices)
+            if (index.second != nullptr && index.first->get_key_columns()[0] == column_name
+                    && (!whole || index.first->get_key_columns().size() == 1))
+                return index.second;
+        return nullptr;
+    }
+
+    double eq_selectivity(const Identifier &column_name, const Value &value) const {
+        IndexStats *stats = stats_for(column_name, true);
+        if (stats != nullptr && stats->entries > 0) {
+            if (value < stats->min_key[0] || stats->max_key[0] < value)
+                return 1.0 / rows;  // out of bounds, so probably nothing
+            return 1.0 / stats->entries;  // our indices are unique
+        }
+        return EQ_SELECTIVITY;
+    }
+
+    // fraction of the rows between low and high (either may be nullptr for no bound), interpolating between the
+    // column's smallest and largest values if we know them
+    double range_selectivity(const Identifier &column_name, const Value *low, const Value *high) const {
+        if (low == nullptr && high == nullptr)
+            return 1.0;
+        IndexStats *stats = stats_for(column_name, false);
+        if (stats != nullptr && stats->entries > 0 && stats->min_key[0].data_type == ColumnAttribute::INT
+                && (low == nullptr || low->data_type == ColumnAttribute::INT)
+                && (high == nullptr || high->data_type == ColumnAttribute::INT)) {
+            double min = stats->min_key[0].n, max = stats->max_key[0].n;
+            double from = low == nullptr ? min : std::max(min, (double) low->n);
+            double to = high == nullptr ? max : std::min(max, (double) high->n);
+            double fraction = (to - from + 1) / (max - min + 1);
+            return std::max(fraction, 1.0 / rows);
+        }
+        return low != nullptr && high != nullptr ? BOUNDS_SELECTIVITY : BOUND_SELECTIVITY;
+    }
+
+    IndexStats *stats_of(DbIndex *index) const {
+        for (auto const& entry: indices)
+            if (entry.first == index)
+                return entry.second;
+        return nullptr;
+    }
+};
+
+// The tightest lower and upper bounds that predicates put on a column (nullptr where there are none).
+static void get_bounds(const Predicates *predicates, const Identifier &column_name,
+                       const Value *&low, const Value *&high) {
+    low = high = nullptr;
+    if (predicates == nullptr)
+        return;
+    for (auto const& predicate: *predicates) {
+        if (predicate.column_name != column_name)
+            continue;
+        if (predicate.comparison == Predicate::GT || predicate.comparison == Predicate::GE) {
+            if (low == nullptr || *low < predicate.value)
+                low = &predicate.value;
+        } else if (predicate.comparison == Predicate::LT || predicate.comparison == Predicate::LE) {
+            if (high == nullptr || predicate.value < *high)
+                high = &predicate.value;
+        }
+    }
+}
+
+static void add_column(ColumnNames &column_names, const Identifier &column_name) {
+    if (std::find(column_names.begin(), column_names.end(), column_name) == column_names.end())
+        column_names.push_back(column_name);
+}
+
+// How one index on its own could narrow down an equality conjunction and predicates: a lookup if they pin down its
+// whole key, else (if it's ordered) a range over the key prefix they pin down and any bounds on the next key column.
+// If it can help, adds that probe to probes, with the fraction of the rows it finds and the blocks read to find
+// their handles.
+static bool index_probe(const PlanStats &stats, DbIndex *index, IndexStats *index_stats, const ValueDict &where,
+                        const Predicates *predicates, IndexProbes &probes, double &fraction, double &cost) {
+    const ColumnNames &key_columns = index->get_key_columns();
+    double height = index_stats != nullptr ? index_stats->height : GUESSED_HEIGHT;
+    double leaves = index_stats != nullptr ? index_stats->leaf_blocks : stats.blocks;
+
+    ValueDict key;
+    fraction = 1.0;
+    for (auto const& column_name: key_columns) {
+        auto found = where.find(column_name);
+        if (found == where.end())
+            break;
+        key[column_name] = found->second;
+        fraction *= stats.eq_selectivity(column_name, found->second);
+    }
+
+    size_t prefix = key.size();
+    if (prefix == key_columns.size()) {
+        if (index->is_unique())
+            fraction = 1.0 / stats.rows;
+        probes.push_back(IndexProbe(index, key));
+    } else if (index->ordered()) {
+        const Value *low, *high;
+        get_bounds(predicates, key_columns[prefix], low, high);
+        if (prefix == 0 && low == nullptr && high == nullptr)
+            return false;
+        fraction *= stats.range_selectivity(key_columns[prefix], low, high);
+        ValueDict max_key(key);
+        if (low != nullptr)
+            key[key_columns[prefix]] = *low;
+        if (high != nullptr)
+            max_key[key_columns[prefix]] = *high;
+        probes.push_back(IndexProbe(index, key, max_key));
+    } else {
+        return false;
+    }
+    cost = height + std::max(1.0, leaves * fraction);
+    return true;
+}
+
+// Index probes to intersect for a conjunction, if two or more of them together beat best_cost: the handles from
+// each (most selective first, while another one saves more fetching than it costs, and skipping any that restrict
+// only columns already restricted), then each surviving row fetched in physical order, a block at most per row.
+// Else nullptr.
+static IndexProbes *intersection(const PlanStats &stats, const ValueDict &where, const Predicates *predicates,
+                                 double best_cost) {
+    IndexProbes candidates;
+    std::vector<double> fractions, costs;
+    for (auto const& entry: stats.indices) {
+        double fraction, cost;
+        if (index_probe(stats, entry.first, entry.second, where, predicates, candidates, fraction, cost)) {
+            fractions.push_back(fraction);
+            costs.push_back(cost);
+        }
+    }
+    if (candidates.size() < 2)
+        return nullptr;
+    std::vector<size_t> order;
+    for (size_t i = 0; i < candidates.size(); i++)
+        order.push_back(i);
+    std::sort(order.begin(), order.end(), [&fractions](size_t a, size_t b) { return fractions[a] < fractions[b]; });
+
+    IndexProbes *ret = new IndexProbes();
+    ColumnNames restricted;
+    double cost = 0, fraction = 1.0;
+    for (auto i: order) {
+        bool adds = false;
+        for (auto const& key: {candidates[i].min_key, candidates[i].max_key})
+            for (auto const& column: key)
+                adds = adds || std::find(restricted.begin(), restricted.end(), column.first) == restricted.end();
+        if (!adds)
+            continue;
+        double fetched = std::min(stats.blocks, stats.rows * fraction);
+        double narrowed = std::min(stats.blocks, stats.rows * fraction * fractions[i]);
+        if (!ret->empty() && costs[i] + narrowed >= fetched)
+            break;
+        ret->push_back(candidates[i]);
+        for (auto const& key: {candidates[i].min_key, candidates[i].max_key})
+            for (auto const& column: key)
+                add_column(restricted, column.first);
+        cost += costs[i];
+        fraction *= fractions[i];
+    }
+    if (ret->size() < 2 || cost + std::min(stats.blocks, stats.rows * fraction) >= best_cost) {
+        delete ret;
+        return nullptr;
+    }
+    return ret;
+}
+
+// Choose how to get at the rows of a Select over a TableScan: a full scan, a lookup, index-only lookup or range
+// scan on one of the table's indices, or the intersection of the handles from several of them, whichever reads the
+// fewest blocks by our estimates. Whatever of the where clause the access path doesn't take care of is left to a
+// Select on top of it. Index-only plans are only
+// considered if we know the columns that will be projected (else projection is nullptr).
+EvalPlan *EvalPlan::access_path(const ColumnNames *projection) {
+    DbRelation &table = this->relation->table;
+    PlanStats stats(table);
+    bool has_predicates = this->select_predicates != nullptr && !this->select_predicates->empty();
+
+    // a full scan reads every block
+    double best_cost = stats.blocks;
+    DbIndex *best = nullptr;
+    bool best_lookup = false, best_index_only = false;
+    uint best_prefix = 0;
+
+    for (auto const& entry: stats.indices) {
+        DbIndex *index = entry.first;
+        IndexStats *index_stats = entry.second;
+        const ColumnNames &key_columns = index->get_key_columns();
+        double height = index_stats != nullptr ? index_stats->height : GUESSED_HEIGHT;
+        double leaves = index_stats != nullptr ? index_stats->leaf_blocks : stats.blocks;
+
+        // how many leading key columns the where clause pins down, and how selective that is
+        uint prefix = 0;
+        double selectivity = 1.0;
+        for (auto const& column_name: key_columns) {
+            auto found = this->select_conjunction->find(column_name);
+            if (found == this->select_conjunction->end())
+                break;
+            selectivity *= stats.eq_selectivity(column_name, found->second);
+            prefix++;
+        }
+
+        if (prefix == key_columns.size()) {
+            // the whole key: a lookup, which (our indices being unique) gets at most one row
+            double rows = index->is_unique() ? 1 : stats.rows * selectivity;
+            ColumnNames needed;
+            if (projection != nullptr) {
+                needed = *projection;
+                for (auto const& column: *this->select_conjunction)
+                    add_column(needed, column.first);
+                if (has_predicates)
+                    for (auto const& predicate: *this->select_predicates)
+                        add_column(needed, predicate.column_name);
+            }
+            bool index_only = projection != nullptr && index->covers(needed);
+            double cost = height + (index_only ? 0 : rows);
+            if (cost < best_cost) {
+                best_cost = cost;
+                best = index;
+                best_lookup = true;
+                best_index_only = index_only;
+                best_prefix = prefix;
+            }
+        } else if (index->ordered()) {
+            // a range scan over the pinned-down prefix and whatever bounds there are on the next key column
+            const Value *low, *high;
+            get_bounds(this->select_predicates, key_columns[prefix], low, high);
+            if (prefix == 0 && low == nullptr && high == nullptr)
+                continue;
+            selectivity *= stats.range_selectivity(key_columns[prefix], low, high);
+            double rows = stats.rows * selectivity;
+            double cost = height + std::max(1.0, leaves * selectivity) + rows;
+            if (cost < best_cost) {
+                best_cost = cost;
+                best = index;
+                best_lookup = false;
+                best_index_only = false;
+                best_prefix = prefix;
+            }
+        }
+    }
+
+    IndexProbes *probes = intersection(stats, *this->select_conjunction, this->select_predicates, best_cost);
+
+    // a full scan of a big enough table is split among worker threads, each filtering its own blocks
+    if (best == nullptr && probes == nullptr && parallel(table, stats.blocks))
+        return new EvalPlan(table, new ValueDict(*this->select_conjunction),
+                            has_predicates ? new Predicates(*this->select_predicates) : nullptr);
+
+    ValueDict *residual = new ValueDict(*this->select_conjunction);
+    Predicates *residual_predicates = has_predicates ? new Predicates(*this->select_predicates) : nullptr;
+    EvalPlan *path;
+    if (probes != nullptr) {
+        path = new EvalPlan(IndexIntersect, probes, table);  // the residual rechecks the whole where clause
+    } else if (best == nullptr) {
+        path = new EvalPlan(table);
+    } else {
+        const ColumnNames &key_columns = best->get_key_columns();
+        ValueDict *key = new ValueDict();
+        for (uint i = 0; i < best_prefix; i++) {
+            (*key)[key_columns[i]] = (*this->select_conjunction)[key_columns[i]];
+            residual->erase(key_columns[i]);  // the access path sees to these
+        }
+        if (best_lookup && best_index_only) {
+            ColumnNames *needed = new ColumnNames(*projection);
+            for (auto const& column: *residual)
+                add_column(*needed, column.first);
+            if (has_predicates)
+                for (auto const& predicate: *this->select_predicates)
+                    add_column(*needed, predicate.column_name);
+            path = new EvalPlan(needed, key, best);
+        } else if (best_lookup) {
+            path = new EvalPlan(key, best);
+        } else {
+            // range bounds are inclusive, so the predicates (strict ones included) stay in the residual
+            ValueDict *max_key = new ValueDict(*key);
+            const Value *low, *high;
+            get_bounds(this->select_predicates, key_columns[best_prefix], low, high);
+            if (low != nullptr)
+                (*key)[key_columns[best_prefix]] = *low;
+            if (high != nullptr)
+                (*max_key)[key_columns[best_prefix]] = *high;
+            path = new EvalPlan(key, max_key, best);
+        }
+    }
+
+    if (residual->empty() && residual_predicates == nullptr) {
+        delete residual;
+        return path;
+    }
+    return new EvalPlan(residual, residual_predicates, path);
+}
+
+static SortColumns ascending(const ColumnNames &column_names) {
+    SortColumns ret;
+    for (auto const& column_name: column_names)
+        ret.push_back(SortColumn(column_name));
+    return ret;
+}
+
+// The rows may come in any order (they're to be sorted, aggregated or hashed), so a parallel scan under here
+// needn't keep to block order.
+void EvalPlan::any_order() {
+    if (this->type == ParallelScan)
+        this->ordered = false;
+    else if (this->type == ProjectAll || this->type == Project || this->type == Select || this->type == Or)
+        this->relation->any_order();
+}
+
+// Choose how to carry out a Join (with both sides optimized): an index nested-loop join, looking up the rows of a
+// smallish side in an index on the other side's join columns, if that reads fewer blocks than scanning the
+// indexed side; else a merge join if both sides are in join column order already; else a hash join.
+EvalPlan *EvalPlan::join_path() {
+    EvalPlan *left = this->relation->optimize();
+    EvalPlan *right = this->right->optimize();
+    double left_rows = left->estimated_rows(), right_rows = right->estimated_rows();
+
+    // with an index on one side's join columns and few enough rows on the other side, look each of those up
+    // rather than reading the whole indexed side
+    EvalPlan *best_outer = nullptr;
+    DbIndex *best_index = nullptr;
+    double best_cost = 0;
+    for (int i = 0; i < 2; i++) {
+        const EvalPlan *inner = i == 0 ? this->right : this->relation;
+        DbIndex *index = inner->join_index(i == 0 ? *this->right_columns : *this->left_columns);
+        if (index == nullptr)
+            continue;
+        PlanStats stats(index->get_relation());
+        IndexStats *index_stats = stats.stats_of(index);
+        double height = index_stats != nullptr ? index_stats->height : GUESSED_HEIGHT;
+        double outer_rows = i == 0 ? left_rows : right_rows;
+        // a block per inner row fetched, and the tree walked once per batch of outer rows
+        double cost = outer_rows + height * std::ceil(outer_rows / EvalOperator::BATCH_SIZE);
+        if (cost < stats.blocks && (best_index == nullptr || cost < best_cost)) {
+            best_cost = cost;
+            best_index = index;
+            best_outer = i == 0 ? left : right;
+        }
+    }
+    if (best_index != nullptr) {
+        EvalPlan *ret;
+        if (best_outer == left)
+            ret = new EvalPlan(left, new EvalPlan(this->right), best_index,
+                               new ColumnNames(*this->left_columns), new ColumnNames(*this->right_columns),
+                               this->left_name, this->right_name);
+        else
+            ret = new EvalPlan(right, new EvalPlan(this->relation), best_index,
+                               new ColumnNames(*this->right_columns), new ColumnNames(*this->left_columns),
+                               this->right_name, this->left_name);
+        delete (best_outer == left ? right : left);
+        return ret;
+    }
+
+    // if both sides come out in join column order already, just merge them
+    if (left->sorted_on(ascending(*this->left_columns)) && right->sorted_on(ascending(*this->right_columns)))
+        return new EvalPlan(SortMergeJoin, left, right, new ColumnNames(*this->left_columns),
+                            new ColumnNames(*this->right_columns), this->left_name, this->right_name);
+
+    // otherwise a hash join, built on whichever side looks smaller
+    left->any_order();
+    right->any_order();
+    if (left_rows <= right_rows)
+        return new EvalPlan(HashJoin, left, right, new ColumnNames(*this->left_columns),
+                            new ColumnNames(*this->right_columns), this->left_name, this->right_name);
+    return new EvalPlan(HashJoin, right, left, new ColumnNames(*this->right_columns),
+                        new ColumnNames(*this->left_columns), this->right_name, this->left_name);
+}
+
+// If this join side is a scan of a table (filtered or not), the B-tree index on that table whose key is just the
+// given join columns, for an index nested-loop join to look rows up in. Else nullptr.
+DbIndex *EvalPlan::join_index(const ColumnNames &join_columns) const {
+    const EvalPlan *scan = this->type == Select ? this->relation : this;
+    if (scan->type != TableScan)
+        return nullptr;
+    DbRelation &table = scan->table;
+    for (auto const& index_name: SQLExec::indices->get_index_names(table.get_table_name())) {
+        DbIndex *index = &SQLExec::indices->get_index(table, index_name);
+        const ColumnNames &key_columns = index->get_key_columns();
+        if (!index->ordered() || key_columns.size() != join_columns.size())
+            continue;  // just the B-trees do lookups so far
+        bool all = true;
+        for (auto const& column_name: key_columns)
+            all = all && std::find(join_columns.begin(), join_columns.end(), column_name) != join_columns.end();
+        if (all)
+            return index;
+    }
+    return nullptr;
+}
+
+// A LIMIT stops pulling rows once it has enough. Beyond that, ORDER BY ... LIMIT n keeps just the first n rows in a
+// bounded heap rather than sorting them all, and a range scan already in order (or under no ORDER BY at all) reads
+// just its first n index entries. With no where clause, an ORDER BY on the leading key columns of a B-tree is the
+// first n entries of the whole index, if that's fewer rows than the table has blocks.
+EvalPlan *EvalPlan::limit_path() {
+    u_long n = 0;  // rows needed from below, if we know
+    if (this->limit != LimitOperator::ALL && this->offset < LimitOperator::ALL - this->limit)
+        n = this->limit + this->offset;
+
+    EvalPlan *optimized = nullptr;
+    if (n != 0 && this->relation->type == Sort && this->relation->relation->type == TableScan) {
+        DbRelation &table = this->relation->relation->table;
+        const SortColumns &sort_columns = *this->relation->sort_columns;
+        PlanStats stats(table);
+        for (auto const& entry: stats.indices) {
+            const ColumnNames &key_columns = entry.first->get_key_columns();
+            bool in_order = entry.first->ordered() && key_columns.size() >= sort_columns.size();
+            for (size_t i = 0; in_order && i < sort_columns.size(); i++)
+                in_order = key_columns[i] == sort_columns[i].column_name && !sort_columns[i].descending;
+            if (in_order && n < stats.blocks) {
+                optimized = new EvalPlan(new ValueDict(), new ValueDict(), entry.first);
+                break;
+            }
+        }
+    }
+    if (optimized == nullptr)
+        optimized = this->relation->optimize();
+
+    if (n != 0 && optimized->type == IndexRange && (optimized->limit == 0 || n < optimized->limit)) {
+        optimized->limit = n;
+    } else if (n != 0 && n <= TopNOperator::MAX_ROWS && optimized->type == Sort) {
+        optimized->type = TopN;
+        optimized->limit = n;
+    }
+    return new EvalPlan(this->limit, this->offset, optimized);
+}
+
+// An Or over a TableScan can get its rows from the union of the handles of an index probe per alternative, if every
+// alternative has one and reading the handles, then the rows in physical order, costs less than scanning the table.
+// The Or stays on top to recheck the rows. Otherwise the table is scanned once for rows matching any alternative.
+EvalPlan *EvalPlan::or_path() {
+    if (this->relation->type != TableScan)
+        return new EvalPlan(new Conditions(*this->alternatives), this->relation->optimize());
+    DbRelation &table = this->relation->table;
+    PlanStats stats(table);
+
+    IndexProbes *probes = new IndexProbes();
+    double cost = 0, fraction = 0;
+    for (auto const& condition: *this->alternatives) {
+        // the cheapest probe for this alternative
+        IndexProbes candidates;
+        size_t best = 0;
+        double best_fraction = 0, best_cost = 0;
+        for (auto const& entry: stats.indices) {
+            double probe_fraction, probe_cost;
+            if (index_probe(stats, entry.first, entry.second, condition.where, &condition.predicates, candidates,
+                            probe_fraction, probe_cost) && (candidates.size() == 1 || probe_cost < best_cost)) {
+                best = candidates.size() - 1;
+                best_fraction = probe_fraction;
+                best_cost = probe_cost;
+            }
+        }
+        if (candidates.empty()) {
+            delete probes;
+            return new EvalPlan(this);
+        }
+        probes->push_back(candidates[best]);
+        cost += best_cost;
+        fraction += best_fraction;
+    }
+    if (cost + std::min(stats.blocks, stats.rows * std::min(1.0, fraction)) < stats.blocks)
+        return new EvalPlan(new Conditions(*this->alternatives), new EvalPlan(IndexUnion, probes, table));
+    delete probes;
+    return new EvalPlan(this);
+}
+
+// fraction of a table's rows that an equality conjunction and predicates (either may be nullptr) let through
+static double selectivity(const PlanStats &stats, const ValueDict *where, const Predicates *predicates) {
+    double fraction = 1.0;
+    if (where != nullptr)
+        for (auto const& column: *where)
+            fraction *= stats.eq_selectivity(column.first, column.second);
+    if (predicates != nullptr) {
+        ColumnNames bounded;
+        for (auto const& predicate: *predicates)
+            if (predicate.comparison != Predicate::NE)
+                add_column(bounded, predicate.column_name);
+        for (auto const& column_name: bounded) {
+            const Value *low, *high;
+            get_bounds(predicates, column_name, low, high);
+            fraction *= stats.range_selectivity(column_name, low, high);
+        }
+    }
+    return fraction;
+}
+
+// fraction of a table's rows with index keys from min_key to max_key: the key prefix both ends agree on, then the
+// range on the next key column
+static double range_fraction(const PlanStats &stats, const ColumnNames &key_columns, const ValueDict &min_key,
+                             const ValueDict &max_key) {
+    double fraction = 1.0;
+    for (auto const& column_name: key_columns) {
+        auto low = min_key.find(column_name), high = max_key.find(column_name);
+        bool has_low = low != min_key.end(), has_high = high != max_key.end();
+        if (has_low && has_high && low->second == high->second) {
+            fraction *= stats.eq_selectivity(column_name, low->second);
+            continue;
+        }
+        fraction *= stats.range_selectivity(column_name, has_low ? &low->second : nullptr,
+                                            has_high ? &high->second : nullptr);
+        break;
+    }
+    return fraction;
+}
+
+// fraction of a table's rows an index probe finds
+static double probe_fraction(const PlanStats &stats, const IndexProbe &probe) {
+    if (!probe.lookup)
+        return range_fraction(stats, probe.index->get_key_columns(), probe.min_key, probe.max_key);
+    if (probe.index->is_unique() && probe.min_key.size() == probe.index->get_key_columns().size())
+        return 1.0 / stats.rows;
+    return selectivity(stats, &probe.min_key, nullptr);
+}
+
+double EvalPlan::estimated_rows() const {
+    switch (this->type) {
+        case ProjectAll:
+        case Project:
+        case Sort:
+            return this->relation->estimated_rows();
+
+        case Limit:
+        case TopN:
+            return std::min((double) this->limit, this->relation->estimated_rows());
+
+        case Select: {
+            if (this->relation->type == TableScan) {
+                PlanStats stats(this->relation->table);
+                return stats.rows * selectivity(stats, this->select_conjunction, this->select_predicates);
+            }
+            double rows = this->relation->estimated_rows();
+            for (uint i = 0; i < this->select_conjunction->size(); i++)
+                rows *= EQ_SELECTIVITY;
+            if (this->select_predicates != nullptr && !this->select_predicates->empty())
+                rows *= BOUND_SELECTIVITY;
+            return rows;
+        }
+
+        case TableScan:
+            return PlanStats(this->table).rows;
+
+        case ParallelScan: {
+            PlanStats stats(this->table);
+            return stats.rows * selectivity(stats, this->select_conjunction, this->select_predicates);
+        }
+
+        case IndexLookup:
+        case IndexOnlyLookup: {
+            if (this->index->is_unique() && this->key->size() == this->index->get_key_columns().size())
+                return 1;
+            PlanStats stats(this->index->get_relation());
+            return stats.rows * selectivity(stats, this->key, nullptr);
+        }
+
+        case IndexRange: {
+            PlanStats stats(this->index->get_relation());
+            double fraction = range_fraction(stats, this->index->get_key_columns(), *this->key, *this->max_key);
+            if (this->limit != 0)
+                return std::min((double) this->limit, stats.rows * fraction);
+            return stats.rows * fraction;
+        }
+
+        case Or: {
+            // the alternatives may overlap, so at most the sum of what each lets through
+            if (this->relation->type != TableScan)
+                return this->relation->estimated_rows();
+            PlanStats stats(this->relation->table);
+            double fraction = 0;
+            for (auto const& condition: *this->alternatives)
+                fraction += selectivity(stats, &condition.where, &condition.predicates);
+            return stats.rows * std::min(1.0, fraction);
+        }
+
+        case IndexIntersect:
+        case IndexUnion: {
+            PlanStats stats(this->table);
+            double fraction = this->type == IndexIntersect ? 1.0 : 0.0;
+            for (auto const& probe: *this->probes)
+                if (this->type == IndexIntersect)
+                    fraction *= probe_fraction(stats, probe);
+                else
+                    fraction += probe_fraction(stats, probe);
+            return stats.rows * std::min(1.0, fraction);
+        }
+
+        case Aggregate:
+            // at most a group per row
+            return this->projection->empty() ? 1 : this->relation->estimated_rows();
+
+        case Count:
+            return 1;
+
+        case Join:
+        case HashJoin:
+        case IndexNestedLoopJoin:
+        case SortMergeJoin:
+            // joining on a key, each row of the bigger side matches about one row of the other
+            return std::max(this->relation->estimated_rows(), this->right->estimated_rows());
+
+        default:
+            throw DbRelationError("Invalid evaluation plan");
+    }
+}
+
+// Scans of a table kept in key order (see DbRelation::ordered_by) and B-tree lookups and range scans come out in
+// ascending key order, which is the order asked for if the sort columns are the leading key columns.
+bool EvalPlan::sorted_on(const SortColumns &sort_columns) const {
+    const ColumnNames *order = nullptr;
+    switch (this->type) {
+        case ProjectAll:
+        case Project:
+        case Select:
+        case Or:
+        case Limit:
+            return this->relation->sorted_on(sort_columns);
+        case Sort:
+        case TopN:
+            if (this->sort_columns->size() < sort_columns.size())
+                return false;
+            for (size_t i = 0; i < sort_columns.size(); i++)
+                if ((*this->sort_columns)[i].column_name != sort_columns[i].column_name
+                        || (*this->sort_columns)[i].descending != sort_columns[i].descending)
+                    return false;
+            return true;
+        case TableScan:
+            order = this->table.ordered_by();
+            break;
+        case ParallelScan:
+            if (this->ordered)
+                order = this->table.ordered_by();
+            break;
+        case IndexLookup:
+        case IndexOnlyLookup:
+        case IndexRange:
+            if (this->index->ordered())
+                order = &this->index->get_key_columns();
+            break;
+        default:
+            break;
+    }
+    if (order == nullptr || order->size() < sort_columns.size())
+        return false;
+    for (size_t i = 0; i < sort_columns.size(); i++)
+        if ((*order)[i] != sort_columns[i].column_name || sort_columns[i].descending)
+            return false;
+    return true;
+}
+
+// How EXPLAIN writes a literal, a key of an index, and a where clause.
+static std::string value_text(const Value &value) {
+    if (value.data_type == ColumnAttribute::TEXT)
+        return "\"" + value.s + "\"";
+    if (value.data_type == ColumnAttribute::BOOLEAN)
+        return value.n ? "true" : "false";
+    return std::to_string(value.n);
+}
+
+static std::string key_text(const DbIndex *index, const ValueDict &key) {
+    std::string ret;
+    for (auto const &column_name: const_cast<DbIndex*>(index)->get_key_columns()) {
+        auto found = key.find(column_name);
+        if (found == key.end())
+            break;
+        ret += (ret.empty() ? "" : ", ") + column_name + " = " + value_text(found->second);
+    }
+    return ret.empty() ? "all" : ret;
+}
+
+static std::string where_text(const ValueDict *where, const Predicates *predicates) {
+    static const char *comparisons[] = {"<", "<=", ">", ">=", "!="};
+    std::string ret;
+    if (where != nullptr)
+        for (auto const &column: *where)
+            ret += (ret.empty() ? "" : " AND ") + column.first + " = " + value_text(column.second);
+    if (predicates != nullptr)
+        for (auto const &predicate: *predicates)
+            ret += (ret.empty() ? "" : " AND ") + predicate.column_name + " " + comparisons[predicate.comparison]
+                   + " " + value_text(predicate.value);
+    return ret;
+}
+
+static std::string probe_text(const IndexProbe &probe) {
+    std::string ret = probe.index->get_name() + " (";
+    if (probe.lookup)
+        return ret + key_text(probe.index, probe.min_key) + ")";
+    return ret + "from " + key_text(probe.index, probe.min_key) + " to " + key_text(probe.index, probe.max_key) + ")";
+}
+
+static std::string names_text(const ColumnNames &column_names) {
+    std::string ret;
+    for (auto const &column_name: column_names)
+        ret += (ret.empty() ? "" : ", ") + column_name;
+    return ret;
+}
+
+static std::string sort_text(const SortColumns &sort_columns) {
+    std::string ret;
+    for (auto const &sort_column: sort_columns)
+        ret += (ret.empty() ? "" : ", ") + sort_column.column_name + (sort_column.descending ? " DESC" : "");
+    return ret;
+}
+
+// One line of EXPLAIN: what this part of the plan does (but not its inputs).
+std::string EvalPlan::describe() const {
+    static const char *names[] = {"ProjectAll", "Project", "Select", "IndexLookup", "IndexOnlyLookup", "IndexRange",
+                                  "TableScan", "Join", "HashJoin", "IndexNestedLoopJoin", "SortMergeJoin", "Sort",
+                                  "Aggregate", "Count", "Limit", "TopN", "Or", "IndexIntersect", "IndexUnion",
+                                  "ParallelScan"};
+    std::string ret = names[this->type];
+    switch (this->type) {
+        case Project:
+            return ret + " " + names_text(*this->projection);
+        case Select:
+            return ret + " " + where_text(this->select_conjunction, this->select_predicates);
+        case TableScan:
+        case Count:
+            return ret + " " + (this->type == Count ? this->relation->table : this->table).get_table_name();
+        case ParallelScan: {
+            ret += " " + this->table.get_table_name();
+            std::string where = where_text(this->select_conjunction, this->select_predicates);
+            if (!where.empty())
+                ret += " where " + where;
+            return ret + (this->ordered ? " in block order" : "");
+        }
+        case IndexLookup:
+        case IndexOnlyLookup:
+            ret += " " + this->index->get_relation().get_table_name() + " using " + this->index->get_name() + " ("
+                   + key_text(this->index, *this->key) + ")";
+            return this->type == IndexOnlyLookup ? ret + " for " + names_text(*this->projection) : ret;
+        case IndexRange:
+            ret += " " + this->index->get_relation().get_table_name() + " using " + this->index->get_name()
+                   + " (from " + key_text(this->index, *this->key) + " to " + key_text(this->index, *this->max_key)
+                   + ")";
+            return this->limit > 0 ? ret + " first " + std::to_string(this->limit) : ret;
+        case Join:
+        case HashJoin:
+        case SortMergeJoin:
+        case IndexNestedLoopJoin:
+            for (uint i = 0; i < this->left_columns->size(); i++)
+                ret += std::string(i == 0 ? " on " : " AND ") + this->left_name + "." + (*this->left_columns)[i]
+                       + " = " + this->right_name + "." + (*this->right_columns)[i];
+            return this->type == IndexNestedLoopJoin ? ret + " using " + this->index->get_name() : ret;
+        case Sort:
+            return ret + " by " + sort_text(*this->sort_columns);
+        case TopN:
+            return ret + " " + std::to_string(this->limit) + " by " + sort_text(*this->sort_columns);
+        case Aggregate: {
+            ColumnNames outputs;
+            for (auto const &aggregate: *this->aggregates)
+                outputs.push_back(aggregate.output_name);
+            ret += " " + names_text(outputs);
+            return this->projection->empty() ? ret : ret + " by " + names_text(*this->projection);
+        }
+        case Limit:
+            if (this->limit != LimitOperator::ALL)
+                ret += " " + std::to_string(this->limit);
+            return this->offset > 0 ? ret + " offset " + std::to_string(this->offset) : ret;
+        case Or:
+            for (uint i = 0; i < this->alternatives->size(); i++)
+                ret += std::string(i == 0 ? " " : " OR ") + "(" + where_text(&(*this->alternatives)[i].where,
+                                                                             &(*this->alternatives)[i].predicates)
+                       + ")";
+            return ret;
+        case IndexIntersect:
+        case IndexUnion:
+            ret += " " + this->table.get_table_name() + " using";
+            for (uint i = 0; i < this->probes->size(); i++)
+                ret += std::string(i == 0 ? " " : ", ") + probe_text((*this->probes)[i]);
+            return ret;
+        default:
+            return ret;
+    }
+}
+
+std::string EvalPlan::explain(const PlanProfiles *profiles) const {
+    std::string ret;
+    explain(profiles, 0, ret);
+    return ret;
+}
+
+// A line for this part of the plan, indented by depth, then its inputs a level deeper. The rows in are the rows out
+// of its inputs; a part that's carried out by the operator of the part above it (like a TableScan under a Select)
+// has no profile of its own.
+void EvalPlan::explain(const PlanProfiles *profiles, uint depth, std::string &out) const {
+    out += std::string(2 * depth, ' ') + describe();
+    char estimate[40];
+    snprintf(estimate, sizeof(estimate), "  (estimated rows %.0f)", estimated_rows());
+    out += estimate;
+    if (profiles != nullptr) {
+        auto found = profiles->find(this);
+        if (found == profiles->end()) {
+            out += "  (in the operator above)";
+        } else {
+            const OperatorProfile &profile = found->second;
+            long rows_in = -1;
+            for (const EvalPlan *input: {this->relation, this->right}) {
+                if (input == nullptr || this->type == Count)
+                    continue;
+                auto input_profile = profiles->find(input);
+                if (input_profile != profiles->end())
+                    rows_in = (rows_in < 0 ? 0 : rows_in) + input_profile->second.rows;
+            }
+            char actual[200];
+            snprintf(actual, sizeof(actual), "  (actual rows %lu, %.3f ms, blocks read %lu, written %lu, "
+                     "allocations %lu)", profile.rows, profile.ms, profile.blocks_read, profile.blocks_written,
+                     profile.allocations);
+            out += actual;
+            if (rows_in >= 0)
+                out += "  (rows in " + std::to_string(rows_in) + ")";
+        }
+    }
+    out += "\n";
+    if (this->relation != nullptr && this->type != Count)
+        this->relation->explain(profiles, depth + 1, out);
+    if (this->right != nullptr)
+        this->right->explain(profiles, depth + 1, out);
+}
+
+// Pull every row through the plan's operators. Callers that can take the rows a batch at a time should use
+// operators() directly instead.
 ValueDicts *EvalPlan::evaluate() {
-    ValueDicts *ret = nullptr;
-    if (this->type != ProjectAll && this->type != Project)
+    if (this->type != ProjectAll && this->type != Project && this->type != IndexOnlyLookup)
         throw DbRelationError("Invalid evaluation plan--not ending with a projection");
 
-    EvalPipeline pipeline = this->relation->pipeline();
-    DbRelation *temp_table = pipeline.first;
-    Handles *handles = pipeline.second;
-    if (this->type == ProjectAll)
-        ret = temp_table->project(handles);
-    else if (this->type == Project)
-        ret = temp_table->project(handles, this->projection);
+    EvalOperator *op = operators();
+    ValueDicts *ret = new ValueDicts();
+    try {
+        op->open();
+        for (ValueDicts *batch = op->next(); batch != nullptr; batch = op->next()) {
+            ret->insert(ret->end(), batch->begin(), batch->end());
+            delete batch;
+        }
+        op->close();
+    } catch (...) {
+        delete op;
+        EvalOperator::free_batch(ret);
+        throw;
+    }
+    delete op;
+    return ret;
+}
+
+EvalOperator *EvalPlan::operators(PlanProfiles *profiles) {
+    EvalOperator *op = make_operators(profiles);
+    if (profiles == nullptr)
+        return op;
+    return new ProfileOperator(op, (*profiles)[this]);
+}
+
+EvalOperator *EvalPlan::make_operators(PlanProfiles *profiles) {
+    switch (this->type) {
+        case ProjectAll:
+            return this->relation->operators(profiles);  // the rows below already have every column
+        case Project:
+            if (this->relation->type == ParallelScan) {  // the workers can project as they go
+                const EvalPlan *scan = this->relation;
+                return new ParallelScanOperator(scan->table, *scan->select_conjunction,
+                                                scan->select_predicates != nullptr ? *scan->select_predicates
+                                                                                   : Predicates(),
+                                                *this->projection, scan->ordered);
+            }
+            return new ProjectOperator(this->relation->operators(profiles), *this->projection);
+        case Select: {
+            Predicates predicates;
+            if (this->select_predicates != nullptr)
+                predicates = *this->select_predicates;
+            if (this->relation->type == TableScan)  // the scan filters with the compiled where clause
+                return new TableScanOperator(this->relation->table, this->select_conjunction, predicates);
+            return new SelectOperator(this->relation->operators(profiles), *this->select_conjunction, predicates);
+        }
+        case TableScan:
+            return new TableScanOperator(this->table);
+        case ParallelScan:
+            return new ParallelScanOperator(this->table, *this->select_conjunction,
+                                            this->select_predicates != nullptr ? *this->select_predicates
+                                                                               : Predicates(),
+                                            ColumnNames(), this->ordered);
+        case IndexLookup:
+            return new IndexLookupOperator(*this->index, this->key);
+        case IndexOnlyLookup:
+            return new IndexOnlyLookupOperator(*this->index, this->key, *this->projection);
+        case IndexRange:
+            return new IndexRangeOperator(*this->index, this->key, this->max_key, this->limit);
+        case Join:
+        case HashJoin:
+            return new HashJoinOperator(this->relation->operators(profiles), this->right->operators(profiles),
+                                        *this->left_columns, *this->right_columns, this->left_name, this->right_name);
+        case SortMergeJoin:
+            return new SortMergeJoinOperator(this->relation->operators(profiles), this->right->operators(profiles),
+                                             *this->left_columns, *this->right_columns, this->left_name,
+                                             this->right_name,
+                                             this->relation->sorted_on(ascending(*this->left_columns)),
+                                             this->right->sorted_on(ascending(*this->right_columns)));
+        case Sort:
+            return new SortOperator(this->relation->operators(profiles), *this->sort_columns);
+        case Aggregate:
+            return new HashAggregateOperator(this->relation->operators(profiles), *this->projection, *this->aggregates);
+        case Count:
+            return new CountOperator(this->relation->table, *this->aggregates);
+        case Limit:
+            return new LimitOperator(this->relation->operators(profiles), this->limit, this->offset);
+        case TopN:
+            return new TopNOperator(this->relation->operators(profiles), *this->sort_columns, this->limit);
+        case Or:
+            return new SelectOperator(this->relation->operators(profiles), *this->alternatives);
+        case IndexIntersect:
+        case IndexUnion:
+            return new IndexSetOperator(this->table, *this->probes, this->type == IndexIntersect);
+        case IndexNestedLoopJoin: {
+            const EvalPlan *inner = this->right;
+            return new IndexNestedLoopJoinOperator(this->relation->operators(profiles), *this->index,
+                                                   inner->type == Select ? inner->select_conjunction : nullptr,
+                                                   inner->type == Select ? inner->select_predicates : nullptr,
+                                                   *this->left_columns, *this->right_columns, this->left_name,
+                                                   this->right_name);
+        }
+        default:
+            throw DbRelationError("Invalid evaluation plan");
+    }
+}
+
+// Just the handles whose rows satisfy every one of predicates. Deletes handles.
+static Handles *satisfying(DbRelation &table, Handles *handles, const Predicates &predicates) {
+    ColumnNames column_names;
+    for (auto const& predicate: predicates)
+        if (std::find(column_names.begin(), column_names.end(), predicate.column_name) == column_names.end())
+            column_names.push_back(predicate.column_name);
+    Handles *ret = new Handles();
+    for (size_t start = 0; start < handles->size(); start += EvalOperator::BATCH_SIZE) {
+        Handles batch(handles->begin() + start,
+                      handles->begin() + std::min(start + EvalOperator::BATCH_SIZE, handles->size()));
+        ValueDicts *rows = table.project(&batch, &column_names);
+        for (size_t i = 0; i < batch.size(); i++)
+            if (SelectOperator::matches(*(*rows)[i], predicates))
+                ret->push_back(batch[i]);
+        EvalOperator::free_batch(rows);
+    }
+    delete handles;
+    return ret;
+}
+
+// Just the handles whose rows match any of the alternatives. Deletes handles.
+static Handles *satisfying(DbRelation &table, Handles *handles, const Conditions &alternatives) {
+    ColumnNames column_names;
+    for (auto const& condition: alternatives) {
+        for (auto const& column: condition.where)
+            add_column(column_names, column.first);
+        for (auto const& predicate: condition.predicates)
+            add_column(column_names, predicate.column_name);
+    }
+    Handles *ret = new Handles();
+    for (size_t start = 0; start < handles->size(); start += EvalOperator::BATCH_SIZE) {
+        Handles batch(handles->begin() + start,
+                      handles->begin() + std::min(start + EvalOperator::BATCH_SIZE, handles->size()));
+        ValueDicts *rows = table.project(&batch, &column_names);
+        for (size_t i = 0; i < batch.size(); i++)
+            if (SelectOperator::matches(*(*rows)[i], alternatives))
+                ret->push_back(batch[i]);
+        EvalOperator::free_batch(rows);
+    }
     delete handles;
     return ret;
 }
@@ -166,20 +1722,414 @@ EvalPipeline EvalPlan::pipeline() {
     // base cases
     if (this->type == TableScan)
         return EvalPipeline(&this->table, this->table.select());
-    if (this->type == Select && this->relation->type == TableScan)
-        return EvalPipeline(&this->relation->table, this->relation->table.select(this->select_conjunction));
-    if (this->type == IndexLookup)
+    if (this->type == IndexLookup || this->type == IndexOnlyLookup)
         return EvalPipeline(&this->index->get_relation(), this->index->lookup(this->key));
+    if (this->type == IndexRange)
+        return EvalPipeline(&this->index->get_relation(), this->index->range(this->key, this->max_key));
+    if (this->type == IndexIntersect || this->type == IndexUnion)
+        return EvalPipeline(&this->table, IndexSetOperator::handles(*this->probes, this->type == IndexIntersect));
+    if (this->type == ParallelScan) {
+        // handles come from a plain scan
+        EvalPipeline ret(&this->table, this->table.select(this->select_conjunction->empty() ? nullptr
+                                                                                        : this->select_conjunction));
+        if (this->select_predicates != nullptr && !this->select_predicates->empty())
+            ret.second = satisfying(this->table, ret.second, *this->select_predicates);
+        return ret;
+    }
 
-    // recursive case
+    // recursive cases
     if (this->type == Select) {
-        EvalPipeline pipeline = this->relation->pipeline();
-        DbRelation *temp_table = pipeline.first;
-        Handles *handles = pipeline.second;
-        EvalPipeline ret(temp_table, temp_table->select(handles, this->select_conjunction));
-        delete handles;
+        const ValueDict *where = this->select_conjunction->empty() ? nullptr : this->select_conjunction;
+        EvalPipeline ret;
+        if (this->relation->type == TableScan) {
+            ret = EvalPipeline(&this->relation->table, this->relation->table.select(where));
+        } else {
+            EvalPipeline pipeline = this->relation->pipeline();
+            DbRelation *temp_table = pipeline.first;
+            Handles *handles = pipeline.second;
+            ret = EvalPipeline(temp_table, temp_table->select(handles, where));
+            delete handles;
+        }
+        if (this->select_predicates != nullptr && !this->select_predicates->empty())
+            ret.second = satisfying(*ret.first, ret.second, *this->select_predicates);
         return ret;
     }
+    if (this->type == Or) {
+        EvalPipeline pipeline = this->relation->pipeline();
+        return EvalPipeline(pipeline.first, satisfying(*pipeline.first, pipeline.second, *this->alternatives));
+    }
+    if (this->type == ProjectAll || this->type == Project)
+        return this->relation->pipeline();  // projecting doesn't change which rows there are
 
-    throw DbRelationError("Not implemented: pipeline other than Select or TableScan");
+    throw DbRelationError("Invalid evaluation plan");
+}
+
+
+// Register an index in the catalog and build it.
+static DbIndex &test_add_index(DbRelation &table, Identifier index_name, const ColumnNames &key_columns) {
+    int seq = 1;
+    for (auto const& column_name: key_columns) {
+        ValueDict row;
+        row["table_name"] = Value(table.get_table_name());
+        row["index_name"] = Value(index_name);
+        row["seq_in_index"] = Value(seq++);
+        row["column_name"] = Value(column_name);
+        row["index_type"] = Value("BTREE");
+        row["is_unique"] = Value(true);
+        row["is_included"] = Value(false);
+        SQLExec::indices->insert(&row);
+    }
+    DbIndex &index = SQLExec::indices->get_index(table, index_name);
+    index.create();
+    return index;
+}
+
+// Optimize and evaluate SELECT * FROM table WHERE where AND predicates, checking the answer against a plain
+// filtered scan. Reports the access path chosen (under any residual Select).
+static bool test_plan(DbRelation &table, const ValueDict &where, const Predicates &predicates,
+                      EvalPlan::PlanType &access) {
+    EvalPlan *plan = new EvalPlan(EvalPlan::ProjectAll,
+                                  new EvalPlan(new ValueDict(where), new Predicates(predicates), new EvalPlan(table)));
+    EvalPlan *optimized = plan->optimize();
+    const EvalPlan *path = optimized->get_relation();
+    if (path->get_type() == EvalPlan::Select)
+        path = path->get_relation();
+    access = path->get_type();
+    ValueDicts *rows = optimized->evaluate();
+
+    SelectOperator scan(new TableScanOperator(table), where, predicates);
+    size_t expected = 0;
+    bool ok = true;
+    scan.open();
+    for (ValueDicts *batch = scan.next(); batch != nullptr; batch = scan.next()) {
+        for (auto row: *batch)
+            ok = ok && expected < rows->size() && *row == *(*rows)[expected++];
+        EvalOperator::free_batch(batch);
+    }
+    scan.close();
+    ok = ok && expected == rows->size();
+    EvalOperator::free_batch(rows);
+    delete plan;
+    delete optimized;
+    return ok;
+}
+
+bool test_eval_plan() {
+    if (SQLExec::tables == nullptr) {
+        SQLExec::tables = new Tables();
+        SQLExec::indices = new Indices();
+    }
+    ColumnNames column_names;
+    column_names.push_back("a");
+    column_names.push_back("b");
+    column_names.push_back("c");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    HeapTable table("__test_eval_plan", column_names, column_attributes);
+    table.create();
+    const int n = 5000;
+    for (int i = 0; i < n; i++) {
+        ValueDict row;
+        row["a"] = Value(i);
+        row["b"] = Value(i % 3 == 0 ? "fizz" : "buzz");
+        row["c"] = Value(i % 7);
+        table.insert(&row);
+    }
+    ColumnNames a, c_a;
+    a.push_back("a");
+    c_a.push_back("c");
+    c_a.push_back("a");
+    DbIndex &index_a = test_add_index(table, "index_a", a);
+    DbIndex &index_c_a = test_add_index(table, "index_c_a", c_a);
+
+    bool ok = true;
+    EvalPlan::PlanType access;
+    ValueDict where;
+    Predicates predicates;
+
+    // whole key, with a leftover equality for the residual Select
+    where["a"] = Value(17);
+    where["b"] = Value("buzz");
+    ok = ok && test_plan(table, where, predicates, access) && access == EvalPlan::IndexLookup;
+
+    // leading key column alone matches a seventh of the table: cheaper to scan
+    where.clear();
+    where["c"] = Value(3);
+    ok = ok && test_plan(table, where, predicates, access) && access == EvalPlan::TableScan;
+
+    // ... but with a bound on the next key column too, a range scan wins
+    predicates.push_back(Predicate("a", Predicate::LT, Value(100)));
+    ok = ok && test_plan(table, where, predicates, access) && access == EvalPlan::IndexRange;
+
+    // a narrow range, a wide one, and one with nothing to go on
+    where.clear();
+    predicates.clear();
+    predicates.push_back(Predicate("a", Predicate::GE, Value(10)));
+    predicates.push_back(Predicate("a", Predicate::LE, Value(14)));
+    ok = ok && test_plan(table, where, predicates, access) && access == EvalPlan::IndexRange;
+    predicates.clear();
+    predicates.push_back(Predicate("a", Predicate::GT, Value(100)));
+    ok = ok && test_plan(table, where, predicates, access) && access == EvalPlan::TableScan;
+    predicates.clear();
+    predicates.push_back(Predicate("c", Predicate::NE, Value(3)));
+    ok = ok && test_plan(table, where, predicates, access) && access == EvalPlan::TableScan;
+
+    // projecting only key columns: index-only
+    where.clear();
+    predicates.clear();
+    where["c"] = Value(3);
+    where["a"] = Value(10);
+    EvalPlan *plan = new EvalPlan(new ColumnNames(a), new EvalPlan(new ValueDict(where), new EvalPlan(table)));
+    EvalPlan *optimized = plan->optimize();
+    ok = ok && optimized->get_relation()->get_type() == EvalPlan::IndexOnlyLookup;
+    ValueDicts *rows = optimized->evaluate();
+    ok = ok && rows->size() == 1 && rows->at(0)->at("a").n == 10;
+    EvalOperator::free_batch(rows);
+    delete plan;
+    delete optimized;
+    if (!ok)
+        std::cout << "access path choice failed" << std::endl;
+
+    // ORDER BY a: a range scan on index_a comes out sorted already, but not the other way around
+    predicates.clear();
+    predicates.push_back(Predicate("a", Predicate::LT, Value(10)));
+    plan = new EvalPlan(EvalPlan::ProjectAll, new EvalPlan(new SortColumns(1, SortColumn("a", true)),
+            new EvalPlan(new ValueDict(), new Predicates(predicates), new EvalPlan(table))));
+    optimized = plan->optimize();
+    ok = ok && optimized->get_relation()->get_type() == EvalPlan::Sort;  // descending: the index doesn't help
+    rows = optimized->evaluate();
+    ok = ok && rows->size() == 10 && rows->at(0)->at("a").n == 9;
+    EvalOperator::free_batch(rows);
+    delete plan;
+    delete optimized;
+    plan = new EvalPlan(EvalPlan::ProjectAll, new EvalPlan(new SortColumns(1, SortColumn("a")),
+            new EvalPlan(new ValueDict(), new Predicates(predicates), new EvalPlan(table))));
+    optimized = plan->optimize();
+    ok = ok && optimized->get_relation()->get_type() != EvalPlan::Sort;
+    rows = optimized->evaluate();
+    ok = ok && rows->size() == 10;
+    for (size_t i = 0; ok && i < rows->size(); i++)
+        ok = rows->at(i)->at("a").n == (int) i;
+    EvalOperator::free_batch(rows);
+    delete plan;
+    delete optimized;
+    if (!ok)
+        std::cout << "sort elimination failed" << std::endl;
+
+    // ORDER BY ... LIMIT: a bounded heap, or the first few entries of an index in that order
+    plan = new EvalPlan(EvalPlan::ProjectAll, new EvalPlan(3, 0, new EvalPlan(new SortColumns(1, SortColumn("a", true)),
+            new EvalPlan(new ValueDict(), new Predicates(predicates), new EvalPlan(table)))));
+    optimized = plan->optimize();
+    ok = ok && optimized->get_relation()->get_relation()->get_type() == EvalPlan::TopN;
+    rows = optimized->evaluate();
+    ok = ok && rows->size() == 3 && rows->at(0)->at("a").n == 9 && rows->at(2)->at("a").n == 7;
+    EvalOperator::free_batch(rows);
+    delete plan;
+    delete optimized;
+    plan = new EvalPlan(EvalPlan::ProjectAll, new EvalPlan(5, 2, new EvalPlan(new SortColumns(1, SortColumn("a")),
+            new EvalPlan(table))));
+    optimized = plan->optimize();
+    ok = ok && optimized->get_relation()->get_relation()->get_type() == EvalPlan::IndexRange
+         && optimized->get_relation()->get_relation()->estimated_rows() == 7;
+    rows = optimized->evaluate();
+    ok = ok && rows->size() == 5;
+    for (size_t i = 0; ok && i < rows->size(); i++)
+        ok = rows->at(i)->at("a").n == (int) i + 2;
+    EvalOperator::free_batch(rows);
+    delete plan;
+    delete optimized;
+    if (!ok)
+        std::cout << "top-n planning failed" << std::endl;
+
+    // a join, with each side's part of the where clause pushed below it and the small side built on
+    ColumnNames d_names;
+    d_names.push_back("id");
+    d_names.push_back("tag");
+    ColumnAttributes d_attributes;
+    d_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    d_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    HeapTable d("__test_eval_plan_d", d_names, d_attributes);
+    d.create();
+    for (int i = 0; i < 50; i++) {
+        ValueDict row;
+        row["id"] = Value(i);
+        row["tag"] = Value("t" + std::to_string(i % 5));
+        d.insert(&row);
+    }
+    where.clear();
+    predicates.clear();
+    where["d.tag"] = Value("t1");
+    predicates.push_back(Predicate("t.a", Predicate::LT, Value(1000)));
+    plan = new EvalPlan(EvalPlan::ProjectAll, new EvalPlan(new ValueDict(where), new Predicates(predicates),
+            new EvalPlan(EvalPlan::Join, new EvalPlan(table), new EvalPlan(d), new ColumnNames(1, "c"),
+                         new ColumnNames(1, "id"), "t", "d")));
+    optimized = plan->optimize();
+    const EvalPlan *join = optimized->get_relation();
+    ok = ok && join->get_type() == EvalPlan::HashJoin && join->get_relation()->get_type() == EvalPlan::Select
+         && join->get_right()->get_type() != EvalPlan::TableScan
+         && join->get_relation()->estimated_rows() < join->get_right()->estimated_rows();
+    rows = optimized->evaluate();
+    size_t expected = 0;
+    for (int i = 0; i < 1000; i++)
+        if (i % 7 == 1 || i % 7 == 6)
+            expected++;
+    ok = ok && rows->size() == expected;
+    for (auto const& row: *rows)
+        ok = ok && row->at("t.c") == row->at("d.id") && row->at("d.tag").s == "t1" && row->at("t.a").n < 1000;
+    EvalOperator::free_batch(rows);
+    delete plan;
+    delete optimized;
+
+    // ... and with an index on the big side's join column, just the few rows from the small side are looked up
+    plan = new EvalPlan(EvalPlan::ProjectAll, new EvalPlan(new ValueDict(where), new Predicates(),
+            new EvalPlan(EvalPlan::Join, new EvalPlan(table), new EvalPlan(d), new ColumnNames(1, "a"),
+                         new ColumnNames(1, "id"), "t", "d")));
+    optimized = plan->optimize();
+    join = optimized->get_relation();
+    ok = ok && join->get_type() == EvalPlan::IndexNestedLoopJoin && join->get_relation()->get_type() == EvalPlan::Select;
+    rows = optimized->evaluate();
+    ok = ok && rows->size() == 10;
+    for (auto const& row: *rows)
+        ok = ok && row->at("t.a") == row->at("d.id") && row->at("d.tag").s == "t1";
+    EvalOperator::free_batch(rows);
+    delete plan;
+    delete optimized;
+    d.drop();
+    if (!ok)
+        std::cout << "join planning failed" << std::endl;
+
+    // COUNT(*) of a whole table comes from its count of rows; with a where clause or groups, it's a hash aggregate
+    plan = new EvalPlan(new ColumnNames(1, "COUNT(*)"), new EvalPlan(new ColumnNames(),
+            new Aggregates(1, Aggregate(Aggregate::COUNT, "", "COUNT(*)")), new EvalPlan(table)));
+    optimized = plan->optimize();
+    ok = ok && optimized->get_relation()->get_type() == EvalPlan::Count;
+    rows = optimized->evaluate();
+    ok = ok && rows->size() == 1 && rows->at(0)->at("COUNT(*)").n == n;
+    EvalOperator::free_batch(rows);
+    delete plan;
+    delete optimized;
+    where.clear();
+    where["c"] = Value(3);
+    plan = new EvalPlan(new ColumnNames(1, "SUM(a)"), new EvalPlan(new ColumnNames(1, "c"),
+            new Aggregates(1, Aggregate(Aggregate::SUM, "a", "SUM(a)")),
+            new EvalPlan(new ValueDict(where), new EvalPlan(table))));
+    optimized = plan->optimize();
+    ok = ok && optimized->get_relation()->get_type() == EvalPlan::Aggregate;
+    rows = optimized->evaluate();
+    expected = 0;
+    for (int i = 3; i < n; i += 7)
+        expected += i;
+    ok = ok && rows->size() == 1 && rows->at(0)->at("SUM(a)").n == (int) expected;
+    EvalOperator::free_batch(rows);
+    delete plan;
+    delete optimized;
+    if (!ok)
+        std::cout << "aggregate planning failed" << std::endl;
+
+    // x < 100 AND y < 100 on a table indexed on each, where each range alone is worth less than a scan: intersect
+    ColumnNames xy_names;
+    xy_names.push_back("x");
+    xy_names.push_back("y");
+    HeapTable xy("__test_eval_plan_xy", xy_names, ColumnAttributes(2, ColumnAttribute(ColumnAttribute::INT)));
+    xy.create();
+    const int xy_n = 10000;
+    for (int i = 0; i < xy_n; i++) {
+        ValueDict row;
+        row["x"] = Value(i);
+        row["y"] = Value(i * 7919 % xy_n);  // a shuffle of 0..9999
+        xy.insert(&row);
+    }
+    DbIndex &index_x = test_add_index(xy, "index_x", ColumnNames(1, "x"));
+    DbIndex &index_y = test_add_index(xy, "index_y", ColumnNames(1, "y"));
+    where.clear();
+    predicates.clear();
+    predicates.push_back(Predicate("x", Predicate::LT, Value(100)));
+    ok = ok && test_plan(xy, where, predicates, access) && access == EvalPlan::TableScan;
+    predicates.push_back(Predicate("y", Predicate::LT, Value(100)));
+    ok = ok && test_plan(xy, where, predicates, access) && access == EvalPlan::IndexIntersect;
+    where["y"] = Value(42);
+    ok = ok && test_plan(xy, where, predicates, access) && access == EvalPlan::IndexLookup;
+
+    // x = 5 OR y = 7 OR x BETWEEN 50 AND 59: the union of a probe for each; with x != 5 as an alternative, a scan
+    Conditions alternatives(3);
+    alternatives[0].where["x"] = Value(5);
+    alternatives[1].where["y"] = Value(7);
+    alternatives[2].predicates.push_back(Predicate("x", Predicate::GE, Value(50)));
+    alternatives[2].predicates.push_back(Predicate("x", Predicate::LE, Value(59)));
+    for (int i = 0; i < 2; i++) {
+        plan = new EvalPlan(EvalPlan::ProjectAll, new EvalPlan(new Conditions(alternatives), new EvalPlan(xy)));
+        optimized = plan->optimize();
+        const EvalPlan *path = optimized->get_relation();
+        ok = ok && path->get_type() == EvalPlan::Or
+             && path->get_relation()->get_type() == (i == 0 ? EvalPlan::IndexUnion : EvalPlan::TableScan);
+        rows = optimized->evaluate();
+        expected = 0;
+        for (int x = 0; x < xy_n; x++) {
+            ValueDict row;
+            row["x"] = Value(x);
+            row["y"] = Value(x * 7919 % xy_n);
+            if (SelectOperator::matches(row, alternatives))
+                ok = ok && expected < rows->size() && *rows->at(expected++) == row;  // physical order either way
+        }
+        ok = ok && expected == rows->size() && (i == 1 || expected == 12);
+        EvalOperator::free_batch(rows);
+        delete plan;
+        delete optimized;
+        alternatives.push_back(Condition(ValueDict(), Predicates(1, Predicate("x", Predicate::NE, Value(5)))));
+    }
+    index_x.drop();
+    index_y.drop();
+    if (!ok)
+        std::cout << "index intersection and union planning failed" << std::endl;
+
+    // EXPLAIN: the range scan on index_c_a with what it read; operators are only profiled when asked to be
+    where.clear();
+    predicates.clear();
+    where["c"] = Value(3);
+    predicates.push_back(Predicate("a", Predicate::LT, Value(100)));
+    plan = new EvalPlan(new ColumnNames(a), new EvalPlan(new ValueDict(where), new Predicates(predicates),
+                                                         new EvalPlan(table)));
+    optimized = plan->optimize();
+    std::string text = optimized->explain();
+    ok = ok && text.find("Project a  (estimated rows") == 0
+         && text.find("\n  Select a < 100  (estimated rows") != std::string::npos
+         && text.find("\n    IndexRange __test_eval_plan using index_c_a (from c = 3 to c = 3, a = 100)")
+            != std::string::npos;
+    EvalOperator *source = optimized->operators();
+    ok = ok && dynamic_cast<ProfileOperator*>(source) == nullptr;
+    delete source;
+    PlanProfiles profiles;
+    WorkCounters::counting = true;
+    source = optimized->operators(&profiles);
+    source->open();
+    for (ValueDicts *batch = source->next(); batch != nullptr; batch = source->next())
+        EvalOperator::free_batch(batch);
+    source->close();
+    WorkCounters::counting = false;
+    delete source;
+    const OperatorProfile &range = profiles[optimized->get_relation()->get_relation()];
+    ok = ok && profiles[optimized].rows == 14 && range.rows == 14 && range.blocks_read > 0 && range.allocations > 0
+         && range.blocks_written == 0 && profiles[optimized].ms >= range.ms;
+    text = optimized->explain(&profiles);
+    ok = ok && text.find("(actual rows 14,") != std::string::npos && text.find("(rows in 14)") != std::string::npos;
+    delete plan;
+    delete optimized;
+    if (!ok)
+        std::cout << "explain failed:" << std::endl << text;
+
+    index_a.drop();
+    index_c_a.drop();
+    for (auto const& table_name: {table.get_table_name(), xy.get_table_name()}) {
+        ValueDict catalog;
+        catalog["table_name"] = Value(table_name);
+        Handles *handles = SQLExec::indices->select(&catalog);
+        for (auto const& handle: *handles)
+            SQLExec::indices->del(handle);
+        delete handles;
+    }
+    xy.drop();
+    table.drop();
+    return ok;
 }
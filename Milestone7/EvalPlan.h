@@ -5,9 +5,16 @@
 #pragma once
 
 #include "storage_engine.h"
+#include "EvalOperator.h"
+#include "SortOperator.h"
+#include "AggregateOperator.h"
+#include "ParallelOperator.h"
 
 
 typedef std::pair<DbRelation*,Handles*> EvalPipeline;
+typedef std::map<int, Value> ParameterValues;  // by Value::parameter
+class EvalPlan;
+typedef std::map<const EvalPlan*, OperatorProfile> PlanProfiles;  // for EXPLAIN ANALYZE
 
 class EvalPlan {
 public:
@@ -16,14 +23,44 @@ public:
         Project,
         Select,
         IndexLookup,
-        TableScan
+        IndexOnlyLookup,
+        IndexRange,
+        TableScan,
+        Join,
+        HashJoin,
+        IndexNestedLoopJoin,
+        SortMergeJoin,
+        Sort,
+        Aggregate,
+        Count,
+        Limit,
+        TopN,
+        Or,
+        IndexIntersect,
+        IndexUnion,
+        ParallelScan
     };
 
     EvalPlan(PlanType type, EvalPlan *relation);  // use for ProjectAll, e.g., EvalPlan(EvalPlan::ProjectAll, table);
     EvalPlan(ColumnNames *projection, EvalPlan *relation); // use for Project
     EvalPlan(ValueDict* conjunction, EvalPlan *relation);  // use for Select
+    EvalPlan(ValueDict* conjunction, Predicates *predicates, EvalPlan *relation);  // use for Select with predicates
+    EvalPlan(SortColumns *sort_columns, EvalPlan *relation);  // use for Sort
+    EvalPlan(ColumnNames *group_by, Aggregates *aggregates, EvalPlan *relation);  // use for Aggregate
+    EvalPlan(u_long limit, u_long offset, EvalPlan *relation);  // use for Limit (limit may be LimitOperator::ALL)
+    EvalPlan(Conditions *alternatives, EvalPlan *relation);  // use for Or (a Select for any of the alternatives)
+    EvalPlan(PlanType type, IndexProbes *probes, DbRelation &table);  // use for IndexIntersect and IndexUnion
     EvalPlan(DbRelation &table);  // use for TableScan
+    EvalPlan(DbRelation &table, ValueDict *conjunction, Predicates *predicates);  // use for ParallelScan (a Select
+                                                                                  // over a TableScan)
     EvalPlan(ValueDict *key, DbIndex *index); // use for IndexLookup
+    EvalPlan(ColumnNames *projection, ValueDict *key, DbIndex *index); // use for IndexOnlyLookup
+    EvalPlan(ValueDict *min_key, ValueDict *max_key, DbIndex *index); // use for IndexRange
+    EvalPlan(PlanType type, EvalPlan *left, EvalPlan *right, ColumnNames *left_columns, ColumnNames *right_columns,
+             const Identifier &left_name, const Identifier &right_name); // use for Join, HashJoin (built on left)
+                                                                         // and SortMergeJoin
+    EvalPlan(EvalPlan *outer, EvalPlan *inner, DbIndex *index, ColumnNames *outer_columns, ColumnNames *inner_columns,
+             const Identifier &outer_name, const Identifier &inner_name); // use for IndexNestedLoopJoin
     EvalPlan(const EvalPlan *other);  // use for copying
     virtual ~EvalPlan();
 
@@ -34,13 +71,66 @@ public:
     ValueDicts *evaluate();
     EvalPipeline pipeline();
 
+    // The operators that carry out the plan a batch of rows at a time (caller deletes). With profiles, each is
+    // wrapped in a ProfileOperator that fills in the profile of the part of the plan it carries out.
+    EvalOperator *operators(PlanProfiles *profiles=nullptr);
+
+    // The plan as an indented tree, a line per part, with the rows each is estimated to produce and, given
+    // profiles, what it actually did (for EXPLAIN and EXPLAIN ANALYZE)
+    std::string explain(const PlanProfiles *profiles=nullptr) const;
+
+    // Put these values in place of the parameters of a prepared statement's plan (those whose Value::parameter
+    // isn't 0), keeping them marked as parameters so a copy of the plan can be bound again
+    void bind(const ParameterValues &values);
+    // the same for a row, predicates or a single value
+    static void bind(ValueDict &row, const ParameterValues &values);
+    static void bind(Predicates &predicates, const ParameterValues &values);
+    static void bind(Value &value, const ParameterValues &values);
+
+    // About how many rows the plan will produce
+    double estimated_rows() const;
+
+    // Whether the plan's rows come out in this order anyway
+    bool sorted_on(const SortColumns &sort_columns) const;
+
+    PlanType get_type() const { return type; }
+    const EvalPlan *get_relation() const { return relation; }
+    const EvalPlan *get_right() const { return right; }
+
 protected:
 
     PlanType type;
-    EvalPlan *relation;  // for everything except TableScan and IndexLookup
-    ColumnNames *projection;  // for Project
+    EvalPlan *relation;  // for everything except TableScan and IndexLookup; the left side of a join
+    EvalPlan *right;  // for the joins; for IndexNestedLoopJoin the inner side, a (Select over a) TableScan
+    ColumnNames *left_columns;  // for the joins: joining where left_columns[i] = right_columns[i]
+    ColumnNames *right_columns;
+    Identifier left_name;  // for the joins: what that side's columns are qualified with (see JoinOperator)
+    Identifier right_name;
+    SortColumns *sort_columns;  // for Sort
+    Aggregates *aggregates;  // for Aggregate and Count
+    ColumnNames *projection;  // for Project and IndexOnlyLookup, and the group columns for Aggregate
     ValueDict *select_conjunction;  // for Select
+    Predicates *select_predicates;  // for Select, if it has any besides the equalities
     DbRelation &table;  // for TableScan
-    ValueDict *key; // for IndexLookup
-    DbIndex *index; // for IndexLookup
+    ValueDict *key; // for IndexLookup and IndexOnlyLookup, and the minimum for IndexRange
+    ValueDict *max_key; // for IndexRange
+    DbIndex *index; // for IndexLookup, IndexOnlyLookup, IndexRange and IndexNestedLoopJoin
+    u_long limit;  // for Limit and TopN; for IndexRange, how many entries to read (0 for all of them)
+    u_long offset;  // for Limit
+    Conditions *alternatives;  // for Or
+    IndexProbes *probes;  // for IndexIntersect and IndexUnion
+    bool ordered;  // for ParallelScan: whether the rows have to come in the order a TableScan would give them
+
+    EvalOperator *make_operators(PlanProfiles *profiles);
+    std::string describe() const;
+    void explain(const PlanProfiles *profiles, uint depth, std::string &out) const;
+    EvalPlan *access_path(const ColumnNames *projection);
+    EvalPlan *push_down();
+    EvalPlan *join_path();
+    EvalPlan *limit_path();
+    EvalPlan *or_path();
+    void any_order();
+    DbIndex *join_index(const ColumnNames &join_columns) const;
 };
+
+bool test_eval_plan();
@@ -0,0 +1,631 @@
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include "JoinOperator.h"
+#include "heap_storage.h"
+#include "btree.h"
+
+
+JoinOperator::JoinOperator(EvalOperator *left, EvalOperator *right, const ColumnNames &left_columns,
+                           const ColumnNames &right_columns, const Identifier &left_name,
+                           const Identifier &right_name)
+        : left(left), right(right), left_columns(left_columns), right_columns(right_columns), left_name(left_name),
+          right_name(right_name) {
+}
+
+JoinOperator::~JoinOperator() {
+    delete this->left;
+    delete this->right;
+}
+
+Identifier JoinOperator::qualified(const Identifier &name, const Identifier &column_name) {
+    return name.empty() ? column_name : name + "." + column_name;
+}
+
+ValueDict *JoinOperator::joined(const ValueDict &left_row, const ValueDict &right_row) const {
+    ValueDict *row = new ValueDict();
+    WorkCounters::allocated();
+    for (auto const &column: left_row)
+        (*row)[qualified(this->left_name, column.first)] = column.second;
+    for (auto const &column: right_row)
+        (*row)[qualified(this->right_name, column.first)] = column.second;
+    return row;
+}
+
+
+const uint32_t JoinHashTable::NONE;
+
+JoinHashTable::JoinHashTable(const ColumnNames &key_columns)
+        : key_columns(key_columns), rows(), hashes(), chain(), slots(), distinct(0), memory(0) {
+}
+
+JoinHashTable::~JoinHashTable() {
+    clear();
+}
+
+void JoinHashTable::clear() {
+    for (auto row: this->rows)
+        delete row;
+    this->rows.clear();
+    this->hashes.clear();
+    this->chain.clear();
+    this->slots.clear();
+    this->distinct = 0;
+    this->memory = 0;
+}
+
+// Hand every row over to the caller, leaving the table empty.
+ValueDicts *JoinHashTable::take() {
+    ValueDicts *ret = new ValueDicts();
+    WorkCounters::allocated();
+    ret->swap(this->rows);
+    clear();
+    return ret;
+}
+
+void JoinHashTable::add(ValueDict *row) {
+    uint32_t h = (uint32_t) hash(*row, this->key_columns);
+    if ((this->distinct + 1) * 2 > this->slots.size())
+        grow();
+    uint32_t number = (uint32_t) this->rows.size();
+    this->rows.push_back(row);
+    this->hashes.push_back(h);
+    this->chain.push_back(NONE);
+    this->memory += EvalOperator::row_bytes(*row) + 3 * sizeof(uint32_t);
+
+    size_t mask = this->slots.size() - 1;
+    for (size_t slot = h & mask; ; slot = (slot + 1) & mask) {
+        uint32_t head = this->slots[slot];
+        if (head == NONE) {
+            this->slots[slot] = number;
+            this->distinct++;
+            return;
+        }
+        if (this->hashes[head] == h && same_key(*this->rows[head], *row, this->key_columns)) {
+            this->chain[number] = head;
+            this->slots[slot] = number;
+            return;
+        }
+    }
+}
+
+uint32_t JoinHashTable::find(const ValueDict &probe, const ColumnNames &probe_columns) const {
+    if (this->slots.empty())
+        return NONE;
+    uint32_t h = (uint32_t) hash(probe, probe_columns);
+    size_t mask = this->slots.size() - 1;
+    for (size_t slot = h & mask; ; slot = (slot + 1) & mask) {
+        uint32_t head = this->slots[slot];
+        if (head == NONE)
+            return NONE;
+        if (this->hashes[head] == h && same_key(*this->rows[head], probe, probe_columns))
+            return head;
+    }
+}
+
+bool JoinHashTable::same_key(const ValueDict &row, const ValueDict &probe, const ColumnNames &probe_columns) const {
+    for (size_t i = 0; i < this->key_columns.size(); i++)
+        if (row.at(this->key_columns[i]) != probe.at(probe_columns[i]))
+            return false;
+    return true;
+}
+
+// Double the slots and put each key's latest row back in; the chains behind them come along unchanged.
+void JoinHashTable::grow() {
+    std::vector<uint32_t> old;
+    old.swap(this->slots);
+    this->slots.assign(std::max((size_t) 16, old.size() * 2), NONE);
+    this->memory += (this->slots.size() - old.size()) * sizeof(uint32_t);
+    size_t mask = this->slots.size() - 1;
+    for (auto head: old) {
+        if (head == NONE)
+            continue;
+        size_t slot = this->hashes[head] & mask;
+        while (this->slots[slot] != NONE)
+            slot = (slot + 1) & mask;
+        this->slots[slot] = head;
+    }
+}
+
+// Mix the key's values together. The low 32 bits pick a slot; the high ones are left for picking a partition.
+uint64_t JoinHashTable::hash(const ValueDict &row, const ColumnNames &key_columns) {
+    uint64_t h = 0x9e3779b97f4a7c15ULL;
+    for (auto const &column_name: key_columns) {
+        auto found = row.find(column_name);
+        if (found == row.end())
+            throw DbRelationError("unknown column '" + column_name + "'");
+        const Value &value = found->second;
+        uint64_t v = value.data_type == ColumnAttribute::TEXT ? std::hash<std::string>()(value.s) : (uint32_t) value.n;
+        h = (h ^ v) * 0xff51afd7ed558ccdULL;
+        h ^= h >> 32;
+    }
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+
+size_t HashJoinOperator::memory_budget = 64 * 1024 * 1024;
+const uint HashJoinOperator::PARTITIONS;
+
+HashJoinOperator::HashJoinOperator(EvalOperator *build, EvalOperator *probe, const ColumnNames &build_columns,
+                                   const ColumnNames &probe_columns, const Identifier &build_name,
+                                   const Identifier &probe_name)
+        : JoinOperator(build, probe, build_columns, probe_columns, build_name, probe_name), table(build_columns),
+          probe_source(nullptr), probe_batch(nullptr), probe_position(0), match(JoinHashTable::NONE),
+          partition(0), build_spill(), probe_spill() {
+}
+
+HashJoinOperator::~HashJoinOperator() {
+    close();
+}
+
+// Build the table from the whole build input, switching over to partitioning both inputs onto disk if it won't fit.
+void HashJoinOperator::open() {
+    close();
+    this->left->open();
+    for (ValueDicts *batch = this->left->next(); batch != nullptr; batch = this->left->next()) {
+        for (auto row: *batch)
+            this->table.add(row);
+        delete batch;
+        if (this->table.bytes() > memory_budget) {
+            spill(*this->left, this->left_columns, this->build_spill, this->table.take());
+            break;
+        }
+    }
+    this->left->close();
+
+    if (spilled()) {
+        this->right->open();
+        spill(*this->right, this->right_columns, this->probe_spill, new ValueDicts());
+        this->right->close();
+        this->partition = 0;
+        next_partition();
+    } else {
+        this->right->open();
+        this->probe_source = this->right;
+    }
+}
+
+ValueDicts *HashJoinOperator::next() {
+    ValueDicts *ret = new ValueDicts();
+    WorkCounters::allocated();
+    while (ret->size() < BATCH_SIZE && this->probe_source != nullptr) {
+        if (this->match != JoinHashTable::NONE) {
+            ret->push_back(joined(this->table.row(this->match), *(*this->probe_batch)[this->probe_position - 1]));
+            this->match = this->table.next(this->match);
+            continue;
+        }
+        if (this->probe_batch != nullptr && this->probe_position < this->probe_batch->size()) {
+            this->match = this->table.find(*(*this->probe_batch)[this->probe_position++], this->right_columns);
+            continue;
+        }
+        if (this->probe_batch != nullptr)
+            free_batch(this->probe_batch);
+        this->probe_position = 0;
+        this->probe_batch = this->probe_source->next();
+        if (this->probe_batch == nullptr && !(spilled() && next_partition())) {
+            if (this->probe_source == this->right)
+                this->right->close();
+            this->probe_source = nullptr;
+        }
+    }
+    if (ret->empty()) {
+        delete ret;
+        return nullptr;
+    }
+    return ret;
+}
+
+void HashJoinOperator::close() {
+    if (this->probe_batch != nullptr)
+        free_batch(this->probe_batch);
+    this->probe_batch = nullptr;
+    this->probe_position = 0;
+    this->match = JoinHashTable::NONE;
+    if (this->probe_source == this->right)
+        this->right->close();
+    else
+        delete this->probe_source;
+    this->probe_source = nullptr;
+    this->table.clear();
+    drop_spill(this->build_spill);
+    drop_spill(this->probe_spill);
+}
+
+// Write pending and then the rest of input out to one temporary table per partition, made when its first row
+// comes along. The rows are deleted as they go.
+void HashJoinOperator::spill(EvalOperator &input, const ColumnNames &key_columns, std::vector<HeapTable*> &files,
+                             ValueDicts *pending) {
+    files.assign(PARTITIONS, nullptr);
+    for (ValueDicts *batch = pending; batch != nullptr; batch = input.next()) {
+        for (auto row: *batch) {
+            uint p = (uint) (JoinHashTable::hash(*row, key_columns) >> 32) % PARTITIONS;
+            if (files[p] == nullptr)
+                files[p] = temp_table("hash_join", *row);
+            files[p]->insert(row);
+        }
+        free_batch(batch);
+    }
+}
+
+// Load the build rows of the next partition that has rows on both sides and start on its probe rows. False once
+// there are no partitions left.
+bool HashJoinOperator::next_partition() {
+    if (this->probe_source != this->right)
+        delete this->probe_source;
+    this->probe_source = nullptr;
+    this->table.clear();
+    while (this->partition < PARTITIONS) {
+        uint p = this->partition++;
+        if (this->build_spill[p] == nullptr || this->probe_spill[p] == nullptr)
+            continue;
+        TableScanOperator scan(*this->build_spill[p]);
+        scan.open();
+        for (ValueDicts *batch = scan.next(); batch != nullptr; batch = scan.next()) {
+            for (auto row: *batch)
+                this->table.add(row);
+            delete batch;
+        }
+        scan.close();
+        this->probe_source = new TableScanOperator(*this->probe_spill[p]);
+        this->probe_source->open();
+        return true;
+    }
+    return false;
+}
+
+void HashJoinOperator::drop_spill(std::vector<HeapTable*> &files) {
+    for (auto file: files) {
+        if (file != nullptr) {
+            file->drop();
+            delete file;
+        }
+    }
+    files.clear();
+}
+
+
+IndexNestedLoopJoinOperator::IndexNestedLoopJoinOperator(EvalOperator *outer, DbIndex &index,
+                                                         const ValueDict *inner_where,
+                                                         const Predicates *inner_predicates,
+                                                         const ColumnNames &outer_columns,
+                                                         const ColumnNames &inner_columns,
+                                                         const Identifier &outer_name, const Identifier &inner_name)
+        : JoinOperator(outer, nullptr, outer_columns, inner_columns, outer_name, inner_name), index(index),
+          inner_where(), inner_predicates(), key_outer_columns() {
+    if (inner_where != nullptr)
+        this->inner_where = *inner_where;
+    if (inner_predicates != nullptr)
+        this->inner_predicates = *inner_predicates;
+    for (auto const &key_column: index.get_key_columns()) {
+        auto found = std::find(inner_columns.begin(), inner_columns.end(), key_column);
+        if (found == inner_columns.end())
+            throw DbRelationError("index key column '" + key_column + "' isn't joined on");
+        this->key_outer_columns.push_back(outer_columns[found - inner_columns.begin()]);
+    }
+}
+
+IndexNestedLoopJoinOperator::~IndexNestedLoopJoinOperator() {
+}
+
+void IndexNestedLoopJoinOperator::open() {
+    this->left->open();
+}
+
+ValueDicts *IndexNestedLoopJoinOperator::next() {
+    const ColumnNames &key_columns = this->index.get_key_columns();
+    DbRelation &inner = this->index.get_relation();
+    ValueDicts *batch;
+    while ((batch = this->left->next()) != nullptr) {
+        // the outer rows in join key order
+        std::vector<KeyValue> keys(batch->size());
+        std::vector<size_t> order(batch->size());
+        for (size_t i = 0; i < batch->size(); i++) {
+            for (auto const &column_name: this->key_outer_columns) {
+                auto found = (*batch)[i]->find(column_name);
+                if (found == (*batch)[i]->end())
+                    throw DbRelationError("unknown column '" + column_name + "'");
+                keys[i].push_back(found->second);
+            }
+            order[i] = i;
+        }
+        std::sort(order.begin(), order.end(), [&keys](size_t a, size_t b) { return keys[a] < keys[b]; });
+
+        ValueDicts key_dicts;
+        for (auto i: order) {
+            ValueDict *key = new ValueDict();
+            for (size_t k = 0; k < key_columns.size(); k++)
+                (*key)[key_columns[k]] = keys[i][k];
+            key_dicts.push_back(key);
+        }
+        HandlesByKey *found = this->index.lookup_many(&key_dicts);
+        for (auto key: key_dicts)
+            delete key;
+
+        Handles handles;
+        std::vector<size_t> outer_of;  // the outer row that goes with each of handles
+        for (size_t j = 0; j < order.size(); j++) {
+            for (auto const &handle: *(*found)[j]) {
+                handles.push_back(handle);
+                outer_of.push_back(order[j]);
+            }
+            delete (*found)[j];
+        }
+        delete found;
+
+        ValueDicts *ret = new ValueDicts();
+        WorkCounters::allocated();
+        ValueDicts *inner_rows = inner.project(&handles);
+        for (size_t j = 0; j < inner_rows->size(); j++) {
+            const ValueDict &inner_row = *(*inner_rows)[j];
+            if (SelectOperator::matches(inner_row, this->inner_where)
+                    && SelectOperator::matches(inner_row, this->inner_predicates))
+                ret->push_back(joined(*(*batch)[outer_of[j]], inner_row));
+        }
+        free_batch(inner_rows);
+        free_batch(batch);
+        if (!ret->empty())
+            return ret;
+        delete ret;
+    }
+    return nullptr;
+}
+
+void IndexNestedLoopJoinOperator::close() {
+    this->left->close();
+}
+
+
+// input sorted on columns, ascending, unless it is already
+static EvalOperator *in_order(EvalOperator *input, const ColumnNames &columns, bool sorted) {
+    if (sorted)
+        return input;
+    SortColumns sort_columns;
+    for (auto const &column_name: columns)
+        sort_columns.push_back(SortColumn(column_name));
+    return new SortOperator(input, sort_columns);
+}
+
+SortMergeJoinOperator::SortMergeJoinOperator(EvalOperator *left, EvalOperator *right, const ColumnNames &left_columns,
+                                             const ColumnNames &right_columns, const Identifier &left_name,
+                                             const Identifier &right_name, bool left_sorted, bool right_sorted)
+        : JoinOperator(in_order(left, left_columns, left_sorted), in_order(right, right_columns, right_sorted),
+                       left_columns, right_columns, left_name, right_name),
+          left_cursor(nullptr), right_cursor(nullptr), group(), group_position(0) {
+}
+
+SortMergeJoinOperator::~SortMergeJoinOperator() {
+    close();
+}
+
+void SortMergeJoinOperator::open() {
+    close();
+    this->left->open();
+    this->right->open();
+    this->left_cursor = new RowCursor(*this->left);
+    this->right_cursor = new RowCursor(*this->right);
+}
+
+ValueDicts *SortMergeJoinOperator::next() {
+    ValueDicts *ret = new ValueDicts();
+    WorkCounters::allocated();
+    while (ret->size() < BATCH_SIZE && this->left_cursor != nullptr && this->left_cursor->valid()) {
+        if (!this->group.empty()) {
+            if (this->group_position < this->group.size()) {
+                ret->push_back(joined(this->left_cursor->row(), *this->group[this->group_position++]));
+                continue;
+            }
+            // done with this left row; the next one may have the same key
+            this->left_cursor->advance();
+            this->group_position = 0;
+            if (!this->left_cursor->valid() || compare(this->left_cursor->row(), *this->group[0]) != 0)
+                clear_group();
+            continue;
+        }
+        if (!this->right_cursor->valid())
+            break;
+        int c = compare(this->left_cursor->row(), this->right_cursor->row());
+        if (c < 0) {
+            this->left_cursor->advance();
+        } else if (c > 0) {
+            this->right_cursor->advance();
+        } else {
+            while (this->right_cursor->valid() && compare(this->left_cursor->row(), this->right_cursor->row()) == 0) {
+                this->group.push_back(this->right_cursor->take());
+                this->right_cursor->advance();
+            }
+        }
+    }
+    if (ret->empty()) {
+        delete ret;
+        return nullptr;
+    }
+    return ret;
+}
+
+void SortMergeJoinOperator::close() {
+    clear_group();
+    if (this->left_cursor != nullptr) {
+        delete this->left_cursor;
+        delete this->right_cursor;
+        this->left_cursor = this->right_cursor = nullptr;
+        this->left->close();
+        this->right->close();
+    }
+}
+
+int SortMergeJoinOperator::compare(const ValueDict &left_row, const ValueDict &right_row) const {
+    for (size_t i = 0; i < this->left_columns.size(); i++) {
+        const Value &left_value = left_row.at(this->left_columns[i]), &right_value = right_row.at(this->right_columns[i]);
+        if (left_value < right_value)
+            return -1;
+        if (right_value < left_value)
+            return 1;
+    }
+    return 0;
+}
+
+void SortMergeJoinOperator::clear_group() {
+    for (auto row: this->group)
+        delete row;
+    this->group.clear();
+    this->group_position = 0;
+}
+
+
+// Join the probe table to the build table's id with a small enough budget to spill or not, and check every joined
+// row against the inputs.
+static bool test_hash_join(DbRelation &build_table, DbRelation &probe_table, const Identifier &build_column,
+                           const Identifier &probe_column, size_t budget, bool expect_spill, size_t expected) {
+    size_t saved = HashJoinOperator::memory_budget;
+    HashJoinOperator::memory_budget = budget;
+    HashJoinOperator join(new TableScanOperator(build_table), new TableScanOperator(probe_table),
+                          ColumnNames(1, build_column), ColumnNames(1, probe_column), build_table.get_table_name(),
+                          probe_table.get_table_name());
+    Identifier build_key = JoinOperator::qualified(build_table.get_table_name(), build_column);
+    Identifier probe_key = JoinOperator::qualified(probe_table.get_table_name(), probe_column);
+    size_t count = 0, columns = build_table.get_column_names().size() + probe_table.get_column_names().size();
+    bool ok = true;
+    join.open();
+    ok = join.spilled() == expect_spill;
+    for (ValueDicts *batch = join.next(); batch != nullptr; batch = join.next()) {
+        ok = ok && !batch->empty() && batch->size() <= EvalOperator::BATCH_SIZE;
+        for (auto row: *batch)
+            ok = ok && row->size() == columns && row->at(build_key) == row->at(probe_key);
+        count += batch->size();
+        EvalOperator::free_batch(batch);
+    }
+    join.close();
+    HashJoinOperator::memory_budget = saved;
+    return ok && count == expected;
+}
+
+bool test_join_operators() {
+    ColumnNames a_names, b_names;
+    ColumnAttributes a_attributes, b_attributes;
+    a_names.push_back("id");
+    a_names.push_back("name");
+    a_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    a_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    b_names.push_back("a_id");
+    b_names.push_back("flag");
+    b_names.push_back("n");
+    b_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    b_attributes.push_back(ColumnAttribute(ColumnAttribute::BOOLEAN));
+    b_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    HeapTable a("__test_join_a", a_names, a_attributes);
+    HeapTable b("__test_join_b", b_names, b_attributes);
+    a.create();
+    b.create();
+    const int n_a = 2000, n_b = 5000;
+    for (int i = 0; i < n_a; i++) {
+        ValueDict row;
+        row["id"] = Value(i);
+        row["name"] = Value("name " + std::to_string(i));
+        a.insert(&row);
+    }
+    for (int i = 0; i < n_b; i++) {
+        ValueDict row;
+        row["a_id"] = Value(i % 2500);  // ids 2000 and up have no match
+        row["flag"] = Value(i % 2 == 0);
+        row["n"] = Value(i);
+        b.insert(&row);
+    }
+    const size_t expected = 4000;
+    bool ok = true;
+
+    // in memory, building on the unique side and then on the side with duplicate keys
+    ok = ok && test_hash_join(a, b, "id", "a_id", HashJoinOperator::memory_budget, false, expected);
+    ok = ok && test_hash_join(b, a, "a_id", "id", HashJoinOperator::memory_budget, false, expected);
+    if (!ok)
+        std::cout << "in-memory hash join failed" << std::endl;
+
+    // partitioned out to disk
+    ok = ok && test_hash_join(a, b, "id", "a_id", 16 * 1024, true, expected);
+    ok = ok && test_hash_join(b, a, "a_id", "id", 16 * 1024, true, expected);
+    if (!ok)
+        std::cout << "grace hash join failed" << std::endl;
+
+    // nothing to build on
+    ValueDict none;
+    none["id"] = Value(-1);
+    HashJoinOperator empty(new TableScanOperator(a, &none), new TableScanOperator(b), ColumnNames(1, "id"),
+                           ColumnNames(1, "a_id"), "a", "b");
+    empty.open();
+    ok = ok && empty.next() == nullptr;
+    empty.close();
+    if (!ok)
+        std::cout << "empty hash join failed" << std::endl;
+
+    // looking each outer row up in an index on the inner join column, with and without a filter on the inner rows
+    BTreeIndex index(a, "__test_join_a_id", ColumnNames(1, "id"), true);
+    index.create();
+    IndexNestedLoopJoinOperator looked_up(new TableScanOperator(b), index, nullptr, nullptr, ColumnNames(1, "a_id"),
+                                          ColumnNames(1, "id"), "b", "a");
+    size_t count = 0;
+    looked_up.open();
+    for (ValueDicts *batch = looked_up.next(); batch != nullptr; batch = looked_up.next()) {
+        ok = ok && batch->size() <= EvalOperator::BATCH_SIZE;
+        for (auto row: *batch)
+            ok = ok && row->size() == 5 && row->at("a.id") == row->at("b.a_id")
+                 && row->at("a.name").s == "name " + std::to_string(row->at("b.a_id").n);
+        count += batch->size();
+        EvalOperator::free_batch(batch);
+    }
+    looked_up.close();
+    ok = ok && count == expected;
+    ValueDict seven;
+    seven["name"] = Value("name 7");
+    IndexNestedLoopJoinOperator filtered(new TableScanOperator(b), index, &seven, nullptr, ColumnNames(1, "a_id"),
+                                         ColumnNames(1, "id"), "b", "a");
+    count = 0;
+    filtered.open();
+    for (ValueDicts *batch = filtered.next(); batch != nullptr; batch = filtered.next()) {
+        for (auto row: *batch)
+            ok = ok && row->at("a.id").n == 7;
+        count += batch->size();
+        EvalOperator::free_batch(batch);
+    }
+    filtered.close();
+    ok = ok && count == 2;
+    index.drop();
+    if (!ok)
+        std::cout << "index nested-loop join failed" << std::endl;
+
+    // merging, sorting both sides first (externally for one of them) and then with one side already in order
+    size_t saved = SortOperator::memory_budget;
+    SortOperator::memory_budget = 32 * 1024;
+    SortMergeJoinOperator merged(new TableScanOperator(b), new TableScanOperator(a), ColumnNames(1, "a_id"),
+                                 ColumnNames(1, "id"), "b", "a");
+    SortMergeJoinOperator presorted(new TableScanOperator(a), new TableScanOperator(b), ColumnNames(1, "id"),
+                                    ColumnNames(1, "a_id"), "a", "b", true, false);
+    SortMergeJoinOperator *merges[2] = {&merged, &presorted};
+    for (auto merge: merges) {
+        ValueDict *previous = nullptr;
+        count = 0;
+        merge->open();
+        for (ValueDicts *batch = merge->next(); batch != nullptr; batch = merge->next()) {
+            ok = ok && batch->size() <= EvalOperator::BATCH_SIZE;
+            for (auto row: *batch) {
+                ok = ok && row->size() == 5 && row->at("a.id") == row->at("b.a_id")
+                     && (previous == nullptr || !(row->at("a.id") < previous->at("a.id")));
+                delete previous;
+                previous = row;
+            }
+            count += batch->size();
+            delete batch;
+        }
+        delete previous;
+        merge->close();
+        ok = ok && count == expected;
+    }
+    SortOperator::memory_budget = saved;
+    if (!ok)
+        std::cout << "sort-merge join failed" << std::endl;
+
+    a.drop();
+    b.drop();
+    return ok;
+}
@@ -0,0 +1,164 @@
+/**
+ * Operators that join two inputs on equal column values.
+ * JoinOperator
+ * JoinHashTable
+ * HashJoinOperator
+ * IndexNestedLoopJoinOperator
+ * SortMergeJoinOperator
+ */
+#pragma once
+
+#include <cstdint>
+#include "EvalOperator.h"
+#include "SortOperator.h"
+
+
+// Joined rows carry the columns of both sides. A side's column names are qualified with its name ("t.a") unless
+// that name is empty, which means its rows come from another join and are qualified already.
+class JoinOperator : public EvalOperator {
+public:
+    // takes ownership of left and right; joins where left_columns[i] = right_columns[i] for every i
+    JoinOperator(EvalOperator *left, EvalOperator *right, const ColumnNames &left_columns,
+                 const ColumnNames &right_columns, const Identifier &left_name, const Identifier &right_name);
+    virtual ~JoinOperator();
+
+    static Identifier qualified(const Identifier &name, const Identifier &column_name);
+
+protected:
+    EvalOperator *left;
+    EvalOperator *right;
+    ColumnNames left_columns;
+    ColumnNames right_columns;
+    Identifier left_name;
+    Identifier right_name;
+
+    ValueDict *joined(const ValueDict &left_row, const ValueDict &right_row) const;
+};
+
+
+// A compact open-addressing table of one join input's rows. Each slot holds the number of the latest row with a
+// given key (found by linear probing on the key's hash); earlier rows with the same key chain back from it through
+// next. Rows belong to the table.
+class JoinHashTable {
+public:
+    static const uint32_t NONE = UINT32_MAX;
+
+    JoinHashTable(const ColumnNames &key_columns);
+    virtual ~JoinHashTable();
+
+    void add(ValueDict *row);
+    void clear();
+    size_t size() const { return rows.size(); }
+    size_t bytes() const { return memory; }  // roughly what the rows and the table take up
+
+    // the first row whose key matches the probe row's values for probe_columns, and the one after a match
+    uint32_t find(const ValueDict &probe, const ColumnNames &probe_columns) const;
+    uint32_t next(uint32_t row_number) const { return chain[row_number]; }
+    const ValueDict &row(uint32_t row_number) const { return *rows[row_number]; }
+    ValueDicts *take();  // empties the table, handing its rows to the caller (for spilling)
+
+    static uint64_t hash(const ValueDict &row, const ColumnNames &key_columns);
+
+protected:
+    ColumnNames key_columns;
+    ValueDicts rows;
+    std::vector<uint32_t> hashes;  // per row
+    std::vector<uint32_t> chain;   // per row: the previous row with the same key, or NONE
+    std::vector<uint32_t> slots;   // power of two in size, never more than half full
+    size_t distinct;
+    size_t memory;
+
+    bool same_key(const ValueDict &row, const ValueDict &probe, const ColumnNames &probe_columns) const;
+    void grow();
+
+private:
+    JoinHashTable(const JoinHashTable &other);
+    JoinHashTable &operator=(const JoinHashTable &other);
+};
+
+
+// Hash join: the build input (the smaller one, by the planner's reckoning) goes into a JoinHashTable and the probe
+// input streams past it. If the build side outgrows memory_budget, both inputs are split by key hash into
+// PARTITIONS temporary heap files and joined a partition at a time (grace hash join).
+class HashJoinOperator : public JoinOperator {
+public:
+    static const uint PARTITIONS = 16;
+    static size_t memory_budget;  // bytes of build rows to hold at once
+
+    // takes ownership of build and probe
+    HashJoinOperator(EvalOperator *build, EvalOperator *probe, const ColumnNames &build_columns,
+                     const ColumnNames &probe_columns, const Identifier &build_name, const Identifier &probe_name);
+    virtual ~HashJoinOperator();
+
+    virtual void open();
+    virtual ValueDicts *next();
+    virtual void close();
+
+    bool spilled() const { return !build_spill.empty(); }
+
+protected:
+    JoinHashTable table;
+    EvalOperator *probe_source;  // probe, or a scan of the probe side's spill for the current partition
+    ValueDicts *probe_batch;
+    size_t probe_position;       // the probe row being matched is probe_batch[probe_position - 1]
+    uint32_t match;              // next build row matching it, or NONE
+    uint partition;              // the one being joined, when spilled
+    std::vector<HeapTable*> build_spill;  // per partition, nullptr if it got no rows
+    std::vector<HeapTable*> probe_spill;
+
+    void spill(EvalOperator &input, const ColumnNames &key_columns, std::vector<HeapTable*> &files,
+               ValueDicts *pending);
+    bool next_partition();
+    void drop_spill(std::vector<HeapTable*> &files);
+};
+
+// Index nested-loop join: each batch of outer rows is sorted on the join key and looked up in an index on the
+// inner table whose key is the inner join columns, with one DbIndex::lookup_many per batch, so the probes walk the
+// tree in key order and neighbouring keys share its pages. The inner rows found are fetched in that same order and
+// checked against the inner side's own where clause, if any. Suits a small outer side.
+class IndexNestedLoopJoinOperator : public JoinOperator {
+public:
+    // takes ownership of outer; inner_where and inner_predicates may be nullptr
+    IndexNestedLoopJoinOperator(EvalOperator *outer, DbIndex &index, const ValueDict *inner_where,
+                                const Predicates *inner_predicates, const ColumnNames &outer_columns,
+                                const ColumnNames &inner_columns, const Identifier &outer_name,
+                                const Identifier &inner_name);
+    virtual ~IndexNestedLoopJoinOperator();
+
+    virtual void open();
+    virtual ValueDicts *next();  // with a unique index, no more rows than the outer batch they came from
+    virtual void close();
+
+protected:
+    DbIndex &index;
+    ValueDict inner_where;
+    Predicates inner_predicates;
+    ColumnNames key_outer_columns;  // the outer column that goes with each of the index's key columns
+};
+
+// Sort-merge join: both inputs in ascending order of their join columns (through a SortOperator, unless they come
+// that way already) and merged. The right rows with the key at hand are held while the left rows with that key go
+// past them.
+class SortMergeJoinOperator : public JoinOperator {
+public:
+    // takes ownership of left and right; left_sorted and right_sorted say that input is already in join column order
+    SortMergeJoinOperator(EvalOperator *left, EvalOperator *right, const ColumnNames &left_columns,
+                          const ColumnNames &right_columns, const Identifier &left_name, const Identifier &right_name,
+                          bool left_sorted=false, bool right_sorted=false);
+    virtual ~SortMergeJoinOperator();
+
+    virtual void open();
+    virtual ValueDicts *next();
+    virtual void close();
+
+protected:
+    RowCursor *left_cursor;
+    RowCursor *right_cursor;
+    ValueDicts group;       // the right rows with the key being matched
+    size_t group_position;  // next of them to join to the current left row
+
+    int compare(const ValueDict &left_row, const ValueDict &right_row) const;
+    void clear_group();
+};
+
+bool test_join_operators();
@@ -0,0 +1,370 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include "ParallelOperator.h"
+#include "ColumnBatch.h"
+#include "EvalPlan.h"
+#include "SQLExec.h"
+#include "heap_storage.h"
+
+
+MorselQueues::MorselQueues(uint morsels, uint workers, bool in_order)
+        : mutex(), shares(in_order ? 1 : std::max(workers, 1U)), stopped(false) {
+    uint n = (uint) this->shares.size();
+    for (uint w = 0; w < n; w++)
+        for (uint morsel = (uint) ((u_long) morsels * w / n); morsel < (u_long) morsels * (w + 1) / n; morsel++)
+            this->shares[w].push_back(morsel);
+}
+
+bool MorselQueues::take(uint worker, uint &morsel) {
+    std::lock_guard<std::mutex> guard(this->mutex);
+    if (this->stopped)
+        return false;
+    std::deque<uint> &own = this->shares[worker % this->shares.size()];
+    if (!own.empty()) {
+        morsel = own.front();
+        own.pop_front();
+        return true;
+    }
+    std::deque<uint> *biggest = &own;
+    for (auto &share: this->shares)
+        if (share.size() > biggest->size())
+            biggest = &share;
+    if (biggest->empty())
+        return false;
+    morsel = biggest->back();
+    biggest->pop_back();
+    return true;
+}
+
+void MorselQueues::stop() {
+    std::lock_guard<std::mutex> guard(this->mutex);
+    this->stopped = true;
+}
+
+
+Exchange::Exchange(bool ordered, uint producers, size_t capacity)
+        : mutex(), changed(), ordered(ordered), producers(producers), capacity(std::max(capacity, (size_t)1)),
+          ready(), pending(), finished(), emitting(0), stopped(false), error() {
+}
+
+Exchange::~Exchange() {
+    for (auto batch: this->ready)
+        EvalOperator::free_batch(batch);
+    for (auto const &morsel: this->pending)
+        for (auto batch: morsel.second)
+            EvalOperator::free_batch(batch);
+}
+
+bool Exchange::put(uint morsel, ValueDicts *batch) {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    // the worker with the morsel being handed back never waits here, so the others always get going again
+    while (!this->stopped && (this->ordered ? morsel >= this->emitting + this->capacity
+                                            : this->ready.size() >= this->capacity))
+        this->changed.wait(lock);
+    if (this->stopped) {
+        lock.unlock();
+        EvalOperator::free_batch(batch);
+        return false;
+    }
+    if (this->ordered)
+        this->pending[morsel].push_back(batch);
+    else
+        this->ready.push_back(batch);
+    this->changed.notify_all();
+    return true;
+}
+
+bool Exchange::finish(uint morsel) {
+    std::lock_guard<std::mutex> guard(this->mutex);
+    if (this->ordered)
+        this->finished.insert(morsel);
+    this->changed.notify_all();
+    return !this->stopped;
+}
+
+void Exchange::done(const std::string &error) {
+    std::lock_guard<std::mutex> guard(this->mutex);
+    this->producers--;
+    if (!error.empty() && this->error.empty()) {
+        this->error = error;
+        this->stopped = true;
+    }
+    this->changed.notify_all();
+}
+
+ValueDicts *Exchange::get() {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    while (true) {
+        if (!this->error.empty())
+            throw DbRelationError(this->error);
+        if (this->ordered) {
+            auto found = this->pending.find(this->emitting);
+            if (found != this->pending.end() && !found->second.empty()) {
+                ValueDicts *batch = found->second.front();
+                found->second.pop_front();
+                return batch;
+            }
+            if (this->finished.erase(this->emitting) > 0) {
+                this->pending.erase(this->emitting++);
+                this->changed.notify_all();  // workers further on may be waiting for room
+                continue;
+            }
+        } else if (!this->ready.empty()) {
+            ValueDicts *batch = this->ready.front();
+            this->ready.pop_front();
+            this->changed.notify_all();
+            return batch;
+        }
+        if (this->producers == 0)
+            return nullptr;
+        this->changed.wait(lock);
+    }
+}
+
+void Exchange::stop() {
+    std::lock_guard<std::mutex> guard(this->mutex);
+    this->stopped = true;
+    this->changed.notify_all();
+}
+
+
+const uint ParallelScanOperator::MORSEL_BLOCKS;
+uint ParallelScanOperator::workers = std::max(1U, std::thread::hardware_concurrency());
+
+ParallelScanOperator::ParallelScanOperator(DbRelation &table, const ValueDict &where, const Predicates &predicates,
+                                           const ColumnNames &projection, bool ordered)
+        : table(table), where(where), predicates(predicates), projection(projection), ordered(ordered),
+          batch_size(BATCH_SIZE), filter(nullptr), projector(nullptr), queues(nullptr), exchange(nullptr), threads() {
+}
+
+ParallelScanOperator::~ParallelScanOperator() {
+    close();
+}
+
+void ParallelScanOperator::open() {
+    close();
+    this->table.open();  // before the workers, which then share it
+    const ColumnNames &column_names = this->table.get_column_names();
+    const ColumnAttributes &column_attributes = this->table.get_column_attributes();
+    this->filter = new CompiledFilter(column_names, column_attributes, &this->where, this->predicates);
+    this->projector = new CompiledProjection(column_names, column_attributes, this->projection);
+    uint morsels = (this->table.get_block_count() + MORSEL_BLOCKS - 1) / MORSEL_BLOCKS;
+    uint n = std::max(1U, std::min(workers, morsels));
+    this->queues = new MorselQueues(morsels, n, this->ordered);
+    this->exchange = new Exchange(this->ordered, n, this->ordered ? 2 * n : 4 * n);
+    for (uint worker = 0; worker < n; worker++)
+        this->threads.push_back(std::thread(&ParallelScanOperator::work, this, worker));
+}
+
+ValueDicts *ParallelScanOperator::next() {
+    if (this->exchange == nullptr)
+        return nullptr;
+    return this->exchange->get();
+}
+
+// Stopping the workers first lets close come in the middle of the scan (say, once a LIMIT has its rows).
+void ParallelScanOperator::close() {
+    if (this->queues != nullptr)
+        this->queues->stop();
+    if (this->exchange != nullptr)
+        this->exchange->stop();
+    for (auto &thread: this->threads)
+        thread.join();
+    this->threads.clear();
+    delete this->queues;
+    this->queues = nullptr;
+    delete this->exchange;
+    this->exchange = nullptr;
+    delete this->filter;
+    this->filter = nullptr;
+    delete this->projector;
+    this->projector = nullptr;
+}
+
+void ParallelScanOperator::work(uint worker) {
+    std::string error;
+    try {
+        ColumnBatch columns(this->table.get_column_names(), this->table.get_column_attributes());
+        uint morsel;
+        while (this->queues->take(worker, morsel))
+            if (!scan_morsel(morsel, columns))
+                break;
+    } catch (std::exception &e) {
+        error = e.what();
+        if (error.empty())
+            error = "parallel scan failed";
+    }
+    this->exchange->done(error);
+}
+
+// Hand on a morsel's matching rows a batch at a time. False if the consumer doesn't want any more.
+bool ParallelScanOperator::scan_morsel(uint morsel, ColumnBatch &columns) {
+    Selection selection;
+    ValueDicts *batch = new ValueDicts();
+    WorkCounters::allocated();
+    BlockID block_id = 1 + morsel * MORSEL_BLOCKS, end = block_id + MORSEL_BLOCKS;
+    try {
+        while (block_id < end && this->table.decode_block(block_id, columns)) {
+            this->filter->select(columns, selection);
+            for (size_t position = 0; position < selection.size();) {
+                size_t stop = std::min(selection.size(), position + this->batch_size - batch->size());
+                this->projector->project(columns, selection, position, stop, *batch);
+                position = stop;
+                if (batch->size() >= this->batch_size) {
+                    ValueDicts *full = batch;
+                    batch = nullptr;
+                    if (!this->exchange->put(morsel, full))
+                        return false;
+                    batch = new ValueDicts();
+                    WorkCounters::allocated();
+                }
+            }
+        }
+    } catch (...) {
+        if (batch != nullptr)
+            EvalOperator::free_batch(batch);
+        throw;
+    }
+    if (batch->empty())
+        delete batch;
+    else if (!this->exchange->put(morsel, batch))
+        return false;
+    return this->exchange->finish(morsel);
+}
+
+
+// Everything pulled from op, in one list (caller frees).
+static ValueDicts *test_drain(EvalOperator &op) {
+    ValueDicts *rows = new ValueDicts();
+    op.open();
+    for (ValueDicts *batch = op.next(); batch != nullptr; batch = op.next()) {
+        rows->insert(rows->end(), batch->begin(), batch->end());
+        delete batch;
+    }
+    op.close();
+    return rows;
+}
+
+static bool test_before(const ValueDict *a, const ValueDict *b) {
+    return a->at("a").n < b->at("a").n;
+}
+
+bool test_parallel_operators() {
+    if (SQLExec::tables == nullptr) {
+        SQLExec::tables = new Tables();
+        SQLExec::indices = new Indices();
+    }
+    ColumnNames column_names;
+    column_names.push_back("a");
+    column_names.push_back("b");
+    column_names.push_back("g");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    HeapTable table("__test_parallel_operators", column_names, column_attributes);
+    table.create();
+    const int n = 30000;
+    for (int i = 0; i < n; i++) {
+        ValueDict row;
+        row["a"] = Value(i);
+        row["b"] = Value("row number " + std::to_string(i));
+        row["g"] = Value(i % 5);
+        table.insert(&row);
+    }
+    uint saved_workers = ParallelScanOperator::workers;
+    ParallelScanOperator::workers = 4;
+    bool ok = table.get_block_count() > 8 * ParallelScanOperator::MORSEL_BLOCKS;
+
+    // g = 2 AND a >= 1000, just a: ordered, exactly what a serial scan gets; unordered, the same rows some other way
+    ValueDict where;
+    where["g"] = Value(2);
+    Predicates predicates(1, Predicate("a", Predicate::GE, Value(1000)));
+    ColumnNames just_a(1, "a");
+    ProjectOperator serial(new SelectOperator(new TableScanOperator(table, &where), ValueDict(), predicates), just_a);
+    ValueDicts *expected = test_drain(serial);
+    ok = ok && expected->size() == (size_t) (n - 1000) / 5;
+    for (int ordered = 1; ordered >= 0; ordered--) {
+        ParallelScanOperator parallel(table, where, predicates, just_a, ordered);
+        ValueDicts *rows = test_drain(parallel);
+        if (!ordered)
+            std::sort(rows->begin(), rows->end(), test_before);
+        ok = ok && rows->size() == expected->size();
+        for (size_t i = 0; ok && i < rows->size(); i++)
+            ok = *rows->at(i) == *expected->at(i);
+        EvalOperator::free_batch(rows);
+    }
+    EvalOperator::free_batch(expected);
+    if (!ok)
+        std::cout << "parallel scan failed" << std::endl;
+
+    // stopping early, and a worker's failure coming back to the consumer
+    LimitOperator limited(new ParallelScanOperator(table, ValueDict(), Predicates(), ColumnNames(), false), 10);
+    ValueDicts *rows = test_drain(limited);
+    ok = ok && rows->size() == 10 && rows->at(0)->size() == 3;
+    EvalOperator::free_batch(rows);
+    ParallelScanOperator broken(table, ValueDict(), Predicates(), ColumnNames(1, "nope"), true);
+    bool threw = false;
+    try {
+        rows = test_drain(broken);
+        EvalOperator::free_batch(rows);
+    } catch (DbRelationError &e) {
+        threw = true;
+    }
+    broken.close();
+    ok = ok && threw;
+    if (!ok)
+        std::cout << "parallel scan stopping failed" << std::endl;
+
+    // a filtered full scan of a big table plans as a parallel one, in order unless something above doesn't care
+    ValueDict big_g;
+    big_g["g"] = Value(3);
+    EvalPlan *plan = new EvalPlan(EvalPlan::ProjectAll, new EvalPlan(new ValueDict(big_g), new EvalPlan(table)));
+    EvalPlan *optimized = plan->optimize();
+    ok = ok && optimized->get_relation()->get_type() == EvalPlan::ParallelScan;
+    rows = optimized->evaluate();
+    ok = ok && rows->size() == (size_t) n / 5;
+    for (size_t i = 0; ok && i < rows->size(); i++)
+        ok = rows->at(i)->at("a").n == (int) (5 * i + 3);
+    EvalOperator::free_batch(rows);
+    delete plan;
+    delete optimized;
+    plan = new EvalPlan(new ColumnNames(1, "SUM(a)"), new EvalPlan(new ColumnNames(),
+            new Aggregates(1, Aggregate(Aggregate::SUM, "a", "SUM(a)")),
+            new EvalPlan(new ValueDict(big_g), new EvalPlan(table))));
+    optimized = plan->optimize();
+    ok = ok && optimized->get_relation()->get_relation()->get_type() == EvalPlan::ParallelScan;
+    rows = optimized->evaluate();
+    int64_t sum = 0;
+    for (int i = 3; i < n; i += 5)
+        sum += i;
+    ok = ok && rows->size() == 1 && rows->at(0)->at("SUM(a)").n == (int) sum;
+    EvalOperator::free_batch(rows);
+    delete plan;
+    delete optimized;
+    if (!ok)
+        std::cout << "parallel scan planning failed" << std::endl;
+
+    // throughput from one worker up to one per core (the table is cached, so this is the CPU side of a scan)
+    std::cout << "rows/sec scanned:";
+    uint cores = std::max(1U, std::thread::hardware_concurrency());
+    for (uint w = 1; w <= cores; w = w < cores ? std::min(2 * w, cores) : cores + 1) {
+        ParallelScanOperator::workers = w;
+        ParallelScanOperator scan(table, where, predicates, ColumnNames(), false);
+        auto start = std::chrono::steady_clock::now();
+        size_t scanned = 0;
+        for (int rep = 0; rep < 3; rep++) {
+            rows = test_drain(scan);
+            EvalOperator::free_batch(rows);
+            scanned += n;
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << " " << w << (w == 1 ? " worker " : " workers ") << (long) (scanned / seconds);
+    }
+    std::cout << std::endl;
+    ParallelScanOperator::workers = saved_workers;
+
+    table.drop();
+    return ok;
+}
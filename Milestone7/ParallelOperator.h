@@ -0,0 +1,113 @@
+/**
+ * Intra-query parallelism: a table scan split up among worker threads.
+ * MorselQueues
+ * Exchange
+ * ParallelScanOperator
+ */
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+#include "EvalOperator.h"
+
+
+// Where a parallel operator's workers get their morsels (numbered 0 up to morsels) from. Each worker starts with its
+// own contiguous share and takes from the front of it, so it reads neighboring blocks; one that runs out steals from
+// the back of the biggest share left. In order, there's just one share, handed out from the front to everybody.
+class MorselQueues {
+public:
+    MorselQueues(uint morsels, uint workers, bool in_order);
+    virtual ~MorselQueues() {}
+
+    bool take(uint worker, uint &morsel);  // false once there are none left, or after stop
+    void stop();
+
+protected:
+    std::mutex mutex;
+    std::vector<std::deque<uint>> shares;
+    bool stopped;
+
+private:
+    MorselQueues(const MorselQueues &other);
+    MorselQueues &operator=(const MorselQueues &other);
+};
+
+
+// Where a parallel operator's workers hand on their rows, a batch at a time, and where its consumer picks them up.
+// Unordered, batches come out as they arrive; ordered, a morsel's batches come out after those of every morsel
+// before it (which needs the morsels handed out in order, see MorselQueues). Either way a worker waits while too
+// much is waiting already: capacity batches, or (ordered) morsels capacity or more past the one being handed back.
+class Exchange {
+public:
+    Exchange(bool ordered, uint producers, size_t capacity);
+    virtual ~Exchange();  // frees whatever batches are left
+
+    // for the workers: each returns false (freeing batch) once the consumer has stopped or another worker failed
+    bool put(uint morsel, ValueDicts *batch);
+    bool finish(uint morsel);  // morsel has no more batches to come
+    void done(const std::string &error="");  // this worker is through (or failed with error)
+
+    // for the consumer: the next batch, or nullptr once every worker is through; rethrows a worker's failure
+    ValueDicts *get();
+    void stop();
+
+protected:
+    std::mutex mutex;
+    std::condition_variable changed;
+    bool ordered;
+    uint producers;  // workers not through yet
+    size_t capacity;
+    std::deque<ValueDicts*> ready;  // unordered
+    std::map<uint, std::deque<ValueDicts*>> pending;  // ordered, by morsel
+    std::set<uint> finished;  // ordered: morsels with nothing more to come
+    uint emitting;  // ordered: the morsel being handed back
+    bool stopped;
+    std::string error;
+
+private:
+    Exchange(const Exchange &other);
+    Exchange &operator=(const Exchange &other);
+};
+
+
+// A full scan of a table that decodes its blocks (see DbRelation::decode_block), split into morsels of MORSEL_BLOCKS
+// blocks apiece among worker threads, each filtering (by where and predicates) and projecting the rows of its own
+// blocks, with a CompiledFilter and CompiledProjection they share. The rows come back through an Exchange, in the
+// same order as a TableScanOperator's if ordered.
+class ParallelScanOperator : public EvalOperator {
+public:
+    static const uint MORSEL_BLOCKS = 16;
+    static uint workers;  // threads per scan; by default one per core
+
+    // projection empty for every column
+    ParallelScanOperator(DbRelation &table, const ValueDict &where, const Predicates &predicates,
+                         const ColumnNames &projection, bool ordered);
+    virtual ~ParallelScanOperator();
+
+    virtual void open();
+    virtual ValueDicts *next();
+    virtual void close();
+    virtual void limit_batch_size(size_t rows) { batch_size = std::max(std::min(rows, BATCH_SIZE), (size_t)1); }
+
+protected:
+    DbRelation &table;
+    ValueDict where;
+    Predicates predicates;
+    ColumnNames projection;
+    bool ordered;
+    size_t batch_size;
+    CompiledFilter *filter;
+    CompiledProjection *projector;
+    MorselQueues *queues;
+    Exchange *exchange;
+    std::vector<std::thread> threads;
+
+    void work(uint worker);
+    bool scan_morsel(uint morsel, ColumnBatch &columns);
+};
+
+bool test_parallel_operators();
@@ -96,6 +96,9 @@ std::string ParseTreeToString::expression(const hsql::Expr *expr) {
         case hsql::kExprLiteralInt:
             ret += std::to_string(expr->ival);
             break;
+        case hsql::kExprPlaceholder:
+            ret += "?";
+            break;
         case hsql::kExprFunctionRef:
             ret += std::string(expr->name) + "?" + expr->expr->name;
             break;
@@ -276,6 +279,9 @@ std::string ParseTreeToString::drop(const hsql::DropStatement *stmt) {
         case hsql::DropStatement::kIndex:
             ret += std::string("INDEX ") + stmt->indexName + " FROM ";
             break;
+        case hsql::DropStatement::kPreparedStatement:
+            ret += "PREPARE ";
+            break;
         default:
             ret += "? ";
     }
@@ -312,6 +318,57 @@ std::string ParseTreeToString::del(const hsql::DeleteStatement *stmt) {
     return ret;
 }
 
+std::string ParseTreeToString::update(const hsql::UpdateStatement *stmt) {
+    std::string ret("UPDATE ");
+    ret += table_ref(stmt->table) + " SET ";
+    bool doComma = false;
+    for (auto const& clause: *stmt->updates) {
+        if (doComma)
+            ret += ", ";
+        ret += std::string(clause->column) + " = " + expression(clause->value);
+        doComma = true;
+    }
+    if (stmt->where != NULL) {
+        ret += " WHERE ";
+        ret += expression(stmt->where);
+    }
+    return ret;
+}
+
+std::string ParseTreeToString::prepare(const hsql::PrepareStatement *stmt) {
+    std::string ret("PREPARE ");
+    ret += std::string(stmt->name) + ": ";
+    if (stmt->query != NULL && stmt->query->size() == 1)
+        ret += statement(stmt->query->getStatement(0));
+    else
+        ret += "...";
+    return ret;
+}
+
+std::string ParseTreeToString::execute(const hsql::ExecuteStatement *stmt) {
+    std::string ret("EXECUTE ");
+    ret += stmt->name;
+    ret += "(";
+    bool doComma = false;
+    if (stmt->parameters != NULL) {
+        for (hsql::Expr *expr : *stmt->parameters) {
+            if (doComma)
+                ret += ", ";
+            ret += expression(expr);
+            doComma = true;
+        }
+    }
+    ret += ")";
+    return ret;
+}
+
+std::string ParseTreeToString::import(const hsql::ImportStatement *stmt) {
+    std::string ret("IMPORT FROM ");
+    ret += stmt->type == hsql::kImportCSV ? "CSV" : "TBL";
+    ret += std::string(" FILE \"") + stmt->filePath + "\" INTO " + stmt->tableName;
+    return ret;
+}
+
 std::string ParseTreeToString::statement(const hsql::SQLStatement *stmt) {
     switch (stmt->type()) {
         case hsql::kStmtSelect:
@@ -326,12 +383,16 @@ std::string ParseTreeToString::statement(const hsql::SQLStatement *stmt) {
             return drop((const hsql::DropStatement *) stmt);
         case hsql::kStmtShow:
             return show((const hsql::ShowStatement *) stmt);
-
-        case hsql::kStmtError:
-        case hsql::kStmtImport:
-        case hsql::kStmtUpdate:
         case hsql::kStmtPrepare:
+            return prepare((const hsql::PrepareStatement *) stmt);
         case hsql::kStmtExecute:
+            return execute((const hsql::ExecuteStatement *) stmt);
+        case hsql::kStmtImport:
+            return import((const hsql::ImportStatement *) stmt);
+        case hsql::kStmtUpdate:
+            return update((const hsql::UpdateStatement *) stmt);
+
+        case hsql::kStmtError:
         case hsql::kStmtExport:
         case hsql::kStmtRename:
         case hsql::kStmtAlter:
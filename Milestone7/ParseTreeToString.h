@@ -19,9 +19,13 @@ public:
     static std::string select(const hsql::SelectStatement *stmt);
     static std::string insert(const hsql::InsertStatement *stmt);
     static std::string del(const hsql::DeleteStatement *stmt);
+    static std::string update(const hsql::UpdateStatement *stmt);
     static std::string create(const hsql::CreateStatement *stmt);
     static std::string drop(const hsql::DropStatement *stmt);
     static std::string show(const hsql::ShowStatement *stmt);
+    static std::string prepare(const hsql::PrepareStatement *stmt);
+    static std::string execute(const hsql::ExecuteStatement *stmt);
+    static std::string import(const hsql::ImportStatement *stmt);
 
     static const std::vector<std::string> reserved_words;
     static bool is_reserved_word(std::string word);
@@ -0,0 +1,333 @@
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <sstream>
+#include "PlanCache.h"
+#include "SQLExec.h"
+
+
+PreparedStatement::PreparedStatement(hsql::StatementType type, const Identifier &table_name,
+                                     const std::vector<int> &placeholders)
+        : type(type), table_name(table_name), placeholders(placeholders), plan(nullptr), optimized(nullptr),
+          column_names(), column_attributes(), row(), schema_version(SQLExec::schema_version) {
+}
+
+PreparedStatement::~PreparedStatement() {
+    delete plan;
+    delete optimized;
+}
+
+bool PreparedStatement::is_current() const {
+    return schema_version == SQLExec::schema_version;
+}
+
+ParameterValues PreparedStatement::values(const KeyValue &parameters) const {
+    ParameterValues values;
+    for (size_t i = 0; i < placeholders.size() && i < parameters.size(); i++)
+        values[placeholders[i]] = parameters[i];
+    return values;
+}
+
+EvalPlan *PreparedStatement::bound_plan(const KeyValue &parameters) {
+    ParameterValues values = this->values(parameters);
+    if (optimized == nullptr) {
+        EvalPlan bound(plan);
+        bound.bind(values);
+        optimized = bound.optimize();
+    }
+    EvalPlan *copy = new EvalPlan(optimized);
+    copy->bind(values);
+    return copy;
+}
+
+
+const size_t PlanCache::CAPACITY = 256;
+
+PlanCache::PlanCache(size_t capacity) : entries(), capacity(capacity), uses(0) {
+}
+
+PlanCache::~PlanCache() {
+    clear();
+}
+
+void PlanCache::clear() {
+    for (auto &entry: entries)
+        delete entry.second.prepared;
+    entries.clear();
+}
+
+static std::string upper_case(const std::string &word) {
+    std::string ret(word);
+    for (auto &c: ret)
+        c = (char) toupper(c);
+    return ret;
+}
+
+std::string PlanCache::normalize(const std::string &query, KeyValue &parameters) {
+    std::string normalized;
+    bool first_word = true;
+    bool literals = false;  // whether we're in a WHERE clause or VALUES list, where literals become parameters
+    size_t i = 0;
+    while (i < query.size()) {
+        char c = query[i];
+        if (isspace(c)) {
+            if (!normalized.empty() && normalized.back() != ' ')
+                normalized += ' ';
+            i++;
+        } else if (c == '\'' || c == '"') {
+            // a string literal, or a quoted identifier
+            size_t end = query.find(c, i + 1);
+            if (end == std::string::npos)
+                return "";  // leave it to the parser to complain about
+            if (c == '\'' && literals) {
+                parameters.push_back(Value(query.substr(i + 1, end - i - 1)));
+                normalized += '?';
+            } else {
+                normalized += query.substr(i, end + 1 - i);
+            }
+            i = end + 1;
+        } else if (isalnum(c) || c == '_') {
+            size_t end = i;
+            while (end < query.size() && (isalnum(query[end]) || query[end] == '_' || query[end] == '.'))
+                end++;
+            std::string word = query.substr(i, end - i);
+            i = end;
+            if (isdigit(c)) {
+                // an int literal, if it's all digits and no longer than the parser's int64 can hold
+                if (literals && word.size() <= 18 && word.find_first_not_of("0123456789") == std::string::npos) {
+                    parameters.push_back(Value((int32_t) std::stoll(word)));
+                    normalized += '?';
+                } else {
+                    normalized += word;
+                }
+                continue;
+            }
+            std::string keyword = upper_case(word);
+            if (first_word && keyword != "SELECT" && keyword != "INSERT" && keyword != "DELETE")
+                return "";
+            first_word = false;
+            if (keyword == "WHERE" || keyword == "VALUES")
+                literals = true;
+            else if (keyword == "GROUP" || keyword == "HAVING" || keyword == "ORDER" || keyword == "LIMIT"
+                     || keyword == "OFFSET")
+                literals = false;
+            normalized += word;
+        } else if (c == '?') {
+            return "";  // a placeholder of its own, which only a prepared statement can have
+        } else {
+            normalized += c;
+            i++;
+        }
+    }
+    if (first_word)
+        return "";
+    if (!normalized.empty() && normalized.back() == ' ')
+        normalized.pop_back();
+    return normalized;
+}
+
+std::string PlanCache::fill_in(const std::string &text, const KeyValue &parameters) {
+    std::string ret;
+    size_t parameter = 0;
+    for (size_t i = 0; i < text.size(); i++) {
+        char c = text[i];
+        if (c == '"') {
+            size_t end = text.find('"', i + 1);
+            if (end == std::string::npos)
+                end = text.size() - 1;
+            ret += text.substr(i, end + 1 - i);
+            i = end;
+        } else if (c == '?' && (i == 0 || !(isalnum(text[i - 1]) || text[i - 1] == '_'))
+                   && parameter < parameters.size()) {
+            // a placeholder (the ? ParseTreeToString puts between a function and its argument follows a name)
+            const Value &value = parameters[parameter++];
+            if (value.data_type == ColumnAttribute::TEXT)
+                ret += "\"" + value.s + "\"";
+            else
+                ret += std::to_string(value.n);
+        } else {
+            ret += c;
+        }
+    }
+    return ret;
+}
+
+PreparedStatement *PlanCache::find(const std::string &normalized, std::string &text) {
+    auto found = entries.find(normalized);
+    if (found == entries.end())
+        return nullptr;
+    if (!found->second.prepared->is_current()) {
+        delete found->second.prepared;
+        entries.erase(found);
+        return nullptr;
+    }
+    found->second.last_used = ++uses;
+    text = found->second.text;
+    return found->second.prepared;
+}
+
+void PlanCache::add(const std::string &normalized, PreparedStatement *prepared, const std::string &text) {
+    auto found = entries.find(normalized);
+    if (found != entries.end()) {
+        delete found->second.prepared;
+        entries.erase(found);
+    }
+    if (entries.size() >= capacity && !entries.empty()) {
+        auto least = entries.begin();
+        for (auto entry = entries.begin(); entry != entries.end(); entry++)
+            if (entry->second.last_used < least->second.last_used)
+                least = entry;
+        delete least->second.prepared;
+        entries.erase(least);
+    }
+    Entry &entry = entries[normalized];
+    entry.prepared = prepared;
+    entry.text = text;
+    entry.last_used = ++uses;
+}
+
+
+// test function -- returns true if all tests pass
+
+// the number of rows query gives (or changes), run the way sql4300 runs it: from the plan cache if it can be, else
+// parsed and executed; -1 if it fails
+static long run(const std::string &query, bool cache=true) {
+    long rows = -1;
+    try {
+        QueryResult *result = nullptr;
+        KeyValue parameters;
+        std::string text;
+        PreparedStatement *prepared = cache ? SQLExec::cached_plan(query, parameters, text) : nullptr;
+        if (prepared != nullptr) {
+            result = SQLExec::execute(prepared, parameters);
+        } else {
+            hsql::SQLParserResult *parse = hsql::SQLParser::parseSQLString(query);
+            if (parse->isValid() && parse->size() == 1) {
+                try {
+                    result = SQLExec::execute(parse->getStatement(0));
+                } catch (SQLExecError &e) {
+                    delete parse;
+                    throw;
+                }
+            }
+            delete parse;
+        }
+        if (result != nullptr) {
+            std::stringstream out;
+            out << *result;  // pulls the rows through
+            std::string message = out.str();
+            size_t count = message.find_first_of("0123456789", message.rfind("successfully"));
+            rows = count == std::string::npos ? 0 : std::stol(message.substr(count));
+            delete result;
+        }
+    } catch (SQLExecError &e) {
+        std::cout << "plan cache test: " << e.what() << std::endl;
+    }
+    return rows;
+}
+
+bool test_plan_cache() {
+    KeyValue parameters;
+    std::string normalized = PlanCache::normalize("select  *\tfrom t1 where a = 12 and b = 'x y'  limit 5",
+                                                  parameters);
+    if (normalized != "select * from t1 where a = ? and b = ? limit 5" || parameters.size() != 2
+            || parameters[0] != Value(12) || parameters[1] != Value("x y")) {
+        std::cout << "normalized as " << normalized << std::endl;
+        return false;
+    }
+    parameters.clear();
+    if (PlanCache::normalize("INSERT INTO t1 (a, b) VALUES (1, 'two')", parameters)
+            != "INSERT INTO t1 (a, b) VALUES (?, ?)" || parameters.size() != 2)
+        return false;
+    parameters.clear();
+    if (PlanCache::normalize("create table t1 (a int)", parameters) != "" || !parameters.empty())
+        return false;
+    if (PlanCache::normalize("SELECT * FROM t1 WHERE a = ?", parameters) != "")
+        return false;
+    parameters.push_back(Value(12));
+    parameters.push_back(Value("x y"));
+    if (PlanCache::fill_in("SELECT COUNT?a FROM t1 WHERE a = ? AND b = ?", parameters)
+            != "SELECT COUNT?a FROM t1 WHERE a = 12 AND b = \"x y\"")
+        return false;
+
+    // the rows after the first of a multi-row INSERT, whose literals go in as they are or not at all
+    std::vector<KeyValue> extra_rows;
+    std::string stripped = SQLExec::strip_extra_rows(
+            "INSERT INTO myvalues VALUES ('VALUES', 1), ('O''Brien', -2147483648), ('''', 2147483647)", extra_rows);
+    if (stripped != "INSERT INTO myvalues VALUES ('VALUES', 1)" || extra_rows.size() != 2
+            || extra_rows[0][0] != Value("O'Brien") || extra_rows[0][1] != Value(INT32_MIN)
+            || extra_rows[1][0] != Value("'") || extra_rows[1][1] != Value(INT32_MAX)) {
+        std::cout << "stripped to " << stripped << std::endl;
+        return false;
+    }
+    for (auto const &big: {"99999999999", "2147483648", "-2147483649", "99999999999999999999"}) {
+        extra_rows.clear();
+        try {
+            SQLExec::strip_extra_rows(std::string("INSERT INTO t VALUES (1), (") + big + ")", extra_rows);
+            std::cout << big << " taken as " << (extra_rows.empty() ? 0 : extra_rows[0][0].n) << std::endl;
+            return false;
+        } catch (SQLExecError &e) {
+        }
+    }
+
+    // a table to query: a goes 0, 1, ...; b is a % 10
+    const int N = 2000;
+    if (run("CREATE TABLE _test_plan_cache (a INT, b INT)") < 0)
+        return false;
+    bool ok = true;
+    for (int i = 0; i < N; i++)
+        ok = ok && run("INSERT INTO _test_plan_cache VALUES (" + std::to_string(i) + ", "
+                       + std::to_string(i % 10) + ")") == 1;
+    ok = ok && run("CREATE INDEX _test_plan_cache_a ON _test_plan_cache (a)") >= 0;
+
+    // the same plan for queries differing in their literals, bound to each one's literals
+    const char *range = "SELECT * FROM _test_plan_cache WHERE a > %d AND a < %d AND b = %d";
+    int expected[][4] = {{100, 200, 3, 10}, {1500, 1600, 0, 9}, {0, 11, 7, 1}, {900, 800, 1, 0}};
+    PreparedStatement *first = nullptr;
+    for (auto const& e: expected) {
+        char query[200];
+        snprintf(query, sizeof(query), range, e[0], e[1], e[2]);
+        parameters.clear();
+        std::string text;
+        PreparedStatement *prepared = SQLExec::cached_plan(query, parameters, text);
+        if (prepared == nullptr || (first != nullptr && prepared != first)
+                || text.find(std::to_string(e[0])) == std::string::npos) {
+            std::cout << "not cached: " << query << std::endl;
+            ok = false;
+            continue;
+        }
+        first = prepared;
+        long rows = run(query);
+        if (rows != e[3]) {
+            std::cout << query << ": " << rows << " rows, not " << e[3] << std::endl;
+            ok = false;
+        }
+    }
+
+    // how long a point query takes parsed and planned every time, and from the plan cache
+    const int QUERIES = 1000;
+    long found[2] = {0, 0};
+    double us[2];
+    for (int cache = 0; cache < 2; cache++) {
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < QUERIES; i++)
+            found[cache] += run("SELECT * FROM _test_plan_cache WHERE a = " + std::to_string(i * 7 % N), cache);
+        auto end = std::chrono::steady_clock::now();
+        us[cache] = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / (double) QUERIES;
+    }
+    ok = ok && found[0] == QUERIES && found[1] == QUERIES;
+    std::cout << "point query us: parsed and planned " << us[0] << "; cached " << us[1] << std::endl;
+
+    // dropping the index means planning again (so the lookup becomes a scan)
+    ok = ok && run("DROP INDEX _test_plan_cache_a FROM _test_plan_cache") >= 0;
+    if (first != nullptr && first->is_current())
+        ok = false;
+    ok = ok && run("SELECT * FROM _test_plan_cache WHERE a = 5") == 1;
+    ok = ok && run("DELETE FROM _test_plan_cache WHERE b = 3") == N / 10;
+    ok = ok && run("DELETE FROM _test_plan_cache WHERE b = 4") == N / 10;
+    ok = ok && run("SELECT * FROM _test_plan_cache WHERE b = 4") == 0;
+    ok = ok && run("DROP TABLE _test_plan_cache") >= 0;
+    return ok;
+}
@@ -0,0 +1,97 @@
+/**
+ * Statements parsed and planned once, then executed again and again with different values.
+ * PreparedStatement
+ * PlanCache
+ */
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+#include "SQLParser.h"
+#include "EvalPlan.h"
+
+
+// A SELECT, INSERT or DELETE whose ? placeholders are parameters, numbered from 1 in the order they appear in the
+// query. SQLExec::prepare makes one and SQLExec::execute runs it with values for its parameters. Its plan is
+// optimized for the values it's first executed with and reused for any others after that: the optimizer only looks
+// at values to estimate costs, so the plan is right for any of them, if not always the best.
+class PreparedStatement {
+public:
+    virtual ~PreparedStatement();
+
+    hsql::StatementType get_type() const { return type; }
+    size_t get_parameter_count() const { return placeholders.size(); }
+
+    // whether no table or index has been created or dropped since it was prepared (else prepare it again)
+    bool is_current() const;
+
+protected:
+    friend class SQLExec;
+
+    PreparedStatement(hsql::StatementType type, const Identifier &table_name, const std::vector<int> &placeholders);
+
+    hsql::StatementType type;
+    Identifier table_name;  // for INSERT and DELETE
+    std::vector<int> placeholders;  // the Value::parameter of each parameter, in order
+    EvalPlan *plan;  // for SELECT and DELETE, as built from the statement
+    EvalPlan *optimized;  // that plan optimized, once the statement has been executed
+    ColumnNames column_names;  // for SELECT, the columns of its result
+    ColumnAttributes column_attributes;
+    ValueDict row;  // for INSERT
+    u_long schema_version;  // SQLExec::schema_version when it was prepared
+
+    ParameterValues values(const KeyValue &parameters) const;
+    EvalPlan *bound_plan(const KeyValue &parameters);  // the optimized plan for these parameters (caller deletes)
+
+private:
+    PreparedStatement(const PreparedStatement &other);
+    PreparedStatement &operator=(const PreparedStatement &other);
+};
+
+
+// Prepared statements for queries that differ only in their literals, keyed by the query with its literals taken
+// out (see normalize), so that running one of those queries again skips the parser and the optimizer. Holds up to
+// capacity of them, then drops the one used least recently to make room for another.
+class PlanCache {
+public:
+    static const size_t CAPACITY;
+
+    explicit PlanCache(size_t capacity=CAPACITY);
+    virtual ~PlanCache();
+
+    // query with each run of white space made one space and the literals of its WHERE clause or VALUES list made ?
+    // placeholders, their values appended to parameters; "" unless it's a SELECT, INSERT or DELETE (without ?
+    // placeholders of its own)
+    static std::string normalize(const std::string &query, KeyValue &parameters);
+
+    // text with its ? placeholders replaced by parameters, written the way ParseTreeToString writes literals
+    static std::string fill_in(const std::string &text, const KeyValue &parameters);
+
+    // the statement cached for a normalized query, if it's still current, and in text what ParseTreeToString made
+    // of it; else nullptr
+    PreparedStatement *find(const std::string &normalized, std::string &text);
+
+    // cache prepared (the cache deletes it) and text for a normalized query
+    void add(const std::string &normalized, PreparedStatement *prepared, const std::string &text);
+
+    size_t size() const { return entries.size(); }
+    void clear();
+
+protected:
+    class Entry {
+    public:
+        PreparedStatement *prepared;
+        std::string text;
+        u_long last_used;
+    };
+    std::map<std::string, Entry> entries;
+    size_t capacity;
+    u_long uses;
+
+private:
+    PlanCache(const PlanCache &other);
+    PlanCache &operator=(const PlanCache &other);
+};
+
+bool test_plan_cache();
@@ -1,10 +1,47 @@
 
 #include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <set>
+#include <sstream>
 #include "SQLExec.h"
+#include "BulkLoader.h"
 #include "EvalPlan.h"
+#include "JoinOperator.h"
+#include "PlanCache.h"
+#include "ParseTreeToString.h"
 
 Tables* SQLExec::tables = nullptr;
 Indices* SQLExec::indices = nullptr;
+u_long SQLExec::schema_version = 0;
+
+static PlanCache plan_cache;  // for SQLExec::cached_plan
+static std::map<Identifier, PreparedStatement*> prepared_statements;  // by the name they were PREPAREd as
+
+static std::vector<int> get_placeholders(const hsql::SQLStatement *statement);
+
+static void print_row(std::ostream &out, const ColumnNames &column_names, const ValueDict &row) {
+    for (auto const &column_name: column_names) {
+        Value value = row.at(column_name);
+        switch (value.data_type) {
+            case ColumnAttribute::INT:
+                out << value.n;
+                break;
+            case ColumnAttribute::TEXT:
+                out << "\"" << value.s << "\"";
+                break;
+            case ColumnAttribute::BOOLEAN:
+                out << (value.n == 0 ? "false" : "true");
+                break;
+            default:
+                out << "???";
+        }
+        out << " ";
+    }
+    out << std::endl;
+}
 
 std::ostream &operator<<(std::ostream &out, const QueryResult &qres) {
     if (qres.column_names != nullptr) {
@@ -14,26 +51,25 @@ std::ostream &operator<<(std::ostream &out, const QueryResult &qres) {
         for (uint i = 0; i < qres.column_names->size(); i++)
             out << "----------+";
         out << std::endl;
-        for (auto const &row: *qres.rows) {
-            for (auto const &column_name: *qres.column_names) {
-                Value value = row->at(column_name);
-                switch (value.data_type) {
-                    case ColumnAttribute::INT:
-                        out << value.n;
-                        break;
-                    case ColumnAttribute::TEXT:
-                        out << "\"" << value.s << "\"";
-                        break;
-                    case ColumnAttribute::BOOLEAN:
-                        out << (value.n == 0 ? "false" : "true");
-                        break;
-                    default:
-                        out << "???";
-                }
-                out << " ";
+        if (qres.rows != nullptr)
+            for (auto const &row: *qres.rows)
+                print_row(out, *qres.column_names, *row);
+    }
+    if (qres.source != nullptr) {
+        size_t count = 0;
+        try {
+            qres.source->open();
+            for (ValueDicts *batch = qres.source->next(); batch != nullptr; batch = qres.source->next()) {
+                for (auto const &row: *batch)
+                    print_row(out, *qres.column_names, *row);
+                count += batch->size();
+                EvalOperator::free_batch(batch);
             }
-            out << std::endl;
+            qres.source->close();
+        } catch (DbRelationError &e) {
+            throw SQLExecError(std::string("DbRelationError: ") + e.what());
         }
+        out << "successfully returned " << count << " rows";
     }
     out << qres.message;
     return out;
@@ -49,10 +85,14 @@ QueryResult::~QueryResult() {
             delete row;
         delete rows;
     }
+    delete source;
 }
 
 
-QueryResult *SQLExec::execute(const hsql::SQLStatement *statement) throw(SQLExecError) {
+QueryResult *SQLExec::execute(const hsql::SQLStatement *statement,
+                              const ColumnNames *include_columns,
+                              bool index_status,
+                              const std::vector<KeyValue> *extra_rows) throw(SQLExecError) {
     // initialize _tables table, if not yet present
     if (SQLExec::tables == nullptr) {
         SQLExec::tables = new Tables();
@@ -60,19 +100,29 @@ QueryResult *SQLExec::execute(const hsql::SQLStatement *statement) throw(SQLExec
     }
 
     try {
+        if (!get_placeholders(statement).empty())
+            throw SQLExecError("only a prepared statement can have ? placeholders");
         switch (statement->type()) {
             case hsql::kStmtCreate:
-                return create((const hsql::CreateStatement *) statement);
+                return create((const hsql::CreateStatement *) statement, include_columns);
             case hsql::kStmtDrop:
                 return drop((const hsql::DropStatement *) statement);
             case hsql::kStmtShow:
-                return show((const hsql::ShowStatement *) statement);
+                return show((const hsql::ShowStatement *) statement, index_status);
             case hsql::kStmtInsert:
-                return insert((const hsql::InsertStatement *) statement);
+                return insert((const hsql::InsertStatement *) statement, extra_rows);
             case hsql::kStmtDelete:
                 return del((const hsql::DeleteStatement *) statement);
             case hsql::kStmtSelect:
                 return select((const hsql::SelectStatement *) statement);
+            case hsql::kStmtPrepare:
+                return prepare_named((const hsql::PrepareStatement *) statement);
+            case hsql::kStmtExecute:
+                return execute_named((const hsql::ExecuteStatement *) statement);
+            case hsql::kStmtImport:
+                return import((const hsql::ImportStatement *) statement);
+            case hsql::kStmtUpdate:
+                return update((const hsql::UpdateStatement *) statement);
             default:
                 return new QueryResult("not implemented");
         }
@@ -81,85 +131,304 @@ QueryResult *SQLExec::execute(const hsql::SQLStatement *statement) throw(SQLExec
     }
 }
 
-// SQL: INSERT ...
-QueryResult *SQLExec::insert(const hsql::InsertStatement *statement) {
-    Identifier table_name = statement->tableName;
-    DbRelation& table = SQLExec::tables->get_table(table_name);
+// the value of an int or string literal, if that's what expr is; a ? placeholder is a parameter to bind later
+static bool get_literal(const hsql::Expr *expr, Value &value) {
+    if (expr->type == hsql::kExprLiteralInt) {
+        value = Value((int32_t)expr->ival);
+        return true;
+    }
+    if (expr->type == hsql::kExprLiteralString) {
+        value = Value(expr->name);
+        return true;
+    }
+    if (expr->type == hsql::kExprPlaceholder) {
+        value = Value();
+        value.parameter = (int)expr->ival + 1;  // the parser numbers them by where they are in the query
+        return true;
+    }
+    return false;
+}
+
+static void get_placeholders(const hsql::Expr *expr, std::vector<int> &placeholders) {
+    if (expr == nullptr)
+        return;
+    if (expr->type == hsql::kExprPlaceholder)
+        placeholders.push_back((int)expr->ival + 1);
+    get_placeholders(expr->expr, placeholders);
+    get_placeholders(expr->expr2, placeholders);
+    if (expr->exprList != nullptr)
+        for (auto const& item: *expr->exprList)
+            get_placeholders(item, placeholders);
+}
+
+// the Value::parameter of each ? placeholder in statement, in the order they appear in the query
+static std::vector<int> get_placeholders(const hsql::SQLStatement *statement) {
+    std::vector<int> placeholders;
+    if (statement->type() == hsql::kStmtSelect) {
+        auto select = (const hsql::SelectStatement *) statement;
+        get_placeholders(select->whereClause, placeholders);
+        for (auto const& expr: *select->selectList)
+            get_placeholders(expr, placeholders);
+    } else if (statement->type() == hsql::kStmtDelete) {
+        get_placeholders(((const hsql::DeleteStatement *) statement)->expr, placeholders);
+    } else if (statement->type() == hsql::kStmtInsert) {
+        auto insert = (const hsql::InsertStatement *) statement;
+        if (insert->values != nullptr)
+            for (auto const& expr: *insert->values)
+                get_placeholders(expr, placeholders);
+    } else if (statement->type() == hsql::kStmtUpdate) {
+        auto update = (const hsql::UpdateStatement *) statement;
+        get_placeholders(update->where, placeholders);
+        if (update->updates != nullptr)
+            for (auto const& clause: *update->updates)
+                get_placeholders(clause->value, placeholders);
+    }
+    std::sort(placeholders.begin(), placeholders.end());
+    return placeholders;
+}
+
+// the row an INSERT ... VALUES gives (its columns in table_name's order unless it lists them)
+static void insert_row(const hsql::InsertStatement *statement, ValueDict &row) {
+    DbRelation& table = SQLExec::tables->get_table(statement->tableName);
 
     // get the column names in the order expected in the VALUES clause
-    ColumnNames *column_names;
+    ColumnNames column_names;
     if (statement->columns == nullptr) {
-        column_names = new ColumnNames(table.get_column_names());
+        column_names = table.get_column_names();
     } else {
-        column_names = new ColumnNames();
         for(auto const& column_name: *statement->columns)
-            column_names->push_back(Identifier(column_name));
+            column_names.push_back(Identifier(column_name));
     }
 
     // construct the row we want to insert
-    ValueDict row;
+    if (statement->values == nullptr || statement->values->size() > column_names.size())
+        throw SQLExecError("only really simple insert statements are supported");
     uint i = 0;
     for (auto const& value_expr: *statement->values) {
-        Identifier col_name = (*column_names)[i++];
-        if (value_expr->type == hsql::kExprLiteralInt)
-            row[col_name] = Value((int32_t)value_expr->ival);
-        else if (value_expr->type == hsql::kExprLiteralString)
-            row[col_name] = Value(value_expr->name);
-        else {
-            delete column_names;
+        Identifier col_name = column_names[i++];
+        if (!get_literal(value_expr, row[col_name]))
             throw SQLExecError("only really simple insert statements are supported");
+    }
+}
+
+// SQL: INSERT ... VALUES (...), ... (the tuples after the first one come in extra_rows, see strip_extra_rows)
+QueryResult *SQLExec::insert(const hsql::InsertStatement *statement, const std::vector<KeyValue> *extra_rows) {
+    ValueDicts rows(1, new ValueDict());
+    try {
+        insert_row(statement, *rows[0]);
+        if (extra_rows != nullptr) {
+            ColumnNames column_names;
+            if (statement->columns == nullptr) {
+                column_names = SQLExec::tables->get_table(statement->tableName).get_column_names();
+            } else {
+                for (auto const& column_name: *statement->columns)
+                    column_names.push_back(Identifier(column_name));
+            }
+            for (auto const& values: *extra_rows) {
+                if (values.size() != statement->values->size())
+                    throw SQLExecError("every row of VALUES must have the same number of values");
+                ValueDict *row = new ValueDict();
+                rows.push_back(row);
+                for (uint i = 0; i < values.size(); i++)
+                    (*row)[column_names[i]] = values[i];
+            }
         }
+    } catch (...) {
+        for (auto row: rows)
+            delete row;
+        throw;
     }
-    delete column_names;
+    QueryResult *result;
+    try {
+        result = insert(statement->tableName, rows);
+    } catch (...) {
+        for (auto row: rows)
+            delete row;
+        throw;
+    }
+    for (auto row: rows)
+        delete row;
+    return result;
+}
 
-    Handle t_insert = table.insert(&row);
+QueryResult *SQLExec::insert(const Identifier &table_name, const ValueDict &row) {
+    return insert(table_name, ValueDicts(1, const_cast<ValueDict*>(&row)));
+}
+
+// The rows go into the table as a batch, packed into its blocks, then each index gets their entries as a batch.
+// If an index can't take them (a duplicate key), the rows come back out of the table and the indices that already
+// have their entries, and the index that failed part way is built again as it was.
+QueryResult *SQLExec::insert(const Identifier &table_name, const ValueDicts &rows) {
+    DbRelation& table = SQLExec::tables->get_table(table_name);
+    Handles *handles = table.insert_many(&rows);
 
     // insert into indices
     auto index_names = SQLExec::indices->get_index_names(table_name);
-    for (auto const& index_name: index_names) {
-        DbIndex& index = SQLExec::indices->get_index(table, index_name);
-        index.insert(t_insert);
+    size_t done = 0;
+    try {
+        for (auto const& index_name: index_names) {
+            DbIndex& index = SQLExec::indices->get_index(table, index_name);
+            index.insert_many(handles);
+            done++;
+        }
+    } catch (...) {
+        for (size_t i = 0; i < done; i++)
+            SQLExec::indices->get_index(table, index_names[i]).del_many(handles);
+        table.del_many(handles);
+        delete handles;
+        if (done < index_names.size()) {
+            SQLExec::schema_version++;  // so prepared statements with plans using the old index know it's gone
+            SQLExec::indices->rebuild_index(table, index_names[done]);
+        }
+        throw;
     }
+    delete handles;
 
-    std::string comment = "successfully inserted 1 row into " + table_name;
+    std::string comment = "successfully inserted " + std::to_string(rows.size())
+                          + (rows.size() == 1 ? " row into " : " rows into ") + table_name;
     if (index_names.size() > 0)
         comment += std::string(" and ") + std::to_string(index_names.size()) + " indices";
     return new QueryResult(comment);
 }
 
-// recursive helper to pick up all the leaf equality conditions
-void get_where_conjunction(const hsql::Expr *expr, ValueDict *conjunction) {
+// SQL: IMPORT FROM CSV FILE 'file' INTO t (or COPY t FROM 'file', see strip_copy_clause)
+// The rows are loaded in bulk (see BulkLoader). If that at least doubles the table, each index is then built over
+// again in bulk, else the new rows go into the indices as a batch. If an index can't take them (a duplicate key),
+// they're taken back out of the table and the indices built again as they were.
+QueryResult *SQLExec::import(const hsql::ImportStatement *statement) {
+    if (statement->type != hsql::kImportCSV)
+        throw SQLExecError("only CSV files can be imported");
+    Identifier table_name = statement->tableName;
+    DbRelation& table = SQLExec::tables->get_table(table_name);
+    BulkLoader loader(table);
+    Handles *handles = loader.load(statement->filePath);
+    u_long n = handles->size();
+    bool rebuild = table.count() <= 2 * n;
+
+    auto index_names = SQLExec::indices->get_index_names(table_name);
+    if (rebuild && !index_names.empty())
+        SQLExec::schema_version++;  // so prepared statements with plans using the old indices know they're gone
+    try {
+        for (auto const& index_name: index_names) {
+            if (rebuild)
+                SQLExec::indices->rebuild_index(table, index_name);
+            else
+                SQLExec::indices->get_index(table, index_name).insert_many(handles);
+        }
+    } catch (DbRelationError& e) {
+        table.del_many(handles);
+        delete handles;
+        for (auto const& index_name: index_names)
+            SQLExec::indices->rebuild_index(table, index_name);
+        throw SQLExecError(std::string("nothing loaded: ") + e.what());
+    }
+    delete handles;
+
+    std::string comment = "successfully loaded " + std::to_string(n) + (n == 1 ? " row into " : " rows into ")
+                          + table_name;
+    if (index_names.size() > 0)
+        comment += std::string(rebuild ? " and rebuilt " : " and ") + std::to_string(index_names.size()) + " indices";
+    return new QueryResult(comment);
+}
+
+// the comparison (other than equality) that an operator expression makes, if any
+static bool get_comparison(const hsql::Expr *expr, Predicate::Comparison &comparison) {
+    if (expr->opType == hsql::Expr::SIMPLE_OP && expr->opChar == '<')
+        comparison = Predicate::LT;
+    else if (expr->opType == hsql::Expr::SIMPLE_OP && expr->opChar == '>')
+        comparison = Predicate::GT;
+    else if (expr->opType == hsql::Expr::LESS_EQ)
+        comparison = Predicate::LE;
+    else if (expr->opType == hsql::Expr::GREATER_EQ)
+        comparison = Predicate::GE;
+    else if (expr->opType == hsql::Expr::NOT_EQUALS)
+        comparison = Predicate::NE;
+    else
+        return false;
+    return true;
+}
+
+// the same comparison with its operands swapped (literal < column is column > literal)
+static Predicate::Comparison flip(Predicate::Comparison comparison) {
+    switch (comparison) {
+        case Predicate::LT:
+            return Predicate::GT;
+        case Predicate::LE:
+            return Predicate::GE;
+        case Predicate::GT:
+            return Predicate::LT;
+        case Predicate::GE:
+            return Predicate::LE;
+        default:
+            return comparison;
+    }
+}
+
+// a column reference's name, qualified with its table if it was given one ("t.a")
+static Identifier column_ref(const hsql::Expr *expr) {
+    if (expr->table != nullptr)
+        return JoinOperator::qualified(expr->table, expr->name);
+    return Identifier(expr->name);
+}
+
+// recursive helper to pick up all the leaf conditions: equalities go in conjunction, other comparisons in predicates
+void get_where_conjunction(const hsql::Expr *expr, ValueDict *conjunction, Predicates *predicates) {
     if (expr->type == hsql::kExprOperator) {
+        Value value, high;
+        Predicate::Comparison comparison;
 
         // base case: column = literal
         if (expr->opType == hsql::Expr::SIMPLE_OP
                 && expr->opChar == '='
-                && expr->expr->type == hsql::kExprColumnRef) {
+                && expr->expr->type == hsql::kExprColumnRef
+                && get_literal(expr->expr2, value)) {
+            (*conjunction)[column_ref(expr->expr)] = value;
+            return;
+        }
 
-            if (expr->expr2->type == hsql::kExprLiteralInt) {
-                (*conjunction)[expr->expr->name] = Value((int32_t)expr->expr2->ival);
+        // base case: column <, <=, >, >= or != literal (or the other way around)
+        if (expr->expr != nullptr && expr->expr2 != nullptr && get_comparison(expr, comparison)) {
+            if (expr->expr->type == hsql::kExprColumnRef && get_literal(expr->expr2, value)) {
+                predicates->push_back(Predicate(column_ref(expr->expr), comparison, value));
                 return;
             }
-            if (expr->expr2->type == hsql::kExprLiteralString) {
-                (*conjunction)[expr->expr->name] = Value(expr->expr2->name);
+            if (expr->expr2->type == hsql::kExprColumnRef && get_literal(expr->expr, value)) {
+                predicates->push_back(Predicate(column_ref(expr->expr2), flip(comparison), value));
                 return;
             }
         }
 
+        // base case: column BETWEEN literal AND literal
+        if (expr->opType == hsql::Expr::BETWEEN
+                && expr->expr->type == hsql::kExprColumnRef
+                && expr->exprList != nullptr && expr->exprList->size() == 2
+                && get_literal(expr->exprList->at(0), value)
+                && get_literal(expr->exprList->at(1), high)) {
+            predicates->push_back(Predicate(column_ref(expr->expr), Predicate::GE, value));
+            predicates->push_back(Predicate(column_ref(expr->expr), Predicate::LE, high));
+            return;
+        }
+
         // recurse on AND operands
         if (expr->opType == hsql::Expr::AND) {
-            get_where_conjunction(expr->expr, conjunction);
-            get_where_conjunction(expr->expr2, conjunction);
+            get_where_conjunction(expr->expr, conjunction, predicates);
+            get_where_conjunction(expr->expr2, conjunction, predicates);
             return;
         }
     }
-    throw SQLExecError("we only know how to do WHERE clauses with =/AND so far");
+    throw SQLExecError("we only know how to do WHERE clauses comparing columns with literals, joined by AND "
+                       "(and those ORed together), so far");
 }
 
-// Get a ValueDict of any AND conjuctions where bottom level has to be EQUALITY expressions
-ValueDict *get_where_conjunction(const hsql::Expr *where_clause) {
+// Get a ValueDict of any AND conjuctions of EQUALITY expressions, with any other comparisons going into predicates
+ValueDict *get_where_conjunction(const hsql::Expr *where_clause, Predicates *predicates) {
     ValueDict *where = new ValueDict();
-    get_where_conjunction(where_clause, where);
+    try {
+        get_where_conjunction(where_clause, where, predicates);
+    } catch (SQLExecError &e) {
+        delete where;
+        throw;
+    }
     return where;
 }
 
@@ -168,7 +437,7 @@ ColumnNames *get_select_column_names(const std::vector<hsql::Expr*>* list) {
     ColumnNames *column_names = new ColumnNames();
     for (auto const& expr: *list) {
         if (expr->type == hsql::kExprColumnRef) {
-            column_names->push_back(Identifier(expr->name));
+            column_names->push_back(column_ref(expr));
         } else {
             delete column_names;
             throw SQLExecError("only support * or explicit column names in SELECT");
@@ -177,71 +446,431 @@ ColumnNames *get_select_column_names(const std::vector<hsql::Expr*>* list) {
     return column_names;
 }
 
-// SQL: SELECT...
-QueryResult *SQLExec::select(const hsql::SelectStatement *statement) {
-    Identifier table_name = statement->fromTable->getName();
-    DbRelation& table = SQLExec::tables->get_table(table_name);
+// Which of the FROM clause's columns a column reference means. A lone table's columns go by their plain names, so
+// "t.a" is just "a" there (table_name being t). Joined columns are all qualified, so there a plain "a" means whichever
+// one "x.a" there is.
+static Identifier resolve_column(const Identifier &ref, const ColumnNames &column_names, const Identifier &table_name) {
+    if (std::find(column_names.begin(), column_names.end(), ref) != column_names.end())
+        return ref;
+    size_t dot = ref.find('.');
+    if (!table_name.empty()) {
+        if (dot != std::string::npos && ref.substr(0, dot) == table_name)
+            return ref.substr(dot + 1);
+        return ref;  // unknown, which the table will tell us about
+    }
+    Identifier found;
+    if (dot == std::string::npos) {
+        for (auto const& column_name: column_names) {
+            size_t suffix = column_name.size() - ref.size();
+            if (column_name.size() > ref.size() && column_name[suffix - 1] == '.'
+                    && column_name.compare(suffix, ref.size(), ref) == 0) {
+                if (!found.empty())
+                    throw SQLExecError("column '" + ref + "' is ambiguous");
+                found = column_name;
+            }
+        }
+    }
+    if (found.empty())
+        throw SQLExecError("unknown column '" + ref + "'");
+    return found;
+}
 
-    // start base of plan at a TableScan
-    EvalPlan *plan = new EvalPlan(table);
+// resolve_column for every column a WHERE clause mentions
+static void resolve_columns(ValueDict &where, Predicates &predicates, const ColumnNames &column_names,
+                            const Identifier &table_name) {
+    ValueDict resolved;
+    for (auto const& column: where)
+        resolved[resolve_column(column.first, column_names, table_name)] = column.second;
+    where.swap(resolved);
+    for (auto &predicate: predicates)
+        predicate.column_name = resolve_column(predicate.column_name, column_names, table_name);
+}
+
+// Each of the alternatives a WHERE clause ORs together, as a Condition
+static void get_alternatives(const hsql::Expr *expr, Conditions &alternatives, const ColumnNames &column_names,
+                             const Identifier &table_name) {
+    if (expr->type == hsql::kExprOperator && expr->opType == hsql::Expr::OR) {
+        get_alternatives(expr->expr, alternatives, column_names, table_name);
+        get_alternatives(expr->expr2, alternatives, column_names, table_name);
+        return;
+    }
+    Condition condition;
+    get_where_conjunction(expr, &condition.where, &condition.predicates);
+    resolve_columns(condition.where, condition.predicates, column_names, table_name);
+    alternatives.push_back(condition);
+}
+
+// Enclose plan in a Select for a WHERE clause, or in an Or if the clause ORs alternatives together. Deletes plan
+// on failure.
+static EvalPlan *where_plan(const hsql::Expr *where_clause, EvalPlan *plan, const ColumnNames &column_names,
+                            const Identifier &table_name) {
+    if (where_clause->type == hsql::kExprOperator && where_clause->opType == hsql::Expr::OR) {
+        Conditions *alternatives = new Conditions();
+        try {
+            get_alternatives(where_clause, *alternatives, column_names, table_name);
+        } catch (SQLExecError &e) {
+            delete alternatives;
+            delete plan;
+            throw;
+        }
+        return new EvalPlan(alternatives, plan);
+    }
+
+    ValueDict *where = nullptr;
+    Predicates *predicates = new Predicates();
+    try {
+        where = get_where_conjunction(where_clause, predicates);
+        resolve_columns(*where, *predicates, column_names, table_name);
+    } catch (SQLExecError &e) {
+        delete where;
+        delete predicates;
+        delete plan;
+        throw;
+    }
+    return new EvalPlan(where, predicates, plan);
+}
+
+// Pick up the column pairs an ON clause equates (joined by AND), naming each the way its own side's rows do.
+// sides are the two sides' qualified columns and names their table names (empty for a side that's a join).
+static void get_join_columns(const hsql::Expr *expr, const ColumnNames sides[2], const Identifier names[2],
+                             const ColumnNames &column_names, ColumnNames *join_columns[2]) {
+    if (expr->type == hsql::kExprOperator && expr->opType == hsql::Expr::AND) {
+        get_join_columns(expr->expr, sides, names, column_names, join_columns);
+        get_join_columns(expr->expr2, sides, names, column_names, join_columns);
+        return;
+    }
+    if (expr->type != hsql::kExprOperator || expr->opType != hsql::Expr::SIMPLE_OP || expr->opChar != '='
+            || expr->expr->type != hsql::kExprColumnRef || expr->expr2->type != hsql::kExprColumnRef)
+        throw SQLExecError("we only know how to join ON equalities between columns, joined by AND, so far");
+    Identifier columns[2] = {resolve_column(column_ref(expr->expr), column_names, ""),
+                             resolve_column(column_ref(expr->expr2), column_names, "")};
+    bool on_left[2];
+    for (int i = 0; i < 2; i++)
+        on_left[i] = std::find(sides[0].begin(), sides[0].end(), columns[i]) != sides[0].end();
+    if (on_left[0] == on_left[1])
+        throw SQLExecError("each ON equality must compare a column from each side of the join");
+    for (int i = 0; i < 2; i++) {
+        int side = on_left[i] ? 0 : 1;
+        Identifier column_name = columns[i];
+        if (!names[side].empty())
+            column_name = column_name.substr(names[side].size() + 1);
+        join_columns[side]->push_back(column_name);
+    }
+}
+
+// Plan the FROM clause: a TableScan for a table, or a Join of the plans for the two sides of a JOIN ... ON. Fills in
+// the columns its rows will have and, for a lone table, the name it goes by (a join's rows are qualified instead,
+// see JoinOperator, so it gets none).
+static EvalPlan *from_plan(const hsql::TableRef *from, ColumnNames &column_names, ColumnAttributes &column_attributes,
+                           Identifier &name) {
+    if (from->type == hsql::kTableName) {
+        DbRelation& table = SQLExec::tables->get_table(from->name);
+        column_names = table.get_column_names();
+        column_attributes = table.get_column_attributes();
+        name = from->getName();
+        return new EvalPlan(table);
+    }
+    if (from->type != hsql::kTableJoin || from->join->type != hsql::kJoinInner || from->join->condition == nullptr)
+        throw SQLExecError("only tables and inner joins with an ON clause are supported in FROM");
+
+    ColumnNames sides[2];
+    ColumnAttributes side_attributes[2];
+    Identifier names[2];
+    EvalPlan *plans[2] = {nullptr, nullptr};
+    ColumnNames *join_columns[2] = {new ColumnNames(), new ColumnNames()};
+    try {
+        plans[0] = from_plan(from->join->left, sides[0], side_attributes[0], names[0]);
+        plans[1] = from_plan(from->join->right, sides[1], side_attributes[1], names[1]);
+        column_names.clear();
+        column_attributes.clear();
+        for (int i = 0; i < 2; i++) {
+            for (auto &column_name: sides[i]) {
+                column_name = JoinOperator::qualified(names[i], column_name);
+                if (std::find(column_names.begin(), column_names.end(), column_name) != column_names.end())
+                    throw SQLExecError("column '" + column_name + "' appears twice in FROM (a table needs an alias)");
+                column_names.push_back(column_name);
+            }
+            column_attributes.insert(column_attributes.end(), side_attributes[i].begin(), side_attributes[i].end());
+        }
+        get_join_columns(from->join->condition, sides, names, column_names, join_columns);
+    } catch (...) {
+        delete plans[0];
+        delete plans[1];
+        delete join_columns[0];
+        delete join_columns[1];
+        throw;
+    }
+    name = "";
+    return new EvalPlan(EvalPlan::Join, plans[0], plans[1], join_columns[0], join_columns[1], names[0], names[1]);
+}
+
+// What an aggregate function call comes out as: its alias, if it has one, else as written, like "SUM(a)".
+static Identifier aggregate_name(const hsql::Expr *expr) {
+    if (expr->alias != nullptr)
+        return expr->alias;
+    std::string name = expr->name;
+    std::transform(name.begin(), name.end(), name.begin(), ::toupper);
+    std::string argument = "*";
+    if (expr->exprList != nullptr && expr->exprList->size() == 1 && expr->exprList->at(0)->type == hsql::kExprColumnRef)
+        argument = column_ref(expr->exprList->at(0));
+    return name + "(" + argument + ")";
+}
+
+// An aggregate function call such as COUNT(*) or MAX(a), against the FROM clause's columns.
+static Aggregate get_aggregate(const hsql::Expr *expr, const ColumnNames &column_names, const Identifier &table_name) {
+    std::string name = expr->name;
+    std::transform(name.begin(), name.end(), name.begin(), ::toupper);
+    Aggregate::Function function;
+    if (name == "COUNT")
+        function = Aggregate::COUNT;
+    else if (name == "SUM")
+        function = Aggregate::SUM;
+    else if (name == "MIN")
+        function = Aggregate::MIN;
+    else if (name == "MAX")
+        function = Aggregate::MAX;
+    else if (name == "AVG")
+        function = Aggregate::AVG;
+    else
+        throw SQLExecError("unknown function " + name);
+    if (expr->distinct)
+        throw SQLExecError("DISTINCT aggregates not supported");
+    if (expr->exprList == nullptr || expr->exprList->size() != 1)
+        throw SQLExecError(name + " takes one argument");
+
+    const hsql::Expr *argument = expr->exprList->at(0);
+    Identifier column_name;
+    if (argument->type == hsql::kExprColumnRef) {
+        column_name = resolve_column(column_ref(argument), column_names, table_name);
+        if (std::find(column_names.begin(), column_names.end(), column_name) == column_names.end())
+            throw SQLExecError("unknown column '" + column_name + "'");
+    } else if (argument->type != hsql::kExprStar || function != Aggregate::COUNT) {
+        throw SQLExecError("only support COUNT(*) or aggregates of a column name");
+    }
+    return Aggregate(function, column_name, aggregate_name(expr));
+}
+
+// Wrap plan in an Aggregate for a GROUP BY or aggregate functions in the SELECT list, gathering the aggregates from
+// there and from the ORDER BY clause. Its rows have the group columns and then the aggregates, which replace
+// column_names and column_attributes; select_names gets what each of the SELECT list comes out as.
+static EvalPlan *aggregate_plan(const hsql::SelectStatement *statement, EvalPlan *plan, ColumnNames &column_names,
+                                ColumnAttributes &column_attributes, const Identifier &table_name,
+                                ColumnNames &select_names) {
+    ColumnNames *group_by = new ColumnNames();
+    Aggregates *aggregates = new Aggregates();
+    try {
+        if (statement->groupBy != nullptr) {
+            if (statement->groupBy->having != nullptr)
+                throw SQLExecError("HAVING not supported");
+            for (auto const& expr: *statement->groupBy->columns) {
+                if (expr->type != hsql::kExprColumnRef)
+                    throw SQLExecError("only support GROUP BY column names");
+                Identifier column_name = resolve_column(column_ref(expr), column_names, table_name);
+                if (std::find(column_names.begin(), column_names.end(), column_name) == column_names.end())
+                    throw SQLExecError("unknown column '" + column_name + "'");
+                group_by->push_back(column_name);
+            }
+        }
+
+        std::vector<const hsql::Expr*> calls;
+        for (auto const& expr: *statement->selectList) {
+            if (expr->type == hsql::kExprFunctionRef) {
+                calls.push_back(expr);
+                select_names.push_back(aggregate_name(expr));
+            } else if (expr->type == hsql::kExprColumnRef) {
+                Identifier column_name = resolve_column(column_ref(expr), column_names, table_name);
+                if (std::find(group_by->begin(), group_by->end(), column_name) == group_by->end())
+                    throw SQLExecError("column '" + column_name + "' must be in GROUP BY or in an aggregate");
+                select_names.push_back(column_name);
+            } else {
+                throw SQLExecError("only support column names and aggregates in SELECT with GROUP BY");
+            }
+        }
+        if (statement->order != nullptr)
+            for (auto const& order: *statement->order)
+                if (order->expr->type == hsql::kExprFunctionRef)
+                    calls.push_back(order->expr);
+        for (auto const& expr: calls) {
+            Aggregate aggregate = get_aggregate(expr, column_names, table_name);
+            bool seen = std::find(group_by->begin(), group_by->end(), aggregate.output_name) != group_by->end();
+            for (auto const& other: *aggregates)
+                seen = seen || other.output_name == aggregate.output_name;
+            if (!seen)
+                aggregates->push_back(aggregate);
+        }
+    } catch (SQLExecError &e) {
+        delete group_by;
+        delete aggregates;
+        delete plan;
+        throw;
+    }
+
+    ColumnNames output_names(*group_by);
+    ColumnAttributes output_attributes;
+    for (auto const& column_name: *group_by)
+        output_attributes.push_back(column_attributes[std::find(column_names.begin(), column_names.end(),
+                                                                column_name) - column_names.begin()]);
+    for (auto const& aggregate: *aggregates) {
+        output_names.push_back(aggregate.output_name);
+        if (aggregate.function == Aggregate::MIN || aggregate.function == Aggregate::MAX)
+            output_attributes.push_back(column_attributes[std::find(column_names.begin(), column_names.end(),
+                                                                    aggregate.column_name) - column_names.begin()]);
+        else
+            output_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    }
+    column_names = output_names;
+    column_attributes = output_attributes;
+    return new EvalPlan(group_by, aggregates, plan);
+}
 
-    // enclose that in a Select if we have a where clause
+// The plan for a SELECT, before it's optimized, and the columns of its result
+static EvalPlan *select_plan(const hsql::SelectStatement *statement, ColumnNames &column_names,
+                             ColumnAttributes &column_attributes) {
+    // start base of plan at a TableScan, or at the joins of the FROM clause's tables
+    ColumnNames from_columns;
+    ColumnAttributes from_attributes;
+    Identifier from_name;
+    EvalPlan *plan = from_plan(statement->fromTable, from_columns, from_attributes, from_name);
+
+    // enclose that in a Select (or an Or) if we have a where clause
     if (statement->whereClause != nullptr)
-        plan = new EvalPlan(get_where_conjunction(statement->whereClause), plan);
+        plan = where_plan(statement->whereClause, plan, from_columns, from_name);
+
+    // group and aggregate for a GROUP BY or aggregate functions in the select list
+    bool aggregating = statement->groupBy != nullptr;
+    for (auto const& expr: *statement->selectList)
+        aggregating = aggregating || expr->type == hsql::kExprFunctionRef;
+    ColumnNames select_names;
+    if (aggregating)
+        plan = aggregate_plan(statement, plan, from_columns, from_attributes, from_name, select_names);
+
+    // sort for an ORDER BY (the optimizer drops the sort if the rows come out in that order anyway)
+    if (statement->order != nullptr) {
+        SortColumns *sort_columns = new SortColumns();
+        try {
+            for (auto const& order: *statement->order) {
+                Identifier column_name;
+                if (order->expr->type == hsql::kExprColumnRef)
+                    column_name = resolve_column(column_ref(order->expr), from_columns, from_name);
+                else if (aggregating && order->expr->type == hsql::kExprFunctionRef)
+                    column_name = aggregate_name(order->expr);
+                else
+                    throw SQLExecError("only support ORDER BY column names and aggregates");
+                sort_columns->push_back(SortColumn(column_name, order->type == hsql::kOrderDesc));
+            }
+        } catch (SQLExecError &e) {
+            delete sort_columns;
+            delete plan;
+            throw;
+        }
+        plan = new EvalPlan(sort_columns, plan);
+    }
+
+    // LIMIT and OFFSET (the optimizer takes the limit down into a sort or range scan if it can)
+    if (statement->limit != nullptr) {
+        if (statement->limit->limit < hsql::kNoLimit || statement->limit->offset < hsql::kNoOffset) {
+            delete plan;
+            throw SQLExecError("LIMIT and OFFSET can't be negative");
+        }
+        u_long limit = statement->limit->limit == hsql::kNoLimit ? LimitOperator::ALL : statement->limit->limit;
+        u_long offset = statement->limit->offset == hsql::kNoOffset ? 0 : statement->limit->offset;
+        plan = new EvalPlan(limit, offset, plan);
+    }
 
     // now wrap the whole thing in a ProjectAll or a Project
-    ColumnNames *column_names;
-    ColumnAttributes *column_attributes;
     if (statement->selectList->at(0)->type == hsql::kExprStar) {
-        column_names = new ColumnNames(table.get_column_names());
-        column_attributes = new ColumnAttributes(table.get_column_attributes());
-        plan = new EvalPlan(EvalPlan::ProjectAll, plan);
-    } else {
-        column_names = get_select_column_names(statement->selectList);
-        column_attributes = table.get_column_attributes(*column_names);
-        plan = new EvalPlan(new ColumnNames(*column_names), plan);
+        column_names = from_columns;
+        column_attributes = from_attributes;
+        return new EvalPlan(EvalPlan::ProjectAll, plan);
     }
+    try {
+        ColumnNames *select_list = aggregating ? new ColumnNames(select_names)
+                                               : get_select_column_names(statement->selectList);
+        column_names = *select_list;
+        delete select_list;
+        for (auto &column_name: column_names) {
+            column_name = resolve_column(column_name, from_columns, from_name);
+            auto found = std::find(from_columns.begin(), from_columns.end(), column_name);
+            if (found == from_columns.end())
+                throw SQLExecError("unknown column '" + column_name + "'");
+            column_attributes.push_back(from_attributes[found - from_columns.begin()]);
+        }
+    } catch (SQLExecError &e) {
+        delete plan;
+        throw;
+    }
+    return new EvalPlan(new ColumnNames(column_names), plan);
+}
 
-    // optimize the plan and evaluate the optimized plan
+// SQL: SELECT...
+QueryResult *SQLExec::select(const hsql::SelectStatement *statement) {
+    ColumnNames column_names;
+    ColumnAttributes column_attributes;
+    EvalPlan *plan = select_plan(statement, column_names, column_attributes);
+
+    // optimize the plan and hand back its operators, so the rows stream out a batch at a time as they're printed
     EvalPlan *optimized = plan->optimize();
-    ValueDicts *rows = optimized->evaluate();
+    EvalOperator *source = optimized->operators();
     delete plan;
     delete optimized;
 
-    return new QueryResult(column_names, column_attributes, rows,
-                           "successfully returned " + std::to_string(rows->size()) + " rows");
+    return new QueryResult(new ColumnNames(column_names), new ColumnAttributes(column_attributes), source);
 }
 
-// SQL: DELETE ...
-QueryResult *SQLExec::del(const hsql::DeleteStatement *statement) {
-    Identifier table_name = statement->tableName;
+// The plan for the rows a DELETE or UPDATE with the given where clause changes, before it's optimized
+static EvalPlan *rows_plan(const Identifier &table_name, const hsql::Expr *where) {
     DbRelation& table = SQLExec::tables->get_table(table_name);
 
     // start base of plan at a TableScan
     EvalPlan *plan = new EvalPlan(table);
 
-    // enclose that in a Select if we have a where clause
-    if (statement->expr != nullptr)
-        plan = new EvalPlan(get_where_conjunction(statement->expr), plan);
+    // enclose that in a Select (or an Or) if we have a where clause
+    if (where != nullptr)
+        plan = where_plan(where, plan, table.get_column_names(), table_name);
+    return plan;
+}
+
+static EvalPlan *delete_plan(const hsql::DeleteStatement *statement) {
+    return rows_plan(statement->tableName, statement->expr);
+}
 
+static EvalPlan *update_plan(const hsql::UpdateStatement *statement) {
+    return rows_plan(statement->table->name, statement->where);
+}
+
+// SQL: DELETE ...
+QueryResult *SQLExec::del(const hsql::DeleteStatement *statement) {
     // optimize the plan and evaluate the optimized plan
+    EvalPlan *plan = delete_plan(statement);
     EvalPlan *optimized = plan->optimize();
+    delete plan;
+    return del(statement->tableName, optimized);
+}
+
+QueryResult *SQLExec::del(const Identifier &table_name, EvalPlan *optimized) {
+    DbRelation& table = SQLExec::tables->get_table(table_name);
     EvalPipeline pipeline = optimized->pipeline();
 
-    // now delete all the handles
+    // now delete all the handles as a batch: from each index first (which needs the rows to find their keys), then
+    // from the table; if any of that fails, the indices are built over again from the table as it is
     auto index_names = SQLExec::indices->get_index_names(table_name);
     Handles *handles = pipeline.second;
-    for (auto const& handle: *handles) {
-        // delete from index before deleting from table
-        for (auto const& index_name: index_names){
+    try {
+        for (auto const& index_name: index_names) {
             DbIndex& index = SQLExec::indices->get_index(table, index_name);
-            index.del(handle);
+            index.del_many(handles);
         }
-        table.del(handle);
+        table.del_many(handles);
+    } catch (...) {
+        delete handles;
+        delete optimized;
+        SQLExec::schema_version++;  // so prepared statements with plans using the old indices know they're gone
+        for (auto const& index_name: index_names)
+            SQLExec::indices->rebuild_index(table, index_name);
+        throw;
     }
     u_long n = handles->size();
     delete handles;
-    delete plan;
     delete optimized;
 
     std::string comment = "successfully deleted " + std::to_string(n) + " rows from " + table_name;
@@ -250,6 +879,367 @@ QueryResult *SQLExec::del(const hsql::DeleteStatement *statement) {
     return new QueryResult(comment);
 }
 
+// SQL: UPDATE t SET column = value, ... WHERE ...
+// The rows come from a plan, as for DELETE, and are changed in place where they still fit (see update_many). Only the
+// indices with a changed column (in their key or INCLUDE columns) take the rows out and put them back, so setting a
+// column no index has touches no index at all, unless rows have to move: every index then gets their new handles.
+// New keys are checked against the table's primary key (if it's kept in a tree) and each unique index first, so a
+// duplicate changes nothing. If anything fails after that, the indices are built over again from the table as it is.
+QueryResult *SQLExec::update(const hsql::UpdateStatement *statement) {
+    Identifier table_name = statement->table->name;
+    DbRelation& table = SQLExec::tables->get_table(table_name);
+    const ColumnNames& column_names = table.get_column_names();
+    ColumnAttributes column_attributes = table.get_column_attributes();
+    ValueDict new_values;
+    for (auto const& clause: *statement->updates) {
+        auto column = std::find(column_names.begin(), column_names.end(), clause->column);
+        if (column == column_names.end())
+            throw SQLExecError(std::string("Column '") + clause->column + "' does not exist in " + table_name);
+        Value value;
+        if (!get_literal(clause->value, value))
+            throw SQLExecError("only literal values can be SET");
+        ColumnAttribute::DataType data_type = column_attributes[column - column_names.begin()].get_data_type();
+        if (data_type == ColumnAttribute::BOOLEAN && value.data_type == ColumnAttribute::INT
+            && (value.n == 0 || value.n == 1))
+            value = Value(value.n == 1);
+        if (value.data_type != data_type)
+            throw SQLExecError(std::string("wrong type of value for column '") + clause->column + "'");
+        new_values[clause->column] = value;
+    }
+
+    // the indices with a changed column, and the others
+    std::vector<DbIndex*> changed, unchanged;
+    for (auto const& index_name: SQLExec::indices->get_index_names(table_name)) {
+        DbIndex& index = SQLExec::indices->get_index(table, index_name);
+        bool changes = false;
+        for (auto const& column: new_values)
+            changes = changes || index.covers(ColumnNames(1, column.first))
+                      || std::find(index.get_key_columns().begin(), index.get_key_columns().end(), column.first)
+                         != index.get_key_columns().end();
+        (changes ? changed : unchanged).push_back(&index);
+    }
+
+    EvalPlan *plan = update_plan(statement);
+    EvalPlan *optimized = plan->optimize();
+    delete plan;
+    EvalPipeline pipeline = optimized->pipeline();
+    Handles *handles = pipeline.second;
+    Handles *updated = nullptr;
+    size_t indices_touched = changed.size();
+    try {
+        if (table.get_primary_key() != nullptr)
+            check_new_keys(table, nullptr, *table.get_primary_key(), handles, new_values);
+        for (auto index: changed)
+            if (index->is_unique())
+                check_new_keys(table, index, index->get_key_columns(), handles, new_values);
+    } catch (...) {
+        delete handles;
+        delete optimized;
+        throw;
+    }
+    try {
+        for (auto index: changed)
+            index->del_many(handles);
+        updated = table.update_many(handles, &new_values);
+        for (auto index: changed)
+            index->insert_many(updated);
+
+        // rows that moved need their new handles in the other indices too (found by their keys, which haven't changed)
+        Handles moved;
+        for (size_t i = 0; i < handles->size(); i++)
+            if (!((*updated)[i] == (*handles)[i]))
+                moved.push_back((*updated)[i]);
+        if (!moved.empty()) {
+            for (auto index: unchanged) {
+                index->del_many(&moved);
+                index->insert_many(&moved);
+            }
+            indices_touched += unchanged.size();
+        }
+    } catch (...) {
+        delete updated;
+        delete handles;
+        delete optimized;
+        SQLExec::schema_version++;  // so prepared statements with plans using the old indices know they're gone
+        for (auto const& index_name: SQLExec::indices->get_index_names(table_name))
+            SQLExec::indices->rebuild_index(table, index_name);
+        throw;
+    }
+    u_long n = handles->size();
+    delete updated;
+    delete handles;
+    delete optimized;
+
+    std::string comment = "successfully updated " + std::to_string(n) + " rows in " + table_name;
+    if (indices_touched > 0)
+        comment += std::string(" and ") + std::to_string(indices_touched) + " indices";
+    return new QueryResult(comment);
+}
+
+// Throw if giving the rows new_values would give two rows the same key in a unique index (or, with no index, the
+// table's primary key): two of them, or one of them and a row that isn't being updated.
+void SQLExec::check_new_keys(DbRelation &table, DbIndex *index, const ColumnNames &key_columns, Handles *handles,
+                             const ValueDict &new_values) {
+    bool key_changes = false;
+    for (auto const& column: key_columns)
+        key_changes = key_changes || new_values.find(column) != new_values.end();
+    if (!key_changes)
+        return;
+    std::set<Handle> updating(handles->begin(), handles->end());
+    std::set<KeyValue> new_keys;
+    ValueDicts *rows = table.project(handles, &key_columns);
+    try {
+        for (auto row: *rows) {
+            KeyValue key;
+            for (auto const& column: key_columns) {
+                auto new_value = new_values.find(column);
+                (*row)[column] = new_value != new_values.end() ? new_value->second : row->at(column);
+                key.push_back(row->at(column));
+            }
+            bool duplicate = !new_keys.insert(key).second;
+            Handles *found = index != nullptr ? index->lookup(row) : table.select(row);
+            for (auto const& handle: *found)
+                duplicate = duplicate || updating.find(handle) == updating.end();
+            delete found;
+            if (duplicate && index != nullptr)
+                throw SQLExecError("Duplicate keys are not allowed in unique index " + index->get_name());
+            if (duplicate)
+                throw SQLExecError("Duplicate keys are not allowed in the primary key of " + table.get_table_name());
+        }
+    } catch (...) {
+        EvalOperator::free_batch(rows);
+        throw;
+    }
+    EvalOperator::free_batch(rows);
+}
+
+// pages the Berkeley DB buffer pool has read in from the database files so far (0 if it can't say)
+static u_long pages_read_in() {
+    DB_MPOOL_STAT *stat = nullptr;
+    try {
+        if (_DB_ENV == nullptr || _DB_ENV->memp_stat(&stat, nullptr, 0) != 0 || stat == nullptr)
+            return 0;
+    } catch (DbException &e) {
+        return 0;
+    }
+    u_long ret = stat->st_page_in;
+    free(stat);
+    return ret;
+}
+
+// SQL: EXPLAIN [ANALYZE] ...
+QueryResult *SQLExec::explain(const hsql::SQLStatement *statement, bool analyze) throw(SQLExecError) {
+    if (SQLExec::tables == nullptr) {
+        SQLExec::tables = new Tables();
+        SQLExec::indices = new Indices();
+    }
+    if (!get_placeholders(statement).empty())
+        throw SQLExecError("only a prepared statement can have ? placeholders");
+
+    EvalPlan *optimized = nullptr;
+    EvalOperator *source = nullptr;
+    try {
+        // the plan as it would be carried out
+        EvalPlan *plan;
+        if (statement->type() == hsql::kStmtSelect) {
+            ColumnNames column_names;
+            ColumnAttributes column_attributes;
+            plan = select_plan((const hsql::SelectStatement *) statement, column_names, column_attributes);
+        } else if (statement->type() == hsql::kStmtDelete && !analyze) {
+            plan = delete_plan((const hsql::DeleteStatement *) statement);
+        } else if (statement->type() == hsql::kStmtUpdate && !analyze) {
+            plan = update_plan((const hsql::UpdateStatement *) statement);
+        } else {
+            throw SQLExecError(analyze ? "EXPLAIN ANALYZE only runs a SELECT"
+                                       : "only SELECT, DELETE and UPDATE can be explained");
+        }
+        optimized = plan->optimize();
+        delete plan;
+        if (!analyze) {
+            std::string text = optimized->explain();
+            delete optimized;
+            return new QueryResult(text.substr(0, text.size() - 1));
+        }
+
+        // else run it, with each operator profiled and the work under them counted, throwing away the rows
+        PlanProfiles profiles;
+        u_long rows = 0;
+        u_long pages_in = pages_read_in();
+        auto start = std::chrono::steady_clock::now();
+        WorkCounters::counting = true;
+        source = optimized->operators(&profiles);
+        source->open();
+        for (ValueDicts *batch = source->next(); batch != nullptr; batch = source->next()) {
+            rows += batch->size();
+            EvalOperator::free_batch(batch);
+        }
+        source->close();
+        WorkCounters::counting = false;
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        pages_in = pages_read_in() - pages_in;
+
+        char summary[200];
+        snprintf(summary, sizeof(summary), "returned %lu rows in %.3f ms, reading %lu pages into the buffer pool",
+                 rows, ms, pages_in);
+        std::string text = optimized->explain(&profiles) + summary;
+        delete source;
+        delete optimized;
+        return new QueryResult(text);
+    } catch (DbRelationError &e) {
+        WorkCounters::counting = false;
+        delete source;
+        delete optimized;
+        throw SQLExecError(std::string("DbRelationError: ") + e.what());
+    } catch (SQLExecError &e) {
+        WorkCounters::counting = false;
+        delete source;
+        delete optimized;
+        throw;
+    }
+}
+
+PreparedStatement *SQLExec::prepare(const hsql::SQLStatement *statement) throw(SQLExecError) {
+    if (SQLExec::tables == nullptr) {
+        SQLExec::tables = new Tables();
+        SQLExec::indices = new Indices();
+    }
+
+    std::vector<int> placeholders = get_placeholders(statement);
+    PreparedStatement *prepared = nullptr;
+    try {
+        switch (statement->type()) {
+            case hsql::kStmtSelect:
+                prepared = new PreparedStatement(hsql::kStmtSelect, "", placeholders);
+                prepared->plan = select_plan((const hsql::SelectStatement *) statement, prepared->column_names,
+                                             prepared->column_attributes);
+                break;
+            case hsql::kStmtDelete: {
+                auto del = (const hsql::DeleteStatement *) statement;
+                prepared = new PreparedStatement(hsql::kStmtDelete, del->tableName, placeholders);
+                prepared->plan = delete_plan(del);
+                break;
+            }
+            case hsql::kStmtInsert: {
+                auto insert = (const hsql::InsertStatement *) statement;
+                prepared = new PreparedStatement(hsql::kStmtInsert, insert->tableName, placeholders);
+                insert_row(insert, prepared->row);
+                break;
+            }
+            default:
+                throw SQLExecError("only SELECT, INSERT and DELETE can be prepared");
+        }
+    } catch (DbRelationError &e) {
+        delete prepared;
+        throw SQLExecError(std::string("DbRelationError: ") + e.what());
+    } catch (SQLExecError &e) {
+        delete prepared;
+        throw;
+    }
+    return prepared;
+}
+
+QueryResult *SQLExec::execute(PreparedStatement *prepared, const KeyValue &parameters) throw(SQLExecError) {
+    if (!prepared->is_current())
+        throw SQLExecError("a table or index has been created or dropped since the statement was prepared");
+    if (parameters.size() != prepared->get_parameter_count())
+        throw SQLExecError("the statement takes " + std::to_string(prepared->get_parameter_count())
+                           + " parameters, not " + std::to_string(parameters.size()));
+
+    try {
+        switch (prepared->type) {
+            case hsql::kStmtSelect: {
+                EvalPlan *plan = prepared->bound_plan(parameters);
+                EvalOperator *source = plan->operators();
+                delete plan;
+                return new QueryResult(new ColumnNames(prepared->column_names),
+                                       new ColumnAttributes(prepared->column_attributes), source);
+            }
+            case hsql::kStmtDelete:
+                return del(prepared->table_name, prepared->bound_plan(parameters));
+            case hsql::kStmtInsert: {
+                ValueDict row(prepared->row);
+                EvalPlan::bind(row, prepared->values(parameters));
+                return insert(prepared->table_name, row);
+            }
+            default:
+                throw SQLExecError("not a statement we can prepare");
+        }
+    } catch (DbRelationError& e) {
+        throw SQLExecError(std::string("DbRelationError: ") + e.what());
+    }
+}
+
+PreparedStatement *SQLExec::cached_plan(const std::string &query, KeyValue &parameters, std::string &text) {
+    std::string normalized = PlanCache::normalize(query, parameters);
+    if (normalized.empty())
+        return nullptr;
+
+    PreparedStatement *prepared = plan_cache.find(normalized, text);
+    if (prepared == nullptr) {
+        // parse and plan the query with its literals as parameters, leaving anything that goes wrong to the usual
+        // way of running it to report
+        hsql::SQLParserResult *parse = hsql::SQLParser::parseSQLString(normalized);
+        if (!parse->isValid() || parse->size() != 1) {
+            delete parse;
+            return nullptr;
+        }
+        try {
+            prepared = prepare(parse->getStatement(0));
+            text = ParseTreeToString::statement(parse->getStatement(0));
+        } catch (SQLExecError &e) {
+            delete parse;
+            return nullptr;
+        }
+        delete parse;
+        plan_cache.add(normalized, prepared, text);
+    }
+    text = PlanCache::fill_in(text, parameters);
+    return prepared;
+}
+
+// SQL: PREPARE ...
+QueryResult *SQLExec::prepare_named(const hsql::PrepareStatement *statement) {
+    Identifier name = statement->name;
+    if (statement->query == nullptr || statement->query->size() != 1)
+        throw SQLExecError("can only prepare one statement at a time");
+    PreparedStatement *prepared = prepare(statement->query->getStatement(0));
+    auto found = prepared_statements.find(name);
+    if (found != prepared_statements.end())
+        delete found->second;
+    prepared_statements[name] = prepared;
+    return new QueryResult("prepared " + name + " with " + std::to_string(prepared->get_parameter_count())
+                           + " parameters");
+}
+
+// SQL: EXECUTE ...
+QueryResult *SQLExec::execute_named(const hsql::ExecuteStatement *statement) {
+    Identifier name = statement->name;
+    auto found = prepared_statements.find(name);
+    if (found == prepared_statements.end())
+        throw SQLExecError("no prepared statement " + name);
+    KeyValue parameters;
+    if (statement->parameters != nullptr) {
+        for (auto const& expr: *statement->parameters) {
+            Value value;
+            if (!get_literal(expr, value) || value.parameter != 0)
+                throw SQLExecError("only int and string literals can be parameters");
+            parameters.push_back(value);
+        }
+    }
+    return execute(found->second, parameters);
+}
+
+// SQL: DROP PREPARE ...
+QueryResult *SQLExec::drop_prepared(const hsql::DropStatement *statement) {
+    Identifier name = statement->name;
+    auto found = prepared_statements.find(name);
+    if (found == prepared_statements.end())
+        throw SQLExecError("no prepared statement " + name);
+    delete found->second;
+    prepared_statements.erase(found);
+    return new QueryResult("dropped prepared statement " + name);
+}
+
 bool SQLExec::column_definition(const hsql::ColumnDefinition *col, Identifier& column_name,
                                 ColumnAttribute& column_attribute, ColumnNames*& primary_key) {
     if (col->definitionType == hsql::ColumnDefinition::kColumn) {
@@ -277,12 +1267,195 @@ bool SQLExec::column_definition(const hsql::ColumnDefinition *col, Identifier& c
     }
 }
 
-QueryResult *SQLExec::create(const hsql::CreateStatement *statement) {
+// Where keyword (in upper case) first appears in query (also in upper case) as a word of its own, not part of a
+// longer name nor inside a 'string' or "name"; npos if it doesn't.
+static std::string::size_type find_keyword(const std::string &query, const std::string &keyword) {
+    auto in_name = [](char c) { return isalnum((unsigned char) c) || c == '_'; };
+    for (std::string::size_type i = 0; i < query.size(); i++) {
+        if (query[i] == '\'' || query[i] == '"') {
+            i = query.find(query[i], i + 1);
+            if (i == std::string::npos)
+                break;
+        } else if (query.compare(i, keyword.size(), keyword) == 0 && (i == 0 || !in_name(query[i - 1]))
+                   && (i + keyword.size() >= query.size() || !in_name(query[i + keyword.size()]))) {
+            return i;
+        }
+    }
+    return std::string::npos;
+}
+
+// Pull the VALUES tuples after the first off of a multi-row INSERT, since our parser only takes one, and put their
+// literals (ints and 'strings') in extra_rows. Returns the rest of the query. Any other query comes back as is.
+std::string SQLExec::strip_extra_rows(const std::string &query, std::vector<KeyValue> &extra_rows) {
+    std::string upper(query);
+    std::transform(upper.begin(), upper.end(), upper.begin(), ::toupper);
+    std::string::size_type start = upper.find_first_not_of(" \t");
+    std::string::size_type values = find_keyword(upper, "VALUES");
+    if (start == std::string::npos || upper.compare(start, 6, "INSERT") != 0 || values == std::string::npos)
+        return query;
+
+    // the end of the first tuple
+    std::string::size_type i = query.find_first_not_of(" \t", values + 6);
+    if (i == std::string::npos || query[i] != '(')
+        return query;
+    while (i < query.size() && query[i] != ')') {
+        if (query[i] == '\'')
+            i = query.find('\'', i + 1);
+        if (i == std::string::npos)
+            return query;  // for the parser to complain about
+        i++;
+    }
+    std::string::size_type first_end = i + 1;
+    i = query.find_first_not_of(" \t", first_end);
+    if (i == std::string::npos || query[i] != ',')
+        return query;
+
+    // then the literals of each of the others
+    while (i != std::string::npos && query[i] == ',') {
+        i = query.find_first_not_of(" \t", i + 1);
+        if (i == std::string::npos || query[i] != '(')
+            throw SQLExecError("expected (value, ...) after VALUES (...),");
+        KeyValue row;
+        do {
+            i = query.find_first_not_of(" \t", i + 1);
+            if (i == std::string::npos)
+                break;
+            if (query[i] == '\'') {
+                // up to the closing quote, with '' standing for a quote inside the string
+                std::string s;
+                std::string::size_type end = i + 1, quote;
+                while ((quote = query.find('\'', end)) != std::string::npos && quote + 1 < query.size()
+                       && query[quote + 1] == '\'') {
+                    s += query.substr(end, quote + 1 - end);
+                    end = quote + 2;
+                }
+                if (quote == std::string::npos)
+                    break;
+                s += query.substr(end, quote - end);
+                row.push_back(Value(s));
+                i = quote + 1;
+            } else {
+                std::string::size_type end = query.find_first_not_of("0123456789", i + (query[i] == '-' ? 1 : 0));
+                if (end == i || (end == i + 1 && query[i] == '-') || end == std::string::npos)
+                    throw SQLExecError("only int and string literals are supported in VALUES");
+                std::string digits = query.substr(i, end - i);
+                long long n;
+                try {
+                    n = std::stoll(digits);
+                } catch (std::out_of_range &e) {
+                    n = std::numeric_limits<long long>::max();
+                }
+                if (n < std::numeric_limits<int32_t>::min() || n > std::numeric_limits<int32_t>::max())
+                    throw SQLExecError("int literal " + digits + " is out of range");
+                row.push_back(Value((int32_t) n));
+                i = end;
+            }
+            i = query.find_first_not_of(" \t", i);
+        } while (i != std::string::npos && query[i] == ',');
+        if (i == std::string::npos || query[i] != ')')
+            throw SQLExecError("expected (value, ...) after VALUES (...),");
+        extra_rows.push_back(row);
+        i = query.find_first_not_of(" \t", i + 1);
+    }
+    if (i != std::string::npos && query[i] != ';')
+        throw SQLExecError("unexpected " + query.substr(i) + " after VALUES");
+    return query.substr(0, first_end);
+}
+
+// Pull a leading EXPLAIN or EXPLAIN ANALYZE off of a query, since our parser doesn't support them, and say which
+// it was in explain and analyze. Returns the rest of the query. Any other query comes back as is.
+std::string SQLExec::strip_explain_clause(const std::string &query, bool &explain, bool &analyze) {
+    std::string upper(query);
+    std::transform(upper.begin(), upper.end(), upper.begin(), ::toupper);
+    std::string::size_type start = upper.find_first_not_of(" \t");
+    if (start == std::string::npos || upper.compare(start, 7, "EXPLAIN") != 0
+        || (start + 7 < upper.size() && !isspace(upper[start + 7])))
+        return query;
+    explain = true;
+    std::string::size_type rest = upper.find_first_not_of(" \t", start + 7);
+    if (rest != std::string::npos && upper.compare(rest, 7, "ANALYZE") == 0
+        && rest + 7 < upper.size() && isspace(upper[rest + 7])) {
+        analyze = true;
+        rest = upper.find_first_not_of(" \t", rest + 7);
+    }
+    if (rest == std::string::npos)
+        throw SQLExecError("expected EXPLAIN [ANALYZE] statement");
+    return query.substr(rest);
+}
+
+// Pull a trailing INCLUDE (col, ...) clause off of a CREATE INDEX query, since our parser doesn't support it.
+// Returns the rest of the query. Any other query comes back as is.
+std::string SQLExec::strip_include_clause(const std::string &query, ColumnNames &include_columns) {
+    std::string upper(query);
+    std::transform(upper.begin(), upper.end(), upper.begin(), ::toupper);
+    std::string::size_type include = upper.rfind(" INCLUDE");
+    if (upper.compare(0, 12, "CREATE INDEX") != 0 || include == std::string::npos)
+        return query;
+    std::string::size_type open = query.find('(', include);
+    std::string::size_type close = query.find(')', include);
+    if (open == std::string::npos || close == std::string::npos || close < open
+        || query.find_first_not_of(" \t", include + 8) != open)
+        throw SQLExecError("expected INCLUDE (column, ...)");
+    std::string columns = query.substr(open + 1, close - open - 1) + ",";
+    std::string::size_type start = 0, comma;
+    while ((comma = columns.find(',', start)) != std::string::npos) {
+        std::string column = columns.substr(start, comma - start);
+        column.erase(0, column.find_first_not_of(" \t"));
+        column.erase(column.find_last_not_of(" \t") + 1);
+        if (column.empty())
+            throw SQLExecError("expected INCLUDE (column, ...)");
+        include_columns.push_back(column);
+        start = comma + 1;
+    }
+    return query.substr(0, include) + query.substr(close + 1);
+}
+
+// Turn SHOW INDEX STATUS FROM t into SHOW INDEX FROM t (which the parser does know) and say so in index_status.
+// Any other query comes back as is.
+std::string SQLExec::strip_status_clause(const std::string &query, bool &index_status) {
+    std::string upper(query);
+    std::transform(upper.begin(), upper.end(), upper.begin(), ::toupper);
+    std::string::size_type show = upper.find_first_not_of(" \t");
+    std::string::size_type status = upper.find(" STATUS ");
+    if (show == std::string::npos || upper.compare(show, 10, "SHOW INDEX") != 0 || status == std::string::npos
+        || upper.find_first_not_of(" \t", show + 10) != status + 1)
+        return query;
+    index_status = true;
+    return query.substr(0, status) + query.substr(status + 7);
+}
+
+// Turn COPY t FROM 'file' into IMPORT FROM CSV FILE 'file' INTO t, which the parser does know. Any other query comes
+// back as is.
+std::string SQLExec::strip_copy_clause(const std::string &query) {
+    std::string upper(query);
+    std::transform(upper.begin(), upper.end(), upper.begin(), ::toupper);
+    std::string::size_type copy = upper.find_first_not_of(" \t");
+    if (copy == std::string::npos || upper.compare(copy, 5, "COPY ") != 0)
+        return query;
+    std::string::size_type from = upper.find(" FROM ", copy);
+    if (from == std::string::npos)
+        throw SQLExecError("expected COPY table FROM 'file'");
+    std::string table_name = query.substr(copy + 5, from - copy - 5);
+    table_name.erase(0, table_name.find_first_not_of(" \t"));
+    table_name.erase(table_name.find_last_not_of(" \t") + 1);
+    std::string file = query.substr(from + 6);
+    file.erase(0, file.find_first_not_of(" \t"));
+    file.erase(file.find_last_not_of(" \t;") + 1);
+    if (table_name.empty() || table_name.find_first_of(" \t") != std::string::npos || file.size() < 2
+        || file.front() != '\'' || file.back() != '\'')
+        throw SQLExecError("expected COPY table FROM 'file'");
+    return "IMPORT FROM CSV FILE " + file + " INTO " + table_name;
+}
+
+QueryResult *SQLExec::create(const hsql::CreateStatement *statement, const ColumnNames *include_columns) {
+    if (include_columns != nullptr && !include_columns->empty() && statement->type != hsql::CreateStatement::kIndex)
+        throw SQLExecError("INCLUDE only applies to CREATE INDEX");
+    SQLExec::schema_version++;  // so prepared statements planned without the new table or index know it
     switch(statement->type) {
         case hsql::CreateStatement::kTable:
             return create_table(statement);
         case hsql::CreateStatement::kIndex:
-            return create_index(statement);
+            return create_index(statement, include_columns);
         default:
             return new QueryResult("Only CREATE TABLE and CREATE INDEX are implemented");
     }
@@ -357,9 +1530,12 @@ QueryResult *SQLExec::create_table(const hsql::CreateStatement *statement) {
     return new QueryResult("created " + table_name);
 }
 
-QueryResult *SQLExec::create_index(const hsql::CreateStatement *statement) {
+QueryResult *SQLExec::create_index(const hsql::CreateStatement *statement, const ColumnNames *include_columns) {
     Identifier index_name = statement->indexName;
     Identifier table_name = statement->tableName;
+    ColumnNames no_include_columns;
+    if (include_columns == nullptr)
+        include_columns = &no_include_columns;
 
     // get underlying relation
     DbRelation& table = SQLExec::tables->get_table(table_name);
@@ -369,6 +1545,18 @@ QueryResult *SQLExec::create_index(const hsql::CreateStatement *statement) {
     for (auto const& col_name: *statement->indexColumns)
         if (std::find(table_columns.begin(), table_columns.end(), col_name) == table_columns.end())
             throw SQLExecError(std::string("Column '") + col_name + "' does not exist in " + table_name);
+    for (auto const& col_name: *include_columns) {
+        if (std::find(table_columns.begin(), table_columns.end(), col_name) == table_columns.end())
+            throw SQLExecError(std::string("Column '") + col_name + "' does not exist in " + table_name);
+        for (auto const& key_name: *statement->indexColumns)
+            if (col_name == key_name)
+                throw SQLExecError(std::string("Column '") + col_name + "' is already in the index key");
+    }
+    if (!include_columns->empty() && std::string(statement->indexType) != "BTREE")
+        throw SQLExecError("INCLUDE columns are only supported for BTREE indices");
+    if (statement->indexColumns->size() + include_columns->size() > DbIndex::MAX_COMPOSITE)
+        throw SQLExecError("an index can have at most " + std::to_string(DbIndex::MAX_COMPOSITE)
+                           + " key and INCLUDE columns");
 
     // insert a row for every column in index into _indices
     ValueDict row;
@@ -379,11 +1567,18 @@ QueryResult *SQLExec::create_index(const hsql::CreateStatement *statement) {
     int seq = 0;
     Handles i_handles;
     try {
+        row["is_included"] = Value(false);
         for (auto const &col_name: *statement->indexColumns) {
             row["seq_in_index"] = Value(++seq);
             row["column_name"] = Value(col_name);
             i_handles.push_back(SQLExec::indices->insert(&row));
         }
+        row["is_included"] = Value(true);
+        for (auto const &col_name: *include_columns) {
+            row["seq_in_index"] = Value(++seq);
+            row["column_name"] = Value(col_name);
+            i_handles.push_back(SQLExec::indices->insert(&row));
+        }
 
         DbIndex &index = SQLExec::indices->get_index(table, index_name);
         index.create();
@@ -403,11 +1598,15 @@ QueryResult *SQLExec::create_index(const hsql::CreateStatement *statement) {
 QueryResult *SQLExec::drop(const hsql::DropStatement *statement) {
     switch(statement->type) {
         case hsql::DropStatement::kTable:
+            SQLExec::schema_version++;  // so prepared statements with plans using the table know it's gone
             return drop_table(statement);
         case hsql::DropStatement::kIndex:
+            SQLExec::schema_version++;
             return drop_index(statement);
+        case hsql::DropStatement::kPreparedStatement:
+            return drop_prepared(statement);
         default:
-            return new QueryResult("Only DROP TABLE and CREATE INDEX are implemented");
+            return new QueryResult("Only DROP TABLE, DROP INDEX and DROP PREPARE are implemented");
     }
 }
 
@@ -469,14 +1668,16 @@ QueryResult *SQLExec::drop_index(const hsql::DropStatement *statement) {
     return new QueryResult("dropped index " + index_name);
 }
 
-QueryResult *SQLExec::show(const hsql::ShowStatement *statement) {
+QueryResult *SQLExec::show(const hsql::ShowStatement *statement, bool index_status) {
+    if (index_status && statement->type != hsql::ShowStatement::kIndex)
+        throw SQLExecError("STATUS only applies to SHOW INDEX");
     switch (statement->type) {
         case hsql::ShowStatement::kTables:
             return show_tables();
         case hsql::ShowStatement::kColumns:
             return show_columns(statement);
         case hsql::ShowStatement::kIndex:
-            return show_index(statement);
+            return index_status ? show_index_status(statement) : show_index(statement);
         default:
             throw SQLExecError("unrecognized SHOW type");
     }
@@ -503,6 +1704,9 @@ QueryResult *SQLExec::show_index(const hsql::ShowStatement *statement) {
     column_names->push_back("is_unique");
     column_attributes->push_back(ColumnAttribute(ColumnAttribute::BOOLEAN));
 
+    column_names->push_back("is_included");
+    column_attributes->push_back(ColumnAttribute(ColumnAttribute::BOOLEAN));
+
     ValueDict where;
     where["table_name"] = statement->tableName;
     Handles* handles = SQLExec::indices->select(&where);
@@ -518,6 +1722,68 @@ QueryResult *SQLExec::show_index(const hsql::ShowStatement *statement) {
                            "successfully returned " + std::to_string(n) + " rows");
 }
 
+// Key bounds from the index statistics as text, e.g. 12, "abc"
+static std::string key_text(const KeyValue &key) {
+    std::string text;
+    for (auto const& value: key) {
+        if (!text.empty())
+            text += ", ";
+        if (value.data_type == ColumnAttribute::TEXT)
+            text += "\"" + value.s + "\"";
+        else if (value.data_type == ColumnAttribute::BOOLEAN)
+            text += value.n == 0 ? "false" : "true";
+        else
+            text += std::to_string(value.n);
+    }
+    return text;
+}
+
+QueryResult *SQLExec::show_index_status(const hsql::ShowStatement *statement) {
+    ColumnNames* column_names = new ColumnNames;
+    ColumnAttributes* column_attributes = new ColumnAttributes;
+    const char *text_columns[] = {"table_name", "index_name", "index_type"};
+    for (auto const& column_name: text_columns) {
+        column_names->push_back(column_name);
+        column_attributes->push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    }
+    const char *int_columns[] = {"height", "entries", "leaf_blocks", "interior_blocks", "avg_leaf_entries"};
+    for (auto const& column_name: int_columns) {
+        column_names->push_back(column_name);
+        column_attributes->push_back(ColumnAttribute(ColumnAttribute::INT));
+    }
+    column_names->push_back("min_key");
+    column_attributes->push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    column_names->push_back("max_key");
+    column_attributes->push_back(ColumnAttribute(ColumnAttribute::TEXT));
+
+    Identifier table_name = statement->tableName;
+    DbRelation& table = SQLExec::tables->get_table(table_name);
+    ValueDicts* rows = new ValueDicts;
+    for (auto const& index_name: SQLExec::indices->get_index_names(table_name)) {
+        ColumnNames key_columns, include_columns;
+        bool is_hash, is_unique;
+        SQLExec::indices->get_columns(table_name, index_name, key_columns, is_hash, is_unique, include_columns);
+        ValueDict* row = new ValueDict;
+        (*row)["table_name"] = Value(table_name);
+        (*row)["index_name"] = Value(index_name);
+        (*row)["index_type"] = Value(is_hash ? "HASH" : "BTREE");
+        IndexStats *stats = SQLExec::indices->get_index(table, index_name).get_stats();
+        IndexStats none;
+        const IndexStats &index_stats = stats == nullptr ? none : *stats;  // zeros if the index keeps none
+        (*row)["height"] = Value((int) index_stats.height);
+        (*row)["entries"] = Value((int) index_stats.entries);
+        (*row)["leaf_blocks"] = Value((int) index_stats.leaf_blocks);
+        (*row)["interior_blocks"] = Value((int) index_stats.interior_blocks);
+        (*row)["avg_leaf_entries"] = Value((int) (index_stats.average_leaf_entries() + 0.5));
+        (*row)["min_key"] = Value(key_text(index_stats.min_key));
+        (*row)["max_key"] = Value(key_text(index_stats.max_key));
+        delete stats;
+        rows->push_back(row);
+    }
+    return new QueryResult(column_names, column_attributes, rows,
+                           "successfully returned " + std::to_string(rows->size()) + " rows");
+}
+
 QueryResult *SQLExec::show_tables() {
     ColumnNames* column_names = new ColumnNames;
     column_names->push_back("table_name");
@@ -577,3 +1843,206 @@ QueryResult *SQLExec::show_columns(const hsql::ShowStatement *statement) {
     return new QueryResult(column_names, column_attributes, rows,
                            "successfully returned " + std::to_string(n) + " rows");
 }
+
+
+// Run a query, for the tests: the message it ends with (after pulling its rows through), or "error: " and what
+// went wrong.
+static std::string test_run(const std::string &query) {
+    hsql::SQLParserResult *parse = hsql::SQLParser::parseSQLString(query);
+    std::string message;
+    try {
+        if (!parse->isValid() || parse->size() != 1)
+            throw SQLExecError("can't parse " + query);
+        QueryResult *result = SQLExec::execute(parse->getStatement(0));
+        std::stringstream out;
+        out << *result;
+        delete result;
+        message = out.str();
+    } catch (SQLExecError &e) {
+        message = std::string("error: ") + e.what();
+    }
+    delete parse;
+    return message;
+}
+
+// the number of rows a SELECT returns, or -1 if it fails
+static long test_count(const std::string &query) {
+    std::string message = test_run(query);
+    std::string::size_type returned = message.rfind("successfully returned ");
+    return returned == std::string::npos ? -1 : std::stol(message.substr(returned + 22));
+}
+
+bool test_sql_update() {
+    const int N = 300;
+    const std::string t = "_test_sql_update";
+    bool ok = test_run("CREATE TABLE " + t + " (id INT, a INT, flag INT, s TEXT)").find("error") != 0;
+    for (int i = 0; ok && i < N; i++)
+        ok = test_run("INSERT INTO " + t + " VALUES (" + std::to_string(i) + ", " + std::to_string(i)
+                      + ", 0, 'row')").find("error") != 0;
+    ok = ok && test_run("CREATE INDEX " + t + "_id ON " + t + " (id)").find("error") != 0
+         && test_run("CREATE INDEX " + t + "_a ON " + t + " (a)").find("error") != 0;
+    if (!ok)
+        return false;
+
+    // setting a column no index has touches no index
+    std::string message = test_run("UPDATE " + t + " SET flag = 1 WHERE id < 50");
+    ok = message.find("successfully updated 50 rows in " + t) != std::string::npos
+         && message.find("indices") == std::string::npos
+         && test_count("SELECT * FROM " + t + " WHERE flag = 1") == 50
+         && test_count("SELECT * FROM " + t + " WHERE id = 10 AND flag = 1") == 1
+         && test_count("SELECT * FROM " + t + " WHERE a = 10 AND flag = 1") == 1;
+    if (!ok)
+        std::cout << "setting a flag: " << message << std::endl;
+
+    // changing a key moves its entry in that index only
+    message = test_run("UPDATE " + t + " SET a = 1000 WHERE id = 7");
+    if (message.find("successfully updated 1 rows in " + t + " and 1 indices") == std::string::npos
+            || test_count("SELECT * FROM " + t + " WHERE a = 1000") != 1
+            || test_count("SELECT * FROM " + t + " WHERE a = 7") != 0
+            || test_count("SELECT * FROM " + t + " WHERE id = 7 AND a = 1000") != 1) {
+        std::cout << "changing a key: " << message << std::endl;
+        ok = false;
+    }
+
+    // a duplicate key, with a row left as it is or between two being updated, changes nothing
+    if (test_run("UPDATE " + t + " SET a = 5 WHERE id = 8").find("error") != 0
+            || test_run("UPDATE " + t + " SET a = 2000 WHERE id < 3").find("error") != 0
+            || test_count("SELECT * FROM " + t + " WHERE a = 8") != 1
+            || test_count("SELECT * FROM " + t + " WHERE a = 5") != 1
+            || test_count("SELECT * FROM " + t + " WHERE a = 2000") != 0
+            || test_count("SELECT * FROM " + t + " WHERE a < 3") != 3) {
+        std::cout << "duplicate keys updated" << std::endl;
+        ok = false;
+    }
+
+    // rows grown past what their blocks hold move, and every index follows them
+    std::string big(300, 'x');
+    message = test_run("UPDATE " + t + " SET s = '" + big + "' WHERE id >= 100");
+    if (message.find("successfully updated 200 rows in " + t + " and 2 indices") == std::string::npos
+            || test_count("SELECT * FROM " + t) != N
+            || test_count("SELECT * FROM " + t + " WHERE s = '" + big + "'") != 200
+            || test_count("SELECT * FROM " + t + " WHERE id = 150 AND s = '" + big + "'") != 1
+            || test_count("SELECT * FROM " + t + " WHERE a = 299 AND s = '" + big + "'") != 1
+            || test_count("SELECT * FROM " + t + " WHERE id = 99 AND s = 'row'") != 1) {
+        std::cout << "moving rows: " << message << std::endl;
+        ok = false;
+    }
+    ok = test_run("DROP TABLE " + t).find("error") != 0 && ok;
+
+    // a table kept in a tree has its primary key checked before anything changes too
+    const std::string tree = "_test_sql_update_tree";
+    bool tree_ok = test_run("CREATE TABLE " + tree + " (id INT, a INT, PRIMARY KEY (id))").find("error") != 0;
+    for (int i = 0; tree_ok && i < 10; i++)
+        tree_ok = test_run("INSERT INTO " + tree + " VALUES (" + std::to_string(i) + ", " + std::to_string(i)
+                           + ")").find("error") != 0;
+    tree_ok = tree_ok && test_run("CREATE INDEX " + tree + "_a ON " + tree + " (a)").find("error") != 0;
+    if (!tree_ok)
+        return false;
+    if (test_run("UPDATE " + tree + " SET id = 100 WHERE id < 5").find("error") != 0
+            || test_run("UPDATE " + tree + " SET id = 3, a = 70 WHERE id = 9").find("error") != 0
+            || test_count("SELECT * FROM " + tree + " WHERE id = 100") != 0
+            || test_count("SELECT * FROM " + tree + " WHERE id < 5") != 5
+            || test_count("SELECT * FROM " + tree + " WHERE a = 9") != 1
+            || test_count("SELECT * FROM " + tree + " WHERE a = 70") != 0) {
+        std::cout << "duplicate primary keys updated" << std::endl;
+        ok = false;
+    }
+    message = test_run("UPDATE " + tree + " SET id = 30 WHERE id = 8");
+    if (message.find("successfully updated 1 rows in " + tree + " and 1 indices") == std::string::npos
+            || test_count("SELECT * FROM " + tree) != 10
+            || test_count("SELECT * FROM " + tree + " WHERE a = 8 AND id = 30") != 1
+            || test_count("SELECT * FROM " + tree + " WHERE id = 8") != 0) {
+        std::cout << "changing a primary key: " << message << std::endl;
+        ok = false;
+    }
+    ok = test_run("DROP TABLE " + tree).find("error") != 0 && ok;
+    return ok;
+}
+
+// An index that fails partway through deleting a batch, as one might on a read error: it takes the first half of the
+// entries out of the real index, then throws.
+class TestFailingIndex : public DbIndex {
+public:
+    TestFailingIndex(DbIndex &index, bool &armed)
+            : DbIndex(index.get_relation(), index.get_name(), index.get_key_columns(), index.is_unique()),
+              index(index), armed(armed) {}
+    virtual void create() { index.create(); }
+    virtual void drop() { index.drop(); }
+    virtual void open() { index.open(); }
+    virtual void close() { index.close(); }
+    virtual Handles* lookup(ValueDict* key_values) { return index.lookup(key_values); }
+    virtual void insert(Handle handle) { index.insert(handle); }
+    virtual void del(Handle handle) { index.del(handle); }
+    virtual void del_many(Handles* handles) {
+        Handles half(handles->begin(), handles->begin() + handles->size() / 2);
+        index.del_many(&half);
+        armed = false;
+        throw DbRelationError("failed partway through deleting");
+    }
+
+protected:
+    DbIndex &index;
+    bool &armed;
+};
+
+// Indices that hand out a TestFailingIndex for one index, until it has failed once.
+class TestFailingIndices : public Indices {
+public:
+    TestFailingIndices(const Identifier &failing) : failing(failing), armed(true), index(nullptr) {}
+    virtual ~TestFailingIndices() { delete index; }
+    virtual DbIndex& get_index(DbRelation &table, Identifier index_name) {
+        DbIndex &real = Indices::get_index(table, index_name);
+        if (!armed || index_name != failing)
+            return real;
+        if (index == nullptr)
+            index = new TestFailingIndex(real, armed);
+        return *index;
+    }
+
+protected:
+    Identifier failing;
+    bool armed;
+    TestFailingIndex *index;
+};
+
+bool test_sql_delete() {
+    const int N = 100;
+    const std::string t = "_test_sql_delete";
+    bool ok = test_run("CREATE TABLE " + t + " (id INT, a INT)").find("error") != 0;
+    for (int i = 0; ok && i < N; i++)
+        ok = test_run("INSERT INTO " + t + " VALUES (" + std::to_string(i) + ", " + std::to_string(i)
+                      + ")").find("error") != 0;
+    ok = ok && test_run("CREATE INDEX " + t + "_id ON " + t + " (id)").find("error") != 0
+         && test_run("CREATE INDEX " + t + "_a ON " + t + " (a)").find("error") != 0;
+    if (!ok)
+        return false;
+
+    // the second index fails after the first has let go of the rows: nothing is deleted, and every index still
+    // finds them
+    Indices *saved = SQLExec::indices;
+    SQLExec::indices = new TestFailingIndices(t + "_a");
+    std::string message = test_run("DELETE FROM " + t + " WHERE id < 50");
+    delete SQLExec::indices;
+    SQLExec::indices = saved;
+    if (message.find("error") != 0
+            || test_count("SELECT * FROM " + t) != N
+            || test_count("SELECT * FROM " + t + " WHERE id = 10") != 1
+            || test_count("SELECT * FROM " + t + " WHERE a = 10") != 1
+            || test_count("SELECT * FROM " + t + " WHERE a = 40") != 1
+            || test_count("SELECT * FROM " + t + " WHERE id < 50") != 50) {
+        std::cout << "failed delete: " << message << std::endl;
+        ok = false;
+    }
+
+    // and once nothing fails, they go
+    message = test_run("DELETE FROM " + t + " WHERE id < 50");
+    if (message.find("successfully deleted 50 rows from " + t) == std::string::npos
+            || test_count("SELECT * FROM " + t) != N - 50
+            || test_count("SELECT * FROM " + t + " WHERE a = 10") != 0
+            || test_count("SELECT * FROM " + t + " WHERE a = 60") != 1) {
+        std::cout << "delete: " << message << std::endl;
+        ok = false;
+    }
+    ok = test_run("DROP TABLE " + t).find("error") != 0 && ok;
+    return ok;
+}
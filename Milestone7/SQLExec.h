@@ -4,6 +4,8 @@
 #include <string>
 #include "SQLParser.h"
 #include "schema_tables.h"
+#include "EvalOperator.h"
+#include "EvalPlan.h"
 
 
 class SQLExecError : public std::runtime_error {
@@ -14,13 +16,20 @@ public:
 
 class QueryResult {
 public:
-    QueryResult() : column_names(nullptr), column_attributes(nullptr), rows(nullptr), message("") {}
+    QueryResult() : column_names(nullptr), column_attributes(nullptr), rows(nullptr), source(nullptr),
+                    message("") {}
 
     QueryResult(std::string message) : column_names(nullptr), column_attributes(nullptr), rows(nullptr),
-                                       message(message) {}
+                                       source(nullptr), message(message) {}
 
     QueryResult(ColumnNames *column_names, ColumnAttributes *column_attributes, ValueDicts *rows, std::string message)
-            : column_names(column_names), column_attributes(column_attributes), rows(rows), message(message) {}
+            : column_names(column_names), column_attributes(column_attributes), rows(rows), source(nullptr),
+              message(message) {}
+
+    // rows pulled from source a batch at a time as they're printed, rather than held all at once
+    QueryResult(ColumnNames *column_names, ColumnAttributes *column_attributes, EvalOperator *source)
+            : column_names(column_names), column_attributes(column_attributes), rows(nullptr), source(source),
+              message("") {}
 
     virtual ~QueryResult();
 
@@ -34,36 +43,81 @@ protected:
     ColumnNames *column_names;
     ColumnAttributes *column_attributes;
     ValueDicts *rows;
+    EvalOperator *source;
     std::string message;
 };
 
 
+class PreparedStatement;
+
 class SQLExec {
 public:
     static Tables *tables;
     static Indices *indices;
-
-    static QueryResult *execute(const hsql::SQLStatement *statement) throw(SQLExecError);
+    static u_long schema_version;  // goes up whenever a table or index is created or dropped
+
+    // include_columns carries a CREATE INDEX ... INCLUDE (...) clause, index_status a SHOW INDEX STATUS and
+    // extra_rows the VALUES tuples after the first of a multi-row INSERT, none of which the parser knows about (see
+    // strip_include_clause, strip_status_clause and strip_extra_rows)
+    static QueryResult *execute(const hsql::SQLStatement *statement,
+                                const ColumnNames *include_columns=nullptr,
+                                bool index_status=false,
+                                const std::vector<KeyValue> *extra_rows=nullptr) throw(SQLExecError);
+
+    // Parse and plan a SELECT, INSERT or DELETE once, to execute as many times as we like with values for its ?
+    // placeholders (caller deletes)
+    static PreparedStatement *prepare(const hsql::SQLStatement *statement) throw(SQLExecError);
+    static QueryResult *execute(PreparedStatement *prepared, const KeyValue &parameters) throw(SQLExecError);
+
+    // The statement in the plan cache for query, or nullptr if it isn't a query the cache can take (then just parse
+    // and execute it). parameters gets query's literals to execute it with and text how ParseTreeToString would
+    // show it. The cache keeps the statement.
+    static PreparedStatement *cached_plan(const std::string &query, KeyValue &parameters, std::string &text);
+
+    // EXPLAIN shows the optimized plan for a SELECT, DELETE or UPDATE; EXPLAIN ANALYZE also runs a SELECT and shows what each
+    // part of the plan took (see strip_explain_clause)
+    static QueryResult *explain(const hsql::SQLStatement *statement, bool analyze) throw(SQLExecError);
+
+    static std::string strip_copy_clause(const std::string &query);
+    static std::string strip_explain_clause(const std::string &query, bool &explain, bool &analyze);
+    static std::string strip_extra_rows(const std::string &query, std::vector<KeyValue> &extra_rows);
+    static std::string strip_include_clause(const std::string &query, ColumnNames &include_columns);
+    static std::string strip_status_clause(const std::string &query, bool &index_status);
 
 protected:
 
-    static QueryResult *create(const hsql::CreateStatement *statement);
+    static QueryResult *create(const hsql::CreateStatement *statement, const ColumnNames *include_columns);
     static QueryResult *create_table(const hsql::CreateStatement *statement);
-    static QueryResult *create_index(const hsql::CreateStatement *statement);
+    static QueryResult *create_index(const hsql::CreateStatement *statement, const ColumnNames *include_columns);
 
     static QueryResult *drop(const hsql::DropStatement *statement);
     static QueryResult *drop_table(const hsql::DropStatement *statement);
     static QueryResult *drop_index(const hsql::DropStatement *statement);
 
-    static QueryResult *show(const hsql::ShowStatement *statement);
+    static QueryResult *show(const hsql::ShowStatement *statement, bool index_status);
     static QueryResult *show_tables();
     static QueryResult *show_columns(const hsql::ShowStatement *statement);
     static QueryResult *show_index(const hsql::ShowStatement *statement);
-
-    static QueryResult *insert(const hsql::InsertStatement *statement);
+    static QueryResult *show_index_status(const hsql::ShowStatement *statement);
+
+    static QueryResult *insert(const hsql::InsertStatement *statement, const std::vector<KeyValue> *extra_rows);
+    static QueryResult *insert(const Identifier &table_name, const ValueDict &row);
+    static QueryResult *insert(const Identifier &table_name, const ValueDicts &rows);
+    static QueryResult *import(const hsql::ImportStatement *statement);
+    static QueryResult *update(const hsql::UpdateStatement *statement);
+    static void check_new_keys(DbRelation &table, DbIndex *index, const ColumnNames &key_columns, Handles *handles,
+                               const ValueDict &new_values);
     static QueryResult *del(const hsql::DeleteStatement *statement);
+    static QueryResult *del(const Identifier &table_name, EvalPlan *optimized);  // deletes optimized
     static QueryResult *select(const hsql::SelectStatement *statement);
 
+    static QueryResult *prepare_named(const hsql::PrepareStatement *statement);
+    static QueryResult *execute_named(const hsql::ExecuteStatement *statement);
+    static QueryResult *drop_prepared(const hsql::DropStatement *statement);
+
     static bool column_definition(const hsql::ColumnDefinition *col, Identifier &column_name,
                                   ColumnAttribute &column_attribute, ColumnNames* &primary_key);
 };
+
+bool test_sql_update();
+bool test_sql_delete();
@@ -0,0 +1,341 @@
+#include <algorithm>
+#include <iostream>
+#include "SortOperator.h"
+#include "heap_storage.h"
+
+
+int SortColumn::compare(const ValueDict &a, const ValueDict &b, const SortColumns &columns) {
+    for (auto const &column: columns) {
+        auto found_a = a.find(column.column_name), found_b = b.find(column.column_name);
+        if (found_a == a.end() || found_b == b.end())
+            throw DbRelationError("unknown column '" + column.column_name + "'");
+        int c = found_a->second < found_b->second ? -1 : found_b->second < found_a->second ? 1 : 0;
+        if (c != 0)
+            return column.descending ? -c : c;
+    }
+    return 0;
+}
+
+
+RowCursor::RowCursor(EvalOperator &input) : input(input), batch(nullptr), position(0) {
+    advance();
+}
+
+RowCursor::~RowCursor() {
+    if (this->batch != nullptr)
+        EvalOperator::free_batch(this->batch);
+}
+
+ValueDict *RowCursor::take() {
+    ValueDict *row = (*this->batch)[this->position];
+    (*this->batch)[this->position] = nullptr;
+    return row;
+}
+
+void RowCursor::advance() {
+    if (this->batch != nullptr && ++this->position < this->batch->size())
+        return;
+    if (this->batch != nullptr)
+        EvalOperator::free_batch(this->batch);
+    this->position = 0;
+    this->batch = this->input.next();
+}
+
+
+size_t SortOperator::memory_budget = 64 * 1024 * 1024;
+
+SortOperator::SortOperator(EvalOperator *input, const SortColumns &sort_columns)
+        : input(input), sort_columns(sort_columns), sorted(nullptr), position(0), runs(), scans(), cursors(), tree() {
+}
+
+SortOperator::~SortOperator() {
+    close();
+    delete this->input;
+}
+
+// Read the whole input, a memory budget's worth at a time; then either it all fit, or set up to merge the runs.
+void SortOperator::open() {
+    close();
+    this->input->open();
+    ValueDicts *rows = new ValueDicts();
+    WorkCounters::allocated();
+    size_t bytes = 0;
+    for (ValueDicts *batch = this->input->next(); batch != nullptr; batch = this->input->next()) {
+        for (auto row: *batch) {
+            rows->push_back(row);
+            bytes += row_bytes(*row);
+            if (bytes > memory_budget) {
+                write_run(*rows);
+                bytes = 0;
+            }
+        }
+        delete batch;
+    }
+    this->input->close();
+
+    if (this->runs.empty()) {
+        sort_run(*rows);
+        this->sorted = rows;
+        this->position = 0;
+        return;
+    }
+    if (!rows->empty())
+        write_run(*rows);
+    delete rows;
+    for (auto run: this->runs) {
+        EvalOperator *scan = new TableScanOperator(*run);
+        scan->open();
+        this->scans.push_back(scan);
+        this->cursors.push_back(new RowCursor(*scan));
+    }
+    this->tree.assign(this->cursors.size(), -1);
+    this->tree[0] = build(1);
+}
+
+ValueDicts *SortOperator::next() {
+    ValueDicts *ret = new ValueDicts();
+    WorkCounters::allocated();
+    if (this->sorted != nullptr) {
+        size_t end = std::min(this->position + BATCH_SIZE, this->sorted->size());
+        ret->assign(this->sorted->begin() + this->position, this->sorted->begin() + end);
+        this->position = end;
+    } else {
+        while (ret->size() < BATCH_SIZE && !this->cursors.empty() && this->cursors[this->tree[0]]->valid()) {
+            int winner = this->tree[0];
+            ret->push_back(this->cursors[winner]->take());
+            this->cursors[winner]->advance();
+            replay(winner);
+        }
+    }
+    if (ret->empty()) {
+        delete ret;
+        return nullptr;
+    }
+    return ret;
+}
+
+void SortOperator::close() {
+    if (this->sorted != nullptr) {
+        // rows before position have been handed back and belong to the caller now
+        for (size_t i = this->position; i < this->sorted->size(); i++)
+            delete (*this->sorted)[i];
+        delete this->sorted;
+        this->sorted = nullptr;
+    }
+    for (auto cursor: this->cursors)
+        delete cursor;
+    this->cursors.clear();
+    for (auto scan: this->scans)
+        delete scan;
+    this->scans.clear();
+    this->tree.clear();
+    for (auto run: this->runs) {
+        run->drop();
+        delete run;
+    }
+    this->runs.clear();
+}
+
+void SortOperator::sort_run(ValueDicts &rows) {
+    const SortColumns &columns = this->sort_columns;
+    std::stable_sort(rows.begin(), rows.end(), [&columns](const ValueDict *a, const ValueDict *b) {
+        return SortColumn::compare(*a, *b, columns) < 0;
+    });
+}
+
+// Sort rows and write them out as the next run, leaving rows empty.
+void SortOperator::write_run(ValueDicts &rows) {
+    sort_run(rows);
+    HeapTable *run = temp_table("sort_run", *rows[0]);
+    this->runs.push_back(run);
+    for (auto row: rows) {
+        run->insert(row);
+        delete row;
+    }
+    rows.clear();
+}
+
+// Whether run a's current row goes out before run b's. Exhausted runs lose to everything, and ties go to the
+// earlier run, which keeps the sort stable.
+bool SortOperator::beats(int a, int b) const {
+    if (!this->cursors[a]->valid())
+        return false;
+    if (!this->cursors[b]->valid())
+        return true;
+    int c = SortColumn::compare(this->cursors[a]->row(), this->cursors[b]->row(), this->sort_columns);
+    return c < 0 || (c == 0 && a < b);
+}
+
+// Play the matches below a node, with the runs as leaves k through 2k - 1 (k runs), leaving each node's loser
+// there and handing back the winner.
+int SortOperator::build(size_t node) {
+    size_t k = this->cursors.size();
+    if (node >= k)
+        return (int) (node - k);
+    int a = build(2 * node), b = build(2 * node + 1);
+    if (beats(b, a))
+        std::swap(a, b);
+    this->tree[node] = b;
+    return a;
+}
+
+// Run's current row has changed, so replay its matches on the way up to the root, against the losers stored there.
+void SortOperator::replay(int run) {
+    int winner = run;
+    for (size_t node = (run + this->cursors.size()) / 2; node > 0; node /= 2)
+        if (beats(this->tree[node], winner))
+            std::swap(this->tree[node], winner);
+    this->tree[0] = winner;
+}
+
+
+const u_long TopNOperator::MAX_ROWS;
+
+TopNOperator::TopNOperator(EvalOperator *input, const SortColumns &sort_columns, u_long n)
+        : input(input), sort_columns(sort_columns), n(n), heap(), position(0) {
+}
+
+TopNOperator::~TopNOperator() {
+    close();
+    delete this->input;
+}
+
+void TopNOperator::open() {
+    close();
+    auto before = [this](const Entry &a, const Entry &b) { return this->before(a, b); };
+    u_long seq = 0;
+    this->input->open();
+    for (ValueDicts *batch = this->input->next(); batch != nullptr; batch = this->input->next()) {
+        for (auto row: *batch) {
+            Entry entry(row, seq++);
+            if (this->heap.size() < this->n) {
+                this->heap.push_back(entry);
+                std::push_heap(this->heap.begin(), this->heap.end(), before);
+            } else if (!this->heap.empty() && before(entry, this->heap.front())) {
+                std::pop_heap(this->heap.begin(), this->heap.end(), before);
+                delete this->heap.back().first;
+                this->heap.back() = entry;
+                std::push_heap(this->heap.begin(), this->heap.end(), before);
+            } else {
+                delete row;
+            }
+        }
+        delete batch;
+    }
+    this->input->close();
+    std::sort_heap(this->heap.begin(), this->heap.end(), before);
+    this->position = 0;
+}
+
+ValueDicts *TopNOperator::next() {
+    if (this->position >= this->heap.size())
+        return nullptr;
+    ValueDicts *ret = new ValueDicts();
+    WorkCounters::allocated();
+    size_t end = std::min(this->position + BATCH_SIZE, this->heap.size());
+    for (; this->position < end; this->position++)
+        ret->push_back(this->heap[this->position].first);
+    return ret;
+}
+
+void TopNOperator::close() {
+    // rows before position have been handed back and belong to the caller now
+    for (size_t i = this->position; i < this->heap.size(); i++)
+        delete this->heap[i].first;
+    this->heap.clear();
+    this->position = 0;
+}
+
+bool TopNOperator::before(const Entry &a, const Entry &b) const {
+    int c = SortColumn::compare(*a.first, *b.first, this->sort_columns);
+    return c < 0 || (c == 0 && a.second < b.second);
+}
+
+
+// Sort a scan of table with the given budget, checking the order, stability and row count.
+static bool test_sort(DbRelation &table, const SortColumns &columns, size_t budget, bool expect_runs, size_t n) {
+    size_t saved = SortOperator::memory_budget;
+    SortOperator::memory_budget = budget;
+    SortOperator sort(new TableScanOperator(table), columns);
+    ValueDict *previous = nullptr;
+    size_t count = 0;
+    bool ok = true;
+    sort.open();
+    ok = (sort.run_count() > 1) == expect_runs;
+    for (ValueDicts *batch = sort.next(); batch != nullptr; batch = sort.next()) {
+        ok = ok && !batch->empty() && batch->size() <= EvalOperator::BATCH_SIZE;
+        for (auto row: *batch) {
+            if (previous != nullptr) {
+                int c = SortColumn::compare(*previous, *row, columns);
+                ok = ok && (c < 0 || (c == 0 && previous->at("seq").n < row->at("seq").n));
+            }
+            delete previous;
+            previous = row;
+        }
+        count += batch->size();
+        delete batch;
+    }
+    delete previous;
+    sort.close();
+    SortOperator::memory_budget = saved;
+    return ok && count == n;
+}
+
+bool test_sort_operator() {
+    ColumnNames column_names;
+    column_names.push_back("seq");
+    column_names.push_back("k");
+    column_names.push_back("s");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    HeapTable table("__test_sort_operator", column_names, column_attributes);
+    table.create();
+    const int n = 5000;
+    for (int i = 0; i < n; i++) {
+        ValueDict row;
+        row["seq"] = Value(i);
+        row["k"] = Value((i * 7919) % 1000);  // lots of ties, in scrambled order
+        row["s"] = Value(std::string(1, 'a' + i % 26));
+        table.insert(&row);
+    }
+    SortColumns by_k(1, SortColumn("k"));
+    SortColumns by_s_then_k_descending;
+    by_s_then_k_descending.push_back(SortColumn("s"));
+    by_s_then_k_descending.push_back(SortColumn("k", true));
+    bool ok = true;
+
+    ok = ok && test_sort(table, by_k, SortOperator::memory_budget, false, n);
+    ok = ok && test_sort(table, by_s_then_k_descending, SortOperator::memory_budget, false, n);
+    if (!ok)
+        std::cout << "in-memory sort failed" << std::endl;
+
+    // about 40 runs, merged
+    ok = ok && test_sort(table, by_k, 32 * 1024, true, n);
+    ok = ok && test_sort(table, by_s_then_k_descending, 32 * 1024, true, n);
+    if (!ok)
+        std::cout << "external merge sort failed" << std::endl;
+
+    // the first few in order, from a bounded heap: just what a full sort would have started with
+    for (auto const &columns: {by_k, by_s_then_k_descending}) {
+        SortOperator sort(new TableScanOperator(table), columns);
+        TopNOperator top(new TableScanOperator(table), columns, 100);
+        sort.open();
+        top.open();
+        ValueDicts *sorted = sort.next(), *first = top.next();
+        ok = ok && first != nullptr && first->size() == 100 && top.next() == nullptr;
+        for (size_t i = 0; ok && i < first->size(); i++)
+            ok = *(*first)[i] == *(*sorted)[i];
+        EvalOperator::free_batch(sorted);
+        if (first != nullptr)
+            EvalOperator::free_batch(first);
+        sort.close();
+        top.close();
+    }
+    if (!ok)
+        std::cout << "top-n failed" << std::endl;
+
+    table.drop();
+    return ok;
+}
@@ -0,0 +1,108 @@
+/**
+ * Sorting rows, in memory or (when they don't fit) by external merge sort.
+ * SortColumn
+ * RowCursor
+ * SortOperator
+ * TopNOperator
+ */
+#pragma once
+
+#include "EvalOperator.h"
+
+
+// A column to sort on, and which way.
+class SortColumn {
+public:
+    Identifier column_name;
+    bool descending;
+
+    SortColumn(Identifier column_name, bool descending=false) : column_name(column_name), descending(descending) {}
+
+    // negative, zero or positive as a sorts before, with or after b on columns
+    static int compare(const ValueDict &a, const ValueDict &b, const std::vector<SortColumn> &columns);
+};
+typedef std::vector<SortColumn> SortColumns;
+
+
+// A row at a time from an operator's batches, for merging: the current row can be looked at or taken.
+class RowCursor {
+public:
+    RowCursor(EvalOperator &input);  // input should already be open
+    virtual ~RowCursor();
+
+    bool valid() const { return batch != nullptr; }
+    const ValueDict &row() const { return *(*batch)[position]; }
+    ValueDict *take();  // the current row, which then belongs to the caller
+    void advance();
+
+protected:
+    EvalOperator &input;
+    ValueDicts *batch;
+    size_t position;
+
+private:
+    RowCursor(const RowCursor &other);
+    RowCursor &operator=(const RowCursor &other);
+};
+
+
+// The input's rows sorted on the given columns (stably, so rows that tie keep their input order). As many rows as
+// fit in memory_budget are sorted at a time; if there are more than that, each such run is written to a temporary
+// heap file and the runs are merged at the end through a loser tree, one comparison per tree level per row.
+class SortOperator : public EvalOperator {
+public:
+    static size_t memory_budget;  // bytes of rows to sort at once
+
+    SortOperator(EvalOperator *input, const SortColumns &sort_columns);  // takes ownership of input
+    virtual ~SortOperator();
+
+    virtual void open();
+    virtual ValueDicts *next();
+    virtual void close();
+
+    size_t run_count() const { return runs.size(); }
+
+protected:
+    EvalOperator *input;
+    SortColumns sort_columns;
+    ValueDicts *sorted;  // when everything fit in memory
+    size_t position;     // next of sorted to hand back
+    std::vector<HeapTable*> runs;
+    std::vector<EvalOperator*> scans;  // one per run, while merging
+    std::vector<RowCursor*> cursors;
+    std::vector<int> tree;  // loser tree over cursors: tree[0] is the winner, tree[1..] the losers of each match
+
+    void sort_run(ValueDicts &rows);
+    void write_run(ValueDicts &rows);
+    bool beats(int a, int b) const;
+    int build(size_t node);
+    void replay(int run);
+};
+
+
+// The first n of the input's rows in sort order (stably), for ORDER BY ... LIMIT: no more than n rows are kept at a
+// time, in a heap with the last of them in order on top, so each further row either goes in past it or is dropped.
+class TopNOperator : public EvalOperator {
+public:
+    static const u_long MAX_ROWS = 65536;  // more than this and a full sort, which can spill to disk, is the safer bet
+
+    TopNOperator(EvalOperator *input, const SortColumns &sort_columns, u_long n);  // takes ownership of input
+    virtual ~TopNOperator();
+
+    virtual void open();
+    virtual ValueDicts *next();
+    virtual void close();
+
+protected:
+    typedef std::pair<ValueDict*, u_long> Entry;  // a row and where it was in the input, to break ties
+
+    EvalOperator *input;
+    SortColumns sort_columns;
+    u_long n;
+    std::vector<Entry> heap;  // then, once the input is read, the rows in order
+    size_t position;          // next of them to hand back
+
+    bool before(const Entry &a, const Entry &b) const;
+};
+
+bool test_sort_operator();
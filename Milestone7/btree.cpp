@@ -1,4 +1,10 @@
+#include <algorithm>
+#include <chrono>
+#include <queue>
+#include <random>
+#include <thread>
 #include "btree.h"
+#include "ParallelOperator.h"
 
 
 /************
@@ -7,11 +13,17 @@
 
 BTreeBase::BTreeBase(DbRelation& relation, Identifier name, ColumnNames key_columns, bool unique)
         : DbIndex(relation, name, key_columns, unique),
-          stat(nullptr),
-          root(nullptr),
           closed(true),
+          stat(nullptr),
           file(relation.get_table_name() + "-" + name),
-          key_profile() {
+          key_profile(),
+          bloom(nullptr),
+          bloom_bits_per_key(BTreeBloom::DEFAULT_BITS_PER_KEY),
+          bloom_negatives(0),
+          bloom_false_positives(0),
+          latches(),
+          stat_mutex(),
+          bloom_latch() {
     if (!unique)
         throw DbRelationError("BTree index must have unique key");
     build_key_profile();
@@ -19,30 +31,112 @@ BTreeBase::BTreeBase(DbRelation& relation, Identifier name, ColumnNames key_colu
 
 BTreeBase::~BTreeBase() {
     delete this->stat;
-    delete this->root;
+    delete this->bloom;
 }
 
 // Create the index.
 void BTreeBase::create() {
     this->file.create();
     this->stat = new BTreeStat(this->file, STAT, STAT + 1, this->key_profile);
-    this->root = make_leaf(this->stat->get_root_id(), true);
+    BTreeNode *root = make_leaf(this->stat->get_root_id(), true);
+    root->save();
+    delete root;
     this->closed = false;
 
-    Handles *handles = nullptr;
     try {
-        // now build the index! -- add every row from relation into index
-        //this->file.begin_write();
-        handles = this->relation.select();
+        load();
+    } catch(...) {
+        drop();
+        throw;
+    }
+}
+
+// Now build the index! -- add every row from relation into index, one at a time
+void BTreeBase::load() {
+    Handles *handles = this->relation.select();
+    try {
+        create_bloom(handles->size());
         for (auto const &handle: *handles)
             insert(handle);
-        //this->file.end_write();
-        delete handles;
     } catch(...) {
         delete handles;
-        drop();
         throw;
     }
+    delete handles;
+}
+
+// Build the tree bottom up from entries (sorted by key), in place of the empty root leaf left by create. Each
+// leaf is filled until the next entry doesn't fit, and then each level of interior nodes above them likewise,
+// so every block is written just once. The leaves take over the leaf values they get (any that are left in
+// entries, say after a duplicate key, are still the caller's).
+void BTreeBase::bulk_load(IndexEntries &entries) {
+    typedef std::pair<KeyValue,BlockID> Child;  // a node and the smallest key under it
+    std::vector<Child> level;
+    BTreeLeafBase *leaf = make_leaf(this->stat->get_root_id(), false);
+    level.push_back(Child(KeyValue(), leaf->get_id()));
+    try {
+        for (size_t i = 0; i < entries.size(); i++) {
+            const KeyValue &key = entries[i].first;
+            if (i > 0 && key == entries[i - 1].first)
+                throw DbRelationError("Duplicate keys are not allowed in unique index");
+            try {
+                leaf->append(&key, entries[i].second);
+            } catch (DbBlockNoRoomError &e) {
+                BTreeLeafBase *next_leaf = make_leaf(0, true);
+                leaf->set_next_leaf(next_leaf->get_id());
+                leaf->save();
+                delete leaf;
+                leaf = next_leaf;
+                leaf->save();  // so its block holds the next leaf pointer while we fill it
+                level.push_back(Child(key, leaf->get_id()));
+                leaf->append(&key, entries[i].second);
+            }
+            entries[i].second.vd = nullptr;
+            if (this->bloom != nullptr)
+                this->bloom->add(&key);
+        }
+        leaf->save();
+    } catch (...) {
+        delete leaf;
+        throw;
+    }
+    delete leaf;
+    if (this->bloom != nullptr)
+        this->bloom->save();
+
+    uint height = 1, leaves = (uint) level.size(), interiors = 0;
+    while (level.size() > 1) {
+        std::vector<Child> parents;
+        BTreeInterior *interior = nullptr;
+        for (auto const &child: level) {
+            if (interior != nullptr) {
+                try {
+                    interior->append(&child.first, child.second);
+                    continue;
+                } catch (DbBlockNoRoomError &e) {
+                    interior->save();
+                    delete interior;
+                }
+            }
+            interior = new BTreeInterior(this->file, 0, this->key_profile, true);
+            interior->set_first(child.second);
+            interior->save();
+            parents.push_back(Child(child.first, interior->get_id()));
+        }
+        interior->save();
+        delete interior;
+        interiors += (uint) parents.size();
+        level = parents;
+        height++;
+    }
+
+    this->stat->set_root_id(level[0].second);
+    this->stat->set_height(height);
+    if (entries.empty())
+        this->stat->set_counts(0, leaves, interiors, KeyValue(), KeyValue());
+    else
+        this->stat->set_counts((uint) entries.size(), leaves, interiors, entries.front().first, entries.back().first);
+    this->stat->save();
 }
 
 // Drop the index.
@@ -56,11 +150,12 @@ void BTreeBase::open() {
     if (this->closed) {
         this->file.open();
         this->stat = new BTreeStat(this->file, STAT, this->key_profile);
-        if (this->stat->get_height() == 1)
-            this->root = make_leaf(this->stat->get_root_id(), false);
-        else
-            this->root = new BTreeInterior(this->file, this->stat->get_root_id(), this->key_profile, false);
+        if (this->stat->get_bloom_id() != 0)
+            this->bloom = new BTreeBloom(this->file, this->stat->get_bloom_id(), this->stat->get_bloom_blocks(),
+                                         this->stat->get_bloom_hashes(), false);
         this->closed = false;
+        if (!this->stat->has_counts())
+            analyze();
     }
 }
 
@@ -69,8 +164,8 @@ void BTreeBase::close() {
     this->file.close();
     delete this->stat;
     this->stat = nullptr;
-    delete this->root;
-    this->root = nullptr;
+    delete this->bloom;
+    this->bloom = nullptr;
     this->closed = true;
 }
 
@@ -79,53 +174,178 @@ void BTreeBase::close() {
 Handles* BTreeBase::lookup(ValueDict* key_dict) {
     open();
     KeyValue *key = tkey(key_dict);
-    BTreeLeafBase *leaf = _lookup(this->root, this->stat->get_height(), key);
     Handles *handles = new Handles();
+    if (!may_contain(key)) {
+        delete key;
+        return handles;
+    }
+    BTreeLeafBase *leaf = _lookup(key, false);
     try {
         BTreeLeafValue value = leaf->find_eq(key);
         handles->push_back(value.h);
     } catch (std::out_of_range &e) {
-        ; // not found, so we return an empty list
+        this->bloom_false_positives += this->bloom != nullptr; // not found, so we return an empty list
     }
+    release(leaf, false);
     delete key;
     return handles;
 }
 
-// Recursive lookup.
-BTreeLeafBase* BTreeBase::_lookup(BTreeNode *node, uint depth, const KeyValue* key) {
-    if (depth == 1) { // base case: leaf
-        return (BTreeLeafBase *)node;
-    } else { // interior node: find the block to go to in the next level down and recurse there
-        BTreeInterior *interior = (BTreeInterior *) node;
-        return _lookup(find(interior, depth, key), depth - 1, key);
-    }
+// Find all the rows for each of a list of keys. Result i holds the handles for keys[i].
+// The tree is only walked once (see _lookup_many), so this beats calling lookup for each key.
+HandlesByKey* BTreeBase::lookup_many(ValueDicts* key_dicts) {
+    open();
+    KeyValues keys;
+    for (auto const& key_dict: *key_dicts)
+        keys.push_back(tkey(key_dict));
+    HandlesByKey *ret = _lookup_many(keys, false);
+    for (auto key: keys)
+        delete key;
+    return ret;
 }
 
-Handles* BTreeBase::_range(KeyValue *tmin, KeyValue *tmax, bool return_keys) {
-    Handles *results = new Handles();
-    BTreeLeafBase *start = _lookup(this->root, this->stat->get_height(), tmin);
-    for (auto const& mval: start->get_key_map()) {
-        if (tmax != nullptr && mval.first > *tmax)
-            return results;
-        if (tmin == nullptr || mval.first >= *tmin) {
+// Probe for a batch of keys in one pass through the tree. The keys are visited in sorted order and we keep
+// the path from the root to the current leaf (latched shared), so consecutive keys share all the ancestors
+// (and the leaf) they have in common instead of redescending from the root each time.
+HandlesByKey* BTreeBase::_lookup_many(const KeyValues &keys, bool return_keys) {
+    std::vector<size_t> order(keys.size());
+    for (size_t i = 0; i < order.size(); i++)
+        order[i] = i;
+    std::sort(order.begin(), order.end(), [&keys](size_t a, size_t b) { return *keys[a] < *keys[b]; });
+
+    HandlesByKey *results = new HandlesByKey();
+    for (size_t i = 0; i < keys.size(); i++)
+        results->push_back(new Handles());
+
+    // path[d] is the node at depth d; uppers[d] is the boundary at or past which keys leave its subtree
+    uint height;
+    std::vector<BTreeNode*> path(1, latch_root(false, height));
+    std::vector<const KeyValue*> uppers(1, nullptr);
+    for (auto const& i: order) {
+        const KeyValue *key = keys[i];
+        if (!may_contain(key))
+            continue;
+        while (path.size() > 1 && uppers.back() != nullptr && !(*key < *uppers.back())) {
+            release(path.back(), false);
+            path.pop_back();
+            uppers.pop_back();
+        }
+        while (path.size() < height) {
+            const KeyValue *upper = uppers.back();
+            BlockID down = ((BTreeInterior *) path.back())->find(key, upper);
+            latch(down, false);
+            path.push_back(read_node(down, height - path.size()));
+            uppers.push_back(upper);
+        }
+        BTreeLeafBase *leaf = (BTreeLeafBase *) path.back();
+        LeafMap::const_iterator entry = leaf->get_key_map().find(*key);
+        if (entry != leaf->get_key_map().end()) {
             if (return_keys)
-                results->push_back(Handle(mval.first));
+                (*results)[i]->push_back(Handle(entry->first));
             else
-                results->push_back(Handle(mval.second.h));
+                (*results)[i]->push_back(entry->second.h);
+        } else {
+            this->bloom_false_positives += this->bloom != nullptr;
         }
     }
-    BlockID next_leaf_id = start->get_next_leaf();
-    while (next_leaf_id > 0) {
-        BTreeLeafBase *next_leaf = this->make_leaf(next_leaf_id, false);
-        for (auto const& mval: next_leaf->get_key_map()) {
-            if (tmax != nullptr && mval.first > *tmax)
+    while (!path.empty()) {
+        release(path.back(), false);
+        path.pop_back();
+    }
+    return results;
+}
+
+// Read in the node in the given block, depth levels up from the leaves (a leaf is depth 1).
+BTreeNode *BTreeBase::read_node(BlockID block_id, uint depth) {
+    if (depth == 1)
+        return make_leaf(block_id, false);
+    return new BTreeInterior(this->file, block_id, this->key_profile, false);
+}
+
+void BTreeBase::latch(BlockID block_id, bool exclusive) {
+    if (exclusive)
+        this->latches.get(block_id).lock();
+    else
+        this->latches.get(block_id).lock_shared();
+}
+
+void BTreeBase::unlatch(BlockID block_id, bool exclusive) {
+    if (exclusive)
+        this->latches.get(block_id).unlock();
+    else
+        this->latches.get(block_id).unlock_shared();
+}
+
+// Latch the root and read it in, along with the height of the tree. The stat latch is held meanwhile, so
+// the root can't split out from under us. Only latch it exclusive (for an update) if it is a leaf.
+BTreeNode *BTreeBase::latch_root(bool exclusive, uint &height) {
+    latch(STAT, false);
+    BlockID root_id = this->stat->get_root_id();
+    height = this->stat->get_height();
+    latch(root_id, exclusive && height == 1);
+    unlatch(STAT, false);
+    return read_node(root_id, height);
+}
+
+// Let go of a node we have latched.
+void BTreeBase::release(BTreeNode *node, bool exclusive) {
+    unlatch(node->get_id(), exclusive);
+    delete node;
+}
+
+// Crab down to the leaf where key belongs (or the first leaf if key is nullptr). The interior nodes are
+// latched shared and the leaf is returned still latched: exclusive if for_update, otherwise shared.
+// Pass it to release() when done with it.
+BTreeLeafBase* BTreeBase::_lookup(const KeyValue* key, bool for_update) {
+    uint height;
+    BTreeNode *node = latch_root(for_update, height);
+    for (uint depth = height; depth > 1; depth--) {
+        BlockID down = ((BTreeInterior *) node)->find(key);
+        latch(down, for_update && depth == 2);
+        BTreeNode *kid = read_node(down, depth - 1);
+        release(node, false);
+        node = kid;
+    }
+    return (BTreeLeafBase *) node;
+}
+
+// Is key past tmax? Only as many columns as tmax has are compared, so a shorter tmax bounds a key prefix.
+static bool past_max(const KeyValue &key, const KeyValue &tmax) {
+    if (key.size() <= tmax.size())
+        return key > tmax;
+    return KeyValue(key.begin(), key.begin() + tmax.size()) > tmax;
+}
+
+// Walk the leaves from tmin to tmax (stopping after limit entries, unless it's 0). Each next leaf is latched before
+// we let go of the one before it.
+Handles* BTreeBase::_range(KeyValue *tmin, KeyValue *tmax, bool return_keys, u_long limit) {
+    Handles *results = new Handles();
+    BTreeLeafBase *leaf = _lookup(tmin, false);
+    while (leaf != nullptr) {
+        for (auto const& mval: leaf->get_key_map()) {
+            if (tmax != nullptr && past_max(mval.first, *tmax)) {
+                release(leaf, false);
                 return results;
-            if (return_keys)
-                results->push_back(Handle(mval.first));
-            else
-                results->push_back(Handle(mval.second.h));
+            }
+            if (tmin == nullptr || mval.first >= *tmin) {
+                if (return_keys)
+                    results->push_back(Handle(mval.first));
+                else
+                    results->push_back(Handle(mval.second.h));
+                if (results->size() == limit) {
+                    release(leaf, false);
+                    return results;
+                }
+            }
         }
-        next_leaf_id = next_leaf->get_next_leaf();
+        BlockID next_leaf_id = leaf->get_next_leaf();
+        BTreeLeafBase *next_leaf = nullptr;
+        if (next_leaf_id > 0) {
+            latch(next_leaf_id, false);
+            next_leaf = make_leaf(next_leaf_id, false);
+        }
+        release(leaf, false);
+        leaf = next_leaf;
     }
     return results;
 }
@@ -135,62 +355,325 @@ void BTreeBase::insert(Handle handle) {
     ValueDict *row = this->relation.project(handle, &this->key_columns);
     KeyValue *key = tkey(row);
     delete row;
+    insert_entry(key, handle);
+    delete key;
+}
+
+// Put the key and its leaf value into the tree (and the Bloom filter).
+void BTreeBase::insert_entry(const KeyValue *key, BTreeLeafValue value) {
+    // into the filter first: once any lookup has seen the key in its leaf, every later one must get past it
+    if (this->bloom != nullptr) {
+        this->bloom_latch.lock();
+        this->bloom->add(key);
+        this->bloom->save();
+        this->bloom_latch.unlock();
+    }
+
+    // usually the leaf has room and it is the only node that changes
+    BTreeLeafBase *leaf = _lookup(key, true);
+    bool split = false;
+    try {
+        leaf->insert(key, value);
+    } catch (DbBlockNoRoomError &e) {
+        split = true;
+    } catch (...) {
+        release(leaf, true);
+        throw;
+    }
+    release(leaf, true);
+    if (split)
+        _insert(key, value);
+
+    std::lock_guard<std::mutex> guard(this->stat_mutex);
+    this->stat->add_entry(key);
+    this->stat->save();
+}
+
+// Put a batch of entries, sorted by key, into the tree. Each leaf gets every entry in a row that surely belongs in it
+// (up to its largest key, or any key at all for the last leaf) and is written just once, and the Bloom filter and
+// the counts are saved once at the end. An entry the leaf has no room for goes in the way insert_entry does it,
+// splitting the leaf. If one fails, the leaf values of the entries that didn't go in are freed.
+void BTreeBase::insert_entries(IndexEntries &entries) {
+    if (this->bloom != nullptr) {
+        this->bloom_latch.lock();
+        for (auto const& entry: entries)
+            this->bloom->add(&entry.first);
+        this->bloom->save();
+        this->bloom_latch.unlock();
+    }
+
+    size_t i = 0, taken = 0;  // the entries before taken are in the tree (or owned by it)
+    try {
+        while (i < entries.size()) {
+            BTreeLeafBase *leaf = _lookup(&entries[i].first, true);
+            size_t first = i;
+            bool split = false;
+            try {
+                const LeafMap &key_map = leaf->get_key_map();
+                KeyValue max_key = key_map.empty() ? KeyValue() : key_map.rbegin()->first;
+                bool last_leaf = leaf->get_next_leaf() == 0;
+                do {
+                    leaf->add(&entries[i].first, entries[i].second);
+                    taken = ++i;
+                } while (i < entries.size() && (last_leaf || entries[i].first < max_key));
+            } catch (DbBlockNoRoomError &e) {
+                split = true;
+            } catch (...) {
+                if (i > first)
+                    leaf->save();
+                release(leaf, true);
+                throw;
+            }
+            if (i > first)
+                leaf->save();
+            release(leaf, true);
+            if (split) {
+                taken = i + 1;
+                _insert(&entries[i].first, entries[i].second);
+                i++;
+            }
+        }
+    } catch (...) {
+        for (size_t j = taken; j < entries.size(); j++)
+            delete entries[j].second.vd;
+        std::lock_guard<std::mutex> guard(this->stat_mutex);
+        for (size_t j = 0; j < i; j++)
+            this->stat->add_entry(&entries[j].first);
+        this->stat->save();
+        throw;
+    }
+
+    std::lock_guard<std::mutex> guard(this->stat_mutex);
+    for (auto const& entry: entries)
+        this->stat->add_entry(&entry.first);
+    this->stat->save();
+}
+
+// Remove keys (sorted, and all in the tree) a leaf at a time: the run of them each leaf holds comes out before it's
+// saved, once. Like del, this leaves the Bloom filter alone and the leaves in place, however empty.
+void BTreeBase::del_keys(const std::vector<KeyValue> &keys) {
+    size_t i = 0;  // the keys before i are out of the tree
+    try {
+        while (i < keys.size()) {
+            BTreeLeafBase *leaf = _lookup(&keys[i], true);
+            size_t first = i;
+            try {
+                const LeafMap &key_map = leaf->get_key_map();
+                KeyValue max_key = key_map.empty() ? KeyValue() : key_map.rbegin()->first;
+                bool last_leaf = leaf->get_next_leaf() == 0;
+                do {
+                    leaf->remove(&keys[i]);
+                    i++;
+                } while (i < keys.size() && (last_leaf || !(max_key < keys[i])));
+            } catch (...) {
+                if (i > first)
+                    leaf->save();
+                release(leaf, true);
+                throw;
+            }
+            leaf->save();
+            release(leaf, true);
+        }
+    } catch (...) {
+        std::lock_guard<std::mutex> guard(this->stat_mutex);
+        for (size_t j = 0; j < i; j++)
+            this->stat->remove_entry();
+        this->stat->save();
+        throw;
+    }
+
+    std::lock_guard<std::mutex> guard(this->stat_mutex);
+    for (size_t j = 0; j < keys.size(); j++)
+        this->stat->remove_entry();
+    this->stat->save();
+}
+
+// Allocate the Bloom filter blocks with room for n_keys (and as many again to grow into)
+void BTreeBase::create_bloom(u_long n_keys) {
+    if (this->bloom_bits_per_key == 0)
+        return;
+    this->bloom = new BTreeBloom(this->file, 0, BTreeBloom::blocks_for(2 * n_keys, this->bloom_bits_per_key),
+                                 BTreeBloom::hashes_for(this->bloom_bits_per_key), true);
+    this->stat->set_bloom(this->bloom->get_first(), this->bloom->get_n_blocks(),
+                          BTreeBloom::hashes_for(this->bloom_bits_per_key));
+    this->stat->save();
+}
+
+// Refill the Bloom filter from the keys now in the tree, dropping any deleted keys and getting a bigger
+// filter if it has outgrown its blocks. Should also be done after loading the tree in bulk.
+void BTreeBase::rebuild_bloom() {
+    open();
+    Handles *keys = _range(nullptr, nullptr, true);
+    if (this->bloom != nullptr
+        && BTreeBloom::blocks_for(keys->size(), this->bloom_bits_per_key) <= this->bloom->get_n_blocks()) {
+        this->bloom->clear();
+    } else {
+        delete this->bloom;
+        this->bloom = nullptr;
+        create_bloom(keys->size());  // the old blocks, if any, are just abandoned
+    }
+    if (this->bloom != nullptr) {
+        for (auto const& key: *keys)
+            this->bloom->add(&key.key_value);
+        this->bloom->save();
+    }
+    delete keys;
+    this->bloom_negatives = this->bloom_false_positives = 0;
+}
+
+// Check the Bloom filter (if we have one): false means the key is definitely not in the tree.
+bool BTreeBase::may_contain(const KeyValue *key) {
+    if (this->bloom == nullptr)
+        return true;
+    this->bloom_latch.lock_shared();
+    bool maybe = this->bloom->may_contain(key);
+    this->bloom_latch.unlock_shared();
+    if (!maybe)
+        this->bloom_negatives++;
+    return maybe;
+}
+
+IndexStats* BTreeBase::get_stats() {
+    open();
+    std::lock_guard<std::mutex> guard(this->stat_mutex);
+    IndexStats *stats = new IndexStats();
+    stats->entries = this->stat->get_entries();
+    stats->height = this->stat->get_height();
+    stats->leaf_blocks = this->stat->get_leaves();
+    stats->interior_blocks = this->stat->get_interiors();
+    stats->min_key = this->stat->get_min_key();
+    stats->max_key = this->stat->get_max_key();
+    return stats;
+}
+
+// Count everything again from the tree itself (for a stat block from before we kept counts, or to tighten
+// the key bounds after deletes).
+void BTreeBase::analyze() {
+    open();
+    uint entries = 0, leaves = 0, interiors = 0;
+    KeyValue min_key, max_key;
+    BTreeNode *root = read_node(this->stat->get_root_id(), this->stat->get_height());
+    _analyze(root, this->stat->get_height(), entries, leaves, interiors, min_key, max_key);
+    delete root;
+    this->stat->set_counts(entries, leaves, interiors, min_key, max_key);
+    this->stat->save();
+}
+
+// Recursive walk for analyze, in key order.
+void BTreeBase::_analyze(BTreeNode *node, uint depth, uint &entries, uint &leaves, uint &interiors,
+                         KeyValue &min_key, KeyValue &max_key) {
+    if (depth == 1) {
+        const LeafMap &key_map = ((BTreeLeafBase *) node)->get_key_map();
+        leaves++;
+        entries += key_map.size();
+        if (!key_map.empty()) {
+            if (min_key.empty())
+                min_key = key_map.begin()->first;
+            max_key = key_map.rbegin()->first;
+        }
+        return;
+    }
+    BTreeInterior *interior = (BTreeInterior *) node;
+    interiors++;
+    BlockPointers kids(1, interior->get_first());
+    kids.insert(kids.end(), interior->get_pointers().begin(), interior->get_pointers().end());
+    for (auto const& block_id: kids) {
+        BTreeNode *kid = read_node(block_id, depth - 1);
+        _analyze(kid, depth - 1, entries, leaves, interiors, min_key, max_key);
+        delete kid;
+    }
+}
 
-    Insertion split = _insert(this->root, this->stat->get_height(), key, handle);
-    if (!BTreeNode::insertion_is_none(split))
-        split_root(split);
+double BTreeBase::bloom_expected_false_positive_rate() const {
+    return this->bloom == nullptr ? 1.0 : this->bloom->expected_false_positive_rate();
 }
 
-// if we split the root grow the tree up one level
-void BTreeBase::split_root(Insertion insertion) {
+double BTreeBase::bloom_observed_false_positive_rate() const {
+    u_long absent = this->bloom_negatives + this->bloom_false_positives;
+    return absent == 0 ? 0.0 : (double) this->bloom_false_positives / absent;
+}
+
+// if we split the root grow the tree up one level (the caller has the stat latch exclusively)
+void BTreeBase::split_root(BlockID old_root, Insertion insertion) {
     BlockID rroot = insertion.first;
     KeyValue boundary = insertion.second;
     BTreeInterior *root = new BTreeInterior(this->file, 0, this->key_profile, true);
-    root->set_first(this->root->get_id());
+    root->set_first(old_root);
     root->insert(&boundary, rroot);
     root->save();
+    std::lock_guard<std::mutex> guard(this->stat_mutex);
     this->stat->set_root_id(root->get_id());
     this->stat->set_height(this->stat->get_height() + 1);
+    this->stat->add_interior();
     this->stat->save();
-    this->root = root;
+    delete root;
 }
 
-// Recursive insert. If a split happens at this level, return the (new node, boundary) of the split.
-Insertion BTreeBase::_insert(BTreeNode *node, uint depth, const KeyValue* key, BTreeLeafValue leaf_value) {
-    if (depth == 1) {
-        BTreeLeafBase *leaf = (BTreeLeafBase *)node;
+// Insert when the leaf has to split. The whole path from the root down is latched exclusively, as is the
+// stat block, and then the insert works its way back up: a split at one level puts its new boundary into
+// the level above, and so on up to a new root if need be.
+void BTreeBase::_insert(const KeyValue* key, BTreeLeafValue value) {
+    latch(STAT, true);
+    uint height = this->stat->get_height();
+    BlockID root_id = this->stat->get_root_id();
+    latch(root_id, true);
+    std::vector<BTreeNode*> path(1, read_node(root_id, height));
+    try {
+        while (path.size() < height) {
+            BlockID down = ((BTreeInterior *) path.back())->find(key);
+            latch(down, true);
+            path.push_back(read_node(down, height - path.size()));
+        }
+
+        BTreeLeafBase *leaf = (BTreeLeafBase *) path.back();
+        Insertion split;
         try {
-            return leaf->insert(key, leaf_value);
+            split = leaf->insert(key, value);  // somebody else may have split it already
         } catch (DbBlockNoRoomError &e) {
-            return leaf->split(make_leaf(0, true), key, leaf_value);
+            BTreeLeafBase *nleaf = make_leaf(0, true);
+            split = leaf->split(nleaf, key, value);
+            delete nleaf;
+            std::lock_guard<std::mutex> guard(this->stat_mutex);
+            this->stat->add_leaf();
         }
-    } else {
-        BTreeInterior *interior = (BTreeInterior *)node;
-        Insertion new_kid = _insert(find(interior, depth, key), depth - 1, key, leaf_value);
-        if (!BTreeNode::insertion_is_none(new_kid)) {
-            BlockID nnode = new_kid.first;
-            KeyValue boundary = new_kid.second;
-            return interior->insert(&boundary, nnode);
+        for (size_t depth = path.size() - 1; depth > 0 && !BTreeNode::insertion_is_none(split); depth--) {
+            split = ((BTreeInterior *) path[depth - 1])->insert(&split.second, split.first);
+            if (!BTreeNode::insertion_is_none(split)) {
+                std::lock_guard<std::mutex> guard(this->stat_mutex);
+                this->stat->add_interior();
+            }
         }
-        return BTreeNode::insertion_none();
+        if (!BTreeNode::insertion_is_none(split))
+            split_root(root_id, split);
+    } catch (...) {
+        for (auto node: path)
+            release(node, true);
+        unlatch(STAT, true);
+        throw;
     }
-}
-
-// Call the interior node's find method and construct an appropriate BTreeNode at the next level with the response
-BTreeNode *BTreeBase::find(BTreeInterior *node, uint height, const KeyValue* key)  {
-    BlockID down = node->find(key);
-    if (height == 2)
-        return make_leaf(down, false);
-    else
-        return new BTreeInterior(this->file, down, this->key_profile, false);
+    for (auto node: path)
+        release(node, true);
+    unlatch(STAT, true);
 }
 
 // Delete an index entry
 void BTreeBase::del(Handle handle) {
-    KeyValue *tkey = this->tkey(this->relation.project(handle));
-    BTreeLeafBase *leaf = this->_lookup(this->root, this->stat->get_height(), tkey);
-    leaf->del(tkey);
+    ValueDict *row = this->relation.project(handle);
+    KeyValue *tkey = this->tkey(row);
+    delete row;
+    BTreeLeafBase *leaf = _lookup(tkey, true);
+    try {
+        leaf->del(tkey);
+    } catch (...) {
+        release(leaf, true);
+        delete tkey;
+        throw;
+    }
+    release(leaf, true);
     delete tkey;
+    std::lock_guard<std::mutex> guard(this->stat_mutex);
+    this->stat->remove_entry();
+    this->stat->save();
 }
 
 // Figure out the data types of each key component and encode them in self.key_profile
@@ -210,6 +693,20 @@ KeyValue *BTreeBase::tkey(const ValueDict *key) const {
     return kv;
 }
 
+// The values of the leading key columns that key has, up to the first one it's missing.
+KeyValue *BTreeBase::tkey_prefix(const ValueDict *key) const {
+    KeyValue *kv = new KeyValue();
+    if (key == nullptr)
+        return kv;
+    for (auto& col_name: this->key_columns) {
+        auto found = key->find(col_name);
+        if (found == key->end())
+            break;
+        kv->push_back(found->second);
+    }
+    return kv;
+}
+
 std::ostream &BTreeBase::_dump(std::ostream &out, BlockID block_id, uint height) {
     out << "(h:" << height << ")";
     if (height == 1) {
@@ -228,15 +725,17 @@ std::ostream &BTreeBase::_dump(std::ostream &out, BlockID block_id, uint height)
 std::ostream &operator<<(std::ostream &out, BTreeBase &btree) {
     //out << "STAT: " << btree.stat << std::endl;
     out << "(h:" << btree.stat->get_height() << ")ROOT: ";
+    BTreeNode *node = btree.read_node(btree.stat->get_root_id(), btree.stat->get_height());
     if (btree.stat->get_height() > 1) {
-        BTreeInterior *root = (BTreeInterior *) btree.root;
+        BTreeInterior *root = (BTreeInterior *) node;
         out << root << std::endl;
         btree._dump(out, root->get_first(), btree.stat->get_height() - 1);
         for (auto const& pointer: root->get_pointers())
             btree._dump(out, pointer, btree.stat->get_height() - 1);
     } else {
-        out << (BTreeLeafIndex *) btree.root;
+        out << (BTreeLeafIndex *) node;
     }
+    delete node;
     return out;
 }
 
@@ -246,8 +745,14 @@ std::ostream &operator<<(std::ostream &out, BTreeBase &btree) {
  * BTreeIndex
  ************/
 
-BTreeIndex::BTreeIndex(DbRelation& relation, Identifier name, ColumnNames key_columns, bool unique)
-        : BTreeBase(relation, name, key_columns, unique) {
+BTreeIndex::BTreeIndex(DbRelation& relation, Identifier name, ColumnNames key_columns, bool unique,
+                       ColumnNames include_columns)
+        : BTreeBase(relation, name, key_columns, unique),
+          include_columns(include_columns),
+          include_column_attributes() {
+    ColumnAttributes *attributes = relation.get_column_attributes(include_columns);
+    this->include_column_attributes = *attributes;
+    delete attributes;
 }
 
 BTreeIndex::~BTreeIndex() {
@@ -255,14 +760,250 @@ BTreeIndex::~BTreeIndex() {
 
 // Construct an appropriate leaf
 BTreeLeafBase *BTreeIndex::make_leaf(BlockID id, bool create) {
-    return new BTreeLeafIndex(this->file, id, this->key_profile, create);
+    return new BTreeLeafIndex(this->file, id, this->key_profile,
+                              this->include_columns, this->include_column_attributes, create);
+}
+
+// Insert a row with the given handle, carrying its INCLUDE column values along into the leaf.
+void BTreeIndex::insert(Handle handle) {
+    if (this->include_columns.empty()) {
+        BTreeBase::insert(handle);
+        return;
+    }
+    ColumnNames column_names(this->key_columns);
+    column_names.insert(column_names.end(), this->include_columns.begin(), this->include_columns.end());
+    ValueDict *row = this->relation.project(handle, &column_names);
+    IndexEntry entry = index_entry(row, handle);
+    delete row;
+    insert_entry(&entry.first, entry.second);
+}
+
+// Insert the entries for a batch of rows: their keys (and INCLUDE column values) projected from the relation a
+// block at a time, then put into the tree in key order, so the ones going into the same leaf come one after another.
+void BTreeIndex::insert_many(Handles* handles) {
+    ColumnNames column_names(this->key_columns);
+    column_names.insert(column_names.end(), this->include_columns.begin(), this->include_columns.end());
+    ValueDicts *rows = this->relation.project(handles, &column_names);
+    IndexEntries entries;
+    try {
+        for (size_t i = 0; i < rows->size(); i++)
+            entries.push_back(index_entry((*rows)[i], (*handles)[i]));
+    } catch (...) {
+        for (auto &entry: entries)
+            delete entry.second.vd;
+        EvalOperator::free_batch(rows);
+        throw;
+    }
+    EvalOperator::free_batch(rows);
+    std::stable_sort(entries.begin(), entries.end(),
+                     [](const IndexEntry &a, const IndexEntry &b) { return a.first < b.first; });
+    insert_entries(entries);
+}
+
+// Take a batch of rows out of the index: their keys, sorted, come out a leaf at a time (see del_keys). The rows must
+// still be in the relation, to get their keys from.
+void BTreeIndex::del_many(Handles* handles) {
+    open();
+    ValueDicts *rows = this->relation.project(handles, &this->key_columns);
+    std::vector<KeyValue> keys;
+    keys.reserve(rows->size());
+    for (auto const& row: *rows) {
+        KeyValue *key = tkey(row);
+        keys.push_back(*key);
+        delete key;
+    }
+    EvalOperator::free_batch(rows);
+    std::sort(keys.begin(), keys.end());
+    del_keys(keys);
+}
+
+// The key and leaf value (with its INCLUDE column values, if any) for a row of the relation.
+IndexEntry BTreeIndex::index_entry(const ValueDict *row, Handle handle) {
+    KeyValue *key = tkey(row);
+    IndexEntry entry(*key, BTreeLeafValue(handle));
+    delete key;
+    if (!this->include_columns.empty()) {
+        entry.second.vd = new ValueDict();
+        for (auto const& column_name: this->include_columns)
+            (*entry.second.vd)[column_name] = row->at(column_name);
+    }
+    return entry;
+}
+
+uint BTreeIndex::build_workers = std::max(1U, std::thread::hardware_concurrency());
+
+// Build the index in bulk. Workers each take morsels of the relation's blocks (as a ParallelScanOperator does) and
+// sort the entries from them; then their runs are merged into one and loaded bottom up (see bulk_load). A relation
+// that can't be read a block at a time is read all at once instead.
+void BTreeIndex::load() {
+    uint blocks = this->relation.decodes_blocks() ? this->relation.get_block_count() : 0;
+    uint morsels = (blocks + ParallelScanOperator::MORSEL_BLOCKS - 1) / ParallelScanOperator::MORSEL_BLOCKS;
+    uint n = std::max(1U, std::min(build_workers, morsels));
+    std::vector<IndexEntries> runs(n);
+    std::vector<std::string> errors(n);
+    auto free_entries = [](IndexEntries &entries) {
+        for (auto &entry: entries)
+            delete entry.second.vd;
+        entries.clear();
+    };
+
+    if (morsels == 0) {
+        ColumnNames column_names(this->key_columns);
+        column_names.insert(column_names.end(), this->include_columns.begin(), this->include_columns.end());
+        Handles *handles = this->relation.select();
+        ValueDicts *rows = nullptr;
+        try {
+            rows = this->relation.project(handles, &column_names);
+        } catch (...) {
+            delete handles;
+            throw;
+        }
+        for (size_t i = 0; i < rows->size(); i++) {
+            runs[0].push_back(index_entry((*rows)[i], (*handles)[i]));
+            delete (*rows)[i];
+        }
+        delete rows;
+        delete handles;
+        std::sort(runs[0].begin(), runs[0].end(),
+                  [](const IndexEntry &a, const IndexEntry &b) { return a.first < b.first; });
+    } else {
+        this->relation.open();  // before the workers, which then share it
+        MorselQueues queues(morsels, n, false);
+        auto work = [&](uint worker) {
+            try {
+                ColumnBatch columns(this->relation.get_column_names(), this->relation.get_column_attributes());
+                uint morsel;
+                while (queues.take(worker, morsel)) {
+                    BlockID block_id = 1 + morsel * ParallelScanOperator::MORSEL_BLOCKS;
+                    extract(block_id, block_id + ParallelScanOperator::MORSEL_BLOCKS, columns, runs[worker]);
+                }
+                std::sort(runs[worker].begin(), runs[worker].end(),
+                          [](const IndexEntry &a, const IndexEntry &b) { return a.first < b.first; });
+            } catch (std::exception &e) {
+                errors[worker] = e.what();
+                if (errors[worker].empty())
+                    errors[worker] = "index build failed";
+                queues.stop();
+            }
+        };
+        std::vector<std::thread> threads;
+        for (uint worker = 0; worker < n; worker++)
+            threads.push_back(std::thread(work, worker));
+        for (auto &thread: threads)
+            thread.join();
+    }
+    for (auto const &error: errors) {
+        if (!error.empty()) {
+            for (auto &run: runs)
+                free_entries(run);
+            throw DbRelationError(error);
+        }
+    }
+
+    // merge the runs, taking the smallest of their first entries each time
+    IndexEntries entries;
+    size_t total = 0;
+    for (auto const &run: runs)
+        total += run.size();
+    entries.reserve(total);
+    std::vector<size_t> next(n, 0);
+    auto later = [&runs, &next](uint a, uint b) { return runs[b][next[b]].first < runs[a][next[a]].first; };
+    std::priority_queue<uint, std::vector<uint>, decltype(later)> heads(later);
+    for (uint run = 0; run < n; run++)
+        if (!runs[run].empty())
+            heads.push(run);
+    while (!heads.empty()) {
+        uint run = heads.top();
+        heads.pop();
+        entries.push_back(runs[run][next[run]++]);
+        if (next[run] < runs[run].size())
+            heads.push(run);
+    }
+    runs.clear();
+
+    try {
+        create_bloom(entries.size());
+        bulk_load(entries);
+    } catch (...) {
+        free_entries(entries);
+        throw;
+    }
+}
+
+// The entries for the rows in blocks block_id up to (not including) end.
+void BTreeIndex::extract(BlockID block_id, BlockID end, ColumnBatch &columns, IndexEntries &entries) {
+    ColumnNames column_names(this->key_columns);
+    column_names.insert(column_names.end(), this->include_columns.begin(), this->include_columns.end());
+    while (block_id < end && this->relation.decode_block(block_id, columns)) {
+        for (uint32_t position = 0; position < columns.size(); position++) {
+            ValueDict *row = columns.project(position, &column_names);
+            entries.push_back(index_entry(row, columns.get_handle(position)));
+            delete row;
+        }
+    }
+}
+
+// Can we produce all the given columns from the leaves alone?
+bool BTreeIndex::covers(const ColumnNames &column_names) const {
+    for (auto const& column_name: column_names) {
+        if (std::find(this->key_columns.begin(), this->key_columns.end(), column_name) == this->key_columns.end()
+            && std::find(this->include_columns.begin(), this->include_columns.end(), column_name)
+               == this->include_columns.end())
+            return false;
+    }
+    return true;
+}
+
+// Like lookup, but return the requested column values straight from the leaf instead of handles.
+// Only valid if covers(*column_names).
+ValueDicts* BTreeIndex::lookup_values(ValueDict* key_dict, const ColumnNames* column_names) {
+    open();
+    KeyValue *key = tkey(key_dict);
+    ValueDicts *rows = new ValueDicts();
+    WorkCounters::allocated();
+    if (!may_contain(key)) {
+        delete key;
+        return rows;
+    }
+    BTreeLeafBase *leaf = _lookup(key, false);
+    try {
+        BTreeLeafValue value = leaf->find_eq(key);
+        rows->push_back(index_row(key, value, column_names));
+    } catch (std::out_of_range &e) {
+        this->bloom_false_positives += this->bloom != nullptr; // not found, so we return an empty list
+    }
+    release(leaf, false);
+    delete key;
+    return rows;
+}
+
+// Assemble a projected row from a leaf entry's key and INCLUDE values.
+ValueDict *BTreeIndex::index_row(const KeyValue *key, const BTreeLeafValue &value, const ColumnNames *column_names) {
+    ValueDict *row = new ValueDict();
+    WorkCounters::allocated();
+    for (auto const& column_name: *column_names) {
+        auto it = std::find(this->key_columns.begin(), this->key_columns.end(), column_name);
+        if (it != this->key_columns.end())
+            (*row)[column_name] = (*key)[it - this->key_columns.begin()];
+        else
+            (*row)[column_name] = value.vd->at(column_name);
+    }
+    return row;
 }
 
 // Range of values in index
-Handles* BTreeIndex::range(ValueDict* min_key, ValueDict* max_key) {
-    KeyValue *tmin = tkey(min_key);
-    KeyValue *tmax = tkey(max_key);
-    Handles *handles = _range(tmin, tmax, false);
+// Find the rows with keys from min_key to max_key, inclusive. Either bound may give just some leading key
+// columns (see tkey_prefix), in which case every key starting with those values is in bounds, or none of them
+// (or be nullptr) for no bound at all on that side.
+Handles* BTreeIndex::range(ValueDict* min_key, ValueDict* max_key, u_long limit) {
+    open();
+    KeyValue *tmin = tkey_prefix(min_key);
+    KeyValue *tmax = tkey_prefix(max_key);
+    if (tmax->empty()) {
+        delete tmax;
+        tmax = nullptr;
+    }
+    Handles *handles = _range(tmin, tmax, false, limit);
     delete tmin;
     delete tmax;
     return handles;
@@ -271,7 +1012,8 @@ Handles* BTreeIndex::range(ValueDict* min_key, ValueDict* max_key) {
 std::ostream &BTreeIndex::_dump(std::ostream &out, BlockID block_id, uint height) {
     out << "(h:" << height << ")";
     if (height == 1) {
-        BTreeLeafIndex node(this->file, block_id, this->key_profile, false);
+        BTreeLeafIndex node(this->file, block_id, this->key_profile,
+                            this->include_columns, this->include_column_attributes, false);
         out << &node << std::endl;
     } else {
         BTreeInterior node(this->file, block_id, this->key_profile, false);
@@ -308,18 +1050,40 @@ BTreeLeafBase *BTreeFile::make_leaf(BlockID id, bool create) {
                              this->non_key_column_names, this->non_key_column_attributes, create);
 }
 
+// The handles into a BTreeTable are the primary keys themselves
+HandlesByKey* BTreeFile::lookup_many(ValueDicts* key_dicts) {
+    open();
+    KeyValues keys;
+    for (auto const& key_dict: *key_dicts)
+        keys.push_back(tkey(key_dict));
+    HandlesByKey *ret = _lookup_many(keys, true);
+    for (auto key: keys)
+        delete key;
+    return ret;
+}
+
 // Range of values in file
 Handles* BTreeFile::range(KeyValue *tmin, KeyValue *tmax) {
     return _range(tmin, tmax, true);
 }
 
 
-// Get the values not in the primary key (Throws std::out_of_range if not found.)
+// Get the values not in the primary key (Throws std::out_of_range if not found.) Caller deletes the result.
 ValueDict* BTreeFile::lookup_value(KeyValue *key) {
     open();
-    BTreeLeafBase *leaf = _lookup(this->root, this->stat->get_height(), key);
-    BTreeLeafValue value = leaf->find_eq(key);
-    return value.vd;
+    if (!may_contain(key))
+        throw std::out_of_range("key not in BTree");
+    BTreeLeafBase *leaf = _lookup(key, false);
+    ValueDict *row;
+    try {
+        row = new ValueDict(*leaf->find_eq(key).vd);
+    } catch (std::out_of_range &e) {
+        this->bloom_false_positives += this->bloom != nullptr;
+        release(leaf, false);
+        throw;
+    }
+    release(leaf, false);
+    return row;
 }
 
 // Insert a row with the given handle. Row must exist in relation already.
@@ -327,9 +1091,78 @@ ValueDict* BTreeFile::lookup_value(KeyValue *key) {
 void BTreeFile::insert_value(ValueDict *row) {
     KeyValue *key = tkey(row);
     BTreeLeafValue value(new ValueDict(*row));
-    Insertion split = _insert(this->root, this->stat->get_height(), key, value);
-    if (!BTreeNode::insertion_is_none(split))
-        split_root(split);
+    insert_entry(key, value);
+    delete key;
+}
+
+// Put row in place of the one with the same key, right in its leaf. False (changing nothing) if the leaf hasn't room
+// for it, so it has to be taken out and inserted again.
+bool BTreeFile::update_value(const ValueDict *row) {
+    open();
+    KeyValue *key = tkey(row);
+    BTreeLeafValue value(new ValueDict(*row));
+    BTreeLeafBase *leaf = _lookup(key, true);
+    BTreeLeafValue old;
+    try {
+        old = leaf->replace(key, value);
+    } catch (DbBlockNoRoomError &e) {
+        release(leaf, true);
+        delete value.vd;
+        delete key;
+        return false;
+    } catch (...) {
+        release(leaf, true);
+        delete value.vd;
+        delete key;
+        throw;
+    }
+    release(leaf, true);  // the leaf takes value with it
+    delete old.vd;
+    delete key;
+    return true;
+}
+
+// Take out the rows with the given handles (which are their keys), a leaf at a time.
+void BTreeFile::del_values(const Handles* handles) {
+    open();
+    std::vector<KeyValue> keys;
+    keys.reserve(handles->size());
+    for (auto const& handle: *handles)
+        keys.push_back(handle.key_value);
+    std::sort(keys.begin(), keys.end());
+    del_keys(keys);
+}
+
+// Whether the tree is still just the empty root leaf create left (so it can be loaded in bulk).
+bool BTreeFile::is_empty() {
+    IndexStats *stats = get_stats();
+    bool empty = stats->entries == 0 && stats->height == 1 && stats->leaf_blocks <= 1;
+    delete stats;
+    return empty;
+}
+
+// Fill an empty tree with rows (not necessarily in key order) bottom up, each block written once (see bulk_load).
+void BTreeFile::load_values(const ValueDicts &rows) {
+    open();
+    IndexEntries entries;
+    try {
+        for (auto const& row: rows) {
+            KeyValue *key = tkey(row);
+            entries.push_back(IndexEntry(*key, BTreeLeafValue(new ValueDict(*row))));
+            delete key;
+        }
+        std::stable_sort(entries.begin(), entries.end(),
+                         [](const IndexEntry &a, const IndexEntry &b) { return a.first < b.first; });
+        // check for duplicates first, since bulk_load would find them only after writing some of the leaves
+        for (size_t i = 1; i < entries.size(); i++)
+            if (entries[i].first == entries[i - 1].first)
+                throw DbRelationError("Duplicate keys are not allowed in unique index");
+        bulk_load(entries);
+    } catch (...) {
+        for (auto &entry: entries)
+            delete entry.second.vd;
+        throw;
+    }
 }
 
 
@@ -377,21 +1210,70 @@ ValueDict* row2 = validate(row);
 index->insert_value(row2);
 return Handle(*(index->tkey(row2)));
 }
+// Rows going into an empty table are loaded into the tree in bulk; otherwise they go in one at a time.
+Handles* BTreeTable::insert_many(const ValueDicts* rows) {
+    open();
+    if (!index->is_empty())
+        return DbRelation::insert_many(rows);
+    ValueDicts full_rows;
+    Handles* handles = new Handles();
+    try {
+        for (auto const& row: *rows) {
+            full_rows.push_back(validate(row));
+            KeyValue *key = index->tkey(full_rows.back());
+            handles->push_back(Handle(*key));
+            delete key;
+        }
+        index->load_values(full_rows);
+    } catch (...) {
+        for (auto row: full_rows)
+            delete row;
+        delete handles;
+        throw;
+    }
+    for (auto row: full_rows)
+        delete row;
+    return handles;
+}
+
+// With the primary key unchanged, the row is rewritten in place in its leaf (if it still fits). Otherwise it goes in
+// under its new key before coming out under the old one (so a duplicate key changes nothing), and the handle returned
+// is its new key.
 Handle BTreeTable::update(const Handle handle, const ValueDict* new_values) {
     ValueDict* row = project(handle);
-    ValueDict* newRow = row;
-    ValueDict* newVals = validate(new_values);
-    for(auto const& key : *newVals){
-        (*newRow)[key.first] = key.second;
+    for (auto const& column: *new_values) {
+        if (std::find(column_names.begin(), column_names.end(), column.first) == column_names.end()) {
+            delete row;
+            throw DbRelationError("unknown column " + column.first);
+        }
+        (*row)[column.first] = column.second;
     }
-    KeyValue* new_tkey = index->tkey(newRow);
-    index->del(handle);
-    index->insert_value(newRow);
-    return handle;
+    KeyValue* new_tkey = index->tkey(row);
+    Handle ret(*new_tkey);
+    bool same_key = *new_tkey == handle.key_value;
+    delete new_tkey;
+    try {
+        if (!same_key) {
+            index->insert_value(row);
+            index->del(handle);
+        } else if (!index->update_value(row)) {
+            index->del(handle);
+            index->insert_value(row);
+        }
+    } catch (...) {
+        delete row;
+        throw;
+    }
+    delete row;
+    return ret;
 }
 void BTreeTable::del(const Handle handle) {
     index->del(handle);
 }
+void BTreeTable::del_many(const Handles* handles) {
+    open();
+    index->del_values(handles);
+}
 Handles* BTreeTable::select() {
     return select(nullptr);
 }
@@ -418,10 +1300,19 @@ Handles* BTreeTable::select(Handles *current_selection, const ValueDict* where)
             handles->push_back(tkey);
     return handles;
 }
+// The tree keeps a count of its entries, one per row.
+u_long BTreeTable::count() {
+    IndexStats *stats = this->index->get_stats();
+    u_long n = stats->entries;
+    delete stats;
+    return n;
+}
+
 ValueDict* BTreeTable::project(Handle handle) {
     KeyValue vals = handle.key_value;
     ValueDict *key = index->lookup_value(&vals);
     ValueDict *result = new ValueDict();
+    WorkCounters::allocated();
 
     if(key== nullptr)
         throw DbRelationError("Cannot project: invalid handle");
@@ -430,6 +1321,7 @@ ValueDict* BTreeTable::project(Handle handle) {
     
 	for(auto const& cn : *key)
         (*result)[cn.first] = cn.second;
+    delete key;
     for(auto const& col : *primary_key) {
         (*result)[col] = vals[i];
         ++i;
@@ -443,6 +1335,7 @@ ValueDict* BTreeTable::project(Handle handle, const ColumnNames* column_names) {
     int i = 0;
     bool foundPKey;
     ValueDict* result = new ValueDict();
+    WorkCounters::allocated();
     ValueDict *vd = index->lookup_value(&vals);
 
     if(vd->size()==0)
@@ -464,6 +1357,7 @@ ValueDict* BTreeTable::project(Handle handle, const ColumnNames* column_names) {
         for(auto const& col : cn)
             (*result)[col] = vd->at(col);
     }
+    delete vd;
     return result;
 }
 
@@ -610,6 +1504,568 @@ bool test_btree()
 	return true;
 }
 
+// covering index: INCLUDE values come back from the leaves and survive splits and reopening
+bool test_btree_covering() {
+    ColumnNames column_names;
+    column_names.push_back("a");
+    column_names.push_back("b");
+    column_names.push_back("c");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    HeapTable table("__test_btree_covering", column_names, column_attributes);
+    table.create();
+    for (int i = 0; i < 1000; i++) {
+        ValueDict row;
+        row["a"] = Value(i);
+        row["b"] = Value(-i);
+        row["c"] = Value("row " + std::to_string(i));
+        table.insert(&row);
+    }
+    ColumnNames key_columns, include_columns;
+    key_columns.push_back("a");
+    include_columns.push_back("c");
+    BTreeIndex index(table, "fooindex", key_columns, true, include_columns);
+    index.create();
+
+    ColumnNames covered, not_covered;
+    covered.push_back("c");
+    covered.push_back("a");
+    not_covered.push_back("b");
+    if (!index.covers(covered) || index.covers(not_covered)) {
+        std::cout << "covers failed" << std::endl;
+        return false;
+    }
+    ValueDict lookup;
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < 1000; i += 7) {
+            lookup["a"] = i;
+            ValueDicts *rows = index.lookup_values(&lookup, &covered);
+            if (rows->size() != 1 || rows->at(0)->at("a").n != i
+                || rows->at(0)->at("c").s != "row " + std::to_string(i)) {
+                std::cout << "index-only lookup failed " << i << std::endl;
+                return false;
+            }
+            for (auto row: *rows)
+                delete row;
+            delete rows;
+        }
+        index.close();  // second pass reads the leaves back from disk
+    }
+    lookup["a"] = 1000;
+    ValueDicts *rows = index.lookup_values(&lookup, &covered);
+    bool missing = rows->empty();
+    delete rows;
+    index.drop();
+    table.drop();
+    return missing;
+}
+
+// lookup_many has to agree with lookup, whatever order (and repetition) the keys come in
+bool test_btree_lookup_many() {
+    ColumnNames column_names;
+    column_names.push_back("a");
+    column_names.push_back("b");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    HeapTable table("__test_btree_lookup_many", column_names, column_attributes);
+    table.create();
+    const int n = 5000;
+    for (int i = 0; i < n; i++) {
+        ValueDict row;
+        row["a"] = Value(i * 2);  // only even keys, so the odd probes miss
+        row["b"] = Value(i);
+        table.insert(&row);
+    }
+    column_names.clear();
+    column_names.push_back("a");
+    BTreeIndex index(table, "fooindex", column_names, true);
+    index.create();
+
+    ValueDicts keys;
+    for (int i = 0; i < 2 * n; i++) {
+        ValueDict *key = new ValueDict();
+        (*key)["a"] = Value((i * 7919) % (2 * n));  // scrambled order, hitting both evens and odds
+        keys.push_back(key);
+    }
+    ValueDict *repeated = new ValueDict(*keys[10]);
+    keys.push_back(repeated);
+
+    auto start = std::chrono::steady_clock::now();
+    HandlesByKey *singles = new HandlesByKey();
+    for (auto const& key: keys)
+        singles->push_back(index.lookup(key));
+    auto middle = std::chrono::steady_clock::now();
+    HandlesByKey *batch = index.lookup_many(&keys);
+    auto end = std::chrono::steady_clock::now();
+
+    bool ok = batch->size() == keys.size();
+    for (size_t i = 0; ok && i < keys.size(); i++) {
+        Handles *one = (*singles)[i], *many = (*batch)[i];
+        ok = one->size() == many->size() && one->size() == (keys[i]->at("a").n % 2 == 0 ? 1U : 0U);
+        if (ok && !one->empty())
+            ok = one->at(0).block_id == many->at(0).block_id && one->at(0).record_id == many->at(0).record_id;
+    }
+    if (!ok)
+        std::cout << "lookup_many disagrees with lookup" << std::endl;
+    double single_secs = std::chrono::duration<double>(middle - start).count();
+    double batch_secs = std::chrono::duration<double>(end - middle).count();
+    std::cout << "lookups/sec: one at a time " << (long) (keys.size() / single_secs)
+              << ", lookup_many " << (long) (keys.size() / batch_secs) << std::endl;
+
+    for (size_t i = 0; i < keys.size(); i++) {
+        delete keys[i];
+        delete (*singles)[i];
+        delete (*batch)[i];
+    }
+    delete singles;
+    delete batch;
+    index.drop();
+    table.drop();
+    return ok;
+}
+
+
+bool test_btree_bloom() {
+    ColumnNames column_names;
+    column_names.push_back("a");
+    column_names.push_back("b");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    HeapTable table("__test_btree_bloom", column_names, column_attributes);
+    table.create();
+    const int n = 2000;
+    for (int i = 0; i < n; i++) {
+        ValueDict row;
+        row["a"] = Value(i * 2);  // only even keys, so the odd probes miss
+        row["b"] = Value(i);
+        table.insert(&row);
+    }
+    column_names.clear();
+    column_names.push_back("a");
+    BTreeIndex index(table, "fooindex", column_names, true);
+    index.create();
+    bool ok = index.has_bloom();
+
+    // keys added after create() go into the filter, too
+    for (int i = n; ok && i < n + 100; i++) {
+        ValueDict row;
+        row["a"] = Value(i * 2);
+        row["b"] = Value(i);
+        index.insert(table.insert(&row));
+    }
+    index.close();  // and it survives a reopen
+    index.open();
+    ok = ok && index.has_bloom();
+
+    for (int i = 0; ok && i < 2 * (n + 100); i++) {
+        ValueDict key;
+        key["a"] = Value(i);
+        Handles *handles = index.lookup(&key);
+        if (handles->size() != (i % 2 == 0 ? 1U : 0U)) {
+            std::cout << "bloom lookup wrong for " << i << std::endl;
+            ok = false;
+        }
+        delete handles;
+    }
+    std::cout << "bloom false positives: expected " << index.bloom_expected_false_positive_rate()
+              << ", observed " << index.bloom_observed_false_positive_rate() << std::endl;
+    if (index.bloom_observed_false_positive_rate() > 0.1) {
+        std::cout << "bloom filter is letting too many misses through" << std::endl;
+        ok = false;
+    }
+
+    index.rebuild_bloom();
+    ValueDict key;
+    key["a"] = Value(2 * (n + 50));
+    Handles *handles = index.lookup(&key);
+    ok = ok && handles->size() == 1;
+    delete handles;
+
+    index.drop();
+    table.drop();
+    return ok;
+}
+
+
+bool test_btree_stats() {
+    ColumnNames column_names;
+    column_names.push_back("a");
+    column_names.push_back("b");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    HeapTable table("__test_btree_stats", column_names, column_attributes);
+    table.create();
+    const int n = 3000;
+    for (int i = 0; i < n; i++) {
+        ValueDict row;
+        row["a"] = Value((i * 7919) % n);  // scrambled order
+        row["b"] = Value(i);
+        table.insert(&row);
+    }
+    column_names.clear();
+    column_names.push_back("a");
+    BTreeIndex index(table, "fooindex", column_names, true);
+    index.create();
+
+    ValueDict row;
+    row["a"] = Value(-5);
+    row["b"] = Value(0);
+    Handle handle = table.insert(&row);
+    index.insert(handle);
+    index.close();
+    index.open();
+
+    IndexStats *stats = index.get_stats();
+    bool ok = stats->entries == n + 1 && stats->min_key.size() == 1 && stats->min_key[0].n == -5
+              && stats->max_key[0].n == n - 1 && stats->leaf_blocks > 1 && stats->height > 1
+              && stats->interior_blocks >= stats->height - 1;
+    if (!ok)
+        std::cout << "stats after create: " << stats->entries << " entries, " << stats->leaf_blocks << " leaves, "
+                  << stats->interior_blocks << " interiors, height " << stats->height << std::endl;
+
+    // the counts we kept as we went should agree with counting them all over again
+    index.analyze();
+    IndexStats *counted = index.get_stats();
+    if (ok && (counted->entries != stats->entries || counted->leaf_blocks != stats->leaf_blocks
+               || counted->interior_blocks != stats->interior_blocks || counted->min_key != stats->min_key
+               || counted->max_key != stats->max_key)) {
+        std::cout << "kept stats disagree with analyze: " << counted->leaf_blocks << " leaves, "
+                  << counted->interior_blocks << " interiors" << std::endl;
+        ok = false;
+    }
+    delete stats;
+    delete counted;
+
+    // deleting the smallest key leaves the bounds alone until we analyze again
+    index.del(handle);
+    stats = index.get_stats();
+    ok = ok && stats->entries == n && stats->min_key[0].n == -5;
+    delete stats;
+    index.analyze();
+    stats = index.get_stats();
+    ok = ok && stats->entries == n && stats->min_key[0].n == 0;
+    delete stats;
+
+    index.drop();
+    table.drop();
+    return ok;
+}
+
+
+// Readers hammer the index with point lookups while writers insert. Every lookup must agree with some
+// order of the inserts: a key whose insert had finished before the lookup started has to be found.
+bool test_btree_concurrency() {
+    ColumnNames column_names;
+    column_names.push_back("a");
+    column_names.push_back("b");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    HeapTable table("__test_btree_concurrency", column_names, column_attributes);
+    table.create();
+    const int n = 4000;
+    for (int i = 0; i < n; i++) {
+        ValueDict row;
+        row["a"] = Value((i * 7919) % n);
+        row["b"] = Value(i);
+        table.insert(&row);
+    }
+    column_names.clear();
+    column_names.push_back("a");
+    BTreeIndex index(table, "fooindex", column_names, true);
+    index.create();
+
+    // the rows the writers will add to the index (keys n to 2n-1, scrambled)
+    Handles handles;
+    for (int i = 0; i < n; i++) {
+        ValueDict row;
+        row["a"] = Value(n + (i * 7919) % n);
+        row["b"] = Value(i);
+        handles.push_back(table.insert(&row));
+    }
+    std::atomic<bool> *inserted = new std::atomic<bool>[n];
+    for (int i = 0; i < n; i++)
+        inserted[i] = false;
+
+    uint n_readers = std::max(2U, std::thread::hardware_concurrency());
+    const uint n_writers = 2;
+    std::atomic<bool> writing(true);
+    std::atomic<u_long> lookups(0), violations(0);
+    auto reader = [&](uint seed) {
+        std::mt19937 random(seed);
+        u_long count = 0;
+        while (writing || count == 0) {
+            int k = (int) (random() % (2 * n + 100));
+            bool must_find = k < n || (k < 2 * n && inserted[k - n]);
+            ValueDict key;
+            key["a"] = Value(k);
+            Handles *found = index.lookup(&key);
+            if ((must_find && found->size() != 1) || (k >= 2 * n && !found->empty()))
+                violations++;
+            delete found;
+            count++;
+        }
+        lookups += count;
+    };
+    auto writer = [&](uint first) {
+        for (int i = first; i < n; i += n_writers) {
+            index.insert(handles[i]);
+            inserted[(i * 7919) % n] = true;
+        }
+    };
+
+    // one reader by itself, for comparison
+    auto start = std::chrono::steady_clock::now();
+    writing = false;
+    for (int i = 0; i < 20000; i++)
+        reader(i);
+    double alone = lookups / std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    writing = true;
+    lookups = 0;
+    start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (uint i = 0; i < n_readers; i++)
+        threads.push_back(std::thread(reader, i + 1));
+    std::vector<std::thread> writers;
+    for (uint i = 0; i < n_writers; i++)
+        writers.push_back(std::thread(writer, i));
+    for (auto &thread: writers)
+        thread.join();
+    writing = false;
+    for (auto &thread: threads)
+        thread.join();
+    double together = lookups / std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "lookups/sec: 1 reader " << (long) alone << ", " << n_readers << " readers with "
+              << n_writers << " writers " << (long) together << std::endl;
+
+    bool ok = violations == 0;
+    if (!ok)
+        std::cout << violations << " lookups disagreed with the inserts before them" << std::endl;
+    for (int k = 0; ok && k < 2 * n; k++) {
+        ValueDict key;
+        key["a"] = Value(k);
+        Handles *found = index.lookup(&key);
+        if (found->size() != 1) {
+            std::cout << "key " << k << " missing after the inserts" << std::endl;
+            ok = false;
+        }
+        delete found;
+    }
+    IndexStats *stats = index.get_stats();
+    ok = ok && stats->entries == 2 * n;
+    delete stats;
+    Handles *all = index.range(nullptr, nullptr);
+    ok = ok && all->size() == 2 * n;
+    delete all;
+
+    delete[] inserted;
+    index.drop();
+    table.drop();
+    return ok;
+}
+
+// CREATE INDEX in bulk: the same tree from one worker or several, that then takes inserts like any other
+bool test_btree_bulk_load() {
+    ColumnNames column_names;
+    column_names.push_back("a");
+    column_names.push_back("b");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    HeapTable table("__test_btree_bulk_load", column_names, column_attributes);
+    table.create();
+    const int n = 50000;
+    for (int i = 0; i < n; i++) {
+        ValueDict row;
+        row["a"] = Value((int) (((long) i * 7919) % n));
+        row["b"] = Value(i);
+        table.insert(&row);
+    }
+    ColumnNames key_columns, include_columns;
+    key_columns.push_back("a");
+    include_columns.push_back("b");
+    uint saved_workers = BTreeIndex::build_workers;
+    BTreeIndex::build_workers = 4;
+    BTreeIndex index(table, "bulkindex", key_columns, true, include_columns);
+    index.create();
+    BTreeIndex::build_workers = 1;
+    BTreeIndex serial(table, "serialindex", key_columns, true);
+    serial.create();
+
+    Handles *all = index.range(nullptr, nullptr);
+    Handles *serial_all = serial.range(nullptr, nullptr);
+    bool ok = all->size() == n && *all == *serial_all;
+    for (int k = 0; ok && k < n; k += 97) {
+        ValueDict *row = table.project((*all)[k]);
+        ok = row->at("a").n == k;
+        delete row;
+    }
+    delete all;
+    delete serial_all;
+    if (!ok)
+        std::cout << "bulk load range failed" << std::endl;
+
+    for (int k = 0; ok && k < n; k += 101) {
+        ValueDict key;
+        key["a"] = Value(k);
+        ValueDicts *rows = index.lookup_values(&key, &include_columns);
+        ok = rows->size() == 1 && (int) (((long) rows->at(0)->at("b").n * 7919) % n) == k;
+        for (auto row: *rows)
+            delete row;
+        delete rows;
+    }
+    ValueDict missing;
+    missing["a"] = Value(n + 5);
+    Handles *found = index.lookup(&missing);
+    ok = ok && found->empty();
+    delete found;
+    if (!ok)
+        std::cout << "bulk load lookup failed" << std::endl;
+
+    // the counts kept during the load agree with a walk of the tree
+    IndexStats *loaded = index.get_stats();
+    index.analyze();
+    IndexStats *counted = index.get_stats();
+    ok = ok && loaded->entries == n && counted->entries == n && loaded->leaf_blocks == counted->leaf_blocks
+         && loaded->interior_blocks == counted->interior_blocks && loaded->height > 1
+         && loaded->min_key == counted->min_key && loaded->max_key == counted->max_key;
+    delete loaded;
+    delete counted;
+    if (!ok)
+        std::cout << "bulk load stats failed" << std::endl;
+
+    // the leaves are full, so these all split one
+    for (int i = 0; ok && i < 200; i++) {
+        ValueDict row;
+        row["a"] = Value(n + i * 97 % 200);
+        row["b"] = Value(-i);
+        index.insert(table.insert(&row));
+    }
+    all = index.range(nullptr, nullptr);
+    ok = ok && all->size() == n + 200;
+    delete all;
+    if (!ok)
+        std::cout << "insert after bulk load failed" << std::endl;
+
+    // ingest with an index kept up, a row at a time and then in a batch
+    const int batch = 2000;
+    double rows_per_sec[2];
+    for (int batched = 0; batched < 2; batched++) {
+        ValueDicts rows;
+        for (int i = 0; i < batch; i++) {
+            rows.push_back(new ValueDict());
+            (*rows.back())["a"] = Value(n + 200 + batched * batch + i * 7 % batch);
+            (*rows.back())["b"] = Value(i);
+        }
+        auto start = std::chrono::steady_clock::now();
+        if (batched) {
+            Handles *handles = table.insert_many(&rows);
+            index.insert_many(handles);
+            delete handles;
+        } else {
+            for (auto row: rows)
+                index.insert(table.insert(row));
+        }
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        rows_per_sec[batched] = batch / secs;
+        for (auto row: rows)
+            delete row;
+    }
+    all = index.range(nullptr, nullptr);
+    ok = ok && all->size() == n + 200 + 2 * batch;
+    delete all;
+    for (int k = n + 200; ok && k < n + 200 + 2 * batch; k += 13) {
+        ValueDict key;
+        key["a"] = Value(k);
+        ValueDicts *rows = index.lookup_values(&key, &include_columns);
+        ok = rows->size() == 1 && (rows->at(0)->at("b").n * 7) % batch == (k - n - 200) % batch;
+        for (auto row: *rows)
+            delete row;
+        delete rows;
+    }
+    if (!ok)
+        std::cout << "batch insert failed" << std::endl;
+    std::cout << "rows/sec inserted with an index: one at a time " << (long) rows_per_sec[0] << ", in a batch "
+              << (long) rows_per_sec[1] << std::endl;
+
+    // and delete them again, a row at a time and then in a batch
+    for (int batched = 0; batched < 2; batched++) {
+        ValueDict min_key, max_key;
+        min_key["a"] = Value(n + 200 + batched * batch);
+        max_key["a"] = Value(n + 200 + batched * batch + batch - 1);
+        Handles *handles = index.range(&min_key, &max_key);
+        ok = ok && handles->size() == batch;
+        auto start = std::chrono::steady_clock::now();
+        if (batched) {
+            index.del_many(handles);
+            table.del_many(handles);
+        } else {
+            for (auto const &handle: *handles) {
+                index.del(handle);
+                table.del(handle);
+            }
+        }
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        rows_per_sec[batched] = batch / secs;
+        delete handles;
+    }
+    all = index.range(nullptr, nullptr);
+    Handles *rows_left = table.select();
+    IndexStats *stats = index.get_stats();
+    ok = ok && all->size() == n + 200 && rows_left->size() == n + 200 && stats->entries == n + 200;
+    delete all;
+    delete rows_left;
+    delete stats;
+    missing["a"] = Value(n + 200 + batch + 7);
+    found = index.lookup(&missing);
+    ok = ok && found->empty();
+    delete found;
+    if (!ok)
+        std::cout << "batch delete failed" << std::endl;
+    std::cout << "rows/sec deleted with an index: one at a time " << (long) rows_per_sec[0] << ", in a batch "
+              << (long) rows_per_sec[1] << std::endl;
+    serial.drop();
+
+    // a duplicate key drops the half-built index
+    ValueDict duplicate;
+    duplicate["a"] = Value(5);
+    duplicate["b"] = Value(0);
+    table.insert(&duplicate);
+    BTreeIndex::build_workers = 4;
+    BTreeIndex failed(table, "failedindex", key_columns, true);
+    try {
+        failed.create();
+        ok = false;
+        std::cout << "bulk load allowed a duplicate key" << std::endl;
+    } catch (DbRelationError &e) {
+    }
+
+    // build time from one worker up to one per core
+    std::cout << "index build ms:";
+    uint cores = std::max(1U, std::thread::hardware_concurrency());
+    BTreeIndex timed(table, "timedindex", column_names, true);
+    for (uint w = 1; w <= cores; w = w < cores ? std::min(2 * w, cores) : cores + 1) {
+        BTreeIndex::build_workers = w;
+        auto start = std::chrono::steady_clock::now();
+        timed.create();
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        std::cout << " " << w << (w == 1 ? " worker " : " workers ") << (long) ms;
+        timed.drop();
+    }
+    std::cout << std::endl;
+    BTreeIndex::build_workers = saved_workers;
+
+    index.drop();
+    table.drop();
+    return ok;
+}
+
 
     /**********************
        BTree Table Test
@@ -676,6 +2132,39 @@ bool test_btable(){
         Handle bHandle(keyValue);
         bTable.del(bHandle);
     }
+    Handles batchHandles;
+    for(int i = 49; i >= 25; --i){
+        KeyValue keyValue;
+        keyValue.push_back(Value(i));
+        batchHandles.push_back(Handle(keyValue));
+    }
+    bTable.del_many(&batchHandles);
+    if(bTable.count() != 50) {
+        return false;
+    }
+    KeyValue updateKey;
+    updateKey.push_back(Value(60));
+    ValueDict newValues;
+    newValues["a"] = Value(99);
+    Handle updated = bTable.update(Handle(updateKey), &newValues);  // in place
+    if(!(updated == Handle(updateKey)) || !test_helper(bTable, updated, 99, (*expected[60])["b"].s)) {
+        return false;
+    }
+    newValues["id"] = Value(200);
+    updated = bTable.update(Handle(updateKey), &newValues);  // under a new key
+    if(updated.key_value != KeyValue(1, Value(200)) || !test_helper(bTable, updated, 99, (*expected[60])["b"].s)
+       || bTable.count() != 50) {
+        return false;
+    }
+    newValues["id"] = Value(70);
+    try {
+        bTable.update(updated, &newValues);  // a key it has already
+        return false;
+    } catch (DbRelationError &e) {
+    }
+    if(!test_helper(bTable, updated, 99, (*expected[60])["b"].s) || bTable.count() != 50) {
+        return false;
+    }
     bTable.drop();
     return true;
 }
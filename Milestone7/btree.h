@@ -1,7 +1,18 @@
 #pragma once
 
+#include <atomic>
 #include "BTreeNode.h"
+#include "ColumnBatch.h"
 
+// A key and its leaf value, for loading a tree in bulk
+typedef std::pair<KeyValue,BTreeLeafValue> IndexEntry;
+typedef std::vector<IndexEntry> IndexEntries;
+
+// Lookups, range scans, inserts and deletes can all run at once from different threads (create, drop, open,
+// close, analyze and rebuild_bloom can't). Each block has a latch (see BTreeLatch) and we crab down the
+// tree with them: a node's latch is only let go once its child's is held. Readers latch shared. Writers
+// first try latching just the leaf exclusively; if the leaf has to split, they start over holding the whole
+// path (and the stat block, in case the root splits) exclusively.
 class BTreeBase : public DbIndex {
 public:
     BTreeBase(DbRelation& relation, Identifier name, ColumnNames key_columns, bool unique);
@@ -14,11 +25,24 @@ public:
     virtual void close();
 
     virtual Handles* lookup(ValueDict* key);
+    virtual HandlesByKey* lookup_many(ValueDicts* keys);
 
     virtual void insert(Handle handle);
     virtual void del(Handle handle);
 
     virtual KeyValue *tkey(const ValueDict *key) const; // pull out the key values from the ValueDict in order
+    virtual KeyValue *tkey_prefix(const ValueDict *key) const; // just the leading key values it has
+
+    // Bloom filter to skip the tree descent for keys that aren't there. Sized at create() with the given
+    // bits per key (0 for no filter) and rebuilt by rebuild_bloom().
+    void set_bloom_bits_per_key(uint bits_per_key) { this->bloom_bits_per_key = bits_per_key; }
+    virtual void rebuild_bloom();
+    bool has_bloom() const { return this->bloom != nullptr; }
+    double bloom_expected_false_positive_rate() const;
+    double bloom_observed_false_positive_rate() const;  // of the lookups so far for keys that weren't there
+
+    virtual IndexStats* get_stats();
+    virtual void analyze();  // recount the statistics by walking the whole tree
 
     friend std::ostream &operator<<(std::ostream &stream, BTreeBase &btree);
 
@@ -26,16 +50,36 @@ protected:
     static const BlockID STAT = 1;
     bool closed;
     BTreeStat *stat;
-    BTreeNode *root;
     HeapFile file;
     KeyProfile key_profile;
+    BTreeBloom *bloom;
+    uint bloom_bits_per_key;
+    std::atomic<u_long> bloom_negatives;  // lookups the filter answered by itself
+    std::atomic<u_long> bloom_false_positives;  // lookups the filter let through that then weren't found
+    BTreeLatches latches;  // the STAT block's latch guards which block is the root and the height
+    std::mutex stat_mutex;  // for the counts in stat
+    BTreeLatch bloom_latch;
 
     virtual void build_key_profile();
-    virtual BTreeLeafBase *_lookup(BTreeNode *node, uint height, const KeyValue* key);
-    virtual Insertion _insert(BTreeNode *node, uint height, const KeyValue* key, BTreeLeafValue handle);
-    virtual void split_root(Insertion insertion);
-    virtual BTreeNode *find(BTreeInterior *node, uint height, const KeyValue* key);
-    Handles* _range(KeyValue *tmin, KeyValue *tmax, bool return_keys);
+    virtual void load();  // fill the new tree from the relation (for create)
+    virtual void bulk_load(IndexEntries &entries);
+    virtual void create_bloom(u_long n_keys);
+    virtual bool may_contain(const KeyValue *key);
+    virtual void insert_entry(const KeyValue *key, BTreeLeafValue value);
+    virtual void insert_entries(IndexEntries &entries);
+    virtual void del_keys(const std::vector<KeyValue> &keys);
+    virtual void _analyze(BTreeNode *node, uint depth, uint &entries, uint &leaves, uint &interiors,
+                          KeyValue &min_key, KeyValue &max_key);
+    virtual BTreeNode *read_node(BlockID block_id, uint depth);
+    virtual void latch(BlockID block_id, bool exclusive);
+    virtual void unlatch(BlockID block_id, bool exclusive);
+    virtual BTreeNode *latch_root(bool exclusive, uint &height);
+    virtual void release(BTreeNode *node, bool exclusive);
+    virtual BTreeLeafBase *_lookup(const KeyValue* key, bool for_update);
+    virtual void _insert(const KeyValue* key, BTreeLeafValue value);
+    virtual void split_root(BlockID old_root, Insertion insertion);
+    Handles* _range(KeyValue *tmin, KeyValue *tmax, bool return_keys, u_long limit=0);
+    HandlesByKey* _lookup_many(const KeyValues &keys, bool return_keys);
     virtual BTreeLeafBase *make_leaf(BlockID id, bool create) = 0;
     virtual std::ostream &_dump(std::ostream &out, BlockID block_id, uint height);
 };
@@ -43,13 +87,30 @@ protected:
 
 class BTreeIndex : public BTreeBase {
 public:
-    BTreeIndex(DbRelation& relation, Identifier name, ColumnNames key_columns, bool unique);
+    BTreeIndex(DbRelation& relation, Identifier name, ColumnNames key_columns, bool unique,
+               ColumnNames include_columns=ColumnNames());
     virtual ~BTreeIndex();
 
-    virtual Handles* range(ValueDict* min_key, ValueDict* max_key);
+    static uint build_workers;  // threads reading the relation for create; by default one per core
+
+    virtual void insert(Handle handle);
+    virtual void insert_many(Handles* handles);
+    virtual void del_many(Handles* handles);
+    virtual bool ordered() const { return true; }
+    virtual Handles* range(ValueDict* min_key, ValueDict* max_key, u_long limit=0);
+
+    virtual bool covers(const ColumnNames &column_names) const;
+    virtual ValueDicts* lookup_values(ValueDict* key_values, const ColumnNames* column_names);
 
 protected:
+    ColumnNames include_columns;  // non-key columns carried along in the leaves (CREATE INDEX ... INCLUDE)
+    ColumnAttributes include_column_attributes;
+
     virtual BTreeLeafBase *make_leaf(BlockID id, bool create);
+    virtual void load();
+    virtual void extract(BlockID block_id, BlockID end, ColumnBatch &columns, IndexEntries &entries);
+    virtual IndexEntry index_entry(const ValueDict *row, Handle handle);
+    virtual ValueDict *index_row(const KeyValue *key, const BTreeLeafValue &value, const ColumnNames *column_names);
     virtual std::ostream &_dump(std::ostream &out, BlockID block_id, uint height);
 };
 
@@ -64,9 +125,14 @@ public:
               bool unique);
     virtual ~BTreeFile();
 
+    virtual HandlesByKey* lookup_many(ValueDicts* keys);
     virtual Handles* range(KeyValue *tmin, KeyValue *tmax);
     virtual ValueDict *lookup_value(KeyValue *key);
     virtual void insert_value(ValueDict *row);
+    virtual bool update_value(const ValueDict *row);
+    virtual void del_values(const Handles* handles);
+    virtual bool is_empty();
+    virtual void load_values(const ValueDicts &rows);
 
 protected:
     ColumnNames non_key_column_names;
@@ -90,17 +156,22 @@ public:
     virtual void close();
 
     virtual Handle insert(const ValueDict* row);
+    virtual Handles* insert_many(const ValueDicts* rows);
     virtual Handle update(const Handle handle, const ValueDict* new_values);
     virtual void del(const Handle handle);
+    virtual void del_many(const Handles* handles);
 
     virtual Handles* select();
     virtual Handles* select(const ValueDict* where);
     virtual Handles* select(Handles *current_selection, const ValueDict* where);
+    virtual u_long count();
 
     virtual ValueDict* project(Handle handle);
     virtual ValueDict* project(Handle handle, const ColumnNames* column_names);
     using DbRelation::project;
 
+    virtual const ColumnNames *ordered_by() const { return get_primary_key(); }  // rows come from the tree
+
 protected:
     BTreeFile *index;
 
@@ -110,4 +181,10 @@ protected:
 };
 
 bool test_btree();
+bool test_btree_covering();
+bool test_btree_lookup_many();
+bool test_btree_bloom();
+bool test_btree_stats();
+bool test_btree_concurrency();
+bool test_btree_bulk_load();
 bool test_btable();
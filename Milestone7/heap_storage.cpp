@@ -1,7 +1,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <memory.h>
+#include <algorithm>
+#include <functional>
+#include <map>
 #include "heap_storage.h"
+#include "ColumnBatch.h"
 
 typedef uint16_t u16;
 
@@ -15,6 +19,12 @@ SlottedPage::SlottedPage(Dbt &block, BlockID block_id, bool is_new) : DbBlock(bl
 	}
 }
 
+// Blocks read from a HeapFile have Berkeley DB malloc their bytes for us, so we are the ones to free them.
+SlottedPage::~SlottedPage() {
+	if (this->block.get_flags() & DB_DBT_MALLOC)
+		free(this->block.get_data());
+}
+
 // Add a new record to the block. Return its id.
 RecordID SlottedPage::add(const Dbt* data) throw(DbBlockNoRoomError) {
 	if (!has_room((u16)data->get_size()))
@@ -66,6 +76,32 @@ void SlottedPage::del(RecordID record_id) {
     slide(loc, loc+size);
 }
 
+// Delete a number of records at once: tombstone them all, then close up the space they leave in a single pass (rather
+// than a slide for each one), packing what's left against the end of the block in the order it was.
+void SlottedPage::del_many(const RecordIDs &record_ids) {
+	for (auto const& record_id: record_ids)
+		put_header(record_id, 0, 0);
+	std::vector<std::pair<u16, RecordID>> live;  // (loc, id) of each record left
+	u16 size, loc;
+	for (RecordID record_id = 1; record_id <= this->num_records; record_id++) {
+		get_header(size, loc, record_id);
+		if (loc != 0)
+			live.push_back(std::make_pair(loc, record_id));
+	}
+	std::sort(live.begin(), live.end(), std::greater<std::pair<u16, RecordID>>());
+	u16 end = DB_BLOCK_SZ - 1;  // the last byte not yet taken
+	for (auto const& record: live) {
+		get_header(size, loc, record.second);
+		u16 new_loc = (u16) (end - size + 1);
+		if (new_loc != loc)
+			memmove(this->address(new_loc), this->address(loc), size);
+		put_header(record.second, size, new_loc);
+		end = (u16) (new_loc - 1);
+	}
+	this->end_free = end;
+	put_header();
+}
+
 // Sequence of all non-deleted record IDs.
 RecordIDs* SlottedPage::ids(void) const {
 	RecordIDs* vec = new RecordIDs();
@@ -117,8 +153,13 @@ void SlottedPage::put_header(RecordID id, u16 size, u16 loc) {
 // Calculate if we have room to store a record with given size. The size should include the 4 bytes
 // for the header, too, if this is an add.
 bool SlottedPage::has_room(u16 size) const {
-	u16 available = this->end_free - (u16)(4 * (this->num_records+2));
-	return size <= available;
+	int available = (int)this->end_free - 4 * (this->num_records+2);  // can dip below zero once the block is full
+	return available >= 0 && size <= available;
+}
+
+// An empty block has all but its first header (and the one the record would need) free, as has_room sees it.
+bool SlottedPage::fits_alone(u_int32_t size) {
+	return size <= DB_BLOCK_SZ - 1 - 4 * 2;
 }
 
 // If start < end, then remove data from offset start up to but not including offset end by sliding data
@@ -211,22 +252,41 @@ SlottedPage* HeapFile::get_new(void) {
 	memset(block, 0, sizeof(block));
 	Dbt data(block, sizeof(block));
 
-	int block_id = ++this->last;
+	int block_id;
+	{
+		std::lock_guard<std::mutex> guard(this->last_mutex);
+		block_id = ++this->last;
+	}
 	Dbt key(&block_id, sizeof(block_id));
 
 	// write out an empty block and read it back in so Berkeley DB is managing the memory
-	SlottedPage* page = new SlottedPage(data, this->last, true);
+	SlottedPage* page = new SlottedPage(data, block_id, true);
 	this->db.put(nullptr, &key, &data, 0); // write it out with initialization done to it
+	WorkCounters::count(WorkCounters::blocks_written);
     delete page;
-    this->db.get(nullptr, &key, &data, 0);
-    return new SlottedPage(data, this->last);
+    return get(block_id);
+}
+
+// Write a block (say, one filled for loading in bulk) to the end of the database file. Returns its block id.
+BlockID HeapFile::append(DbBlock* block) {
+	int block_id;
+	{
+		std::lock_guard<std::mutex> guard(this->last_mutex);
+		block_id = ++this->last;
+	}
+	Dbt key(&block_id, sizeof(block_id));
+	this->db.put(nullptr, &key, block->get_block(), 0);
+	WorkCounters::count(WorkCounters::blocks_written);
+	return block_id;
 }
 
 // Get a block from the database file.
 SlottedPage* HeapFile::get(BlockID block_id) {
 	Dbt key(&block_id, sizeof(block_id));
 	Dbt data;
+	data.set_flags(DB_DBT_MALLOC);  // our own copy, not Berkeley DB's buffer that the next get overwrites
 	this->db.get(nullptr, &key, &data, 0);
+	WorkCounters::count(WorkCounters::blocks_read);
 	return new SlottedPage(data, block_id, false);
 }
 
@@ -235,6 +295,7 @@ void HeapFile::put(DbBlock* block) {
 	int block_id = block->get_block_id();
 	Dbt key(&block_id, sizeof(block_id));
 	this->db.put(nullptr, &key, block->get_block(), 0);
+	WorkCounters::count(WorkCounters::blocks_written);
 }
 
 // Sequence of all block ids.
@@ -248,7 +309,9 @@ BlockIDs* HeapFile::block_ids() const {
 uint32_t HeapFile::get_block_count() {
     DB_BTREE_STAT* stat;
     this->db.stat(nullptr, &stat, DB_FAST_STAT);
-    return stat->bt_ndata;
+    uint32_t count = stat->bt_ndata;
+    free(stat);
+    return count;
 }
 
 // Wrapper for Berkeley DB open, which does both open and creation.
@@ -256,7 +319,7 @@ void HeapFile::db_open(uint flags) {
     if (!this->closed)
         return;
     this->db.set_re_len(DB_BLOCK_SZ); // record length - will be ignored if file already exists
-    this->db.open(nullptr, this->dbfilename.c_str(), nullptr, DB_RECNO, flags, 0644);
+    this->db.open(nullptr, this->dbfilename.c_str(), nullptr, DB_RECNO, flags | DB_THREAD, 0644);
     this->last = flags ? 0 : get_block_count();
     this->closed = false;
 }
@@ -314,12 +377,208 @@ Handle HeapTable::insert(const ValueDict* row) {
     return handle;
 }
 
+// Insert a batch of rows, packing them into the last block and as many new ones as they need, each block written
+// once. Every row is checked and marshaled before anything is written, so a bad one leaves the table as it was.
+Handles* HeapTable::insert_many(const ValueDicts* rows) {
+	open();
+	std::vector<Dbt*> records;
+	auto free_records = [&records]() {
+		for (auto data: records) {
+			delete[] (char*)data->get_data();
+			delete data;
+		}
+	};
+	try {
+		for (auto const& row: *rows) {
+			ValueDict* full_row = validate(row);
+			try {
+				records.push_back(marshal(full_row));
+			} catch (...) {
+				delete full_row;
+				throw;
+			}
+			delete full_row;
+			if (!SlottedPage::fits_alone(records.back()->get_size()))
+				throw DbRelationError("row too big to fit in a block");
+		}
+	} catch (...) {
+		free_records();
+		throw;
+	}
+
+	Handles* handles = new Handles();
+	SlottedPage* block = nullptr;
+	try {
+		for (auto data: records) {
+			if (block == nullptr)
+				block = this->file.get(this->file.get_last_block_id());
+			RecordID record_id;
+			try {
+				record_id = block->add(data);
+			} catch (DbBlockNoRoomError& e) {
+				// this block is full, so write it out and go on in a new one
+				this->file.put(block);
+				delete block;
+				block = nullptr;
+				block = this->file.get_new();
+				record_id = block->add(data);
+			}
+			handles->push_back(Handle(block->get_block_id(), record_id));
+		}
+		if (block != nullptr)
+			this->file.put(block);
+	} catch (...) {
+		delete block;
+		delete handles;
+		free_records();
+		throw;
+	}
+	delete block;
+	free_records();
+	return handles;
+}
+
+// A new block holding as many of rows as fit, from rows[next] on, each checked and marshaled as insert would do it;
+// next is moved past them. Only reads the table's definition, so any number of threads can pack blocks at once.
+DbBlock* HeapTable::pack_block(const ValueDicts &rows, size_t &next) const {
+	Dbt data(malloc(DB_BLOCK_SZ), DB_BLOCK_SZ);
+	memset(data.get_data(), 0, DB_BLOCK_SZ);
+	data.set_flags(DB_DBT_MALLOC);  // so the page frees it
+	SlottedPage* block = new SlottedPage(data, 0, true);
+	try {
+		for (size_t first = next; next < rows.size(); next++) {
+			ValueDict* full_row = validate(rows[next]);
+			Dbt* record;
+			try {
+				record = marshal(full_row);
+			} catch (...) {
+				delete full_row;
+				throw;
+			}
+			delete full_row;
+			bool full = false;
+			try {
+				block->add(record);
+			} catch (DbBlockNoRoomError& e) {
+				full = true;
+			}
+			delete[] (char*)record->get_data();
+			delete record;
+			if (full && next == first)
+				throw DbRelationError("row too big to fit in a block");
+			if (full)
+				break;
+		}
+	} catch (...) {
+		delete block;
+		throw;
+	}
+	return block;
+}
+
+// Append a block from pack_block to the file. Returns the handles of its rows.
+Handles* HeapTable::append_block(DbBlock *block) {
+	open();
+	BlockID block_id = this->file.append(block);
+	RecordIDs* record_ids = block->ids();
+	Handles* handles = new Handles();
+	for (auto const& record_id: *record_ids)
+		handles->push_back(Handle(block_id, record_id));
+	delete record_ids;
+	return handles;
+}
+
 // Expect new_values to be a dictionary with column name keys.
 // Conceptually, execute: UPDATE INTO <table_name> SET <new_values> WHERE <handle>
 // where handle is sufficient to identify one specific record (e.g., returned from an insert
 // or select).
+// The row is changed in place if it still fits in its block; else it moves, and the handle returned is its new one.
 Handle HeapTable::update(const Handle handle, const ValueDict* new_values) {
-	throw DbRelationError("Not implemented");
+	Handles handles(1, handle);
+	Handles* updated = update_many(&handles, new_values);
+	Handle ret = updated->front();
+	delete updated;
+	return ret;
+}
+
+// Give a batch of rows the same new_values, each block read and written once however many of them it holds. A row
+// is changed in place if it still fits in its block; any that have grown too big for theirs go in as a batch at the
+// end of the table, and only then come out of their old blocks, so a failure on the way can't lose them. Returns the
+// handles in the same order, with the moved rows' new ones.
+Handles* HeapTable::update_many(const Handles* handles, const ValueDict* new_values) {
+	open();
+	for (auto const& column: *new_values)
+		if (std::find(this->column_names.begin(), this->column_names.end(), column.first) == this->column_names.end())
+			throw DbRelationError("unknown column " + column.first);
+	std::map<BlockID, std::vector<size_t>> by_block;  // where in handles each block's rows are
+	for (size_t i = 0; i < handles->size(); i++)
+		by_block[(*handles)[i].block_id].push_back(i);
+
+	Handles* updated = new Handles(*handles);
+	std::vector<size_t> moving;  // where in handles the rows to move are
+	ValueDicts moving_rows;
+	try {
+		for (auto const& block_rows: by_block) {
+			SlottedPage* block = this->file.get(block_rows.first);
+			try {
+				for (auto i: block_rows.second) {
+					RecordID record_id = (*handles)[i].record_id;
+					Dbt* data = block->get(record_id);
+					if (data == nullptr)
+						throw DbRelationError("row to update not found");
+					ValueDict* row = unmarshal(data);
+					delete data;
+					for (auto const& column: *new_values)
+						(*row)[column.first] = column.second;
+					Dbt* record;
+					try {
+						record = marshal(row);
+					} catch (...) {
+						delete row;
+						throw;
+					}
+					try {
+						block->put(record_id, *record);
+						delete row;
+					} catch (DbBlockNoRoomError& e) {
+						if (!SlottedPage::fits_alone(record->get_size())) {
+							delete row;
+							delete[] (char*)record->get_data();
+							delete record;
+							throw DbRelationError("row too big to fit in a block");
+						}
+						moving.push_back(i);
+						moving_rows.push_back(row);
+					}
+					delete[] (char*)record->get_data();
+					delete record;
+				}
+				this->file.put(block);
+			} catch (...) {
+				delete block;
+				throw;
+			}
+			delete block;
+		}
+		if (!moving_rows.empty()) {
+			Handles* moved = insert_many(&moving_rows);
+			Handles old;
+			for (size_t j = 0; j < moving.size(); j++) {
+				old.push_back((*handles)[moving[j]]);
+				(*updated)[moving[j]] = (*moved)[j];
+			}
+			delete moved;
+			del_many(&old);
+		}
+	} catch (...) {
+		for (auto row: moving_rows)
+			delete row;
+		delete updated;
+		throw;
+	}
+	for (auto row: moving_rows)
+		delete row;
+	return updated;
 }
 
 // Conceptually, execute: DELETE FROM <table_name> WHERE <handle>
@@ -335,6 +594,25 @@ void HeapTable::del(const Handle handle) {
     delete block;
 }
 
+// Delete a batch of rows, each block read and written once however many of them it holds.
+void HeapTable::del_many(const Handles* handles) {
+	open();
+	std::map<BlockID, RecordIDs> by_block;
+	for (auto const& handle: *handles)
+		by_block[handle.block_id].push_back(handle.record_id);
+	for (auto const& block_records: by_block) {
+		SlottedPage* block = this->file.get(block_records.first);
+		try {
+			block->del_many(block_records.second);
+			this->file.put(block);
+		} catch (...) {
+			delete block;
+			throw;
+		}
+		delete block;
+	}
+}
+
 // Conceptually, execute: SELECT <handle> FROM <table_name> WHERE 1
 // Returns a list of handles for qualifying rows.
 Handles* HeapTable::select() {
@@ -362,6 +640,87 @@ Handles* HeapTable::select(const ValueDict* where) {
 	return handles;
 }
 
+// One block's worth of select(where), for scanning without holding every handle at once.
+Handles* HeapTable::select_block(BlockID &block_id, const ValueDict* where) {
+    open();
+    if (block_id == 0)
+        block_id = 1;
+    if (block_id > file.get_last_block_id())
+        return nullptr;
+    Handles* handles = new Handles();
+    SlottedPage* block = file.get(block_id);
+    RecordIDs* record_ids = block->ids();
+    for (auto const& record_id: *record_ids) {
+        Handle handle(block_id, record_id);
+        if (selected(handle, where))
+            handles->push_back(handle);
+    }
+    delete record_ids;
+    delete block;
+    block_id++;
+    return handles;
+}
+
+// Add up each page's live records from its slot headers, without unmarshaling any rows.
+u_long HeapTable::count() {
+    open();
+    u_long n = 0;
+    BlockIDs* block_ids = file.block_ids();
+    for (auto const& block_id: *block_ids) {
+        SlottedPage* block = file.get(block_id);
+        n += block->size();
+        delete block;
+    }
+    delete block_ids;
+    return n;
+}
+
+uint HeapTable::get_block_count() {
+    open();
+    return file.get_last_block_id();
+}
+
+// Decode one block's records straight into column arrays, without a ValueDict per row (see unmarshal).
+bool HeapTable::decode_block(BlockID &block_id, ColumnBatch &batch) {
+    open();
+    if (block_id == 0)
+        block_id = 1;
+    if (block_id > file.get_last_block_id())
+        return false;
+    batch.clear();
+    SlottedPage* block = file.get(block_id);
+    RecordIDs* record_ids = block->ids();
+    for (auto const& record_id: *record_ids) {
+        Dbt* data = block->get(record_id);
+        char *bytes = (char*)data->get_data();
+        uint offset = 0;
+        batch.add_handle(Handle(block_id, record_id));
+        for (uint col_num = 0; col_num < this->column_attributes.size(); col_num++) {
+            ColumnAttribute ca = this->column_attributes[col_num];
+            bool missing = offset >= data->get_size();  // a column added since the row was written, as in unmarshal
+            if (ca.get_data_type() == ColumnAttribute::DataType::INT) {
+                batch.add_int(col_num, missing ? 0 : *(int32_t*)(bytes + offset));
+                offset += sizeof(int32_t);
+            } else if (ca.get_data_type() == ColumnAttribute::DataType::TEXT) {
+                u16 size = missing ? 0 : *(u16*)(bytes + offset);
+                offset += sizeof(u16);
+                batch.add_text(col_num, bytes + offset, size);
+                offset += size;
+            } else if (ca.get_data_type() == ColumnAttribute::DataType::BOOLEAN) {
+                batch.add_boolean(col_num, missing ? 0 : *(uint8_t*)(bytes + offset));
+                offset += sizeof(uint8_t);
+            } else {
+                throw DbRelationError("Only know how to unmarshal INT, TEXT, or BOOLEAN");
+            }
+        }
+        delete data;
+    }
+    delete record_ids;
+    delete block;
+    block_id++;
+    return true;
+}
+
 // Refine another selection
 Handles* HeapTable::select(Handles *current_selection, const ValueDict* where) {
     Handles* handles = new Handles();
@@ -382,18 +741,62 @@ ValueDict* HeapTable::project(Handle handle, const ColumnNames* column_names) {
 	RecordID record_id = handle.record_id;
     SlottedPage* block = file.get(block_id);
     Dbt* data = block->get(record_id);
-    ValueDict* row = unmarshal(data);
+    ValueDict* row;
+    try {
+        row = unmarshal(data, column_names);
+    } catch (DbRelationError& e) {
+        delete data;
+        delete block;
+        throw;
+    }
     delete data;
     delete block;
-    if (column_names->empty())
-    	return row;
-    ValueDict* result = new ValueDict();
-    for (auto const& column_name: *column_names) {
-        if (row->find(column_name) == row->end())
-            throw DbRelationError("table does not have column named '" + column_name + "'");
-        (*result)[column_name] = (*row)[column_name];
+    return row;
+}
+
+// Return all values for each of the handles, in the handles' order.
+ValueDicts* HeapTable::project(Handles *handles) {
+    return project(handles, &this->column_names);
+}
+
+// Return the values given by column_names for each of the handles, in the handles' order. Each block is read just
+// once: the handles are visited in (block, record) order, so the ones on the same block come together even if (like
+// an index's) they come in some other order.
+ValueDicts* HeapTable::project(Handles *handles, const ColumnNames* column_names) {
+    std::vector<size_t> order(handles->size());
+    for (size_t i = 0; i < order.size(); i++)
+        order[i] = i;
+    std::sort(order.begin(), order.end(), [handles](size_t a, size_t b) { return (*handles)[a] < (*handles)[b]; });
+
+    ValueDicts* rows = new ValueDicts(handles->size(), nullptr);
+    WorkCounters::allocated();
+    SlottedPage* block = nullptr;
+    try {
+        for (auto i: order) {
+            const Handle &handle = (*handles)[i];
+            if (block == nullptr || block->get_block_id() != handle.block_id) {
+                delete block;
+                block = nullptr;
+                block = file.get(handle.block_id);
+            }
+            Dbt* data = block->get(handle.record_id);
+            try {
+                (*rows)[i] = unmarshal(data, column_names);
+            } catch (DbRelationError& e) {
+                delete data;
+                throw;
+            }
+            delete data;
+        }
+    } catch (DbRelationError& e) {
+        delete block;
+        for (auto row: *rows)
+            delete row;
+        delete rows;
+        throw;
     }
-    return result;
+    delete block;
+    return rows;
 }
 
 // Check if the given row is acceptable to insert. Raise ValueError if not.
@@ -421,13 +824,16 @@ Handle HeapTable::append(const ValueDict* row) {
         record_id = block->add(data);
     } catch (DbBlockNoRoomError& e) {
     	// need a new block
+    	delete block;
     	block = this->file.get_new();
     	record_id = block->add(data);
     }
     this->file.put(block);
+    BlockID block_id = block->get_block_id();
+    delete block;
     delete[] (char*)data->get_data();
     delete data;
-    return Handle(this->file.get_last_block_id(), record_id);
+    return Handle(block_id, record_id);
 }
 
 // return the bits to go into the file
@@ -480,6 +886,7 @@ Dbt* HeapTable::marshal(const ValueDict* row) const {
 
 ValueDict* HeapTable::unmarshal(Dbt* data) const {
     ValueDict *row = new ValueDict();
+    WorkCounters::allocated();
     Value value;
     char *bytes = (char*)data->get_data();
     uint offset = 0;
@@ -487,7 +894,12 @@ ValueDict* HeapTable::unmarshal(Dbt* data) const {
     for (auto const& column_name: this->column_names) {
     	ColumnAttribute ca = this->column_attributes[col_num++];
         value.data_type = ca.get_data_type();
-    	if (ca.get_data_type() == ColumnAttribute::DataType::INT) {
+        if (offset >= data->get_size()) {
+            // a row written before this column was added on the end (as is_included was to _indices) doesn't have
+            // it, so it's 0, false or empty
+            value.n = 0;
+            value.s.clear();
+        } else if (ca.get_data_type() == ColumnAttribute::DataType::INT) {
     		value.n = *(int32_t*)(bytes + offset);
     		offset += sizeof(int32_t);
     	} else if (ca.get_data_type() == ColumnAttribute::DataType::TEXT) {
@@ -509,12 +921,34 @@ ValueDict* HeapTable::unmarshal(Dbt* data) const {
     return row;
 }
 
+// Just the values given by column_names (all of them if it's empty).
+ValueDict* HeapTable::unmarshal(Dbt* data, const ColumnNames* column_names) const {
+    ValueDict* row = unmarshal(data);
+    if (column_names->empty())
+        return row;
+    ValueDict* result = new ValueDict();
+    WorkCounters::allocated();
+    for (auto const& column_name: *column_names) {
+        auto found = row->find(column_name);
+        if (found == row->end()) {
+            delete row;
+            delete result;
+            throw DbRelationError("table does not have column named '" + column_name + "'");
+        }
+        (*result)[column_name] = found->second;
+    }
+    delete row;
+    return result;
+}
+
 // See if the row at the given handle satisfies the given where clause
 bool HeapTable::selected(Handle handle, const ValueDict* where) {
-    if (where == nullptr)
+    if (where == nullptr || where->empty())
         return true;
     ValueDict* row = this->project(handle, where);
-    return *row == *where;
+    bool ret = *row == *where;
+    delete row;
+    return ret;
 }
 
 
@@ -586,6 +1020,20 @@ bool test_heap_storage() {
             return false;
     std::cout << "many inserts/select/projects ok" << std::endl;
 
+    // projecting the lot at once, in reverse, reads each block once and keeps the handles' order
+    std::reverse(handles->begin(), handles->end());
+    ColumnNames just_a(1, "a");
+    ValueDicts* rows = table.project(handles, &just_a);
+    bool ok = rows->size() == handles->size();
+    for (size_t j = 0; ok && j < rows->size(); j++)
+        ok = (*rows)[j]->size() == 1 && (*rows)[j]->at("a").n == 999 - (int) j;
+    for (auto r: *rows)
+        delete r;
+    delete rows;
+    if (!ok)
+        return false;
+    std::cout << "batched project ok" << std::endl;
+
     table.del(last_handle);
     handles = table.select();
     if (handles->size() != 1000)
@@ -596,6 +1044,108 @@ bool test_heap_storage() {
             return false;
     std::cout << "del ok" << std::endl;
 
+    // a batch of rows goes in packed into new blocks, the handles in the rows' order
+    ValueDicts batch;
+    for (int j = 999; j < 1499; j++) {
+        batch.push_back(new ValueDict());
+        test_set_row(*batch.back(), j, b);
+    }
+    Handles* batch_handles = table.insert_many(&batch);
+    for (auto r: batch)
+        delete r;
+    ok = batch_handles->size() == 500 && batch_handles->front().block_id <= handles->back().block_id + 1;
+    for (size_t j = 0; ok && j < batch_handles->size(); j++)
+        ok = test_compare(table, (*batch_handles)[j], 999 + (int) j, b);
+    delete batch_handles;
+    handles = table.select();
+    ok = ok && handles->size() == 1500;
+    if (!ok)
+        return false;
+    std::cout << "insert_many ok" << std::endl;
+
+    // deleting every third row as a batch leaves the rest as they were
+    Handles thirds;
+    for (size_t j = 0; j < handles->size(); j += 3)
+        thirds.push_back((*handles)[j]);
+    table.del_many(&thirds);
+    Handles* left = table.select();
+    ok = left->size() == handles->size() - thirds.size();
+    for (size_t j = 0, k = 0; ok && j < handles->size(); j++) {
+        if (j % 3 == 0)
+            continue;
+        ok = (*left)[k++] == (*handles)[j] && test_compare(table, (*handles)[j], (int) j - 1, b);
+    }
+    delete left;
+    if (!ok)
+        return false;
+    std::cout << "del_many ok" << std::endl;
+
+    // setting a flag changes the rows in place; growing them past what their blocks hold moves some
+    Handles* rows_left = table.select();
+    Handles firsts(rows_left->begin(), rows_left->begin() + 10);
+    ValueDict flag;
+    flag["c"] = Value(true);
+    Handles* updated = table.update_many(&firsts, &flag);
+    ok = *updated == firsts;
+    for (size_t j = 0; ok && j < firsts.size(); j++) {
+        ValueDict* row = table.project(firsts[j]);
+        ok = (*row)["c"] == Value(true) && (*row)["b"] == Value(b);
+        delete row;
+    }
+    delete updated;
+    ValueDict longer;
+    longer["b"] = Value(std::string(200, 'x'));
+    updated = table.update_many(rows_left, &longer);
+    size_t moved = 0;
+    for (size_t j = 0; ok && j < updated->size(); j++) {
+        moved += !((*updated)[j] == (*rows_left)[j]);
+        ValueDict* row = table.project((*updated)[j]);
+        ok = (*row)["b"] == longer["b"] && (*row)["c"] == Value(j < 10 || (*row)["a"].n % 2 == 0);
+        delete row;
+    }
+    Handles* now = table.select();
+    ok = ok && moved > 0 && now->size() == rows_left->size();
+    delete now;
+
+    // a row that would be too big for any block is refused, and stays as it was
+    Handles last(1, updated->back());
+    ValueDict too_long;
+    too_long["b"] = Value(std::string(DB_BLOCK_SZ - 11, 'y'));
+    try {
+        delete table.update_many(&last, &too_long);
+        ok = false;
+    } catch (DbRelationError& e) {
+    }
+    ValueDict* kept = table.project(last.front());
+    ok = ok && (*kept)["b"] == longer["b"];
+    delete kept;
+    delete updated;
+    delete rows_left;
+    if (!ok)
+        return false;
+    std::cout << "update_many ok" << std::endl;
     table.drop();
+
+    // rows written before a column was added on the end read back with it false (or 0, or empty)
+    ColumnNames narrow_names(column_names.begin(), column_names.begin() + 2);
+    ColumnAttributes narrow_attributes(column_attributes.begin(), column_attributes.begin() + 2);
+    HeapTable narrow("_test_short_rows_cpp", narrow_names, narrow_attributes);
+    narrow.create();
+    test_set_row(row, 12, b);
+    narrow.insert(&row);
+    narrow.close();
+    HeapTable wide("_test_short_rows_cpp", column_names, column_attributes);
+    Handles* short_rows = wide.select();
+    ok = short_rows->size() == 1;
+    if (ok) {
+        ValueDict* short_row = wide.project(short_rows->front());
+        ok = (*short_row)["a"] == Value(12) && (*short_row)["b"] == Value(b) && (*short_row)["c"] == Value(false);
+        delete short_row;
+    }
+    delete short_rows;
+    wide.drop();
+    if (!ok)
+        return false;
+    std::cout << "short rows ok" << std::endl;
     return true;
 }
@@ -6,6 +6,7 @@
  */
 #pragma once
 
+#include <mutex>
 #include "db_cxx.h"
 #include "storage_engine.h"
 
@@ -25,16 +26,19 @@
 class SlottedPage : public DbBlock {
 public:
 	SlottedPage(Dbt &block, BlockID block_id, bool is_new=false);
-	virtual ~SlottedPage() {}
+	virtual ~SlottedPage();
 
 	virtual RecordID add(const Dbt* data) throw(DbBlockNoRoomError);
 	virtual Dbt* get(RecordID record_id) const;
 	virtual void put(RecordID record_id, const Dbt &data) throw(DbBlockNoRoomError);
 	virtual void del(RecordID record_id);
+	virtual void del_many(const RecordIDs &record_ids);
 	virtual RecordIDs* ids(void) const;
     virtual void clear();
 	virtual u_int16_t size() const;
 
+	static bool fits_alone(u_int32_t size);  // whether a record this size fits in an empty block
+
 protected:
 	uint16_t num_records;
 	uint16_t end_free;
@@ -53,6 +57,8 @@ protected:
         database blocks for each Berkeley DB record in the RecNo file. In this way we are using Berkeley DB
         for buffer management and file management.
         Uses SlottedPage for storing records within blocks.
+        The file can be shared between threads: each block read gets its own copy of the bytes (freed along
+        with the SlottedPage), and new block ids are handed out under a mutex.
  */
 class HeapFile : public DbFile {
 public:
@@ -64,6 +70,7 @@ public:
 	virtual void open(void);
 	virtual void close(void);
 	virtual SlottedPage* get_new(void);
+	virtual BlockID append(DbBlock* block);
 	virtual SlottedPage* get(BlockID block_id);
 	virtual void put(DbBlock* block);
 	virtual BlockIDs* block_ids() const;
@@ -75,6 +82,7 @@ protected:
 	uint32_t last;
 	bool closed;
 	Db db;
+	std::mutex last_mutex;  // for handing out new block ids
 	virtual void db_open(uint flags=0);
     virtual uint32_t get_block_count();
 };
@@ -96,15 +104,28 @@ public:
 	virtual void close();
 
 	virtual Handle insert(const ValueDict* row);
+	virtual Handles* insert_many(const ValueDicts* rows);
+	virtual void del_many(const Handles* handles);
 	virtual Handle update(const Handle handle, const ValueDict* new_values);
+	virtual Handles* update_many(const Handles* handles, const ValueDict* new_values);
 	virtual void del(const Handle handle);
 
 	virtual Handles* select();
 	virtual Handles* select(const ValueDict* where);
 	virtual Handles* select(Handles *current_selection, const ValueDict* where);
+	virtual u_long count();
+	virtual Handles* select_block(BlockID &block_id, const ValueDict* where);
+	virtual bool decodes_blocks() const { return true; }
+	virtual uint get_block_count();
+	virtual bool decode_block(BlockID &block_id, ColumnBatch &batch);
+	virtual bool loads_blocks() const { return true; }
+	virtual DbBlock* pack_block(const ValueDicts &rows, size_t &next) const;
+	virtual Handles* append_block(DbBlock *block);
 
 	virtual ValueDict* project(Handle handle);
 	virtual ValueDict* project(Handle handle, const ColumnNames* column_names);
+    virtual ValueDicts* project(Handles *handles);
+    virtual ValueDicts* project(Handles *handles, const ColumnNames* column_names);
     using DbRelation::project;
 
 protected:
@@ -113,6 +134,7 @@ protected:
 	virtual Handle append(const ValueDict* row);
 	virtual Dbt* marshal(const ValueDict* row) const;
 	virtual ValueDict* unmarshal(Dbt* data) const;
+    virtual ValueDict* unmarshal(Dbt* data, const ColumnNames* column_names) const;
 	virtual bool selected(Handle handle, const ValueDict* where);
 };
 
@@ -264,6 +264,8 @@ void Columns::create() {
     row["column_name"] = Value("is_unique");
     row["data_type"] = Value("BOOLEAN");
     insert(&row);
+    row["column_name"] = Value("is_included");
+    insert(&row);
 }
 
 // Manually check that (table_name, column_name) is unique.
@@ -309,6 +311,7 @@ ColumnNames& Indices::COLUMN_NAMES() {
         cn.push_back("column_name");
         cn.push_back("index_type");
         cn.push_back("is_unique");
+        cn.push_back("is_included");
     }
     return cn;
 }
@@ -327,6 +330,7 @@ ColumnAttributes& Indices::COLUMN_ATTRIBUTES() {
         cas.push_back(ca);  // index_type
         ca.set_data_type(ColumnAttribute::BOOLEAN);
         cas.push_back(ca);  // is_unique
+        cas.push_back(ca);  // is_included
     }
     return cas;
 }
@@ -373,31 +377,44 @@ void Indices::del(Handle handle) {
     HeapTable::del(handle);
 }
 
-// Return a list of column names and column attributes for given table.
+// Return the key column names (and the non-key INCLUDE column names) for given index.
 void Indices::get_columns(Identifier table_name, Identifier index_name,
-                          ColumnNames &column_names, bool &is_hash, bool &is_unique) {
+                          ColumnNames &column_names, bool &is_hash, bool &is_unique,
+                          ColumnNames &include_columns) {
     // SELECT * FROM _indices WHERE table_name = <table_name> AND index_name = <index_name>
     ValueDict where;
     where["table_name"] = table_name;
     where["index_name"] = index_name;
     Handles* handles = select(&where);
 
-    Identifier colnames[DbIndex::MAX_COMPOSITE];
-    uint size = 0;
+    ColumnNames colnames;
+    std::vector<bool> included;
     for (auto const& handle: *handles) {
         ValueDict *row = project(handle);
 
         Identifier column_name = (*row)["column_name"].s;
         uint which = (uint) (*row)["seq_in_index"].n;
+        if (which == 0) {
+            delete row;
+            delete handles;
+            throw DbRelationError("bad seq_in_index for " + column_name + " in index " + index_name);
+        }
+        if (which > colnames.size()) {
+            colnames.resize(which);
+            included.resize(which);
+        }
         colnames[which - 1] = column_name;  // seq_in_index is 1-based
-        if (which > size)
-            size = which;
+        included[which - 1] = (*row)["is_included"].n != 0;  // INCLUDE columns are numbered after the key
         is_unique = (*row)["is_unique"].n != 0;
         is_hash = (*row)["index_type"].s == "HASH";
         delete row;
     }
-    for (uint i = 0; i < size; i++)
-        column_names.push_back(colnames[i]);
+    for (uint i = 0; i < colnames.size(); i++) {
+        if (included[i])
+            include_columns.push_back(colnames[i]);
+        else
+            column_names.push_back(colnames[i]);
+    }
     delete handles;
 }
 
@@ -424,19 +441,31 @@ DbIndex& Indices::get_index(DbRelation &table, Identifier index_name) {
         return  *Indices::index_cache[cache_key];
 
     // otherwise assume it is a DummyIndex (for now)
-    ColumnNames column_names;
+    ColumnNames column_names, include_columns;
     bool is_hash, is_unique;
-    get_columns(table_name, index_name, column_names, is_hash, is_unique);
+    get_columns(table_name, index_name, column_names, is_hash, is_unique, include_columns);
     DbIndex* index;
     if (is_hash) {
         index = new DummyIndex(table, index_name, column_names, is_unique);  // FIXME - change to HashIndex
     } else {
-        index = new BTreeIndex(table, index_name, column_names, is_unique);
+        index = new BTreeIndex(table, index_name, column_names, is_unique, include_columns);
     }
     Indices::index_cache[cache_key] = index;
     return *index;
 }
 
+// Build an index over again, in bulk, from its relation as it is now (say, after loading the relation in bulk). The
+// dropped index's file can't be opened again, so this takes a new DbIndex for it; get_index has to be asked again.
+DbIndex& Indices::rebuild_index(DbRelation &table, Identifier index_name) {
+    DbIndex& old_index = get_index(table, index_name);
+    old_index.drop();
+    Indices::index_cache.erase(std::pair<Identifier,Identifier>(table.get_table_name(), index_name));
+    delete &old_index;
+    DbIndex& index = get_index(table, index_name);
+    index.create();
+    return index;
+}
+
 IndexNames Indices::get_index_names(Identifier table_name) {
     IndexNames ret;
     ValueDict where;
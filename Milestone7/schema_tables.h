@@ -61,9 +61,11 @@ protected:
 
 public:
     virtual void get_columns(Identifier table_name, Identifier index_name,
-                             ColumnNames &column_names, bool &is_hash, bool &is_unique);
+                             ColumnNames &column_names, bool &is_hash, bool &is_unique,
+                             ColumnNames &include_columns);
     virtual DbIndex& get_index(DbRelation &table, Identifier index_name);
     virtual IndexNames get_index_names(Identifier table_name);
+    virtual DbIndex& rebuild_index(DbRelation &table, Identifier index_name);
 
     Indices();
     virtual ~Indices() {}
@@ -13,6 +13,12 @@
 #include "ParseTreeToString.h"
 #include "SQLExec.h"
 #include "btree.h"
+#include "EvalPlan.h"
+#include "JoinOperator.h"
+#include "AggregateOperator.h"
+#include "ParallelOperator.h"
+#include "PlanCache.h"
+#include "BulkLoader.h"
 
 void initialize_environment(char *envHome);
 
@@ -36,12 +42,63 @@ int main(int argc, char *argv[]) {
         if (query == "test") {
             std::cout << "test_heap_storage: " << (test_heap_storage() ? "ok" : "failed") << std::endl;
             std::cout << "test_btree: " << (test_btree() ? "ok" : "failed") << std::endl;
+            std::cout << "test_btree_covering: " << (test_btree_covering() ? "ok" : "failed") << std::endl;
+            std::cout << "test_btree_lookup_many: " << (test_btree_lookup_many() ? "ok" : "failed") << std::endl;
+            std::cout << "test_btree_bloom: " << (test_btree_bloom() ? "ok" : "failed") << std::endl;
+            std::cout << "test_btree_stats: " << (test_btree_stats() ? "ok" : "failed") << std::endl;
+            std::cout << "test_btree_concurrency: " << (test_btree_concurrency() ? "ok" : "failed") << std::endl;
+            std::cout << "test_btree_bulk_load: " << (test_btree_bulk_load() ? "ok" : "failed") << std::endl;
+            std::cout << "test_eval_operators: " << (test_eval_operators() ? "ok" : "failed") << std::endl;
+            std::cout << "test_column_batch: " << (test_column_batch() ? "ok" : "failed") << std::endl;
+            std::cout << "test_compiled_expressions: " << (test_compiled_expressions() ? "ok" : "failed") << std::endl;
+            std::cout << "test_eval_plan: " << (test_eval_plan() ? "ok" : "failed") << std::endl;
+            std::cout << "test_sort_operator: " << (test_sort_operator() ? "ok" : "failed") << std::endl;
+            std::cout << "test_join_operators: " << (test_join_operators() ? "ok" : "failed") << std::endl;
+            std::cout << "test_aggregate_operators: " << (test_aggregate_operators() ? "ok" : "failed") << std::endl;
+            std::cout << "test_parallel_operators: " << (test_parallel_operators() ? "ok" : "failed") << std::endl;
+            std::cout << "test_plan_cache: " << (test_plan_cache() ? "ok" : "failed") << std::endl;
+            std::cout << "test_bulk_loader: " << (test_bulk_loader() ? "ok" : "failed") << std::endl;
+            std::cout << "test_sql_update: " << (test_sql_update() ? "ok" : "failed") << std::endl;
+            std::cout << "test_sql_delete: " << (test_sql_delete() ? "ok" : "failed") << std::endl;
 std::cout << "test_btable: " << (test_btable() ? "ok" : "failed") << std::endl;
 
             continue;
         }
 
-        // parse and execute
+        // parse and execute (the parser doesn't know EXPLAIN [ANALYZE], more than one row of INSERT VALUES,
+        // CREATE INDEX ... INCLUDE, SHOW INDEX STATUS or COPY ... FROM, so we take care of those clauses)
+        ColumnNames include_columns;
+        bool index_status = false;
+        bool explain = false, analyze = false;
+        std::vector<KeyValue> extra_rows;
+        try {
+            query = SQLExec::strip_explain_clause(query, explain, analyze);
+            query = SQLExec::strip_extra_rows(query, extra_rows);
+            query = SQLExec::strip_include_clause(query, include_columns);
+            query = SQLExec::strip_status_clause(query, index_status);
+            query = SQLExec::strip_copy_clause(query);
+        } catch (SQLExecError& e) {
+            std::cout << std::string("Error: ") << e.what() << std::endl;
+            continue;
+        }
+
+        // a SELECT, INSERT or DELETE goes through the plan cache, so one differing only in its literals from one
+        // run before skips the parser and the optimizer, using that one's plan with this one's literals
+        KeyValue parameters;
+        std::string text;
+        PreparedStatement *prepared = explain || !extra_rows.empty() ? nullptr
+                                                                     : SQLExec::cached_plan(query, parameters, text);
+        if (prepared != nullptr) {
+            try {
+                std::cout << text << std::endl;
+                QueryResult *result = SQLExec::execute(prepared, parameters);
+                std::cout << *result << std::endl;
+                delete result;
+            } catch (SQLExecError& e) {
+                std::cout << std::string("Error: ") << e.what() << std::endl;
+            }
+            continue;
+        }
         hsql::SQLParserResult *parse = hsql::SQLParser::parseSQLString(query);
         if (!parse->isValid()) {
             std::cout << "invalid SQL: " << query << std::endl;
@@ -50,8 +107,12 @@ std::cout << "test_btable: " << (test_btable() ? "ok" : "failed") << std::endl;
             for (uint i = 0; i < parse->size(); ++i) {
                 const hsql::SQLStatement *statement = parse->getStatement(i);
                 try {
-                    std::cout << ParseTreeToString::statement(statement) << std::endl;
-                    QueryResult *result = SQLExec::execute(statement);
+                    std::cout << (explain ? (analyze ? "EXPLAIN ANALYZE " : "EXPLAIN ") : "")
+                              << ParseTreeToString::statement(statement) << (extra_rows.empty() ? "" : ", ...")
+                              << std::endl;
+                    QueryResult *result = explain ? SQLExec::explain(statement, analyze)
+                                                  : SQLExec::execute(statement, &include_columns, index_status,
+                                                                     &extra_rows);
                     std::cout << *result << std::endl;
                     delete result;
                 } catch (SQLExecError& e) {
@@ -74,7 +135,7 @@ void initialize_environment(char *envHome) {
     env->set_message_stream(&std::cout);
     env->set_error_stream(&std::cerr);
     try {
-        env->open(envHome, DB_CREATE | DB_INIT_MPOOL, 0);
+        env->open(envHome, DB_CREATE | DB_INIT_MPOOL | DB_THREAD, 0);
     } catch (DbException &exc) {
         std::cerr << "(sql4300: " << exc.what() << ")";
         exit(1);
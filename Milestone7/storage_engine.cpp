@@ -1,12 +1,17 @@
 #include <algorithm>
 #include "storage_engine.h"
 
+std::atomic<bool> WorkCounters::counting(false);
+std::atomic<u_long> WorkCounters::blocks_read(0);
+std::atomic<u_long> WorkCounters::blocks_written(0);
+std::atomic<u_long> WorkCounters::allocations(0);
+
 bool Value::operator==(const Value &other) const {
     if (this->data_type != other.data_type)
         return false;
-    if (this->data_type == ColumnAttribute::INT)
-        return this->n == other.n;
-    return this->s == other.s;
+    if (this->data_type == ColumnAttribute::TEXT)
+        return this->s == other.s;
+    return this->n == other.n;
 }
 
 bool Value::operator!=(const Value &other) const {
@@ -31,6 +36,33 @@ bool Value::operator<(const Value &other) const {
     return this->n < other.n;
 }
 
+// Values of different types are never ordered one way or the other (and so always unequal).
+bool Predicate::matches(const Value &other) const {
+    if (this->comparison == NE)
+        return other != this->value;
+    if (other.data_type != this->value.data_type)
+        return false;
+    switch (this->comparison) {
+        case LT:
+            return other < this->value;
+        case LE:
+            return !(this->value < other);
+        case GT:
+            return this->value < other;
+        case GE:
+            return !(other < this->value);
+        default:
+            return false;
+    }
+}
+
+bool Predicate::matches(const ValueDict &row) const {
+    auto found = row.find(this->column_name);
+    if (found == row.end())
+        throw DbRelationError("unknown column '" + this->column_name + "'");
+    return matches(found->second);
+}
+
 // Get only selected column attributes
 ColumnAttributes* DbRelation::get_column_attributes(const ColumnNames &select_column_names) const {
     ColumnAttributes *ret = new ColumnAttributes();
@@ -55,9 +87,29 @@ ValueDict* DbRelation::project(Handle handle, const ValueDict* where) {
     return this->project(handle, &t);
 }
 
+bool DbRelation::decode_block(BlockID &block_id, ColumnBatch &batch) {
+    throw DbRelationError("cannot decode the blocks of " + this->table_name);
+}
+
+u_long DbRelation::count() {
+    Handles *handles = select();
+    u_long n = handles->size();
+    delete handles;
+    return n;
+}
+
+// Relations that aren't kept in blocks hand back everything as one piece.
+Handles* DbRelation::select_block(BlockID &block_id, const ValueDict* where) {
+    if (block_id != 0)
+        return nullptr;
+    block_id = 1;
+    return select(where);
+}
+
 // Do a projection for each of a list of handles
 ValueDicts* DbRelation::project(Handles *handles) {
     ValueDicts *ret = new ValueDicts();
+    WorkCounters::allocated();
     for (auto const& handle: *handles)
         ret->push_back(project(handle));
     return ret;
@@ -66,18 +118,79 @@ ValueDicts* DbRelation::project(Handles *handles) {
 // Do a projection for each of a list of handles
 ValueDicts* DbRelation::project(Handles *handles, const ColumnNames *column_names) {
     ValueDicts *ret = new ValueDicts();
+    WorkCounters::allocated();
     for (auto const& handle: *handles)
         ret->push_back(project(handle, column_names));
     return ret;
 }
 
-// Do a projection for each of a list of handles
+// Do a projection for each of a list of handles (through the ColumnNames form, which a relation may batch)
 ValueDicts* DbRelation::project(Handles *handles, const ValueDict* where) {
     ColumnNames t;
     for (auto const& column: *where)
         t.push_back(column.first);
-    ValueDicts *ret = new ValueDicts();
+    return project(handles, &t);
+}
+
+// Insert each of a list of rows. If one can't go in, those before it are taken back out, so none are left in.
+Handles* DbRelation::insert_many(const ValueDicts* rows) {
+    Handles *handles = new Handles();
+    try {
+        for (auto const& row: *rows)
+            handles->push_back(insert(row));
+    } catch (...) {
+        del_many(handles);
+        delete handles;
+        throw;
+    }
+    return handles;
+}
+
+Handles* DbRelation::update_many(const Handles* handles, const ValueDict* new_values) {
+    Handles* updated = new Handles();
+    try {
+        for (auto const& handle: *handles)
+            updated->push_back(update(handle, new_values));
+    } catch (...) {
+        delete updated;
+        throw;
+    }
+    return updated;
+}
+
+void DbRelation::del_many(const Handles* handles) {
     for (auto const& handle: *handles)
-        ret->push_back(project(handle, &t));
+        del(handle);
+}
+
+DbBlock* DbRelation::pack_block(const ValueDicts &rows, size_t &next) const {
+    throw DbRelationError("loading blocks not supported");
+}
+
+Handles* DbRelation::append_block(DbBlock *block) {
+    throw DbRelationError("loading blocks not supported");
+}
+
+// Insert the index entries for each of a list of rows. Indices that can do better than one insert at a time should
+// override this.
+void DbIndex::insert_many(Handles* handles) {
+    for (auto const& handle: *handles)
+        insert(handle);
+}
+
+// Remove the index entries for each of a list of rows. Indices that can do better than one del at a time should
+// override this.
+void DbIndex::del_many(Handles* handles) {
+    for (auto const& handle: *handles)
+        del(handle);
+}
+
+// Look up each of a list of keys. Indices that can do better than one lookup at a time should override this.
+HandlesByKey* DbIndex::lookup_many(ValueDicts* keys) {
+    HandlesByKey *ret = new HandlesByKey();
+    for (auto const& key: *keys) {
+        Handles *handles = lookup(key);
+        ret->push_back(handles != nullptr ? handles : new Handles());
+    }
     return ret;
 }
@@ -11,6 +11,7 @@
  */
 #pragma once
 
+#include <atomic>
 #include <exception>
 #include <map>
 #include <utility>
@@ -24,6 +25,27 @@ typedef uint32_t BlockID;
 typedef std::vector<RecordID> RecordIDs;
 typedef std::length_error DbBlockNoRoomError;
 
+// Counts of the work done under the query operators, for EXPLAIN ANALYZE: blocks read from and written to the
+// database files (a Berkeley DB get or put each) and the batches and rows allocated for the operators, by them or by
+// the relations they read. Nothing is counted unless counting is on, so otherwise all it costs is checking that.
+class WorkCounters {
+public:
+    static std::atomic<bool> counting;
+    static std::atomic<u_long> blocks_read;
+    static std::atomic<u_long> blocks_written;
+    static std::atomic<u_long> allocations;
+
+    static void count(std::atomic<u_long> &counter) {
+        if (counting.load(std::memory_order_relaxed))
+            counter.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    static void allocated(u_long n = 1) {
+        if (counting.load(std::memory_order_relaxed))
+            allocations.fetch_add(n, std::memory_order_relaxed);
+    }
+};
+
 class DbBlock {
 public:
 	DbBlock(Dbt &block, BlockID block_id, bool is_new=false) : block(block), block_id(block_id) {}
@@ -91,12 +113,14 @@ public:
 	ColumnAttribute::DataType data_type;
 	int32_t n;
 	std::string s;
+	int parameter;  // for a value standing in for a ? placeholder of a prepared statement: which one (see
+	                // EvalPlan::bind), else 0; it plays no part in comparisons
 
-	Value() : n(0) {data_type = ColumnAttribute::INT;}
-	Value(int32_t n) : n(n) {data_type = ColumnAttribute::INT;}
-	Value(std::string s) : s(s) {data_type = ColumnAttribute::TEXT; }
-    Value(const char *s) : s(s) {data_type = ColumnAttribute::TEXT; }
-    Value(bool b) : n(b ? 1: 0) {data_type = ColumnAttribute::BOOLEAN; }
+	Value() : n(0), parameter(0) {data_type = ColumnAttribute::INT;}
+	Value(int32_t n) : n(n), parameter(0) {data_type = ColumnAttribute::INT;}
+	Value(std::string s) : s(s), parameter(0) {data_type = ColumnAttribute::TEXT; }
+    Value(const char *s) : s(s), parameter(0) {data_type = ColumnAttribute::TEXT; }
+    Value(bool b) : n(b ? 1: 0), parameter(0) {data_type = ColumnAttribute::BOOLEAN; }
 
 	bool operator==(const Value &other) const;
     bool operator!=(const Value &other) const;
@@ -114,7 +138,19 @@ public:
 
     Handle() : block_id(0), record_id(0), key_value() {}
     Handle(BlockID block_id, RecordID record_id) : block_id(block_id), record_id(record_id) {}
-    Handle(KeyValue kv) : key_value(kv) {}
+    Handle(KeyValue kv) : block_id(0), record_id(0), key_value(kv) {}
+
+    // physical order, (block_id, record_id), then key_value for the handles of a table kept in key order
+    bool operator<(const Handle &other) const {
+        if (block_id != other.block_id)
+            return block_id < other.block_id;
+        if (record_id != other.record_id)
+            return record_id < other.record_id;
+        return key_value < other.key_value;
+    }
+    bool operator==(const Handle &other) const {
+        return block_id == other.block_id && record_id == other.record_id && key_value == other.key_value;
+    }
 };
 
 typedef std::string Identifier;
@@ -123,6 +159,44 @@ typedef std::vector<ColumnAttribute> ColumnAttributes;
 typedef std::vector<Handle> Handles;  // FIXME: will need to turn this into an iterator at some point
 typedef std::map<Identifier, Value> ValueDict;
 typedef std::vector<ValueDict*> ValueDicts;
+typedef std::vector<Handles*> HandlesByKey;  // i-th entry goes with the i-th of a list of lookup keys
+
+// A WHERE term comparing a column with a literal other than by equality (equalities go in a ValueDict).
+// BETWEEN low AND high is the pair GE low, LE high.
+class Predicate {
+public:
+    enum Comparison {
+        LT,
+        LE,
+        GT,
+        GE,
+        NE
+    };
+    Identifier column_name;
+    Comparison comparison;
+    Value value;
+
+    Predicate(Identifier column_name, Comparison comparison, Value value)
+            : column_name(column_name), comparison(comparison), value(value) {}
+
+    bool matches(const Value &other) const;  // other <comparison> value
+    bool matches(const ValueDict &row) const;
+    bool is_bound() const { return comparison != NE; }
+};
+typedef std::vector<Predicate> Predicates;
+
+// One of the alternatives of a WHERE clause that ORs them together: an equality conjunction and other predicates.
+class Condition {
+public:
+    ValueDict where;
+    Predicates predicates;
+
+    Condition() : where(), predicates() {}
+    Condition(const ValueDict &where, const Predicates &predicates) : where(where), predicates(predicates) {}
+};
+typedef std::vector<Condition> Conditions;
+
+class ColumnBatch;  // see ColumnBatch.h
 
 class DbRelationError : public std::runtime_error {
 public:
@@ -154,12 +228,37 @@ public:
 	virtual void close() = 0;
 
 	virtual Handle insert(const ValueDict* row) = 0;
+    // Insert a batch of rows, returning their handles in the same order (caller deletes). Relations that can do
+    // better than one insert at a time should override this.
+    virtual Handles* insert_many(const ValueDicts* rows);
 	virtual Handle update(const Handle handle, const ValueDict* new_values) = 0;
+    // Give a batch of rows the same new values, returning their handles in the same order, which may have changed if
+    // a row had to move (caller deletes). Relations that can do better than one update at a time should override this.
+    virtual Handles* update_many(const Handles* handles, const ValueDict* new_values);
 	virtual void del(const Handle handle) = 0;
+    // Delete a batch of rows. Relations that can do better than one del at a time should override this.
+    virtual void del_many(const Handles* handles);
 
 	virtual Handles* select() = 0;
 	virtual Handles* select(const ValueDict* where) = 0;
     virtual Handles* select(Handles* current_selection, const ValueDict* where) = 0;
+    virtual u_long count();  // how many rows there are (by default, by selecting them all)
+    // For scanning a piece at a time: the handles (matching where, if given) from the next block at or after
+    // block_id, which is moved past it; nullptr once there are no more blocks. Start with block_id 0.
+    virtual Handles* select_block(BlockID &block_id, const ValueDict* where);
+    // Columnar scanning, for relations where decodes_blocks(): like select_block, but decoding every row of the
+    // block into batch (replacing what was there) and returning false once there are no more blocks.
+    virtual bool decodes_blocks() const { return false; }
+    virtual bool decode_block(BlockID &block_id, ColumnBatch &batch);
+    // Loading in bulk (see BulkLoader), for relations where loads_blocks(): rows are packed into blocks by any
+    // number of threads at once, then the blocks appended to the relation in order. pack_block makes a block
+    // (caller deletes) of as many rows as fit from rows[next] on, moving next past them; append_block gives the
+    // handles of the rows in the block it appended (caller deletes).
+    virtual bool loads_blocks() const { return false; }
+    virtual DbBlock* pack_block(const ValueDicts &rows, size_t &next) const;
+    virtual Handles* append_block(DbBlock *block);
+    // The columns a select comes back sorted on, if it comes back in any particular order (else nullptr).
+    virtual const ColumnNames *ordered_by() const { return nullptr; }
 
 	virtual ValueDict* project(Handle handle) = 0;
 	virtual ValueDict* project(Handle handle, const ColumnNames* column_names) = 0;
@@ -172,6 +271,7 @@ public:
     virtual const ColumnAttributes get_column_attributes() const { return column_attributes; }
     virtual ColumnAttributes* get_column_attributes(const ColumnNames &select_column_names) const;
     virtual Identifier get_table_name() const { return table_name; }
+    virtual uint get_block_count() { return 0; }  // for the planner; 0 if the relation can't say
     virtual bool has_primary_key() const { return this->primary_key == nullptr; }
     virtual const ColumnNames *get_primary_key() const { return this->primary_key; }
 
@@ -182,6 +282,22 @@ protected:
     ColumnNames *primary_key;
 };
 
+// What an index knows about its contents, for the planner. The key bounds are in key column order (empty
+// for an empty index) and may be looser than the keys actually present after deletes.
+class IndexStats {
+public:
+    u_long entries;  // also the number of distinct keys, since our indices are unique
+    uint height;
+    uint leaf_blocks;
+    uint interior_blocks;
+    KeyValue min_key;
+    KeyValue max_key;
+
+    IndexStats() : entries(0), height(0), leaf_blocks(0), interior_blocks(0), min_key(), max_key() {}
+
+    double average_leaf_entries() const { return leaf_blocks == 0 ? 0.0 : (double) entries / leaf_blocks; }
+};
+
 class DbIndex {
 public:
     static const uint MAX_COMPOSITE = 32U; // maximum number of columns in a composite index
@@ -197,14 +313,31 @@ public:
     virtual void close() = 0;
 
     virtual Handles* lookup(ValueDict* key_values) = 0;
-    virtual Handles* range(ValueDict* min_key, ValueDict* max_key) {
+    virtual HandlesByKey* lookup_many(ValueDicts* keys);
+    // Range queries, on an ordered index: the rows with keys from min_key to max_key, inclusive (just the first
+    // limit of them, in key order, if limit isn't 0)
+    virtual bool ordered() const { return false; }
+    virtual Handles* range(ValueDict* min_key, ValueDict* max_key, u_long limit=0) {
         throw DbRelationError("range index query not supported");
     }
 
+    // Index-only access: an index covers a projection if it can supply every one of its columns itself.
+    virtual bool covers(const ColumnNames &column_names) const { return false; }
+    virtual ValueDicts* lookup_values(ValueDict* key_values, const ColumnNames* column_names) {
+        throw DbRelationError("index-only lookup not supported");
+    }
+
     virtual void insert(Handle handle) = 0;
+    virtual void insert_many(Handles* handles);  // like insert for each (the rows must be in the relation already)
     virtual void del(Handle handle) = 0;
+    virtual void del_many(Handles* handles);  // like del for each (the rows must still be in the relation)
+
+    // Statistics for the planner (caller deletes), or nullptr if the index doesn't keep any
+    virtual IndexStats* get_stats() { return nullptr; }
 
     virtual const ColumnNames &get_key_columns() { return this->key_columns; }
+    virtual const Identifier &get_name() const { return this->name; }
+    virtual bool is_unique() const { return this->unique; }
     virtual DbRelation &get_relation() { return this->relation; }
 
 protected: